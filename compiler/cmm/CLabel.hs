@@ -49,6 +49,10 @@ module CLabel (
 
         mkSplitMarkerLabel,
         mkDirty_MUT_VAR_Label,
+        mkConcMarkActiveLabel,
+        mkConcMarkPushClosureLabel,
+        mkConcMarkPushFieldsLabel,
+        mkConcMarkPushArrayLabel,
         mkUpdInfoLabel,
         mkBHUpdInfoLabel,
         mkIndStaticInfoLabel,
@@ -398,12 +402,17 @@ mkConEntryLabel name        c     = IdLabel name c ConEntry
 mkStaticConEntryLabel name  c     = IdLabel name c StaticConEntry
 
 -- Constructing Cmm Labels
-mkDirty_MUT_VAR_Label, mkSplitMarkerLabel, mkUpdInfoLabel,
-    mkBHUpdInfoLabel, mkIndStaticInfoLabel, mkMainCapabilityLabel,
+mkDirty_MUT_VAR_Label, mkConcMarkActiveLabel, mkConcMarkPushClosureLabel,
+    mkConcMarkPushFieldsLabel, mkConcMarkPushArrayLabel,
+    mkSplitMarkerLabel, mkUpdInfoLabel, mkBHUpdInfoLabel, mkIndStaticInfoLabel, mkMainCapabilityLabel,
     mkMAP_FROZEN_infoLabel, mkMAP_DIRTY_infoLabel,
     mkEMPTY_MVAR_infoLabel, mkTopTickyCtrLabel,
     mkCAFBlackHoleInfoTableLabel, mkCAFBlackHoleEntryLabel :: CLabel
 mkDirty_MUT_VAR_Label           = mkForeignLabel (fsLit "dirty_MUT_VAR") Nothing ForeignLabelInExternalPackage IsFunction
+mkConcMarkActiveLabel           = CmmLabel rtsPackageId (fsLit "conc_mark_active")      CmmData
+mkConcMarkPushClosureLabel      = mkForeignLabel (fsLit "concMarkPushClosure") Nothing ForeignLabelInExternalPackage IsFunction
+mkConcMarkPushFieldsLabel       = mkForeignLabel (fsLit "concMarkPushFields") Nothing ForeignLabelInExternalPackage IsFunction
+mkConcMarkPushArrayLabel        = mkForeignLabel (fsLit "concMarkPushArray") Nothing ForeignLabelInExternalPackage IsFunction
 mkSplitMarkerLabel              = CmmLabel rtsPackageId (fsLit "__stg_split_marker")    CmmCode
 mkUpdInfoLabel                  = CmmLabel rtsPackageId (fsLit "stg_upd_frame")         CmmInfo
 mkBHUpdInfoLabel                = CmmLabel rtsPackageId (fsLit "stg_bh_upd_frame" )     CmmInfo
@@ -26,7 +26,7 @@ import StgCmmGran
 import StgCmmLayout
 import StgCmmUtils
 import StgCmmClosure
-import StgCmmForeign    (emitPrimCall)
+import StgCmmForeign    (emitPrimCall, emitConcMarkBarrier)
 
 import MkGraph
 import CoreSyn          ( AltCon(..) )
@@ -604,6 +604,8 @@ emitBlackHoleCode is_single_entry node = do
 
   when eager_blackholing $ do
     tickyBlackHole (not is_single_entry)
+    -- we are about to overwrite a free variable; see rts/sm/ConcMark.c
+    emitConcMarkBarrier mkConcMarkPushFieldsLabel [(node, AddrHint)]
     emitStore (cmmOffsetW dflags node (fixedHdrSize dflags))
                   (CmmReg (CmmGlobal CurrentTSO))
     emitPrimCall [] MO_WriteBarrier []
@@ -8,7 +8,7 @@
 
 module StgCmmForeign (
   cgForeignCall, loadThreadState, saveThreadState,
-  emitPrimCall, emitCCall,
+  emitPrimCall, emitCCall, emitConcMarkBarrier,
   emitForeignCall,     -- For CmmParse
   emitSaveThreadState, -- will be needed by the Cmm parser
   emitLoadThreadState, -- ditto
@@ -188,6 +188,20 @@ emitCCall hinted_results fn hinted_args
     fc = ForeignConvention CCallConv arg_hints result_hints CmmMayReturn
 
 
+-- | The write barrier for a concurrent mark of the old generation
+-- (see rts/sm/ConcMark.c): if a mark is in progress, call the given
+-- RTS function with the current Capability and the arguments, which
+-- must remember whatever is about to be overwritten.
+emitConcMarkBarrier :: CLabel -> [(CmmActual,ForeignHint)] -> FCode ()
+emitConcMarkBarrier fn hinted_args
+  = do dflags <- getDynFlags
+       let active = CmmLoad (CmmLit (CmmLabel mkConcMarkActiveLabel)) (bWord dflags)
+           myCapability = cmmSubWord dflags (CmmReg baseReg)
+                              (mkIntExpr dflags (oFFSET_Capability_r dflags))
+       call <- getCode $ emitCCall [] (CmmLit (CmmLabel fn))
+                                   ((myCapability, AddrHint) : hinted_args)
+       emit =<< mkCmmIfThen (cmmNeWord dflags active (zeroExpr dflags)) call
+
 emitPrimCall :: [CmmFormal] -> CallishMachOp -> [CmmActual] -> FCode ()
 emitPrimCall res op args
   = void $ emitForeignCall PlayRisky res (PrimTarget op) args
@@ -243,11 +243,13 @@ emitPrimOp dflags [res] ReadMutVarOp [mutv]
    = emitAssign (CmmLocal res) (cmmLoadIndexW dflags mutv (fixedHdrSize dflags) (gcWord dflags))
 
 emitPrimOp dflags [] WriteMutVarOp [mutv,var]
-   = do emitStore (cmmOffsetW dflags mutv (fixedHdrSize dflags)) var
+   = do -- dirty_MUT_VAR also wants the old value, for the concurrent mark
+        old <- assignTempE (cmmLoadIndexW dflags mutv (fixedHdrSize dflags) (gcWord dflags))
+        emitStore (cmmOffsetW dflags mutv (fixedHdrSize dflags)) var
         emitCCall
                 [{-no results-}]
                 (CmmLit (CmmLabel mkDirty_MUT_VAR_Label))
-                [(CmmReg (CmmGlobal BaseReg), AddrHint), (mutv,AddrHint)]
+                [(CmmReg (CmmGlobal BaseReg), AddrHint), (mutv,AddrHint), (old,AddrHint)]
 
 --  #define sizzeofByteArrayzh(r,a) \
 --     r = ((StgArrWords *)(a))->bytes
@@ -1110,6 +1112,9 @@ doWritePtrArrayOp :: CmmExpr
 doWritePtrArrayOp addr idx val
   = do dflags <- getDynFlags
        let ty = cmmExprType dflags val
+       -- remember the old element if the old generation is being marked
+       emitConcMarkBarrier mkConcMarkPushClosureLabel
+           [(cmmLoadIndexOffExpr dflags (arrPtrsHdrSize dflags) ty addr ty idx, AddrHint)]
        mkBasicIndexedWrite (arrPtrsHdrSize dflags) Nothing addr ty idx val
        emit (setInfo addr (CmmLit (CmmLabel mkMAP_DIRTY_infoLabel)))
   -- the write barrier.  We must write a byte into the mark table:
@@ -1440,6 +1445,11 @@ emitCopyArray copy src0 src_off0 dst0 dst_off0 n0 = do
         dst     <- assignTempE dst0
         dst_off <- assignTempE dst_off0
 
+        -- Remember the elements we overwrite if the old generation is
+        -- being marked.
+        emitConcMarkBarrier mkConcMarkPushArrayLabel
+            [(dst, AddrHint), (dst_off, NoHint), (n, NoHint)]
+
         -- Set the dirty bit in the header.
         emit (setInfo dst (CmmLit (CmmLabel mkMAP_DIRTY_infoLabel)))
 
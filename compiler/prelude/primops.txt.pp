@@ -1933,6 +1933,57 @@ primop  EqStableNameOp "eqStableName#" GenPrimOp
 primop  StableNameToIntOp "stableNameToInt#" GenPrimOp
    StableName# a -> Int#
 
+------------------------------------------------------------------------
+section "Compact regions"
+        {Immutable data that the garbage collector doesn't look inside.}
+------------------------------------------------------------------------
+
+primop  CompactOp "compact#" GenPrimOp
+   a -> State# RealWorld -> (# State# RealWorld, Int#, a #)
+   { Copy the data reachable from the argument into a new compact
+     region, and return {\tt 0\#} and the copy.  The data must be fully
+     evaluated and immutable: constructors, unpinned byte arrays and
+     frozen arrays.  The garbage collector keeps the whole region alive
+     while anything points into it, but never traverses it.  If the
+     data contains anything else (a thunk, a function, a mutable array,
+     a pinned byte array), returns {\tt 1\#} and the argument itself.
+     A {\tt MutableByteArray\#} can't be told apart from a
+     {\tt ByteArray\#}, so it is copied too, and writes to the original
+     are not seen in the copy, or the other way round.  If any byte
+     arrays were copied, returns {\tt 2\#} and the copy instead of
+     {\tt 0\#}; the caller must check that none of them were mutable
+     before using it.  An array in a compact region must not be
+     thawed. }
+   with
+   has_side_effects = True
+   out_of_line      = True
+
+primop  CompactSaveOp "compactSave#" GenPrimOp
+   a -> Addr# -> State# RealWorld -> (# State# RealWorld, Int# #)
+   { Write the compact region that the first argument points into (a
+     result of {\tt compact\#}) to the file named by the
+     NUL-terminated string, so that {\tt compactLoad\#} can load it
+     again later.  Returns {\tt 0\#} on success, or {\tt 1\#} if the
+     argument is not in a compact region, the file can't be written, or
+     regions can't be saved on this platform. }
+   with
+   has_side_effects = True
+   out_of_line      = True
+
+primop  CompactLoadOp "compactLoad#" GenPrimOp
+   Addr# -> State# RealWorld -> (# State# RealWorld, Int#, a #)
+   { Map a file written by {\tt compactSave\#} into the heap as a new
+     compact region, and return {\tt 0\#} and the closure it was saved
+     from.  The file must have been written by the same executable,
+     statically linked.  Files from another executable are refused,
+     and so are files whose objects or pointers are malformed.  The
+     result must be used at the type it was saved at, which is not
+     checked.  Returns {\tt 1\#} if the file can't be loaded, or on
+     platforms where regions can't be saved and loaded. }
+   with
+   has_side_effects = True
+   out_of_line      = True
+
 ------------------------------------------------------------------------
 section "Unsafe pointer equality"
 --  (#1 Bad Guy: Alistair Reid :)   
@@ -73,6 +73,12 @@
  */
 #define MUT_ARR_PTRS_CARD_BITS 7
 
+/* The stable pointer table is divided into segments of
+ * (1<<SPT_SEGMENT_BITS) entries, which are never moved; see
+ * rts/Stable.c.
+ */
+#define SPT_SEGMENT_BITS 10
+
 /* -----------------------------------------------------------------------------
    STG Registers.
 
@@ -291,4 +297,32 @@
 
 #define MAX_SPARE_WORKERS 6
 
+/* -----------------------------------------------------------------------------
+   NUMA nodes
+
+   The maximum number of NUMA nodes we support.  This is a fixed limit
+   so that we can use static arrays indexed by node in the block
+   allocator, and a bitmask (StgWord) to specify the set of nodes to
+   use (see +RTS --numa).
+   -------------------------------------------------------------------------- */
+
+#define MAX_NUMA_NODES 16
+
+/* -----------------------------------------------------------------------------
+   Aging
+
+   The maximum number of GCs an object can be made to survive in
+   generation 0 before it is promoted (see +RTS --tenure-age).  Each
+   age needs a workspace in every GC thread.
+   -------------------------------------------------------------------------- */
+
+#define MAX_TENURE_AGE 16
+
+/* -----------------------------------------------------------------------------
+   The maximum number of OS threads that can run C finalizers (see
+   +RTS --cfinalizer-threads).
+   -------------------------------------------------------------------------- */
+
+#define MAX_CFINALIZER_THREADS 64
+
 #endif /* RTS_CONSTANTS_H */
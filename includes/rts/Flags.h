@@ -34,6 +34,7 @@ struct GC_FLAGS {
 
     nat	    maxHeapSize;        /* in *blocks* */
     nat     minAllocAreaSize;   /* in *blocks* */
+    nat     nurseryChunkSize;   /* in *blocks* */
     nat     minOldGenSize;      /* in *blocks* */
     nat     heapSizeSuggestion; /* in *blocks* */
     rtsBool heapSizeSuggestionAuto;
@@ -49,13 +50,42 @@ struct GC_FLAGS {
 
     rtsBool sweep;		/* use "mostly mark-sweep" instead of copying
                                  * for the oldest generation */
+    rtsBool lazySweep;          /* sweep the oldest generation on demand,
+                                 * after the GC */
     rtsBool ringBell;
     rtsBool frontpanel;
 
     Time    idleGCDelayTime;    /* units: TIME_RESOLUTION */
     rtsBool doIdleGC;
+    rtsBool idleSlices;         /* spend idle time on incremental work on
+                                 * the oldest generation, not a major GC */
 
     StgWord heapBase;           /* address to ask the OS for memory */
+    StgWord addressSpaceSize;   /* bytes of address space to reserve for
+                                 * the heap (USE_LARGE_ADDRESS_SPACE) */
+
+    rtsBool numa;               /* Use NUMA */
+    StgWord numaMask;           /* bitmask of NUMA nodes to use */
+
+    nat     hugePages;          /* back the heap with huge pages */
+#define HUGE_PAGES_OFF         0
+#define HUGE_PAGES_TRANSPARENT 1 /* madvise(MADV_HUGEPAGE) */
+#define HUGE_PAGES_EXPLICIT    2 /* mmap(MAP_HUGETLB) */
+
+    rtsBool decommit;           /* give free memory back to the OS in
+                                 * the background */
+    StgWord decommitSlack;      /* in *blocks* */
+    StgWord decommitRate;       /* in *blocks* per second */
+
+    rtsBool concurrentMark;     /* mark the old generation concurrently */
+    rtsBool pretenure;          /* copy types that survive straight out of
+                                 * the nursery into generation 1 */
+    nat     tenureAge;          /* GCs an object survives in generation 0
+                                 * before it is promoted */
+    Time    pauseTarget;        /* size the heap to keep GC pauses under
+                                 * this; units: TIME_RESOLUTION, 0 == off */
+    nat     cFinalizerThreads;  /* OS threads to run C finalizers on,
+                                 * 0 == run them after each GC */
 };
 
 struct DEBUG_FLAGS {  
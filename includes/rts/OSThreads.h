@@ -201,6 +201,7 @@ void  freeThreadLocalKey (ThreadLocalKey *key);
 
 // Processors and affinity
 void setThreadAffinity     (nat n, nat m);
+void setThreadNode         (nat node);
 #endif // !CMINUSMINUS
 
 #else
@@ -25,19 +25,24 @@ typedef struct {
     StgPtr  addr;			/* Haskell object, free list, or NULL */
     StgPtr  old;			/* old Haskell object, used during GC */
     StgClosure *sn_obj;		/* the StableName object (or NULL) */
+    StgWord next;		/* next entry in its generation's list */
 } snEntry;
 
 typedef struct {
     StgPtr addr;
 } spEntry;
 
+#define SPT_SEGMENT_SIZE (1 << SPT_SEGMENT_BITS)
+#define SPT_SEGMENT_MASK (SPT_SEGMENT_SIZE - 1)
+
 extern DLL_IMPORT_RTS snEntry *stable_name_table;
-extern DLL_IMPORT_RTS spEntry *stable_ptr_table;
+extern DLL_IMPORT_RTS spEntry **stable_ptr_table;
 
 EXTERN_INLINE
 StgPtr deRefStablePtr(StgStablePtr sp)
 {
-    return stable_ptr_table[(StgWord)sp].addr;
+    return stable_ptr_table[(StgWord)sp >> SPT_SEGMENT_BITS]
+                           [(StgWord)sp & SPT_SEGMENT_MASK].addr;
 }
 
 #endif /* RTS_STABLE_H */
@@ -76,7 +76,7 @@ typedef struct bdescr_ {
 
     StgWord16 gen_no;          // gen->no, cached
     StgWord16 dest_no;         // number of destination generation
-    StgWord16 _pad1;
+    StgWord16 node;            // which NUMA node does this block live on?
 
     StgWord16 flags;           // block flags, see below
 
@@ -119,6 +119,18 @@ typedef struct bdescr_ {
 #define BF_KNOWN     128
 /* Block was swept in the last generation */
 #define BF_SWEPT     256
+/* Block group is free, and its memory has been given back to the OS */
+#define BF_DECOMMITTED 512
+/* Block was in the old generation when the current concurrent mark started */
+#define BF_SNAPSHOT  1024
+/* Large object in the snapshot has been reached by the concurrent mark */
+#define BF_SNAPSHOT_MARKED 2048
+/* Block of small pinned objects, with a mark bitmap at the start */
+#define BF_PINNED_SMALL 4096
+/* The GC is marking the live objects in this BF_PINNED_SMALL block */
+#define BF_PINNED_MARK 8192
+/* Block is part of a compact region (see rts/sm/CompactRegion.c) */
+#define BF_COMPACT_REGION 16384
 
 /* Finding the block descriptor for a given block -------------------------- */
 
@@ -247,10 +259,17 @@ extern void initBlockAllocator(void);
 bdescr *allocGroup(W_ n);
 bdescr *allocBlock(void);
 
+// versions that allocate memory on a specific NUMA node:
+bdescr *allocGroupOnNode(nat node, W_ n);
+bdescr *allocBlockOnNode(nat node);
+
 // versions that take the storage manager lock for you:
 bdescr *allocGroup_lock(W_ n);
 bdescr *allocBlock_lock(void);
 
+bdescr *allocGroupOnNode_lock(nat node, W_ n);
+bdescr *allocBlockOnNode_lock(nat node);
+
 /* De-Allocation ----------------------------------------------------------- */
 
 void freeGroup(bdescr *p);
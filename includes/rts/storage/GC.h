@@ -73,16 +73,28 @@ typedef struct generation_ {
     memcount       n_blocks;            // number of blocks
     memcount       n_words;             // number of used words
 
+    bdescr *       unswept_blocks;      // blocks still to be swept by a
+                                        // lazy sweep (+RTS --lazy-sweep);
+                                        // also counted in n_blocks and
+                                        // n_words
+    memcount       n_unswept_blocks;
+
     bdescr *       large_objects;	// large objects (doubly linked)
     memcount       n_large_blocks;      // no. of blocks used by large objs
     memcount       n_large_words;       // no. of words used by large objs
     memcount       n_new_large_words;   // words of new large objects
                                         // (for doYouWantToGC())
 
+    bdescr *       compact_regions;     // compact regions (doubly linked,
+                                        // by the block descriptor of
+                                        // each region's first block)
+    memcount       n_compact_blocks;    // no. of blocks in compact regions
+
     memcount       max_blocks;          // max blocks
 
     StgTSO *       threads;             // threads in this gen
                                         // linked via global_link
+    StgWeak *      weak_ptr_list;       // weak pointers in this gen
     struct generation_ *to;		// destination gen for live objects
 
     // stats information
@@ -113,9 +125,14 @@ typedef struct generation_ {
     bdescr *     scavenged_large_objects;  // live large objs after GC (d-link)
     memcount     n_scavenged_large_blocks; // size (not count) of above
 
+    bdescr *     live_compact_regions;     // live compact regions after GC
+    memcount     n_live_compact_blocks;    // size (not count) of above
+
     bdescr *     bitmap;  		// bitmap for compacting collection
 
     StgTSO *     old_threads;
+    StgWeak *    old_weak_ptr_list;
+    StgWeak *    weak_ptr_list_tail;
 } generation;
 
 extern generation * generations;
@@ -201,6 +218,8 @@ typedef struct _GCStats {
   StgDouble gc_wall_seconds;
   StgDouble cpu_seconds;
   StgDouble wall_seconds;
+  StgWord64 pinned_bytes;       // in blocks of small pinned objects
+  StgWord64 pinned_free_bytes;  // ... that allocatePinned() can reuse
 } GCStats;
 void getGCStats (GCStats *s);
 rtsBool getGCStatsEnabled (void);
@@ -215,6 +234,15 @@ typedef struct _ParGCStats {
 } ParGCStats;
 void getParGCStats (ParGCStats *s);
 
+// The free space in the pinned blocks that a Capability allocates
+// small pinned objects into, after the last GC.
+typedef struct _PinnedStats {
+  StgWord64 free_bytes;
+  StgWord64 free_chunks;
+  StgWord64 reused_bytes;       // allocated from the free space, in total
+} PinnedStats;
+void getPinnedStats (nat cap, PinnedStats *s);
+
 /*
 typedef struct _TaskStats {
   StgWord64 mut_time;
@@ -236,10 +264,26 @@ HsInt64 getAllocations (void);
    This is the write barrier for MUT_VARs, a.k.a. IORefs.  A
    MUT_VAR_CLEAN object is not on the mutable list; a MUT_VAR_DIRTY
    is.  When written to, a MUT_VAR_CLEAN turns into a MUT_VAR_DIRTY
-   and is put on the mutable list.
+   and is put on the mutable list.  old is the value being
+   overwritten, which is remembered if a concurrent mark is running.
    -------------------------------------------------------------------------- */
 
-void dirty_MUT_VAR(StgRegTable *reg, StgClosure *p);
+void dirty_MUT_VAR(StgRegTable *reg, StgClosure *p, StgClosure *old);
+
+/* -----------------------------------------------------------------------------
+   The snapshot write barrier for the concurrent mark of the old
+   generation (+RTS --concurrent-mark).  While conc_mark_active is
+   non-zero, any pointer to a heap object that is about to be
+   overwritten must be passed to concMarkPushClosure() first
+   (concMarkPushFields() does this for every pointer field of a
+   closure, concMarkPushArray() for n elements of an array).
+   -------------------------------------------------------------------------- */
+
+extern StgWord conc_mark_active;
+
+void concMarkPushClosure (Capability *cap, StgClosure *p);
+void concMarkPushFields  (Capability *cap, StgClosure *p);
+void concMarkPushArray   (Capability *cap, StgMutArrPtrs *arr, W_ off, W_ n);
 
 /* set to disable CAF garbage collection in GHCi. */
 /* (needed when dynamic libraries are used). */
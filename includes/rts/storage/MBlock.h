@@ -18,6 +18,7 @@ extern W_ mblocks_allocated;
 extern void initMBlocks(void);
 extern void * getMBlock(void);
 extern void * getMBlocks(nat n);
+extern void * getMBlocksOnNode(nat node, nat n);
 extern void freeMBlocks(void *addr, nat n);
 extern void freeAllMBlocks(void);
 
@@ -55,9 +56,28 @@ extern SpinLock gc_alloc_block_sync;
    an address that is not in the cache, it calls slowIsHeapAlloced
    (see MBlock.c) which will find the block map for the 4GB block in
    question.
+
+   If the RTS was configured with --enable-large-address-space
+   (USE_LARGE_ADDRESS_SPACE), none of the above applies: the whole heap
+   is allocated from one range of address space that is reserved when
+   the RTS starts up (see initMBlocks()), so HEAP_ALLOCED is a simple
+   range check.
    -------------------------------------------------------------------------- */
 
-#if SIZEOF_VOID_P == 4
+#ifdef USE_LARGE_ADDRESS_SPACE
+
+struct mblock_address_range {
+    W_ begin, end;
+    W_ padding[6];  // ensure nothing else inhabits this cache line
+} ATTRIBUTE_ALIGNED(64);
+
+extern struct mblock_address_range mblock_address_space;
+
+# define HEAP_ALLOCED(p)        ((W_)(p) >= mblock_address_space.begin && \
+                                 (W_)(p) < mblock_address_space.end)
+# define HEAP_ALLOCED_GC(p)     HEAP_ALLOCED(p)
+
+#elif SIZEOF_VOID_P == 4
 extern StgWord8 mblock_map[];
 
 /* On a 32-bit machine a 4KB table is always sufficient */
@@ -395,6 +395,10 @@ RTS_FUN_DECL(stg_makeStableNamezh);
 RTS_FUN_DECL(stg_makeStablePtrzh);
 RTS_FUN_DECL(stg_deRefStablePtrzh);
 
+RTS_FUN_DECL(stg_compactzh);
+RTS_FUN_DECL(stg_compactSavezh);
+RTS_FUN_DECL(stg_compactLoadzh);
+
 RTS_FUN_DECL(stg_forkzh);
 RTS_FUN_DECL(stg_forkOnzh);
 RTS_FUN_DECL(stg_yieldzh);
@@ -465,9 +469,11 @@ extern StgWord stg_stack_save_entries[];
 // Storage.c
 extern unsigned int RTS_VAR(g0);
 extern unsigned int RTS_VAR(large_alloc_lim);
-extern StgWord RTS_VAR(weak_ptr_list);
 extern StgWord RTS_VAR(atomic_modify_mutvar_mutex);
 
+// ConcMark.c
+extern StgWord RTS_VAR(conc_mark_active);
+
 // RtsFlags
 extern StgWord RTS_VAR(RtsFlags); // bogus type
 
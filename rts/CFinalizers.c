@@ -0,0 +1,317 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Running C finalizers on a pool of OS threads
+ * (+RTS --cfinalizer-threads=<n>).
+ *
+ * The C finalizers of the weak pointers that a GC finds to be dead
+ * (those added by Foreign.ForeignPtr.newForeignPtr and friends) are
+ * normally run by scheduleFinalizers() straight after the GC, by the
+ * Task that did the GC, while it holds its Capability.  A program that
+ * frees a lot of large foreign buffers can spend a noticeable time
+ * there, and no Haskell code runs on that Capability in the meantime.
+ *
+ * With --cfinalizer-threads, scheduleFinalizers() instead copies the
+ * finalizers into a CFinalizerBatch (the weak pointers themselves are
+ * about to become DEAD_WEAKs and may be moved by the next GC), and
+ * queueCFinalizers() hands the batch over to a pool of OS threads
+ * that run them.  The finalizer threads don't hold a Capability, and
+ * queueing a batch only takes cfinalizer_mutex, so the Task that did
+ * the GC can go straight back to running Haskell code.
+ *
+ * C finalizers may not call back into Haskell (see rts_lock()), and
+ * the order in which the finalizers of one batch are run is the order
+ * in which they were added, as before.  Different batches may be run
+ * in parallel.  exitCFinalizers() waits for the queue to be empty, so
+ * that all the finalizers queued before the RTS shuts down get run.
+ *
+ * The number of finalizers waiting to be run is posted to the
+ * eventlog, and +RTS -s reports the largest it got.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "RtsUtils.h"
+#include "Weak.h"
+#include "CFinalizers.h"
+#include "Trace.h"
+
+typedef struct {
+    void   *fn;
+    void   *ptr;
+    void   *env;
+    StgWord flag;
+} CFinalizer;
+
+struct CFinalizerBatch_ {
+    struct CFinalizerBatch_ *link;
+    nat n;              // finalizers in use
+    nat size;           // finalizers allocated
+    CFinalizer finalizers[FLEXIBLE_ARRAY];
+};
+
+#define INIT_BATCH_SIZE 64
+
+#if defined(THREADED_RTS)
+static rtsBool          cfinalizer_pool;       // the threads are running
+static Mutex            cfinalizer_mutex;
+static Condition        cfinalizer_cond;       // work arrived, or stop
+static Condition        cfinalizer_done_cond;  // a batch finished
+static CFinalizerBatch *cfinalizer_queue_hd;
+static CFinalizerBatch *cfinalizer_queue_tl;
+static nat              cfinalizer_running;    // batches being run
+static nat              cfinalizer_threads;    // threads still alive
+static rtsBool          cfinalizer_stop;       // asked to exit
+static ThreadLocalKey   cfinalizer_key;        // set in finalizer threads
+#endif
+
+// Statistics, protected by cfinalizer_mutex
+static W_ cfinalizer_backlog;     // finalizers queued or running
+static W_ cfinalizer_max_backlog;
+static W_ cfinalizers_queued;
+static W_ cfinalizer_batches;
+
+static void
+runCFinalizerBatch (CFinalizerBatch *batch)
+{
+    nat i;
+
+    for (i = 0; i < batch->n; i++) {
+        runCFinalizer(batch->finalizers[i].fn,
+                      batch->finalizers[i].ptr,
+                      batch->finalizers[i].env,
+                      batch->finalizers[i].flag);
+    }
+}
+
+#if defined(THREADED_RTS)
+static void startCFinalizerThreads (void);
+
+static void OSThreadProcAttr
+cfinalizerThread (void *arg STG_UNUSED)
+{
+    CFinalizerBatch *batch;
+    W_ backlog;
+
+    setThreadLocalVar(&cfinalizer_key, (void *)1);
+
+    ACQUIRE_LOCK(&cfinalizer_mutex);
+    while (1) {
+        while (cfinalizer_queue_hd == NULL && !cfinalizer_stop) {
+            waitCondition(&cfinalizer_cond, &cfinalizer_mutex);
+        }
+        if (cfinalizer_queue_hd == NULL) break; // stopping
+
+        batch = cfinalizer_queue_hd;
+        cfinalizer_queue_hd = batch->link;
+        if (cfinalizer_queue_hd == NULL) {
+            cfinalizer_queue_tl = NULL;
+        }
+        cfinalizer_running++;
+        RELEASE_LOCK(&cfinalizer_mutex);
+
+        runCFinalizerBatch(batch);
+
+        ACQUIRE_LOCK(&cfinalizer_mutex);
+        cfinalizer_running--;
+        cfinalizer_backlog -= batch->n;
+        backlog = cfinalizer_backlog;
+        broadcastCondition(&cfinalizer_done_cond);
+        RELEASE_LOCK(&cfinalizer_mutex);
+
+        traceCFinalizerBacklog(backlog);
+        stgFree(batch);
+
+        ACQUIRE_LOCK(&cfinalizer_mutex);
+    }
+    cfinalizer_threads--;
+    broadcastCondition(&cfinalizer_done_cond);
+    RELEASE_LOCK(&cfinalizer_mutex);
+}
+#endif
+
+void
+initCFinalizers (void)
+{
+    cfinalizer_backlog     = 0;
+    cfinalizer_max_backlog = 0;
+    cfinalizers_queued     = 0;
+    cfinalizer_batches     = 0;
+
+#if defined(THREADED_RTS)
+    cfinalizer_pool = rtsFalse;
+    if (RtsFlags.GcFlags.cFinalizerThreads == 0) return;
+
+    newThreadLocalKey(&cfinalizer_key);
+    startCFinalizerThreads();
+#endif
+}
+
+#if defined(THREADED_RTS)
+static void
+startCFinalizerThreads (void)
+{
+    OSThreadId tid;
+    nat i;
+
+    initMutex(&cfinalizer_mutex);
+    initCondition(&cfinalizer_cond);
+    initCondition(&cfinalizer_done_cond);
+    cfinalizer_queue_hd = NULL;
+    cfinalizer_queue_tl = NULL;
+    cfinalizer_running  = 0;
+    cfinalizer_stop     = rtsFalse;
+    cfinalizer_threads  = RtsFlags.GcFlags.cFinalizerThreads;
+    cfinalizer_pool     = rtsTrue;
+
+    for (i = 0; i < RtsFlags.GcFlags.cFinalizerThreads; i++) {
+        if (createOSThread(&tid, (OSThreadProc*)cfinalizerThread,
+                           NULL) != 0) {
+            sysErrorBelch("failed to create a C finalizer thread");
+            stg_exit(EXIT_FAILURE);
+        }
+    }
+}
+#endif
+
+// Called in the child of forkProcess().  None of the finalizer threads
+// were copied, and one may have been holding cfinalizer_mutex when we
+// forked.  The batches still on the queue are the parent's to run, so
+// that no finalizer is run twice; we free them and start a new pool
+// for the child's own.
+void
+resetCFinalizersAfterFork (void)
+{
+#if defined(THREADED_RTS)
+    CFinalizerBatch *batch, *next;
+
+    if (!cfinalizer_pool) return;
+
+    for (batch = cfinalizer_queue_hd; batch != NULL; batch = next) {
+        next = batch->link;
+        stgFree(batch);
+    }
+    cfinalizer_backlog = 0;
+
+    startCFinalizerThreads();
+#endif
+}
+
+void
+exitCFinalizers (void)
+{
+#if defined(THREADED_RTS)
+    if (!cfinalizer_pool) return;
+
+    // The threads exit once the queue is empty, so this waits for
+    // every batch queued so far to be run.
+    ACQUIRE_LOCK(&cfinalizer_mutex);
+    cfinalizer_stop = rtsTrue;
+    broadcastCondition(&cfinalizer_cond);
+    while (cfinalizer_threads != 0) {
+        waitCondition(&cfinalizer_done_cond, &cfinalizer_mutex);
+    }
+    ASSERT(cfinalizer_queue_hd == NULL && cfinalizer_running == 0);
+    RELEASE_LOCK(&cfinalizer_mutex);
+
+    closeCondition(&cfinalizer_done_cond);
+    closeCondition(&cfinalizer_cond);
+    closeMutex(&cfinalizer_mutex);
+    freeThreadLocalKey(&cfinalizer_key);
+
+    // any later GC runs its finalizers itself
+    cfinalizer_pool = rtsFalse;
+#endif
+}
+
+void
+addCFinalizer (CFinalizerBatch **batch,
+               void *fn, void *ptr, void *env, StgWord flag)
+{
+    CFinalizerBatch *b = *batch;
+    CFinalizer *f;
+
+    if (b == NULL) {
+        b = stgMallocBytes(sizeof(CFinalizerBatch)
+                           + INIT_BATCH_SIZE * sizeof(CFinalizer),
+                           "addCFinalizer");
+        b->link = NULL;
+        b->n    = 0;
+        b->size = INIT_BATCH_SIZE;
+        *batch = b;
+    } else if (b->n == b->size) {
+        b->size *= 2;
+        b = stgReallocBytes(b, sizeof(CFinalizerBatch)
+                               + b->size * sizeof(CFinalizer),
+                            "addCFinalizer");
+        *batch = b;
+    }
+
+    f = &b->finalizers[b->n++];
+    f->fn   = fn;
+    f->ptr  = ptr;
+    f->env  = env;
+    f->flag = flag;
+}
+
+void
+queueCFinalizers (CFinalizerBatch *batch)
+{
+    if (batch == NULL) return;
+
+#if defined(THREADED_RTS)
+    if (cfinalizer_pool) {
+        W_ backlog;
+
+        batch->link = NULL;
+
+        ACQUIRE_LOCK(&cfinalizer_mutex);
+        if (cfinalizer_queue_tl == NULL) {
+            cfinalizer_queue_hd = batch;
+        } else {
+            cfinalizer_queue_tl->link = batch;
+        }
+        cfinalizer_queue_tl = batch;
+        cfinalizer_backlog += batch->n;
+        if (cfinalizer_backlog > cfinalizer_max_backlog) {
+            cfinalizer_max_backlog = cfinalizer_backlog;
+        }
+        cfinalizers_queued += batch->n;
+        cfinalizer_batches++;
+        backlog = cfinalizer_backlog;
+        signalCondition(&cfinalizer_cond);
+        RELEASE_LOCK(&cfinalizer_mutex);
+
+        debugTrace(DEBUG_weak, "weak: queued %d C finalizers", batch->n);
+        traceCFinalizerBacklog(backlog);
+        return;
+    }
+#endif
+
+    // No finalizer threads: run them now, as scheduleFinalizers()
+    // always used to.
+    runCFinalizerBatch(batch);
+    stgFree(batch);
+}
+
+rtsBool
+isCFinalizerThread (void)
+{
+#if defined(THREADED_RTS)
+    if (cfinalizer_pool) {
+        return getThreadLocalVar(&cfinalizer_key) != NULL;
+    }
+#endif
+    return rtsFalse;
+}
+
+void
+getCFinalizerStats (W_ *finalizers, W_ *batches, W_ *max_backlog)
+{
+    *finalizers  = cfinalizers_queued;
+    *batches     = cfinalizer_batches;
+    *max_backlog = cfinalizer_max_backlog;
+}
@@ -0,0 +1,41 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Running C finalizers on a pool of OS threads.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef CFINALIZERS_H
+#define CFINALIZERS_H
+
+#include "BeginPrivate.h"
+
+typedef struct CFinalizerBatch_ CFinalizerBatch;
+
+void initCFinalizers (void);
+
+// Waits for the finalizers that have been queued to finish.
+void exitCFinalizers (void);
+
+// Called in the child after forkProcess().
+void resetCFinalizersAfterFork (void);
+
+// Add a C finalizer to *batch (which starts out NULL), to be run later
+// by queueCFinalizers().
+void addCFinalizer (CFinalizerBatch **batch,
+                    void *fn, void *ptr, void *env, StgWord flag);
+
+// Hand a batch over to the finalizer threads, or run it now if there
+// aren't any.  Frees the batch.
+void queueCFinalizers (CFinalizerBatch *batch);
+
+// Is this OS thread one of the finalizer threads?
+rtsBool isCFinalizerThread (void);
+
+// for +RTS -s
+void getCFinalizerStats (W_ *finalizers, W_ *batches, W_ *max_backlog);
+
+#include "EndPrivate.h"
+
+#endif /* CFINALIZERS_H */
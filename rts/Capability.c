@@ -26,6 +26,8 @@
 #include "sm/GC.h" // for gcWorkerThread()
 #include "STM.h"
 #include "RtsUtils.h"
+#include "sm/OSMem.h"
+#include "sm/Pinned.h"
 
 #include <string.h>
 
@@ -37,6 +39,11 @@ nat n_capabilities = 0;
 nat enabled_capabilities = 0;
 Capability *capabilities = NULL;
 
+// The number of logical NUMA nodes we are using, and the mapping from
+// logical nodes to the OS node numbers (see initCapabilities())
+nat n_numa_nodes = 1;
+nat numa_map[MAX_NUMA_NODES];
+
 // Holds the Capability which last became free.  This is used so that
 // an in-call has a chance of quickly finding a free Capability.
 // Maintaining a global free list of Capabilities would require global
@@ -226,6 +233,7 @@ initCapability( Capability *cap, nat i )
     nat g;
 
     cap->no = i;
+    cap->node = capNoToNumaNode(i);
     cap->in_haskell        = rtsFalse;
     cap->idle              = 0;
     cap->disabled          = rtsFalse;
@@ -252,6 +260,9 @@ initCapability( Capability *cap, nat i )
 #endif
     cap->total_allocated        = 0;
 
+    initBlockCache(&cap->block_cache);
+    cap->conc_mark_buf          = NULL;
+
     cap->f.stgEagerBlackholeInfo = (W_)&__stg_EAGER_BLACKHOLE_info;
     cap->f.stgGCEnter1     = (StgFunPtr)__stg_gc_enter_1;
     cap->f.stgGCFun        = (StgFunPtr)__stg_gc_fun;
@@ -275,6 +286,12 @@ initCapability( Capability *cap, nat i )
     cap->context_switch = 0;
     cap->pinned_object_block = NULL;
     cap->pinned_object_blocks = NULL;
+    cap->large_objects = NULL;
+    cap->n_large_blocks = 0;
+    initCapabilityPinned(cap);
+    cap->spt_segment = NULL;
+    cap->weak_ptr_list_hd = NULL;
+    cap->weak_ptr_list_tl = NULL;
 
 #ifdef PROFILING
     cap->r.rCCCS = CCS_SYSTEM;
@@ -306,6 +323,28 @@ initCapabilities( void )
     traceCapsetCreate(CAPSET_OSPROCESS_DEFAULT, CapsetTypeOsProcess);
     traceCapsetCreate(CAPSET_CLOCKDOMAIN_DEFAULT, CapsetTypeClockdomain);
 
+    // Figure out the NUMA topology: the logical nodes are the OS nodes
+    // that are both in the --numa mask and available to the process.
+    // Capabilities are assigned to the logical nodes round-robin.
+    if (RtsFlags.GcFlags.numa) {
+        nat logical = 0, physical;
+        StgWord mask = RtsFlags.GcFlags.numaMask & osNumaMask();
+        for (physical = 0; physical < MAX_NUMA_NODES; physical++) {
+            if (mask & 1) {
+                numa_map[logical++] = physical;
+            }
+            mask = mask >> 1;
+        }
+        n_numa_nodes = logical;
+        if (logical == 0) {
+            barf("available NUMA node set is empty");
+        }
+        debugTrace(DEBUG_sched, "using %d NUMA node(s)", n_numa_nodes);
+    } else {
+        n_numa_nodes = 1;
+        numa_map[0] = 0;
+    }
+
 #if defined(THREADED_RTS)
 
 #ifndef REG_Base
@@ -967,6 +1006,7 @@ freeCapability (Capability *cap)
 {
     stgFree(cap->mut_lists);
     stgFree(cap->saved_mut_lists);
+    freeCapabilityPinned(cap);
 #if defined(THREADED_RTS)
     freeSparkPool(cap->sparks);
 #endif
@@ -24,6 +24,8 @@
 #include "sm/GC.h" // for evac_fn
 #include "Task.h"
 #include "Sparks.h"
+#include "sm/BlockAlloc.h" // for BlockCache
+#include "sm/ConcMark.h" // for MarkChunk
 
 #include "BeginPrivate.h"
 
@@ -36,6 +38,13 @@ struct Capability_ {
 
     nat no;  // capability number.
 
+    // The NUMA node on which this capability resides.  This is used to
+    // allocate node-local memory in allocate().
+    //
+    // Note: this is a "logical" node number, not the OS node number.
+    // The OS node number is numa_map[node].
+    nat node;
+
     // The Task currently holding this Capability.  This task has
     // exclusive access to the contents of this Capability (apart from
     // returning_tasks_hd/returning_tasks_tl).
@@ -78,6 +87,28 @@ struct Capability_ {
     bdescr *pinned_object_block;
     // full pinned object blocks allocated since the last GC
     bdescr *pinned_object_blocks;
+    // large objects allocated since the last GC, which the GC moves
+    // onto g0->large_objects
+    bdescr *large_objects;
+    W_ n_large_blocks;
+
+    // free space in the pinned blocks that survived the last GC, by
+    // generation and size class (see sm/Pinned.c)
+    struct PinnedChunk_ **pinned_chunks;
+    W_ pinned_free_words;
+    W_ pinned_free_chunks;
+    W_ pinned_reused_words;   // allocated from pinned_chunks, in total
+
+    // The segment of the stable pointer table that this Capability
+    // allocates StablePtrs from without taking a lock (see Stable.c),
+    // or NULL.
+    struct spSegment_ *spt_segment;
+
+    // Weak pointers created by mkWeak# on this Capability since the
+    // last GC.  mkWeak# adds to this list without taking a lock; the
+    // GC moves them onto the weak pointer list of generation 0.
+    StgWeak *weak_ptr_list_hd;
+    StgWeak *weak_ptr_list_tl;
 
     // Context switch flag.  When non-zero, this means: stop running
     // Haskell code, and switch threads.
@@ -125,6 +156,15 @@ struct Capability_ {
     // Total words allocated by this cap since rts start
     W_ total_allocated;
 
+    // Free blocks and small block groups owned by this Capability, so
+    // that most block allocation can avoid the global lock.  See
+    // "Per-Capability block caches" in sm/BlockAlloc.c.
+    BlockCache block_cache;
+
+    // Pointers remembered by the write barrier during a concurrent
+    // mark of the old generation.  See sm/ConcMark.c.
+    MarkChunk *conc_mark_buf;
+
     // Per-capability STM-related data
     StgTVarWatchQueue *free_tvar_watch_queues;
     StgInvariantCheckQueue *free_invariant_check_queues;
@@ -213,6 +253,18 @@ INLINE_HEADER void releaseCapability_ (Capability* cap STG_UNUSED,
 //
 extern Capability *capabilities;
 
+//
+// The number of NUMA nodes in use (1 unless +RTS --numa is given)
+//
+extern nat n_numa_nodes;
+
+//
+// Map logical NUMA node to OS node numbers
+//
+extern nat numa_map[MAX_NUMA_NODES];
+
+#define capNoToNumaNode(n) ((n) % n_numa_nodes)
+
 // The Capability that was last free.  Used as a good guess for where
 // to assign new threads.
 //
@@ -353,7 +405,7 @@ recordMutableCap (StgClosure *p, Capability *cap, nat gen)
     bd = cap->mut_lists[gen];
     if (bd->free >= bd->start + BLOCK_SIZE_W) {
 	bdescr *new_bd;
-	new_bd = allocBlock_lock();
+	new_bd = allocBlockOnCap_lock(cap);
 	new_bd->link = bd;
 	bd = new_bd;
 	cap->mut_lists[gen] = bd;
@@ -1084,6 +1084,13 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(stg_checkzh)                                        \
       SymI_HasProto(closure_flags)                                      \
       SymI_HasProto(cmp_thread)                                         \
+      SymI_HasProto(stg_compactzh)                                      \
+      SymI_HasProto(stg_compactSavezh)                                  \
+      SymI_HasProto(stg_compactLoadzh)                                  \
+      SymI_HasProto(conc_mark_active)                                   \
+      SymI_HasProto(concMarkPushArray)                                  \
+      SymI_HasProto(concMarkPushClosure)                                \
+      SymI_HasProto(concMarkPushFields)                                 \
       SymI_HasProto(createAdjustor)                                     \
       SymI_HasProto(stg_decodeDoublezu2Intzh)                           \
       SymI_HasProto(stg_decodeFloatzuIntzh)                             \
@@ -1108,6 +1115,7 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(getOrSetSystemTimerThreadIOManagerThreadStore)      \
       SymI_HasProto(getGCStats)                                         \
       SymI_HasProto(getGCStatsEnabled)                                  \
+      SymI_HasProto(getPinnedStats)                                     \
       SymI_HasProto(genSymZh)                                           \
       SymI_HasProto(genericRaise)                                       \
       SymI_HasProto(getProgArgv)                                        \
@@ -20,8 +20,12 @@ void sendMessage    (Capability *from_cap, Capability *to_cap, Message *msg);
 #include "Updates.h" // for DEBUG_FILL_SLOP
 
 INLINE_HEADER void
-doneWithMsgThrowTo (MessageThrowTo *m)
+doneWithMsgThrowTo (Capability *cap, MessageThrowTo *m)
 {
+    // m is locked, so we remember the exception for the concurrent
+    // mark ourselves (the source and target are TSOs, which it
+    // doesn't need).
+    concMarkBarrier(cap, m->exception);
     OVERWRITING_CLOSURE((StgClosure*)m);
     unlockClosure((StgClosure*)m, &stg_MSG_NULL_info);
     LDV_RECORD_CREATE(m);
@@ -931,8 +931,8 @@ findPtr(P_ p, int follow)
   int i = 0;
   searched = 0;
 
-  for (n = 0; n < n_capabilities; n++) {
-      bd = nurseries[i].blocks;
+  for (n = 0; n < n_nurseries; n++) {
+      bd = nurseries[n].blocks;
       i = findPtrBlocks(p,bd,arr,arr_size,i);
       if (i >= arr_size) return;
   }
@@ -1076,7 +1076,7 @@ heapCensusChain( Census *census, bdescr *bd )
 
 void heapCensus (Time t)
 {
-  nat g, n;
+  nat g, n, w;
   Census *census;
   gen_workspace *ws;
 
@@ -1102,10 +1102,12 @@ void heapCensus (Time t)
       heapCensusChain( census, generations[g].large_objects );
 
       for (n = 0; n < n_capabilities; n++) {
-          ws = &gc_threads[n]->gens[g];
-          heapCensusChain(census, ws->todo_bd);
-          heapCensusChain(census, ws->part_list);
-          heapCensusChain(census, ws->scavd_list);
+          for (w = g; w < n_gc_workspaces; w = nextGenWorkspace(g,w)) {
+              ws = &gc_threads[n]->gens[w];
+              heapCensusChain(census, ws->todo_bd);
+              heapCensusChain(census, ws->part_list);
+              heapCensusChain(census, ws->scavd_list);
+          }
       }
   }
 
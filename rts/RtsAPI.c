@@ -17,6 +17,7 @@
 #include "Capability.h"
 #include "Stable.h"
 #include "Weak.h"
+#include "CFinalizers.h"
 
 /* ----------------------------------------------------------------------------
    Building Haskell objects from C datatypes.
@@ -543,7 +544,7 @@ rts_lock (void)
 
     task = newBoundTask();
 
-    if (task->running_finalizers) {
+    if (task->running_finalizers || isCFinalizerThread()) {
         errorBelch("error: a C finalizer called back into Haskell.\n"
                    "   This was previously allowed, but is disallowed in GHC 6.10.2 and later.\n"
                    "   To create finalizers that may call back into Haskell, use\n"
@@ -13,6 +13,7 @@
 #include "RtsUtils.h"
 #include "Profiling.h"
 #include "RtsFlags.h"
+#include "sm/OSMem.h"
 
 #ifdef HAVE_CTYPE_H
 #include <ctype.h>
@@ -100,6 +101,7 @@ void initRtsFlagsDefaults(void)
     RtsFlags.GcFlags.stkChunkBufferSize = (1 * 1024) / sizeof(W_);
 
     RtsFlags.GcFlags.minAllocAreaSize   = (512 * 1024)        / BLOCK_SIZE;
+    RtsFlags.GcFlags.nurseryChunkSize   = 0;    /* off by default */
     RtsFlags.GcFlags.minOldGenSize      = (1024 * 1024)       / BLOCK_SIZE;
     RtsFlags.GcFlags.maxHeapSize	= 0;    /* off by default */
     RtsFlags.GcFlags.heapSizeSuggestion	= 0;    /* none */
@@ -111,6 +113,7 @@ void initRtsFlagsDefaults(void)
     RtsFlags.GcFlags.compact            = rtsFalse;
     RtsFlags.GcFlags.compactThreshold   = 30.0;
     RtsFlags.GcFlags.sweep              = rtsFalse;
+    RtsFlags.GcFlags.lazySweep          = rtsFalse;
 #ifdef RTS_GTK_FRONTPANEL
     RtsFlags.GcFlags.frontpanel         = rtsFalse;
 #endif
@@ -132,6 +135,23 @@ void initRtsFlagsDefaults(void)
 #else
     RtsFlags.GcFlags.heapBase           = 0;   /* means don't care */
 #endif
+#if SIZEOF_VOID_P == 8
+    RtsFlags.GcFlags.addressSpaceSize   = (StgWord)1 << 40; /* 1 TB */
+#else
+    RtsFlags.GcFlags.addressSpaceSize   = 0;
+#endif
+    RtsFlags.GcFlags.numa               = rtsFalse;
+    RtsFlags.GcFlags.numaMask           = 1;
+    RtsFlags.GcFlags.hugePages          = HUGE_PAGES_OFF;
+    RtsFlags.GcFlags.decommit           = rtsFalse;
+    RtsFlags.GcFlags.decommitSlack      = (16 * 1024 * 1024) / BLOCK_SIZE;
+    RtsFlags.GcFlags.decommitRate       = (64 * 1024 * 1024) / BLOCK_SIZE;
+    RtsFlags.GcFlags.concurrentMark     = rtsFalse;
+    RtsFlags.GcFlags.pretenure          = rtsFalse;
+    RtsFlags.GcFlags.tenureAge          = 2;
+    RtsFlags.GcFlags.pauseTarget        = 0;
+    RtsFlags.GcFlags.idleSlices         = rtsFalse;
+    RtsFlags.GcFlags.cFinalizerThreads  = 0;
 
 #ifdef DEBUG
     RtsFlags.DebugFlags.scheduler	= rtsFalse;
@@ -242,6 +262,7 @@ usage_text[] = {
 "  -kb<size> Sets the stack chunk buffer size (default 1k)",
 "",
 "  -A<size> Sets the minimum allocation area size (default 512k) Egs: -A1m -A10k",
+"  -n<size> Divide the allocation area into chunks of this size (default off)",
 "  -M<size> Sets the maximum heap size (default unlimited)  Egs: -M256k -M1G",
 "  -H<size> Sets the minimum heap size (default 0M)   Egs: -H24m  -H1G",
 "  -m<n>    Minimum % of heap which must be available (default 3%)",
@@ -252,6 +273,40 @@ usage_text[] = {
 "  -c       Use in-place compaction for all oldest generation collections",
 "           (the default is to use copying)",
 "  -w       Use mark-region for the oldest generation (experimental)",
+"  --numa[=<node_mask>]",
+"           Use NUMA, on the nodes given by <node_mask> (default: off,",
+"           --numa alone uses all the nodes available to the process)",
+"  --huge-pages[=explicit]",
+"           Back the heap with transparent huge pages, or with explicitly",
+"           reserved (hugetlbfs) huge pages if =explicit is given",
+"  --decommit[=<size>]",
+"           Give free memory back to the OS in the background, keeping",
+"           <size> bytes of free memory (default: 16m)",
+"  --decommit-rate=<size>",
+"           Give back at most <size> bytes per second (default: 64m)",
+#if defined(THREADED_RTS)
+"  --concurrent-mark",
+"           Mark the oldest generation concurrently with the program",
+#endif
+"  --lazy-sweep",
+"           Like -w, but free the unused blocks of the oldest generation",
+"           as memory is needed, rather than during the major GC",
+"  --pretenure",
+"           Copy objects of types that usually survive two GCs straight",
+"           out of the nursery into generation 1",
+"  --tenure-age=<n>",
+"           Promote objects out of generation 0 once they have survived",
+"           <n> GCs (default: 2)",
+"  --pause-target=<sec>",
+"           Size the heap to keep GC pauses under <sec> (default: off)",
+#if defined(THREADED_RTS)
+"  --idle-slices",
+"           When idle, sweep and mark the old generation a piece at a",
+"           time instead of doing a major GC (see -I)",
+"  --cfinalizer-threads=<n>",
+"           Run the C finalizers of dead ForeignPtrs on <n> separate OS",
+"           threads (at most 64), instead of after each GC (default: 0)",
+#endif
 #if defined(THREADED_RTS)
 "  -I<sec>  Perform full GC after <sec> idle time (default: 0.3, 0 == off)",
 #endif
@@ -387,6 +442,10 @@ usage_text[] = {
 "  -xm       Base address to mmap memory in the GHCi linker",
 "            (hex; must be <80000000)",
 #endif
+#if defined(USE_LARGE_ADDRESS_SPACE)
+"  -xr<size> Size of the address space reserved for the heap",
+"            (default: 1T)",
+#endif
 #if defined(USE_PAPI)
 "  -aX       CPU performance counter measurements using PAPI",
 "            (use with the -s<file> option).  X is one of:",
@@ -705,6 +764,102 @@ error = rtsTrue;
                       printRtsInfo();
                       stg_exit(0);
                   }
+                  else if (!strncmp("numa", &rts_argv[arg][2], 4) &&
+                           (rts_argv[arg][6] == '\0' ||
+                            rts_argv[arg][6] == '=')) {
+                      StgWord mask;
+                      OPTION_SAFE;
+                      if (rts_argv[arg][6] == '=') {
+                          mask = (StgWord)strtol(rts_argv[arg]+7,
+                                                 (char **) NULL, 10);
+                      } else {
+                          mask = (StgWord)~0;
+                      }
+                      if (!osNumaAvailable()) {
+                          errorBelch("%s: OS reports NUMA is not available",
+                                     rts_argv[arg]);
+                          error = rtsTrue;
+                          break;
+                      }
+                      RtsFlags.GcFlags.numa = rtsTrue;
+                      RtsFlags.GcFlags.numaMask = mask;
+                  }
+                  else if (strequal("huge-pages",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.GcFlags.hugePages = HUGE_PAGES_TRANSPARENT;
+                  }
+                  else if (strequal("huge-pages=explicit",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.GcFlags.hugePages = HUGE_PAGES_EXPLICIT;
+                  }
+                  else if (strequal("decommit",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.GcFlags.decommit = rtsTrue;
+                  }
+                  else if (!strncmp("decommit=", &rts_argv[arg][2], 9)) {
+                      OPTION_SAFE;
+                      RtsFlags.GcFlags.decommit = rtsTrue;
+                      RtsFlags.GcFlags.decommitSlack =
+                          decodeSize(rts_argv[arg], 11, 0, HS_WORD_MAX)
+                          / BLOCK_SIZE;
+                  }
+                  else if (!strncmp("decommit-rate=", &rts_argv[arg][2], 14)) {
+                      OPTION_SAFE;
+                      RtsFlags.GcFlags.decommitRate =
+                          decodeSize(rts_argv[arg], 16, BLOCK_SIZE, HS_WORD_MAX)
+                          / BLOCK_SIZE;
+                  }
+                  else if (strequal("concurrent-mark",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          RtsFlags.GcFlags.concurrentMark = rtsTrue;
+                      );
+                  }
+                  else if (strequal("lazy-sweep",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.sweep = rtsTrue;
+                      RtsFlags.GcFlags.lazySweep = rtsTrue;
+                  }
+                  else if (strequal("pretenure",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.pretenure = rtsTrue;
+                  }
+                  else if (!strncmp("tenure-age=", &rts_argv[arg][2], 11)) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.tenureAge =
+                          strtol(rts_argv[arg]+13, (char **) NULL, 10);
+                  }
+                  else if (!strncmp("pause-target=", &rts_argv[arg][2], 13)) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.pauseTarget =
+                          fsecondsToTime(atof(rts_argv[arg]+15));
+                  }
+                  else if (strequal("idle-slices",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.idleSlices = rtsTrue;
+                  }
+                  else if (!strncmp("cfinalizer-threads=",
+                                    &rts_argv[arg][2], 19)) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          long n;
+                          n = strtol(rts_argv[arg]+21, (char **) NULL, 10);
+                          if (n < 0 || n > MAX_CFINALIZER_THREADS) {
+                              errorBelch("--cfinalizer-threads must be between 0 and %d",
+                                         MAX_CFINALIZER_THREADS);
+                              error = rtsTrue;
+                          } else {
+                              RtsFlags.GcFlags.cFinalizerThreads = (nat)n;
+                          }
+                      );
+                  }
                   else {
 		      OPTION_SAFE;
 		      errorBelch("unknown RTS option: %s",rts_argv[arg]);
@@ -717,6 +872,12 @@ error = rtsTrue;
                       = decodeSize(rts_argv[arg], 2, BLOCK_SIZE, HS_INT_MAX)
                            / BLOCK_SIZE;
                   break;
+	      case 'n':
+        	  OPTION_UNSAFE;
+                  RtsFlags.GcFlags.nurseryChunkSize
+                      = decodeSize(rts_argv[arg], 2, BLOCK_SIZE, HS_INT_MAX)
+                           / BLOCK_SIZE;
+                  break;
 
 #ifdef USE_PAPI
 	      case 'a':
@@ -1333,6 +1494,17 @@ error = rtsTrue;
                     break;
 #endif
 
+                case 'r': /* size of the heap reservation */
+                    OPTION_UNSAFE;
+#if defined(USE_LARGE_ADDRESS_SPACE)
+                    RtsFlags.GcFlags.addressSpaceSize
+                        = decodeSize(rts_argv[arg], 3, MBLOCK_SIZE, HS_WORD_MAX);
+#else
+                    errorBelch("-xr: the RTS was not built with a large address space");
+                    error = rtsTrue;
+#endif
+                    break;
+
                 case 'c': /* Debugging tool: show current cost centre on an exception */
                     OPTION_SAFE;
                     PROFILING_BUILD_ONLY(
@@ -1437,6 +1609,45 @@ static void normaliseRtsOpts (void)
         errorBelch("stack chunk buffer size (-kb) must be less than 50%% of the stack chunk size (-kc)");
         errorUsage();
     }
+
+    if (RtsFlags.GcFlags.concurrentMark &&
+        RtsFlags.GcFlags.generations < 2) {
+        errorBelch("--concurrent-mark needs at least two generations (-G2)");
+        errorUsage();
+    }
+
+    if (RtsFlags.GcFlags.pretenure &&
+        RtsFlags.GcFlags.generations < 2) {
+        errorBelch("--pretenure needs at least two generations (-G2)");
+        errorUsage();
+    }
+
+    // gen 0 has a workspace for each age but the first, see GCThread.h
+    if (RtsFlags.GcFlags.tenureAge < 2 ||
+        RtsFlags.GcFlags.tenureAge > MAX_TENURE_AGE ||
+        (RtsFlags.GcFlags.tenureAge > 2 &&
+         RtsFlags.GcFlags.generations < 2)) {
+        errorBelch("--tenure-age must be between 2 and %d, and needs at least two generations (-G2) if it is more than 2",
+                   MAX_TENURE_AGE);
+        errorUsage();
+    }
+
+    if (RtsFlags.GcFlags.pauseTarget < 0) {
+        errorBelch("--pause-target must be positive");
+        errorUsage();
+    }
+
+    if (RtsFlags.GcFlags.pauseTarget != 0 &&
+        RtsFlags.GcFlags.generations < 2) {
+        errorBelch("--pause-target needs at least two generations (-G2)");
+        errorUsage();
+    }
+
+    // a single chunk per Capability is the same as not using chunks
+    if (RtsFlags.GcFlags.nurseryChunkSize >=
+        RtsFlags.GcFlags.minAllocAreaSize) {
+        RtsFlags.GcFlags.nurseryChunkSize = 0;
+    }
 }
 
 static void errorUsage (void)
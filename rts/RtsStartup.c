@@ -24,6 +24,7 @@
 #include "STM.h"        /* initSTM */
 #include "RtsSignals.h"
 #include "Weak.h"
+#include "CFinalizers.h"
 #include "Ticky.h"
 #include "StgRun.h"
 #include "Prelude.h"		/* fixupRTStoPreludeRefs */
@@ -187,6 +188,9 @@ hs_init_ghc(int *argc, char **argv[], RtsConfig rts_config)
     /* initialise the stable pointer table */
     initStableTables();
 
+    /* start the C finalizer threads, if any */
+    initCFinalizers();
+
     /* Add some GC roots for things in the base package that the RTS
      * knows about.  We don't know whether these turn out to be CAFs
      * or refer to CAFs, but we have to assume that they might.
@@ -305,6 +309,8 @@ hs_add_root(void (*init_root)(void) STG_UNUSED)
 static void
 hs_exit_(rtsBool wait_foreign)
 {
+    nat g, i;
+
     if (hs_init_count <= 0) {
 	errorBelch("warning: too many hs_exit()s");
 	return;
@@ -334,8 +340,17 @@ hs_exit_(rtsBool wait_foreign)
     /* stop all running tasks */
     exitScheduler(wait_foreign);
 
+    /* wait for the C finalizer threads to run the finalizers queued
+     * by the last GCs */
+    exitCFinalizers();
+
     /* run C finalizers for all active weak pointers */
-    runAllCFinalizers(weak_ptr_list);
+    for (i = 0; i < n_capabilities; i++) {
+        runAllCFinalizers(capabilities[i].weak_ptr_list_hd);
+    }
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        runAllCFinalizers(generations[g].weak_ptr_list);
+    }
     
 #if defined(RTS_USER_SIGNALS)
     if (RtsFlags.MiscFlags.install_signal_handlers) {
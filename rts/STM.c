@@ -188,7 +188,8 @@ static void unlock_stm(StgTRecHeader *trec STG_UNUSED) {
   TRACE("%p : unlock_stm()", trec);
 }
 
-static StgClosure *lock_tvar(StgTRecHeader *trec STG_UNUSED, 
+static StgClosure *lock_tvar(Capability *cap STG_UNUSED,
+                             StgTRecHeader *trec STG_UNUSED, 
                              StgTVar *s STG_UNUSED) {
   StgClosure *result;
   TRACE("%p : lock_tvar(%p)", trec, s);
@@ -203,12 +204,14 @@ static void unlock_tvar(Capability *cap,
                         StgBool force_update) {
   TRACE("%p : unlock_tvar(%p)", trec, s);
   if (force_update) {
+    StgClosure *old = s -> current_value;
     s -> current_value = c;
-    dirty_TVAR(cap,s);
+    dirty_TVAR(cap,s,old);
   }
 }
 
-static StgBool cond_lock_tvar(StgTRecHeader *trec STG_UNUSED, 
+static StgBool cond_lock_tvar(Capability *cap STG_UNUSED,
+                              StgTRecHeader *trec STG_UNUSED, 
                               StgTVar *s STG_UNUSED,
                               StgClosure *expected) {
   StgClosure *result;
@@ -246,7 +249,8 @@ static void unlock_stm(StgTRecHeader *trec STG_UNUSED) {
   smp_locked = 0;
 }
 
-static StgClosure *lock_tvar(StgTRecHeader *trec STG_UNUSED, 
+static StgClosure *lock_tvar(Capability *cap STG_UNUSED,
+                             StgTRecHeader *trec STG_UNUSED, 
                              StgTVar *s STG_UNUSED) {
   StgClosure *result;
   TRACE("%p : lock_tvar(%p)", trec, s);
@@ -263,12 +267,14 @@ static void *unlock_tvar(Capability *cap,
   TRACE("%p : unlock_tvar(%p, %p)", trec, s, c);
   ASSERT (smp_locked == trec);
   if (force_update) {
+    StgClosure *old = s -> current_value;
     s -> current_value = c;
-    dirty_TVAR(cap,s);
+    dirty_TVAR(cap,s,old);
   }
 }
 
-static StgBool cond_lock_tvar(StgTRecHeader *trec STG_UNUSED, 
+static StgBool cond_lock_tvar(Capability *cap STG_UNUSED,
+                               StgTRecHeader *trec STG_UNUSED, 
                                StgTVar *s STG_UNUSED,
                                StgClosure *expected) {
   StgClosure *result;
@@ -303,7 +309,8 @@ static void unlock_stm(StgTRecHeader *trec STG_UNUSED) {
   TRACE("%p : unlock_stm()", trec);
 }
 
-static StgClosure *lock_tvar(StgTRecHeader *trec, 
+static StgClosure *lock_tvar(Capability *cap,
+                             StgTRecHeader *trec, 
                              StgTVar *s STG_UNUSED) {
   StgClosure *result;
   TRACE("%p : lock_tvar(%p)", trec, s);
@@ -313,6 +320,10 @@ static StgClosure *lock_tvar(StgTRecHeader *trec,
     } while (GET_INFO(UNTAG_CLOSURE(result)) == &stg_TREC_HEADER_info);
   } while (cas((void *)&(s -> current_value),
 	       (StgWord)result, (StgWord)trec) != (StgWord)result);
+  // The TVar no longer points to result while we hold the lock, so
+  // the concurrent mark has to be told about it here (see
+  // sm/ConcMark.c)
+  concMarkBarrier(cap, result);
   return result;
 }
 
@@ -324,10 +335,12 @@ static void unlock_tvar(Capability *cap,
   TRACE("%p : unlock_tvar(%p, %p)", trec, s, c);
   ASSERT(s -> current_value == (StgClosure *)trec);
   s -> current_value = c;
-  dirty_TVAR(cap,s);
+  // the value we displaced was remembered by lock_tvar/cond_lock_tvar
+  dirty_TVAR(cap,s,(StgClosure *)trec);
 }
 
-static StgBool cond_lock_tvar(StgTRecHeader *trec, 
+static StgBool cond_lock_tvar(Capability *cap,
+                              StgTRecHeader *trec, 
                               StgTVar *s,
                               StgClosure *expected) {
   StgClosure *result;
@@ -336,6 +349,9 @@ static StgBool cond_lock_tvar(StgTRecHeader *trec,
   w = cas((void *)&(s -> current_value), (StgWord)expected, (StgWord)trec);
   result = (StgClosure *)w;
   TRACE("%p : %s", trec, result ? "success" : "failure");
+  if (result == expected) {
+    concMarkBarrier(cap, expected); // as in lock_tvar
+  }
   return (result == expected);
 }
 
@@ -476,6 +492,14 @@ static StgTRecHeader *new_stg_trec_header(Capability *cap,
 // Allocation / deallocation functions that retain per-capability lists
 // of closures that can be re-used
 
+// A re-used closure may be in the old generation, where a concurrent
+// mark would not otherwise know that it is live again, nor about the
+// values in the fields we are about to overwrite.
+static void reuse_closure(Capability *cap, StgClosure *p) {
+  concMarkBarrierFields(cap, p);
+  concMarkBarrier(cap, p);
+}
+
 static StgInvariantCheckQueue *alloc_stg_invariant_check_queue(Capability *cap,
 							       StgAtomicInvariant *invariant) {
   StgInvariantCheckQueue *result = NULL;
@@ -483,6 +507,7 @@ static StgInvariantCheckQueue *alloc_stg_invariant_check_queue(Capability *cap,
     result = new_stg_invariant_check_queue(cap, invariant);
   } else {
     result = cap -> free_invariant_check_queues;
+    reuse_closure(cap, (StgClosure *)result);
     result -> invariant = invariant;
     result -> my_execution = NO_TREC;
     cap -> free_invariant_check_queues = result -> next_queue_entry;
@@ -497,6 +522,7 @@ static StgTVarWatchQueue *alloc_stg_tvar_watch_queue(Capability *cap,
     result = new_stg_tvar_watch_queue(cap, closure);
   } else {
     result = cap -> free_tvar_watch_queues;
+    reuse_closure(cap, (StgClosure *)result);
     result -> closure = closure;
     cap -> free_tvar_watch_queues = result -> next_queue_entry;
   }
@@ -517,6 +543,7 @@ static StgTRecChunk *alloc_stg_trec_chunk(Capability *cap) {
     result = new_stg_trec_chunk(cap);
   } else {
     result = cap -> free_trec_chunks;
+    reuse_closure(cap, (StgClosure *)result);
     cap -> free_trec_chunks = result -> prev_chunk;
     result -> prev_chunk = END_STM_CHUNK_LIST;
     result -> next_entry_idx = 0;
@@ -539,8 +566,10 @@ static StgTRecHeader *alloc_stg_trec_header(Capability *cap,
     result = new_stg_trec_header(cap, enclosing_trec);
   } else {
     result = cap -> free_trec_headers;
+    reuse_closure(cap, (StgClosure *)result);
     cap -> free_trec_headers = result -> enclosing_trec;
     result -> enclosing_trec = enclosing_trec;
+    concMarkBarrierFields(cap, (StgClosure *)result -> current_chunk);
     result -> current_chunk -> next_entry_idx = 0;
     result -> invariants_to_check = END_INVARIANT_CHECK_QUEUE;
     if (enclosing_trec == NO_TREC) {
@@ -599,7 +628,7 @@ static void build_watch_queue_entries_for_trec(Capability *cap,
     }
     s -> first_watch_queue_entry = q;
     e -> new_value = (StgClosure *) q;
-    dirty_TVAR(cap,s); // we modified first_watch_queue_entry
+    dirty_TVAR(cap,s,(StgClosure *)fq); // we modified first_watch_queue_entry
   });
 }
 
@@ -619,7 +648,7 @@ static void remove_watch_queue_entries_for_trec(Capability *cap,
     StgTVarWatchQueue *q;
     StgClosure *saw;
     s = e -> tvar;
-    saw = lock_tvar(trec, s);
+    saw = lock_tvar(cap, trec, s);
     q = (StgTVarWatchQueue *) (e -> new_value);
     TRACE("%p : removing tso=%p from watch queue for tvar=%p", 
 	  trec, 
@@ -636,7 +665,7 @@ static void remove_watch_queue_entries_for_trec(Capability *cap,
     } else {
       ASSERT (s -> first_watch_queue_entry == q);
       s -> first_watch_queue_entry = nq;
-      dirty_TVAR(cap,s); // we modified first_watch_queue_entry
+      dirty_TVAR(cap,s,(StgClosure *)q); // we modified first_watch_queue_entry
     }
     free_stg_tvar_watch_queue(cap, q);
     unlock_tvar(cap, trec, s, saw, FALSE);
@@ -694,6 +723,7 @@ static void merge_update_into(Capability *cap,
               t, tvar, e -> expected_value, expected_value);
         t -> state = TREC_CONDEMNED;
       } 
+      concMarkBarrier(cap, e -> new_value);
       e -> new_value = new_value;
       BREAK_FOR_EACH;
     }
@@ -850,7 +880,7 @@ static StgBool validate_and_acquire_ownership (Capability *cap,
       s = e -> tvar;
       if (acquire_all || entry_is_update(e)) {
         TRACE("%p : trying to acquire %p", trec, s);
-        if (!cond_lock_tvar(trec, s, e -> expected_value)) {
+        if (!cond_lock_tvar(cap, trec, s, e -> expected_value)) {
           TRACE("%p : failed to acquire %p", trec, s);
           result = FALSE;
           BREAK_FOR_EACH;
@@ -1153,7 +1183,7 @@ static void disconnect_invariant(Capability *cap,
 	} else {
 	  ASSERT (s -> first_watch_queue_entry == q);
 	  s -> first_watch_queue_entry = nq;
-          dirty_TVAR(cap,s); // we modified first_watch_queue_entry
+          dirty_TVAR(cap,s,(StgClosure *)q); // we modified first_watch_queue_entry
         }
 	TRACE("  found it in watch queue entry %p", q);
 	free_stg_tvar_watch_queue(cap, q);
@@ -1194,7 +1224,7 @@ static void connect_invariant_to_trec(Capability *cap,
       fq -> prev_queue_entry = q;
     }
     s -> first_watch_queue_entry = q;
-    dirty_TVAR(cap,s); // we modified first_watch_queue_entry
+    dirty_TVAR(cap,s,(StgClosure *)fq); // we modified first_watch_queue_entry
   });
 
   inv -> last_execution = my_execution;
@@ -1261,7 +1291,7 @@ StgInvariantCheckQueue *stmGetInvariantsToCheck(Capability *cap, StgTRecHeader *
       TRecEntry *e = &(c -> entries[i]);
       if (entry_is_update(e)) {
 	StgTVar *s = e -> tvar;
-	StgClosure *old = lock_tvar(trec, s);
+	StgClosure *old = lock_tvar(cap, trec, s);
 		
 	// Pick up any invariants on the TVar being updated
 	// by entry "e"
@@ -1675,6 +1705,7 @@ void stmWriteTVar(Capability *cap,
   if (entry != NULL) {
     if (entry_in == trec) {
       // Entry found in our trec
+      concMarkBarrier(cap, entry -> new_value);
       entry -> new_value = new_value;
     } else {
       // Entry found in another trec
@@ -28,6 +28,10 @@
 #include "Weak.h"
 #include "sm/GC.h" // waitForGcThreads, releaseGCThreads, N
 #include "sm/GCThread.h"
+#include "sm/ConcMark.h"
+#include "sm/Sweep.h"
+#include "sm/PauseTarget.h"
+#include "sm/Decommit.h"
 #include "Sparks.h"
 #include "Capability.h"
 #include "Task.h"
@@ -42,6 +46,7 @@
 #include "ThreadPaused.h"
 #include "Messages.h"
 #include "Stable.h"
+#include "CFinalizers.h"
 
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>
@@ -140,6 +145,9 @@ static void scheduleStartSignalHandlers (Capability *cap);
 static void scheduleCheckBlockedThreads (Capability *cap);
 static void scheduleProcessInbox(Capability **cap);
 static void scheduleDetectDeadlock (Capability **pcap, Task *task);
+#if defined(THREADED_RTS)
+static void scheduleIdleSlices (Capability **pcap, Task *task);
+#endif
 static void schedulePushWork(Capability *cap, Task *task);
 #if defined(THREADED_RTS)
 static void scheduleActivateSpark(Capability *cap);
@@ -898,6 +906,13 @@ scheduleDetectDeadlock (Capability **pcap, Task *task)
 	 * any threads to run currently.
 	 */
 	if (recent_activity != ACTIVITY_INACTIVE) return;
+
+        // With +RTS --idle-slices we don't do a major GC when the
+        // program goes idle; see scheduleIdleSlices().
+        if (RtsFlags.GcFlags.idleSlices) {
+            scheduleIdleSlices(pcap, task);
+            return;
+        }
 #endif
 
 	debugTrace(DEBUG_sched, "deadlocked, forcing major GC...");
@@ -959,6 +974,71 @@ scheduleDetectDeadlock (Capability **pcap, Task *task)
     }
 }
 
+/* ----------------------------------------------------------------------------
+ * Incremental work while idle (+RTS --idle-slices)
+ *
+ * Rather than a major GC, which may still be running when the next
+ * request arrives, the idle time is spent on the work that the oldest
+ * generation would otherwise leave for later, in small pieces:
+ *
+ *   - sweeping IDLE_SWEEP_BLOCKS blocks at a time (+RTS --lazy-sweep),
+ *
+ *   - a GC of the younger generations that starts a concurrent mark of
+ *     the oldest generation, or finishes one once the marking thread
+ *     has run out of work (+RTS --concurrent-mark).
+ *
+ * We stop as soon as this Capability has something else to do.  When
+ * a mark is still in progress we come back after the next -I delay;
+ * when there is nothing left, we turn off the timer as for +RTS -I0.
+ * As with -I0, a deadlock is not detected until the next major GC.
+ * ------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+#define IDLE_SWEEP_BLOCKS 64
+
+static rtsBool
+idleInterrupted (Capability *cap)
+{
+    return recent_activity != ACTIVITY_INACTIVE
+        || !emptyRunQueue(cap)
+        || !emptyInbox(cap)
+        || cap->returning_tasks_hd != NULL
+        || pending_sync != 0
+        || sched_state != SCHED_RUNNING;
+}
+
+static void
+scheduleIdleSlices (Capability **pcap, Task *task)
+{
+    Capability *cap = *pcap;
+
+    while (oldest_gen->unswept_blocks != NULL) {
+        if (idleInterrupted(cap)) return;
+        lazySweep(cap, IDLE_SWEEP_BLOCKS);
+    }
+
+    if (idleInterrupted(cap)) return;
+
+    if (concMarkIdle()) {
+        debugTrace(DEBUG_sched, "idle, doing a concurrent mark GC...");
+        // this sets recent_activity back to ACTIVITY_YES
+        scheduleDoGC(pcap, task, rtsFalse);
+        return;
+    }
+
+    if (conc_mark_active) {
+        // the marking thread is still busy; look again later
+        recent_activity = ACTIVITY_YES;
+        return;
+    }
+
+    recent_activity = ACTIVITY_DONE_GC;
+#ifndef PROFILING
+    stopTimer();
+#endif
+}
+#endif
+
 
 /* ----------------------------------------------------------------------------
  * Send pending messages (PARALLEL_HASKELL only)
@@ -996,8 +1076,8 @@ scheduleProcessInbox (Capability **pcap USED_IF_THREADS)
     Capability *cap = *pcap;
 
     while (!emptyInbox(cap)) {
-        if (cap->r.rCurrentNursery->link == NULL ||
-            g0->n_new_large_words >= large_alloc_lim) {
+        if (g0->n_new_large_words >= large_alloc_lim ||
+            (cap->r.rCurrentNursery->link == NULL && !getNewNursery(cap))) {
             scheduleDoGC(pcap, cap->running_task, rtsFalse);
             cap = *pcap;
         }
@@ -1108,7 +1188,7 @@ scheduleHandleHeapOverflow( Capability *cap, StgTSO *t )
 	    cap->r.rNursery->n_blocks == 1) {  // paranoia to prevent infinite loop
 	                                       // if the nursery has only one block.
 	    
-            bd = allocGroup_lock(blocks);
+            bd = allocGroupOnCap_lock(cap,blocks);
             cap->r.rNursery->n_blocks += blocks;
 	    
 	    // link the new group into the list
@@ -1163,6 +1243,17 @@ scheduleHandleHeapOverflow( Capability *cap, StgTSO *t )
     } else {
         pushOnRunQueue(cap,t);
     }
+
+    // If the nursery is divided into chunks (+RTS -n), try to carry on
+    // with a fresh chunk rather than GC'ing straight away.
+    if (cap->r.rCurrentNursery->link == NULL &&
+        g0->n_new_large_words < large_alloc_lim &&
+        getNewNursery(cap)) {
+        debugTrace(DEBUG_sched, "thread %ld got a new nursery chunk",
+                   (long)t->id);
+        return rtsFalse;
+    }
+
     return rtsTrue;
     /* actual GC is done at the end of the while loop in schedule() */
 }
@@ -1458,7 +1549,9 @@ scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
 #ifdef THREADED_RTS
     if (sched_state < SCHED_INTERRUPTING
         && RtsFlags.ParFlags.parGcEnabled
-        && collect_gen >= RtsFlags.ParFlags.parGcGen
+        && (RtsFlags.GcFlags.pauseTarget != 0
+            ? pauseParallelGC(collect_gen)
+            : collect_gen >= RtsFlags.ParFlags.parGcGen)
         && ! oldest_gen->mark)
     {
         gc_type = SYNC_GC_PAR;
@@ -1643,6 +1736,13 @@ delete_threads_and_gc:
 #endif
 
 #if defined(THREADED_RTS)
+    // With +RTS --concurrent-mark, the oldest generation is marked
+    // concurrently instead of being collected by this GC, unless we
+    // have been asked for a major GC.  See sm/ConcMark.c.
+    if (RtsFlags.GcFlags.concurrentMark && !force_major && !heap_census) {
+        collect_gen = concMarkPlanGC(collect_gen);
+    }
+
     // reset pending_sync *before* GC, so that when the GC threads
     // emerge they don't immediately re-enter the GC.
     pending_sync = 0;
@@ -1908,6 +2008,12 @@ forkProcess(HsStablePtr *entry
             generations[g].threads = END_TSO_QUEUE;
         }
 
+        // The RTS's own background threads weren't copied either, and
+        // may have been holding their locks when we forked.
+        resetConcMarkAfterFork();
+        resetDecommitAfterFork();
+        resetCFinalizersAfterFork();
+
         // On Unix, all timers are reset in the child, so we need to start
         // the timer again.
         initTimer();
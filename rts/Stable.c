@@ -16,6 +16,11 @@
 #include "RtsUtils.h"
 #include "Trace.h"
 #include "Stable.h"
+#include "Capability.h"
+#include "Task.h"
+
+#include <stddef.h> // for offsetof()
+#include <string.h> // for memcpy()
 
 /* Comment from ADR's implementation in old RTS:
 
@@ -77,24 +82,61 @@
   application, etc of a stable pointer.
 
   Stable Pointers are exported to the outside world as indices and not
-  pointers, because the stable pointer table is allowed to be
-  reallocated for growth. The table is never shrunk for its space to
-  be reclaimed.
+  pointers, because the stable pointer table is allowed to grow (see
+  below). The table is never shrunk for its space to be reclaimed.
 
   Future plans for stable ptrs include distinguishing them by the
   generation of the pointed object. See
   http://hackage.haskell.org/trac/ghc/ticket/7670 for details.
 */
 
+/*
+  The stable pointer table is made of segments of SPT_SEGMENT_SIZE
+  entries.  stable_ptr_table is a directory of the segments, so
+  StablePtr n is entry (n & SPT_SEGMENT_MASK) of segment
+  (n >> SPT_SEGMENT_BITS).  Segments never move, and when the
+  directory is enlarged the old one is kept until the tables are
+  freed, so deRefStablePtr() needs no lock.
+
+  Each segment is owned by at most one Capability, which allocates
+  StablePtrs from it without taking a lock: the owner has the
+  segment's free list to itself, and anyone else freeing an entry in
+  the segment pushes it on the remote_free list with a CAS, which the
+  owner takes over when its own list runs out.  stable_mutex is only
+  needed to change the owner of a segment, to add a segment, and for
+  threads that don't hold a Capability, since those may run at the
+  same time as the GC.
+
+  The free entries of a segment point to other entries in the same
+  segment (or are NULL), which is how the GC tells them apart from
+  live entries.
+*/
+
+typedef struct spSegment_ {
+    nat no;                         // index in stable_ptr_table
+    Capability *owner;              // or NULL
+    spEntry *free;                  // free entries, used by the owner
+    spEntry * volatile remote_free; // free entries, from everyone else
+    spEntry entries[SPT_SEGMENT_SIZE];
+} spSegment;
+
 snEntry *stable_name_table = NULL;
 static snEntry *stable_name_free = NULL;
 static unsigned int SNT_size = 0;
 #define INIT_SNT_SIZE 64
 
-spEntry *stable_ptr_table = NULL;
-static spEntry *stable_ptr_free = NULL;
-static unsigned int SPT_size = 0;
-#define INIT_SPT_SIZE 64
+spEntry **stable_ptr_table = NULL;
+static unsigned int SPT_size = 0;      // size of the directory
+static unsigned int n_spt_segments = 0;
+static unsigned int spt_search = 0;    // where findSpSegment() starts
+#define INIT_SPT_SIZE 4
+
+// Directories replaced by enlargeStablePtrTable(), which another
+// thread may still be reading.  The directory doubles each time, so
+// we never need many of these.
+#define MAX_N_OLD_SPTS 64
+static spEntry **old_SPTs[MAX_N_OLD_SPTS];
+static nat n_old_SPTs = 0;
 
 #ifdef THREADED_RTS
 Mutex stable_mutex;
@@ -111,6 +153,18 @@ static void enlargeStablePtrTable(void);
 
 static HashTable *addrToStableHash = NULL;
 
+/*
+ * The stable names in use are kept on a list for each generation: the
+ * youngest generation that either the object or the StableName object
+ * is in.  A GC only looks at the entries on the lists of the
+ * generations it collects, which gcStableTables() moves to sn_young
+ * until updateStableTables() puts them back.  The lists are linked
+ * through snEntry.next by index, and end in 0, which is never a
+ * stable name.
+ */
+static StgWord *sn_gen_lists = NULL;
+static StgWord sn_young = 0;
+
 /* -----------------------------------------------------------------------------
  * We must lock the StablePtr table during GC, to prevent simultaneous
  * calls to freeStablePtr().
@@ -141,20 +195,23 @@ initSnEntryFreeList(snEntry *table, nat n, snEntry *free)
     p->addr   = (P_)free;
     p->old    = NULL;
     p->sn_obj = NULL;
+    p->next   = 0;
     free = p;
   }
   stable_name_free = table;
 }
 
-STATIC_INLINE void
-initSpEntryFreeList(spEntry *table, nat n, spEntry *free)
+STATIC_INLINE spSegment *
+spSegmentOf(StgWord sp)
 {
-  spEntry *p;
-  for (p = table + n - 1; p >= table; p--) {
-      p->addr = (P_)free;
-      free = p;
-  }
-  stable_ptr_free = table;
+    return (spSegment *)((StgWord8 *)stable_ptr_table[sp >> SPT_SEGMENT_BITS]
+                         - offsetof(spSegment, entries));
+}
+
+STATIC_INLINE StgWord
+spIndex(spSegment *seg, spEntry *sp)
+{
+    return ((StgWord)seg->no << SPT_SEGMENT_BITS) + (sp - seg->entries);
 }
 
 void
@@ -170,12 +227,16 @@ initStableTables(void)
      */
     initSnEntryFreeList(stable_name_table + 1,INIT_SNT_SIZE-1,NULL);
     addrToStableHash = allocHashTable();
+    sn_gen_lists = stgCallocBytes(RtsFlags.GcFlags.generations,
+                                  sizeof *sn_gen_lists, "initStableTables");
+    sn_young = 0;
 
     if (SPT_size > 0) return;
     SPT_size = INIT_SPT_SIZE;
     stable_ptr_table = stgMallocBytes(SPT_size * sizeof *stable_ptr_table,
                                       "initStablePtrTable");
-    initSpEntryFreeList(stable_ptr_table,INIT_SPT_SIZE,NULL);
+    n_spt_segments = 0;
+    spt_search = 0;
 
 #ifdef THREADED_RTS
     initMutex(&stable_mutex);
@@ -201,19 +262,75 @@ enlargeStableNameTable(void)
     initSnEntryFreeList(stable_name_table + old_SNT_size, old_SNT_size, NULL);
 }
 
+// Requires: stable_mutex
 static void
 enlargeStablePtrTable(void)
 {
-    nat old_SPT_size = SPT_size;
+    spEntry **new_table;
 
-    // 2nd and subsequent times
+    if (n_old_SPTs == MAX_N_OLD_SPTS) {
+        barf("enlargeStablePtrTable: too many old tables");
+    }
+
+    // Other threads may be looking things up in the old directory
+    // without the lock, so we can't realloc it.
+    new_table = stgMallocBytes(SPT_size * 2 * sizeof *stable_ptr_table,
+                               "enlargeStablePtrTable");
+    memcpy(new_table, stable_ptr_table, SPT_size * sizeof *stable_ptr_table);
+    old_SPTs[n_old_SPTs++] = stable_ptr_table;
+    write_barrier();
+    stable_ptr_table = new_table;
     SPT_size *= 2;
-    stable_ptr_table =
-        stgReallocBytes(stable_ptr_table,
-                        SPT_size * sizeof *stable_ptr_table,
-                        "enlargeStablePtrTable");
+}
+
+// Add a segment to the table, with every entry free and no owner.
+// Requires: stable_mutex
+static spSegment *
+newSpSegment(void)
+{
+    spSegment *seg;
+    spEntry *p, *free;
 
-    initSpEntryFreeList(stable_ptr_table + old_SPT_size, old_SPT_size, NULL);
+    if (n_spt_segments == SPT_size) {
+        enlargeStablePtrTable();
+    }
+
+    seg = stgMallocBytes(sizeof(spSegment), "newSpSegment");
+    free = NULL;
+    for (p = seg->entries + SPT_SEGMENT_SIZE - 1; p >= seg->entries; p--) {
+        p->addr = (P_)free;
+        free = p;
+    }
+    seg->no          = n_spt_segments;
+    seg->owner       = NULL;
+    seg->free        = NULL;
+    seg->remote_free = free;
+
+    stable_ptr_table[n_spt_segments] = seg->entries;
+    write_barrier();
+    n_spt_segments++;
+
+    debugTrace(DEBUG_stable, "new stable pointer segment %d", seg->no);
+    return seg;
+}
+
+// Find a segment that has free entries and no owner, or add one.
+// Requires: stable_mutex
+static spSegment *
+findSpSegment(void)
+{
+    nat i, n;
+    spSegment *seg;
+
+    for (i = 0; i < n_spt_segments; i++) {
+        n = (spt_search + i) % n_spt_segments;
+        seg = spSegmentOf((StgWord)n << SPT_SEGMENT_BITS);
+        if (seg->owner == NULL && seg->remote_free != NULL) {
+            spt_search = n;
+            return seg;
+        }
+    }
+    return newSpSegment();
 }
 
 /* -----------------------------------------------------------------------------
@@ -232,10 +349,24 @@ exitStableTables(void)
     stable_name_table = NULL;
     SNT_size = 0;
 
-    if (stable_ptr_table)
+    if (sn_gen_lists)
+        stgFree(sn_gen_lists);
+    sn_gen_lists = NULL;
+
+    if (stable_ptr_table) {
+        nat i;
+        for (i = 0; i < n_spt_segments; i++) {
+            stgFree(spSegmentOf((StgWord)i << SPT_SEGMENT_BITS));
+        }
+        for (i = 0; i < n_old_SPTs; i++) {
+            stgFree(old_SPTs[i]);
+        }
         stgFree(stable_ptr_table);
+    }
     stable_ptr_table = NULL;
     SPT_size = 0;
+    n_spt_segments = 0;
+    n_old_SPTs = 0;
 
 #ifdef THREADED_RTS
     closeMutex(&stable_mutex);
@@ -250,26 +381,63 @@ freeSnEntry(snEntry *sn)
   stable_name_free = sn;
 }
 
+// The Capability that the current thread holds, if any.  A thread
+// holding a Capability can't be running at the same time as the GC.
+STATIC_INLINE Capability *
+heldCapability(void)
+{
+    Task *task;
+
+    if (SPT_size == 0) return NULL; // not initialised yet
+    task = myTask();
+    if (task != NULL && task->cap != NULL && task->cap->running_task == task) {
+        return task->cap;
+    }
+    return NULL;
+}
+
 STATIC_INLINE void
-freeSpEntry(spEntry *sp)
+freeSpEntry(Capability *cap, StgWord sp)
 {
-    sp->addr = (P_)stable_ptr_free;
-    stable_ptr_free = sp;
+    spSegment *seg;
+    spEntry *p, *head;
+
+    seg = spSegmentOf(sp);
+    p = &seg->entries[sp & SPT_SEGMENT_MASK];
+
+    if (cap != NULL && seg->owner == cap) {
+        p->addr = (P_)seg->free;
+        seg->free = p;
+    } else {
+        do {
+            head = seg->remote_free;
+            p->addr = (P_)head;
+        } while (cas((StgVolatilePtr)&seg->remote_free,
+                     (StgWord)head, (StgWord)p) != (StgWord)head);
+    }
 }
 
 void
 freeStablePtrUnsafe(StgStablePtr sp)
 {
-    ASSERT((StgWord)sp < SPT_size);
-    freeSpEntry(&stable_ptr_table[(StgWord)sp]);
+    ASSERT(((StgWord)sp >> SPT_SEGMENT_BITS) < n_spt_segments);
+    freeSpEntry(heldCapability(), (StgWord)sp);
 }
 
 void
 freeStablePtr(StgStablePtr sp)
 {
-    stableLock();
-    freeStablePtrUnsafe(sp);
-    stableUnlock();
+    Capability *cap;
+
+    cap = heldCapability();
+    if (cap != NULL) {
+        ASSERT(((StgWord)sp >> SPT_SEGMENT_BITS) < n_spt_segments);
+        freeSpEntry(cap, (StgWord)sp);
+    } else {
+        stableLock();
+        freeStablePtrUnsafe(sp);
+        stableUnlock();
+    }
 }
 
 /* -----------------------------------------------------------------------------
@@ -346,6 +514,10 @@ lookupStableName (StgPtr p)
   stable_name_table[sn].sn_obj = NULL;
   /* debugTrace(DEBUG_stable, "new stable name %d at %p\n",sn,p); */
 
+  /* the StableName object will be in the nursery */
+  stable_name_table[sn].next = sn_gen_lists[0];
+  sn_gen_lists[0] = sn;
+
   /* add the new stable name to the hash table */
   insertHashTable(addrToStableHash, (W_)p, (void *)sn);
 
@@ -357,15 +529,49 @@ lookupStableName (StgPtr p)
 StgStablePtr
 getStablePtr(StgPtr p)
 {
-  StgWord sp;
+    Capability *cap;
+    spSegment *seg;
+    spEntry *sp;
+
+    cap = heldCapability();
+
+    if (cap == NULL) {
+        // Take an entry from a segment that has no owner.  We are the
+        // only ones taking entries from it, so the CAS can't be
+        // fooled by an entry being taken and put back.
+        stableLock();
+        seg = findSpSegment();
+        do {
+            sp = seg->remote_free;
+        } while (cas((StgVolatilePtr)&seg->remote_free,
+                     (StgWord)sp, (StgWord)sp->addr) != (StgWord)sp);
+        sp->addr = p;
+        stableUnlock();
+        return (StgStablePtr)spIndex(seg, sp);
+    }
 
-  stableLock();
-  if (!stable_ptr_free) enlargeStablePtrTable();
-  sp = stable_ptr_free - stable_ptr_table;
-  stable_ptr_free  = (spEntry*)(stable_ptr_free->addr);
-  stable_ptr_table[sp].addr = p;
-  stableUnlock();
-  return (StgStablePtr)(sp);
+    seg = cap->spt_segment;
+    if (seg != NULL && seg->free == NULL) {
+        seg->free = (spEntry *)xchg((StgPtr)&seg->remote_free, 0);
+    }
+
+    if (seg == NULL || seg->free == NULL) {
+        // Our segment is full: swap it for one with some free entries.
+        stableLock();
+        if (seg != NULL) {
+            seg->owner = NULL;
+        }
+        seg = findSpSegment();
+        seg->owner = cap;
+        seg->free = (spEntry *)xchg((StgPtr)&seg->remote_free, 0);
+        cap->spt_segment = seg;
+        stableUnlock();
+    }
+
+    sp = seg->free;
+    seg->free = (spEntry *)sp->addr;
+    sp->addr = p;
+    return (StgStablePtr)spIndex(seg, sp);
 }
 
 /* -----------------------------------------------------------------------------
@@ -374,15 +580,19 @@ getStablePtr(StgPtr p)
 
 #define FOR_EACH_STABLE_PTR(p, CODE)                                    \
     do {                                                                \
-        spEntry *p;                                                     \
-        spEntry *__end_ptr = &stable_ptr_table[SPT_size];               \
-        for (p = stable_ptr_table; p < __end_ptr; p++) {                \
-            /* Internal pointers are free slots. NULL is last in free */ \
-            /* list. */                                                 \
-            if (p->addr &&                                              \
-                (p->addr < (P_)stable_ptr_table || p->addr >= (P_)__end_ptr)) \
-            {                                                           \
-                do { CODE } while(0);                                   \
+        spEntry *p, *__seg_ptr, *__end_ptr;                             \
+        nat __seg;                                                      \
+        for (__seg = 0; __seg < n_spt_segments; __seg++) {              \
+            __seg_ptr = stable_ptr_table[__seg];                        \
+            __end_ptr = &__seg_ptr[SPT_SEGMENT_SIZE];                   \
+            for (p = __seg_ptr; p < __end_ptr; p++) {                   \
+                /* Pointers into the segment are free slots. NULL is */ \
+                /* last in a free list. */                              \
+                if (p->addr &&                                          \
+                    (p->addr < (P_)__seg_ptr || p->addr >= (P_)__end_ptr)) \
+                {                                                       \
+                    do { CODE } while(0);                               \
+                }                                                       \
             }                                                           \
         }                                                               \
     } while(0)
@@ -414,11 +624,18 @@ markStablePtrTable(evac_fn evac, void *user)
     FOR_EACH_STABLE_PTR(p, evac(user, (StgClosure **)&p->addr););
 }
 
+// Only for the entries that this GC will look at, see gcStableTables()
 STATIC_INLINE void
 rememberOldStableNameAddresses(void)
 {
-    /* TODO: Only if !full GC */
-    FOR_EACH_STABLE_NAME(p, p->old = p->addr;);
+    StgWord sn;
+    nat g;
+
+    for (g = 0; g <= N; g++) {
+        for (sn = sn_gen_lists[g]; sn != 0; sn = stable_name_table[sn].next) {
+            stable_name_table[sn].old = stable_name_table[sn].addr;
+        }
+    }
 }
 
 void
@@ -462,6 +679,94 @@ threadStableTables( evac_fn evac, void *user )
     threadStablePtrTable(evac, user);
 }
 
+/* -----------------------------------------------------------------------------
+ * Stable names and the concurrent mark (see sm/ConcMark.c)
+ *
+ * A concurrent mark of the oldest generation treats the stable names
+ * of the younger generations as roots, as a GC of the younger
+ * generations would.  It runs in the GC, after gcStableTables(), so
+ * the ones that GC looked at are on sn_young.  Once the mark is done,
+ * sweepOldStableNames() frees the entries on the oldest generation's
+ * list whose StableName object wasn't marked, and forgets the objects
+ * that weren't.  Nothing in the oldest generation has moved, so the
+ * hash table only loses those entries.
+ * -------------------------------------------------------------------------- */
+
+STATIC_INLINE void
+markStableNameList(StgWord sn, evac_fn evac, void *user)
+{
+    snEntry *p;
+
+    for (; sn != 0; sn = p->next) {
+        p = &stable_name_table[sn];
+        if (p->sn_obj != NULL) {
+            evac(user, (StgClosure **)&p->sn_obj);
+        }
+        if (p->addr != NULL) {
+            evac(user, (StgClosure **)&p->addr);
+        }
+    }
+}
+
+void
+markStableTablesExceptOldest(evac_fn evac, void *user)
+{
+    nat g;
+
+    markStablePtrTable(evac, user);
+
+    markStableNameList(sn_young, evac, user);
+    for (g = 0; g < RtsFlags.GcFlags.generations - 1; g++) {
+        markStableNameList(sn_gen_lists[g], evac, user);
+    }
+}
+
+void
+sweepOldStableNames(rtsBool (*is_live)(StgClosure *p))
+{
+    StgWord sn, next, *last;
+    snEntry *p;
+
+    last = &sn_gen_lists[RtsFlags.GcFlags.generations - 1];
+    for (sn = *last; sn != 0; sn = next) {
+        p = &stable_name_table[sn];
+        next = p->next;
+
+        if (p->sn_obj != NULL && !is_live(p->sn_obj)) {
+            debugTrace(DEBUG_stable, "GC'd StableName %ld (addr=%p)",
+                       (long)sn, p->addr);
+            if (p->addr != NULL) {
+                removeHashTable(addrToStableHash, (W_)p->addr, (void *)sn);
+            }
+            p->sn_obj = NULL;
+            freeSnEntry(p);
+            *last = next;
+            continue;
+        }
+        if (p->addr != NULL && !is_live((StgClosure *)p->addr)) {
+            debugTrace(DEBUG_stable, "GC'd pointee %ld", (long)sn);
+            removeHashTable(addrToStableHash, (W_)p->addr, (void *)sn);
+            p->addr = NULL;
+        }
+        last = &p->next;
+    }
+}
+
+// The youngest generation that a stable name entry points into
+static nat
+snEntryGen(snEntry *p)
+{
+    nat g = RtsFlags.GcFlags.generations - 1;
+
+    if (p->addr != NULL && HEAP_ALLOCED(p->addr)) {
+        g = stg_min(g, Bdescr(p->addr)->gen_no);
+    }
+    if (p->sn_obj != NULL) {
+        g = stg_min(g, Bdescr((P_)p->sn_obj)->gen_no);
+    }
+    return g;
+}
+
 /* -----------------------------------------------------------------------------
  * Garbage collect any dead entries in the stable pointer table.
  *
@@ -474,23 +779,38 @@ threadStableTables( evac_fn evac, void *user )
  * name table entry.  We can re-use stable name table entries for live
  * heap objects, as long as the program has no StableName objects that
  * refer to the entry.
+ *
+ * Entries that point only into generations we aren't collecting can't
+ * have changed, so we only look at the lists of generations 0..N.
  * -------------------------------------------------------------------------- */
 
 void
 gcStableTables( void )
 {
-    FOR_EACH_STABLE_NAME(
-        p, {
+    StgWord sn, next;
+    snEntry *p;
+    nat g;
+
+    sn_young = 0;
+
+    for (g = 0; g <= N; g++) {
+        for (sn = sn_gen_lists[g]; sn != 0; sn = next) {
+            p = &stable_name_table[sn];
+            next = p->next;
+
             // Update the pointer to the StableName object, if there is one
             if (p->sn_obj != NULL) {
                 p->sn_obj = isAlive(p->sn_obj);
                 if(p->sn_obj == NULL) {
                     // StableName object died
                     debugTrace(DEBUG_stable, "GC'd StableName %ld (addr=%p)",
-                               (long)(p - stable_name_table), p->addr);
+                               (long)sn, p->addr);
+                    if (p->old != NULL) {
+                        removeHashTable(addrToStableHash, (W_)p->old,
+                                        (void *)sn);
+                    }
                     freeSnEntry(p);
-                    /* Can't "continue", so use goto */
-                    goto next_stable_name;
+                    continue;
                 }
             }
             /* If sn_obj became NULL, the object died, and addr is now
@@ -501,50 +821,53 @@ gcStableTables( void )
                 p->addr = (StgPtr)isAlive((StgClosure *)p->addr);
                 if(p->addr == NULL) {
                     // StableName pointee died
-                    debugTrace(DEBUG_stable, "GC'd pointee %ld",
-                               (long)(p - stable_name_table));
+                    debugTrace(DEBUG_stable, "GC'd pointee %ld", (long)sn);
                 }
             }
-    next_stable_name:
-            if (0) {}
-        });
+
+            p->next = sn_young;
+            sn_young = sn;
+        }
+        sn_gen_lists[g] = 0;
+    }
 }
 
 /* -----------------------------------------------------------------------------
  * Update the StableName hash table
  *
- * The boolean argument 'full' indicates that a major collection is
- * being done, so we might as well throw away the hash table and build
- * a new one.  For a minor collection, we just re-hash the elements
- * that changed.
+ * We re-hash the entries that gcStableTables() looked at whose objects
+ * moved, and put each entry back on the list for its generation.
+ * Everything else in the hash table is still right, even after a
+ * major collection, so this is the only hashing work a GC does.
  * -------------------------------------------------------------------------- */
 
 void
-updateStableTables(rtsBool full)
+updateStableTables(void)
 {
-    if (full && addrToStableHash != NULL && 0 != keyCountHashTable(addrToStableHash)) {
-        freeHashTable(addrToStableHash,NULL);
-        addrToStableHash = allocHashTable();
+    StgWord sn, next;
+    snEntry *p;
+    nat g;
+
+    // Remove all the old addresses before adding any new ones: an
+    // object may have moved to where another one was (e.g. when
+    // compacting).
+    for (sn = sn_young; sn != 0; sn = stable_name_table[sn].next) {
+        p = &stable_name_table[sn];
+        if (p->addr != p->old && p->old != NULL) {
+            removeHashTable(addrToStableHash, (W_)p->old, (void *)sn);
+        }
     }
 
-    if(full) {
-        FOR_EACH_STABLE_NAME(
-            p, {
-                if (p->addr != NULL) {
-                    // Target still alive, Re-hash this stable name
-                    insertHashTable(addrToStableHash, (W_)p->addr, (void *)(p - stable_name_table));
-                }
-            });
-    } else {
-        FOR_EACH_STABLE_NAME(
-            p, {
-                if (p->addr != p->old) {
-                    removeHashTable(addrToStableHash, (W_)p->old, NULL);
-                    /* Movement happened: */
-                    if (p->addr != NULL) {
-                        insertHashTable(addrToStableHash, (W_)p->addr, (void *)(p - stable_name_table));
-                    }
-                }
-            });
+    for (sn = sn_young; sn != 0; sn = next) {
+        p = &stable_name_table[sn];
+        next = p->next;
+        if (p->addr != p->old && p->addr != NULL) {
+            insertHashTable(addrToStableHash, (W_)p->addr, (void *)sn);
+        }
+        g = snEntryGen(p);
+        p->next = sn_gen_lists[g];
+        sn_gen_lists[g] = sn;
     }
+
+    sn_young = 0;
 }
@@ -38,8 +38,15 @@ StgWord lookupStableName      ( StgPtr p );
 void    markStableTables      ( evac_fn evac, void *user );
 
 void    threadStableTables    ( evac_fn evac, void *user );
+
+/* For the concurrent mark of the oldest generation (sm/ConcMark.c):
+ * the StablePtrs and the stable names outside the oldest generation
+ * are roots, and the stable names in it are swept when the mark is
+ * done. */
+void    markStableTablesExceptOldest ( evac_fn evac, void *user );
+void    sweepOldStableNames   ( rtsBool (*is_live)(StgClosure *p) );
 void    gcStableTables        ( void );
-void    updateStableTables    ( rtsBool full );
+void    updateStableTables    ( void );
 
 void    stableLock            ( void );
 void    stableUnlock          ( void );
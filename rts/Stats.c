@@ -18,6 +18,10 @@
 #include "sm/GC.h" // gc_alloc_block_sync, whitehole_spin
 #include "sm/GCThread.h"
 #include "sm/BlockAlloc.h"
+#include "sm/OSMem.h"
+#include "sm/PauseTarget.h"
+#include "sm/Pinned.h"
+#include "CFinalizers.h"
 
 #if USE_PAPI
 #include "Papi.h"
@@ -367,6 +371,12 @@ stat_endGC (Capability *cap, gc_thread *gct,
     W_ tot_alloc;
     W_ alloc;
 
+    // +RTS --pause-target sizes the heap from the pause times
+    if (RtsFlags.GcFlags.pauseTarget != 0) {
+        pauseEndGC(gen, getProcessElapsedTime() - gct->gc_start_elapsed,
+                   par_n_threads);
+    }
+
     if (RtsFlags.GcFlags.giveStats != NO_GC_STATS ||
         RtsFlags.ProfFlags.doHeapProfile)
         // heap profiling needs GC_tot_time
@@ -690,10 +700,20 @@ stat_exit (void)
 	    showStgWord64(max_slop*sizeof(W_), temp, rtsTrue/*commas*/);
 	    statsPrintf("%16s bytes maximum slop\n", temp);
 
-	    statsPrintf("%16" FMT_SizeT " MB total memory in use (%" FMT_SizeT " MB lost due to fragmentation)\n\n", 
+	    statsPrintf("%16" FMT_SizeT " MB total memory in use (%" FMT_SizeT " MB lost due to fragmentation)\n", 
                         peak_mblocks_allocated * MBLOCK_SIZE_W / (1024 * 1024 / sizeof(W_)),
                         (W_)(peak_mblocks_allocated * BLOCKS_PER_MBLOCK * BLOCK_SIZE_W - hw_alloc_blocks * BLOCK_SIZE_W) / (1024 * 1024 / sizeof(W_)));
 
+            if (RtsFlags.GcFlags.hugePages != HUGE_PAGES_OFF) {
+                W_ huge_bytes = osHugePageBytes();
+                W_ heap_bytes = mblocks_allocated * MBLOCK_SIZE;
+                statsPrintf("%16" FMT_SizeT " MB in huge pages (%.1f%% of the heap)\n",
+                            huge_bytes / (1024 * 1024),
+                            heap_bytes == 0 ? 0.0 :
+                            stg_min(100.0, huge_bytes * 100.0 / heap_bytes));
+            }
+            statsPrintf("\n");
+
 	    /* Print garbage collections in each gen */
             statsPrintf("                                    Tot time (elapsed)  Avg pause  Max pause\n");
             for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
@@ -743,6 +763,14 @@ stat_exit (void)
                             sparks.converted, sparks.overflowed, sparks.dud,
                             sparks.gcd, sparks.fizzled);
             }
+
+            if (RtsFlags.GcFlags.cFinalizerThreads != 0) {
+                W_ finalizers, batches, max_backlog;
+                getCFinalizerStats(&finalizers, &batches, &max_backlog);
+                statsPrintf("  C FINALIZERS: %" FMT_Word " (%" FMT_Word " batches, %" FMT_Word " max backlog, using %d threads)\n\n",
+                            finalizers, batches, max_backlog,
+                            RtsFlags.GcFlags.cFinalizerThreads);
+            }
 #endif
 
 	    statsPrintf("  INIT    time  %6.2fs  (%6.2fs elapsed)\n",
@@ -987,6 +1015,8 @@ extern void getGCStats( GCStats *s )
     s->wall_seconds = TimeToSecondsDbl(current_elapsed - end_init_elapsed);
     s->par_tot_bytes_copied = GC_par_tot_copied*(StgWord64)sizeof(W_);
     s->par_max_bytes_copied = GC_par_max_copied*(StgWord64)sizeof(W_);
+    s->pinned_bytes = pinnedBlockWords()*(StgWord64)sizeof(W_);
+    s->pinned_free_bytes = pinnedFreeWords()*(StgWord64)sizeof(W_);
 }
 // extern void getTaskStats( TaskStats **s ) {}
 #if 0
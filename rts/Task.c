@@ -400,6 +400,10 @@ workerStart(Task *task)
 
     if (RtsFlags.ParFlags.setAffinity) {
         setThreadAffinity(cap->no, n_capabilities);
+    } else if (RtsFlags.GcFlags.numa) {
+        // keep the worker on the CPUs of the node that its
+        // Capability's memory lives on
+        setThreadNode(numa_map[cap->node]);
     }
 
     // set the thread-local pointer to the Task:
@@ -302,6 +302,10 @@ threadPaused(Capability *cap, StgTSO *tso)
 	    }
 
 
+            // the free variables of the thunk are about to be lost;
+            // see sm/ConcMark.c
+            concMarkBarrierFields(cap, bh);
+
             // zero out the slop so that the sanity checker can tell
             // where the next closure is.
             OVERWRITING_CLOSURE(bh);
@@ -620,6 +620,21 @@ void traceTaskDelete_ (Task *task)
     }
 }
 
+void traceCFinalizerBacklog_ (W_ pending)
+{
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        ACQUIRE_LOCK(&trace_utx);
+        tracePreface();
+        debugBelch("%" FMT_Word " C finalizers pending\n", pending);
+        RELEASE_LOCK(&trace_utx);
+    } else
+#endif
+    {
+        postCFinalizerBacklogEvent(pending);
+    }
+}
+
 #ifdef DEBUG
 static void traceCap_stderr(Capability *cap, char *msg, va_list ap)
 {
@@ -277,6 +277,8 @@ void traceTaskMigrate_ (Task       *task,
 
 void traceTaskDelete_ (Task       *task);
 
+void traceCFinalizerBacklog_ (W_ pending);
+
 #else /* !TRACING */
 
 #define traceSchedEvent(cap, tag, tso, other) /* nothing */
@@ -307,6 +309,7 @@ INLINE_HEADER void traceEventStartup_ (int n_caps STG_UNUSED) {};
 #define traceTaskCreate_(taskID, cap) /* nothing */
 #define traceTaskMigrate_(taskID, cap, new_cap) /* nothing */
 #define traceTaskDelete_(taskID) /* nothing */
+#define traceCFinalizerBacklog_(pending) /* nothing */
 
 #endif /* TRACING */
 
@@ -427,6 +430,8 @@ INLINE_HEADER void dtraceStartup (int num_caps) {
     HASKELLEVENT_TASK_MIGRATE(taskID, cap, new_cap)
 #define dtraceTaskDelete(taskID)                        \
     HASKELLEVENT_TASK_DELETE(taskID)
+#define dtraceCFinalizerBacklog(pending)                \
+    HASKELLEVENT_CFINALIZER_BACKLOG(pending)
 
 #else /* !defined(DTRACE) */
 
@@ -480,6 +485,7 @@ INLINE_HEADER void dtraceStartup (int num_caps STG_UNUSED) {};
 #define dtraceTaskCreate(taskID, cap, tid)              /* nothing */
 #define dtraceTaskMigrate(taskID, cap, new_cap)         /* nothing */
 #define dtraceTaskDelete(taskID)                        /* nothing */
+#define dtraceCFinalizerBacklog(pending)                /* nothing */
 
 #endif
 
@@ -877,6 +883,14 @@ INLINE_HEADER void traceTaskDelete(Task *task STG_UNUSED)
     dtraceTaskDelete(serialisableTaskId(task));
 }
 
+INLINE_HEADER void traceCFinalizerBacklog(W_ pending STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_gc)) {
+        traceCFinalizerBacklog_(pending);
+    }
+    dtraceCFinalizerBacklog(pending);
+}
+
 #include "EndPrivate.h"
 
 #endif /* TRACE_H */
@@ -25,6 +25,10 @@
  */
 
 /*
+ * During a concurrent mark of the old generation the fields of the
+ * updatee are about to be lost, so they are remembered first (see
+ * sm/ConcMark.c).
+ *
  * We have two versions of this macro (sadly), one for use in C-- code,
  * and the other for C.
  *
@@ -44,6 +48,9 @@
 #define updateWithIndirection(p1, p2, and_then) \
     W_ bd;							\
 								\
+    if (W_[conc_mark_active] != 0) {                            \
+      ccall concMarkPushFields(MyCapability() "ptr", p1 "ptr"); \
+    }                                                           \
     OVERWRITING_CLOSURE(p1);                                    \
     StgInd_indirectee(p1) = p2;                                 \
     prim_write_barrier;                                         \
@@ -70,6 +77,7 @@ INLINE_HEADER void updateWithIndirection (Capability *cap,
     ASSERT( (P_)p1 != (P_)p2 );
     /* not necessarily true: ASSERT( !closure_IND(p1) ); */
     /* occurs in RaiseAsync.c:raiseAsync() */
+    if (conc_mark_active) concMarkPushFields(cap, p1);
     OVERWRITING_CLOSURE(p1);
     ((StgInd *)p1)->indirectee = p2;
     write_barrier();
@@ -12,14 +12,15 @@
 
 #include "RtsUtils.h"
 #include "Weak.h"
+#include "CFinalizers.h"
 #include "Schedule.h"
 #include "Prelude.h"
 #include "Trace.h"
 
-// ForeignPtrs with C finalizers rely on weak pointers inside weak_ptr_list
-// to always be in the same order.
-
-StgWeak *weak_ptr_list;
+// The Haskell finalizers found by a GC are run by up to one thread per
+// Capability, so that a large number of them can run in parallel, but
+// we don't start another thread for fewer than this many.
+#define MIN_FINALIZER_BATCH 64
 
 void
 runCFinalizer(void *fn, void *ptr, void *env, StgWord flag)
@@ -58,10 +59,59 @@ runAllCFinalizers(StgWeak *list)
     }
 }
 
+/*
+ * Create a thread to run the first n Haskell finalizers on the list,
+ * and return the rest of the list.
+ */
+static StgWeak *
+scheduleFinalizerBatch(Capability *cap, StgWeak *list, nat n)
+{
+    StgWeak *w;
+    StgTSO *t;
+    StgMutArrPtrs *arr;
+    StgWord size;
+    nat i;
+
+    size = n + mutArrPtrsCardTableSize(n);
+    arr = (StgMutArrPtrs *)allocate(cap, sizeofW(StgMutArrPtrs) + size);
+    TICK_ALLOC_PRIM(sizeofW(StgMutArrPtrs), n, 0);
+    SET_HDR(arr, &stg_MUT_ARR_PTRS_FROZEN_info, CCS_SYSTEM);
+    arr->ptrs = n;
+    arr->size = size;
+
+    i = 0;
+    for (w = list; i < n; w = w->link) {
+	if (w->finalizer != &stg_NO_FINALIZER_closure) {
+	    arr->payload[i] = w->finalizer;
+	    i++;
+	}
+    }
+    // set all the cards to 1
+    for (i = n; i < size; i++) {
+        arr->payload[i] = (StgClosure *)(W_)(-1);
+    }
+
+    t = createIOThread(cap, 
+		       RtsFlags.GcFlags.initialStkSize, 
+		       rts_apply(cap,
+			   rts_apply(cap,
+			       (StgClosure *)runFinalizerBatch_closure,
+			       rts_mkInt(cap,n)), 
+			   (StgClosure *)arr)
+	);
+    scheduleThread(cap,t);
+
+    return w;
+}
+
 /*
  * scheduleFinalizers() is called on the list of weak pointers found
  * to be dead after a garbage collection.  It overwrites each object
- * with DEAD_WEAK, and creates a new thread to run the pending finalizers.
+ * with DEAD_WEAK, runs the C finalizers (or queues them for the C
+ * finalizer threads, see CFinalizers.c), and creates new threads to run
+ * the pending Haskell finalizers.
+ * If there are a lot of finalizers, they are divided between several
+ * threads, which the scheduler can push to other Capabilities.
  *
  * This function is called just after GC.  The weak pointers on the
  * argument list are those whose keys were found to be not reachable,
@@ -77,11 +127,9 @@ void
 scheduleFinalizers(Capability *cap, StgWeak *list)
 {
     StgWeak *w;
-    StgTSO *t;
-    StgMutArrPtrs *arr;
-    StgWord size;
-    nat n, i;
+    nat n, batches, batch;
     Task *task;
+    CFinalizerBatch *cfinalizers;
 
     task = myTask();
     if (task != NULL) {
@@ -90,6 +138,7 @@ scheduleFinalizers(Capability *cap, StgWeak *list)
 
     // count number of finalizers, and kill all the weak pointers first...
     n = 0;
+    cfinalizers = NULL;
     for (w = list; w; w = w->link) { 
 	StgArrWords *farr;
 
@@ -104,7 +153,8 @@ scheduleFinalizers(Capability *cap, StgWeak *list)
 	farr = (StgArrWords *)UNTAG_CLOSURE(w->cfinalizer);
 
 	if ((StgClosure *)farr != &stg_NO_FINALIZER_closure)
-	    runCFinalizer((void *)farr->payload[0],
+	    addCFinalizer(&cfinalizers,
+	                  (void *)farr->payload[0],
 	                  (void *)farr->payload[1],
 	                  (void *)farr->payload[2],
 	                  farr->payload[3]);
@@ -120,6 +170,9 @@ scheduleFinalizers(Capability *cap, StgWeak *list)
 #endif
 	SET_HDR(w, &stg_DEAD_WEAK_info, w->header.prof.ccs);
     }
+
+    // run the C finalizers, or hand them over to the finalizer threads
+    queueCFinalizers(cfinalizers);
 	
     if (task != NULL) {
         task->running_finalizers = rtsFalse;
@@ -128,34 +181,21 @@ scheduleFinalizers(Capability *cap, StgWeak *list)
     // No finalizers to run?
     if (n == 0) return;
 
-    debugTrace(DEBUG_weak, "weak: batching %d finalizers", n);
-
-    size = n + mutArrPtrsCardTableSize(n);
-    arr = (StgMutArrPtrs *)allocate(cap, sizeofW(StgMutArrPtrs) + size);
-    TICK_ALLOC_PRIM(sizeofW(StgMutArrPtrs), n, 0);
-    SET_HDR(arr, &stg_MUT_ARR_PTRS_FROZEN_info, CCS_SYSTEM);
-    arr->ptrs = n;
-    arr->size = size;
-
-    n = 0;
-    for (w = list; w; w = w->link) {
-	if (w->finalizer != &stg_NO_FINALIZER_closure) {
-	    arr->payload[n] = w->finalizer;
-	    n++;
-	}
+    batches = n / MIN_FINALIZER_BATCH;
+    if (batches > n_capabilities) {
+        batches = n_capabilities;
     }
-    // set all the cards to 1
-    for (i = n; i < size; i++) {
-        arr->payload[i] = (StgClosure *)(W_)(-1);
+    if (batches == 0) {
+        batches = 1;
     }
 
-    t = createIOThread(cap, 
-		       RtsFlags.GcFlags.initialStkSize, 
-		       rts_apply(cap,
-			   rts_apply(cap,
-			       (StgClosure *)runFinalizerBatch_closure,
-			       rts_mkInt(cap,n)), 
-			   (StgClosure *)arr)
-	);
-    scheduleThread(cap,t);
+    debugTrace(DEBUG_weak, "weak: batching %d finalizers in %d threads",
+               n, batches);
+
+    w = list;
+    for (batch = 0; batch < batches; batch++) {
+        // the first (n % batches) batches get one extra finalizer
+        w = scheduleFinalizerBatch(cap, w, n / batches
+                                           + (batch < n % batches ? 1 : 0));
+    }
 }
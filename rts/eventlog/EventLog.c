@@ -106,6 +106,7 @@ char *EventDesc[] = {
   [EVENT_TASK_CREATE]         = "Task create",
   [EVENT_TASK_MIGRATE]        = "Task migrate",
   [EVENT_TASK_DELETE]         = "Task delete",
+  [EVENT_CFINALIZER_BACKLOG]  = "C finalizers pending",
 };
 
 // Event type. 
@@ -421,6 +422,10 @@ initEventLogging(void)
             eventTypes[t].size = sizeof(EventTaskId);
             break;
 
+        case EVENT_CFINALIZER_BACKLOG: // (pending_finalizers)
+            eventTypes[t].size = sizeof(StgWord64);
+            break;
+
         case EVENT_BLOCK_MARKER:
             eventTypes[t].size = sizeof(StgWord32) + sizeof(EventTimestamp) + 
                 sizeof(EventCapNo);
@@ -998,6 +1003,22 @@ void postTaskDeleteEvent (EventTaskId taskId)
     RELEASE_LOCK(&eventBufMutex);
 }
 
+void postCFinalizerBacklogEvent (W_ pending)
+{
+    ACQUIRE_LOCK(&eventBufMutex);
+
+    if (!hasRoomForEvent(&eventBuf, EVENT_CFINALIZER_BACKLOG)) {
+        // Flush event buffer to make room for new event.
+        printAndClearEventBuf(&eventBuf);
+    }
+
+    postEventHeader(&eventBuf, EVENT_CFINALIZER_BACKLOG);
+    /* EVENT_CFINALIZER_BACKLOG (pending_finalizers) */
+    postWord64(&eventBuf, pending);
+
+    RELEASE_LOCK(&eventBufMutex);
+}
+
 void
 postEvent (Capability *cap, EventTypeNum tag)
 {
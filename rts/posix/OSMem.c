@@ -9,6 +9,11 @@
 // This is non-posix compliant.
 // #include "PosixSource.h"
 
+/* Linux needs _GNU_SOURCE to get dl_iterate_phdr() from <link.h> */
+#if defined(__linux__) || defined(__GLIBC__)
+#define _GNU_SOURCE 1
+#endif
+
 #include "Rts.h"
 
 #include "RtsUtils.h"
@@ -32,6 +37,15 @@
 
 #include <errno.h>
 
+#if defined(linux_HOST_OS)
+#include <sys/syscall.h>
+#endif
+
+#if defined(linux_HOST_OS) || defined(freebsd_HOST_OS)
+#include <link.h>
+#define USE_DL_ITERATE_PHDR
+#endif
+
 #if darwin_HOST_OS
 #include <mach/mach.h>
 #include <mach/vm_map.h>
@@ -39,9 +53,46 @@
 
 static caddr_t next_request = 0;
 
+// The alignment of the memory that we map: MBLOCK_SIZE, or
+// HUGE_PAGE_SIZE when using huge pages (+RTS --huge-pages), so that the
+// kernel can back the whole heap with huge pages.
+static W_ map_alignment = MBLOCK_SIZE;
+
+// Try mmap(MAP_HUGETLB) first?  Cleared if it fails, after which we
+// fall back to transparent huge pages.
+static rtsBool use_hugetlb = rtsFalse;
+
 void osMemInit(void)
 {
     next_request = (caddr_t)RtsFlags.GcFlags.heapBase;
+
+    if (RtsFlags.GcFlags.hugePages != HUGE_PAGES_OFF) {
+        map_alignment = stg_max(MBLOCK_SIZE, HUGE_PAGE_SIZE);
+#if defined(MAP_HUGETLB)
+        use_hugetlb = RtsFlags.GcFlags.hugePages == HUGE_PAGES_EXPLICIT;
+#else
+        if (RtsFlags.GcFlags.hugePages == HUGE_PAGES_EXPLICIT) {
+            errorBelch("warning: explicit huge pages are not supported on this platform");
+        }
+#endif
+    }
+}
+
+// Ask the kernel to back [p, p+size) with transparent huge pages.
+static void
+advise_huge_pages (void *p STG_UNUSED, W_ size STG_UNUSED)
+{
+#if defined(MADV_HUGEPAGE)
+    static rtsBool warned = rtsFalse;
+
+    if (RtsFlags.GcFlags.hugePages != HUGE_PAGES_OFF &&
+        madvise(p, size, MADV_HUGEPAGE) != 0 && !warned) {
+        // e.g. EINVAL if the kernel was built without transparent
+        // huge page support
+        sysErrorBelch("warning: madvise(MADV_HUGEPAGE)");
+        warned = rtsTrue;
+    }
+#endif
 }
 
 /* -----------------------------------------------------------------------------
@@ -112,9 +163,35 @@ my_mmap (void *addr, W_ size)
     } else {
 	vm_protect(mach_task_self(),(vm_address_t)ret,size,FALSE,VM_PROT_READ|VM_PROT_WRITE);
     }
+#else
+    ret = (void *)-1;
+#if defined(MAP_HUGETLB)
+    if (use_hugetlb) {
+        ret = mmap(addr, size, PROT_READ | PROT_WRITE,
+                   MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+        if (ret == (void *)-1) {
+            // Most likely there are not enough huge pages reserved
+            // (see /proc/sys/vm/nr_hugepages).
+            errorBelch("warning: could not map huge pages (%s); "
+                       "using transparent huge pages instead",
+                       strerror(errno));
+            use_hugetlb = rtsFalse;
+        }
+    }
+    if (ret == (void *)-1) {
+        ret = mmap(addr, size, PROT_READ | PROT_WRITE,
+                   MAP_ANON | MAP_PRIVATE, -1, 0);
+        if (ret != (void *)-1) {
+            advise_huge_pages(ret, size);
+        }
+    }
 #else
     ret = mmap(addr, size, PROT_READ | PROT_WRITE, 
                MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (ret != (void *)-1) {
+        advise_huge_pages(ret, size);
+    }
+#endif
 #endif
 
     if (ret == (void *)-1) {
@@ -133,23 +210,23 @@ my_mmap (void *addr, W_ size)
 }
 
 // Implements the general case: allocate a chunk of memory of 'size'
-// mblocks.
+// bytes, aligned to map_alignment.
 
 static void *
 gen_map_mblocks (W_ size)
 {
-    int slop;
+    W_ slop;
     StgWord8 *ret;
 
     // Try to map a larger block, and take the aligned portion from
     // it (unmap the rest).
-    size += MBLOCK_SIZE;
+    size += map_alignment;
     ret = my_mmap(0, size);
     
     // unmap the slop bits around the chunk we allocated
-    slop = (W_)ret & MBLOCK_MASK;
+    slop = (W_)ret & (map_alignment - 1);
     
-    if (munmap((void*)ret, MBLOCK_SIZE - slop) == -1) {
+    if (munmap((void*)ret, map_alignment - slop) == -1) {
       barf("gen_map_mblocks: munmap failed");
     }
     if (slop > 0 && munmap((void*)(ret+size-slop), slop) == -1) {
@@ -169,7 +246,7 @@ gen_map_mblocks (W_ size)
     // 
 
     // next time, try after the block we just got.
-    ret += MBLOCK_SIZE - slop;
+    ret += map_alignment - slop;
     return ret;
 }
 
@@ -185,7 +262,7 @@ osGetMBlocks(nat n)
   } else {
       ret = my_mmap(next_request, size);
 
-      if (((W_)ret & MBLOCK_MASK) != 0) {
+      if (((W_)ret & (map_alignment - 1)) != 0) {
 	  // misaligned block!
 #if 0 // defined(DEBUG)
 	  errorBelch("warning: getMBlock: misaligned block %p returned when allocating %d megablock(s) at %p", ret, n, next_request);
@@ -219,10 +296,14 @@ void osFreeAllMBlocks(void)
 {
     void *mblock;
 
+    // With huge pages, memory is mapped and unmapped in whole huge
+    // pages, so we only need to unmap at each aligned mblock.
     for (mblock = getFirstMBlock();
          mblock != NULL;
          mblock = getNextMBlock(mblock)) {
-        munmap(mblock, MBLOCK_SIZE);
+        if (((W_)mblock & (map_alignment - 1)) == 0) {
+            munmap(mblock, map_alignment);
+        }
     }
 }
 
@@ -255,3 +336,338 @@ void setExecutable (void *p, W_ len, rtsBool exec)
 	barf("setExecutable: failed to protect 0x%p\n", p);
     }
 }
+
+/* -----------------------------------------------------------------------------
+   NUMA support
+
+   On Linux we talk to the kernel directly using the get_mempolicy()
+   and mbind() system calls, rather than depending on libnuma.  All we
+   need is the set of nodes that we are allowed to allocate memory on,
+   and a way to say that a range of fresh memory should preferably be
+   placed on a particular node.
+   -------------------------------------------------------------------------- */
+
+#if defined(linux_HOST_OS) && defined(SYS_get_mempolicy) && defined(SYS_mbind)
+#define USE_NUMA_SYSCALLS 1
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_F_MEMS_ALLOWED
+#define MPOL_F_MEMS_ALLOWED (1 << 2)
+#endif
+
+// The kernel insists that the node mask we pass to get_mempolicy() is
+// large enough for every possible node, so use a generous size.
+#define NUMA_SYSCALL_MAX_NODES 1024
+#endif
+
+rtsBool osNumaAvailable(void)
+{
+#if USE_NUMA_SYSCALLS
+    return (syscall(SYS_get_mempolicy, NULL, NULL, 0, NULL, 0) == 0);
+#else
+    return rtsFalse;
+#endif
+}
+
+StgWord osNumaMask(void)
+{
+#if USE_NUMA_SYSCALLS
+    unsigned long mask[NUMA_SYSCALL_MAX_NODES / (8 * sizeof(unsigned long))];
+    int mode;
+
+    memset(mask, 0, sizeof(mask));
+    if (syscall(SYS_get_mempolicy, &mode, mask, NUMA_SYSCALL_MAX_NODES,
+                NULL, MPOL_F_MEMS_ALLOWED) != 0) {
+        return 1;
+    }
+    // we only support nodes 0..MAX_NUMA_NODES-1
+    return (StgWord)mask[0] & (((StgWord)1 << MAX_NUMA_NODES) - 1);
+#else
+    return 1;
+#endif
+}
+
+nat osNumaNodes(void)
+{
+    StgWord mask = osNumaMask();
+    nat n = 0;
+
+    while (mask != 0) {
+        n++;
+        mask = mask >> 1;
+    }
+    return n;
+}
+
+void osBindMBlocksToNode(void *addr STG_UNUSED,
+                         W_ size STG_UNUSED,
+                         nat node STG_UNUSED)
+{
+#if USE_NUMA_SYSCALLS
+    unsigned long mask = 1UL << node;
+
+    // MPOL_PREFERRED rather than MPOL_BIND: if the node runs out of
+    // memory we would rather get remote memory than fail.  The +1 on
+    // maxnode is because the kernel ignores the last bit of the mask.
+    if (syscall(SYS_mbind, addr, (unsigned long)size, MPOL_PREFERRED,
+                &mask, 8 * sizeof(mask) + 1, 0) != 0) {
+        sysErrorBelch("osBindMBlocksToNode: mbind");
+        stg_exit(EXIT_FAILURE);
+    }
+#endif
+}
+
+void osDiscardMemory(void *at, W_ size)
+{
+#if defined(MADV_DONTNEED)
+    // We use MADV_DONTNEED rather than MADV_FREE, so that the pages
+    // are dropped (and RSS goes down) straight away rather than
+    // when the kernel gets round to it.
+    if (madvise(at, size, MADV_DONTNEED) != 0) {
+        sysErrorBelch("osDiscardMemory: madvise");
+    }
+#endif
+}
+
+rtsBool osMapFile(void *at, W_ size, int fd, StgWord64 offset)
+{
+    void *ret;
+
+    ret = mmap(at, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+               fd, (off_t)offset);
+    if (ret == MAP_FAILED) {
+        // a failed MAP_FIXED may have unmapped the old memory already
+        osUnmapFile(at, size);
+        return rtsFalse;
+    }
+    return rtsTrue;
+}
+
+void osUnmapFile(void *at, W_ size)
+{
+    void *ret;
+
+    ret = mmap(at, size, PROT_READ | PROT_WRITE,
+               MAP_ANON | MAP_PRIVATE | MAP_FIXED, -1, 0);
+    if (ret == MAP_FAILED) {
+        barf("osUnmapFile: mmap: %s", strerror(errno));
+    }
+}
+
+#if defined(USE_DL_ITERATE_PHDR)
+
+// FNV-1a
+static StgWord64
+hash_bytes (StgWord64 h, const void *p, W_ n)
+{
+    const StgWord8 *b = p;
+    W_ i;
+
+    for (i = 0; i < n; i++) {
+        h = (h ^ b[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static StgWord64
+hash_word (StgWord64 h, W_ w)
+{
+    return hash_bytes(h, &w, sizeof(w));
+}
+
+// The GNU build ID in a PT_NOTE segment, if there is one
+static StgWord64
+hash_build_id (StgWord64 h, const StgWord8 *p, const StgWord8 *end)
+{
+#if defined(NT_GNU_BUILD_ID)
+    const ElfW(Nhdr) *note;
+    W_ name, desc;
+
+    while (p + sizeof(ElfW(Nhdr)) <= end) {
+        note = (const ElfW(Nhdr) *)p;
+        name = (note->n_namesz + 3) & ~3;
+        desc = (note->n_descsz + 3) & ~3;
+        p += sizeof(ElfW(Nhdr));
+        if (p + name + desc > end) break;
+        if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4
+            && memcmp(p, "GNU", 4) == 0) {
+            return hash_bytes(h, p + name, note->n_descsz);
+        }
+        p += name + desc;
+    }
+#endif
+    return h;
+}
+
+static int
+image_segments (struct dl_phdr_info *info, size_t size STG_UNUSED, void *data)
+{
+    ProgramImage *img = data;
+    const ElfW(Phdr) *ph;
+    StgWord64 h;
+    W_ start;
+    nat i;
+
+    h = 14695981039346656037ULL;
+    img->n_segments = 0;
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        ph = &info->dlpi_phdr[i];
+        start = info->dlpi_addr + ph->p_vaddr;
+        if (ph->p_type == PT_LOAD && img->n_segments < MAX_IMAGE_SEGMENTS) {
+            img->segments[img->n_segments].start = start;
+            img->segments[img->n_segments].end   = start + ph->p_memsz;
+            img->n_segments++;
+            h = hash_word(h, ph->p_vaddr);
+            h = hash_word(h, ph->p_memsz);
+            h = hash_word(h, ph->p_filesz);
+            h = hash_word(h, ph->p_flags);
+        } else if (ph->p_type == PT_NOTE) {
+            h = hash_build_id(h, (const StgWord8 *)start,
+                              (const StgWord8 *)start + ph->p_memsz);
+        }
+    }
+    img->fingerprint = h;
+    return 1;   // the first object is the program itself
+}
+
+rtsBool osProgramImage(ProgramImage *img)
+{
+    img->n_segments = 0;
+    dl_iterate_phdr(image_segments, img);
+    return img->n_segments > 0;
+}
+
+#else
+
+rtsBool osProgramImage(ProgramImage *img STG_UNUSED)
+{
+    return rtsFalse;
+}
+
+#endif
+
+W_ osHugePageBytes(void)
+{
+#if defined(linux_HOST_OS)
+    FILE *f;
+    char line[128];
+    unsigned long kb;
+    W_ total = 0;
+
+    // Sum the huge page usage of all our mappings.  AnonHugePages
+    // counts transparent huge pages, *_Hugetlb counts hugetlbfs pages
+    // (only reported by newer kernels).
+    f = fopen("/proc/self/smaps", "r");
+    if (f == NULL) return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 ||
+            sscanf(line, "Shared_Hugetlb: %lu kB", &kb) == 1 ||
+            sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1) {
+            total += (W_)kb * 1024;
+        }
+    }
+    fclose(f);
+    return total;
+#else
+    return 0;
+#endif
+}
+
+#ifdef USE_LARGE_ADDRESS_SPACE
+
+/* -----------------------------------------------------------------------------
+   Reserving address space for the heap
+
+   With USE_LARGE_ADDRESS_SPACE the whole heap lives in one range of
+   address space, reserved when the RTS starts up (see initMBlocks()).
+   The reservation is mapped PROT_NONE with MAP_NORESERVE, so it costs
+   neither memory nor swap until parts of it are committed.  Committing
+   replaces part of the reservation with an ordinary read/write mapping
+   (which counts against the overcommit limit as usual), and
+   decommitting puts the PROT_NONE mapping back, releasing the pages.
+   -------------------------------------------------------------------------- */
+
+static void *heap_reservation = NULL;
+static W_ heap_reservation_size = 0;
+
+void *osReserveHeapMemory(W_ *len)
+{
+    W_ size;
+    StgWord8 *at, *base;
+
+    size = *len & ~(map_alignment - 1);
+
+    // We map an extra map_alignment bytes so that we can align the
+    // start of the range.  If the OS won't give us that much address
+    // space (e.g. because of ulimit -v) we halve the request until it
+    // does.
+    while (1) {
+        if (size < map_alignment) {
+            errorBelch("out of memory (could not reserve address space for the heap)");
+            stg_exit(EXIT_FAILURE);
+        }
+        at = mmap((void *)RtsFlags.GcFlags.heapBase, size + map_alignment,
+                  PROT_NONE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+        if (at != MAP_FAILED) break;
+        if (errno != ENOMEM) {
+            barf("osReserveHeapMemory: mmap: %s", strerror(errno));
+        }
+        size = (size / 2) & ~(map_alignment - 1);
+    }
+
+    // unmap the slop on either side of the aligned range
+    base = (StgWord8 *)(((W_)at + map_alignment - 1) & ~(map_alignment - 1));
+    if (base > at && munmap(at, base - at) == -1) {
+        barf("osReserveHeapMemory: munmap failed");
+    }
+    if (munmap(base + size, at + map_alignment - base) == -1) {
+        barf("osReserveHeapMemory: munmap failed");
+    }
+
+    heap_reservation = base;
+    heap_reservation_size = size;
+    *len = size;
+    return base;
+}
+
+void osCommitMemory(void *at, W_ size)
+{
+    void *ret;
+
+    ret = mmap(at, size, PROT_READ | PROT_WRITE,
+               MAP_ANON | MAP_PRIVATE | MAP_FIXED, -1, 0);
+    if (ret == MAP_FAILED) {
+        if (errno == ENOMEM) {
+            errorBelch("out of memory (requested %" FMT_Word " bytes)", size);
+            stg_exit(EXIT_FAILURE);
+        } else {
+            barf("osCommitMemory: mmap: %s", strerror(errno));
+        }
+    }
+    // (explicit huge pages are not used with a large address space)
+    advise_huge_pages(at, size);
+}
+
+void osDecommitMemory(void *at, W_ size)
+{
+    void *ret;
+
+    ret = mmap(at, size, PROT_NONE,
+               MAP_ANON | MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, -1, 0);
+    if (ret == MAP_FAILED) {
+        sysErrorBelch("osDecommitMemory: mmap");
+    }
+}
+
+void osReleaseHeapMemory(void)
+{
+    if (heap_reservation != NULL) {
+        munmap(heap_reservation, heap_reservation_size);
+        heap_reservation = NULL;
+        heap_reservation_size = 0;
+    }
+}
+
+#endif /* USE_LARGE_ADDRESS_SPACE */
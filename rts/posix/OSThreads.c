@@ -308,6 +308,52 @@ setThreadAffinity (nat n GNUC3_ATTRIBUTE(__unused__),
 }
 #endif
 
+#if defined(linux_HOST_OS) && defined(HAVE_SCHED_H) && defined(HAVE_SCHED_SETAFFINITY)
+// Schedules the thread to run only on the CPUs of the given (OS) NUMA
+// node.  The kernel tells us which CPUs belong to the node in sysfs,
+// as a list of ranges like "0-7,16-23".
+void
+setThreadNode (nat node)
+{
+    char path[64];
+    FILE *f;
+    cpu_set_t cs;
+    int lo, hi, i, c;
+
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/node/node%u/cpulist", node);
+    f = fopen(path, "r");
+    if (f == NULL) {
+        // not fatal: we just won't restrict the thread
+        return;
+    }
+
+    CPU_ZERO(&cs);
+    while (fscanf(f, "%d", &lo) == 1) {
+        hi = lo;
+        c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%d", &hi) != 1) break;
+            c = fgetc(f);
+        }
+        for (i = lo; i <= hi && i < CPU_SETSIZE; i++) {
+            CPU_SET(i, &cs);
+        }
+        if (c != ',') break;
+    }
+    fclose(f);
+
+    if (CPU_COUNT(&cs) > 0) {
+        sched_setaffinity(0, sizeof(cpu_set_t), &cs);
+    }
+}
+#else
+void
+setThreadNode (nat node STG_UNUSED)
+{
+}
+#endif
+
 void
 interruptOSThread (OSThreadId id)
 {
@@ -22,10 +22,13 @@
 #include "RtsUtils.h"
 #include "BlockAlloc.h"
 #include "OSMem.h"
+#include "Capability.h"
+#include "Trace.h"
 
 #include <string.h>
 
-static void  initMBlock(void *mblock);
+static void  initMBlock(void *mblock, nat node);
+static void  free_mega_group(bdescr *mg);
 
 /* -----------------------------------------------------------------------------
 
@@ -117,6 +120,24 @@ static void  initMBlock(void *mblock);
 
   checkFreeListSanity() checks all the invariants on the free lists.
 
+  NUMA
+  ~~~~
+
+  When the RTS is running on a NUMA machine (+RTS --numa), we keep a
+  separate set of free lists for each NUMA node.  Every megablock
+  belongs to a single node for its lifetime: it is bound to the node
+  with osBindMBlocksToNode() when we get it from the OS, and the node
+  number is recorded in the node field of every bdescr in the
+  megablock by initMBlock().  freeGroup() can therefore find the right
+  free list by looking at p->node, and coalescing never crosses a node
+  boundary because free_mblock_list is per-node too.
+
+  The allocGroupOnNode() family allocates on a specific node;
+  allocGroup() picks the node with the fewest blocks allocated, so
+  that allocation that is not associated with a particular Capability
+  is spread evenly across the nodes.  Without --numa there is just one
+  node (n_numa_nodes == 1) and everything works as before.
+
   --------------------------------------------------------------------------- */
 
 /* ---------------------------------------------------------------------------
@@ -133,11 +154,11 @@ static void  initMBlock(void *mblock);
 
 // In THREADED_RTS mode, the free list is protected by sm_mutex.
 
-static bdescr *free_list[MAX_FREE_LIST];
-static bdescr *free_mblock_list;
+static bdescr *free_list[MAX_NUMA_NODES][MAX_FREE_LIST];
+static bdescr *free_mblock_list[MAX_NUMA_NODES];
 
-// free_list[i] contains blocks that are at least size 2^i, and at
-// most size 2^(i+1) - 1.  
+// free_list[node][i] contains blocks that are at least size 2^i, and
+// at most size 2^(i+1) - 1.
 // 
 // To find the free list in which to place a block, use log_2(size).
 // To find a free block of the right size, use log_2_ceil(size).
@@ -145,19 +166,38 @@ static bdescr *free_mblock_list;
 W_ n_alloc_blocks;   // currently allocated blocks
 W_ hw_alloc_blocks;  // high-water allocated blocks
 
+W_ n_alloc_blocks_by_node[MAX_NUMA_NODES];
+
+// For decommitFreeBlocks(): the number of blocks in free groups that
+// are not BF_DECOMMITTED, and where it got to in the free lists (see
+// "Decommitting free memory" below).
+static W_      n_committed_free;
+static nat     decommit_node;
+static nat     decommit_list;   // MAX_FREE_LIST for free_mblock_list
+static bdescr *decommit_cursor;
+static volatile StgWord discard_in_flight;
+
 /* -----------------------------------------------------------------------------
    Initialisation
    -------------------------------------------------------------------------- */
 
 void initBlockAllocator(void)
 {
-    nat i;
-    for (i=0; i < MAX_FREE_LIST; i++) {
-        free_list[i] = NULL;
+    nat i, node;
+    for (node = 0; node < MAX_NUMA_NODES; node++) {
+        for (i=0; i < MAX_FREE_LIST; i++) {
+            free_list[node][i] = NULL;
+        }
+        free_mblock_list[node] = NULL;
+        n_alloc_blocks_by_node[node] = 0;
     }
-    free_mblock_list = NULL;
     n_alloc_blocks = 0;
     hw_alloc_blocks = 0;
+    n_committed_free = 0;
+    decommit_node = 0;
+    decommit_list = 0;
+    decommit_cursor = NULL;
+    discard_in_flight = 0;
 }
 
 /* -----------------------------------------------------------------------------
@@ -173,6 +213,7 @@ initGroup(bdescr *head)
   n = head->blocks;
   head->free   = head->start;
   head->link   = NULL;
+  head->flags  = 0;
   for (i=1, bd = head+1; i < n; i++, bd++) {
       bd->free = 0;
       bd->blocks = 0;
@@ -208,14 +249,70 @@ log_2(W_ n)
 }
 
 STATIC_INLINE void
-free_list_insert (bdescr *bd)
+recordAllocatedBlocks(nat node, W_ n)
+{
+    n_alloc_blocks += n;
+    n_alloc_blocks_by_node[node] += n;
+    if (n_alloc_blocks > hw_alloc_blocks) hw_alloc_blocks = n_alloc_blocks;
+}
+
+STATIC_INLINE void
+recordFreedBlocks(nat node, W_ n)
+{
+    ASSERT(n_alloc_blocks >= n);
+    n_alloc_blocks -= n;
+    n_alloc_blocks_by_node[node] -= n;
+}
+
+// Wait for decommitFreeBlocks() to finish discarding memory.
+STATIC_INLINE void
+wait_for_discard (void)
+{
+#if defined(THREADED_RTS)
+    while (discard_in_flight) {
+        yieldThread();
+    }
+#endif
+}
+
+// Every free group goes through free_group_linked() when it is put on
+// a free list, and through free_group_unlinked() before it is taken
+// off one or changes size, which keeps n_committed_free and
+// decommit_cursor up to date.  A decommitted group may be being
+// discarded right now, so we wait for that to finish before doing
+// anything with it.
+STATIC_INLINE void
+free_group_linked (bdescr *bd)
+{
+    if (!(bd->flags & BF_DECOMMITTED)) {
+        n_committed_free += bd->blocks;
+    }
+}
+
+STATIC_INLINE void
+free_group_unlinked (bdescr *bd)
+{
+    if (bd->flags & BF_DECOMMITTED) {
+        wait_for_discard();
+    } else {
+        ASSERT(n_committed_free >= bd->blocks);
+        n_committed_free -= bd->blocks;
+    }
+    if (bd == decommit_cursor) {
+        decommit_cursor = bd->link;
+    }
+}
+
+STATIC_INLINE void
+free_list_insert (nat node, bdescr *bd)
 {
     nat ln;
 
     ASSERT(bd->blocks < BLOCKS_PER_MBLOCK);
     ln = log_2(bd->blocks);
     
-    dbl_link_onto(bd, &free_list[ln]);
+    dbl_link_onto(bd, &free_list[node][ln]);
+    free_group_linked(bd);
 }
 
 
@@ -244,23 +341,25 @@ setup_tail (bdescr *bd)
 // Take a free block group bd, and split off a group of size n from
 // it.  Adjust the free list as necessary, and return the new group.
 static bdescr *
-split_free_block (bdescr *bd, W_ n, nat ln)
+split_free_block (bdescr *bd, nat node, W_ n, nat ln)
 {
     bdescr *fg; // free group
 
     ASSERT(bd->blocks > n);
-    dbl_link_remove(bd, &free_list[ln]);
+    free_group_unlinked(bd);
+    dbl_link_remove(bd, &free_list[node][ln]);
     fg = bd + bd->blocks - n; // take n blocks off the end
     fg->blocks = n;
     bd->blocks -= n;
     setup_tail(bd);
     ln = log_2(bd->blocks);
-    dbl_link_onto(bd, &free_list[ln]);
+    dbl_link_onto(bd, &free_list[node][ln]);
+    free_group_linked(bd);
     return fg;
 }
 
 static bdescr *
-alloc_mega_group (nat mblocks)
+alloc_mega_group (nat node, nat mblocks)
 {
     bdescr *best, *bd, *prev;
     nat n;
@@ -269,14 +368,15 @@ alloc_mega_group (nat mblocks)
 
     best = NULL;
     prev = NULL;
-    for (bd = free_mblock_list; bd != NULL; prev = bd, bd = bd->link)
+    for (bd = free_mblock_list[node]; bd != NULL; prev = bd, bd = bd->link)
     {
         if (bd->blocks == n) 
         {
+            free_group_unlinked(bd);
             if (prev) {
                 prev->link = bd->link;
             } else {
-                free_mblock_list = bd->link;
+                free_mblock_list[node] = bd->link;
             }
             initGroup(bd);
             return bd;
@@ -297,13 +397,41 @@ alloc_mega_group (nat mblocks)
         bd = FIRST_BDESCR((StgWord8*)MBLOCK_ROUND_DOWN(best) + 
                           (best_mblocks-mblocks)*MBLOCK_SIZE);
 
+        free_group_unlinked(best);
         best->blocks = MBLOCK_GROUP_BLOCKS(best_mblocks - mblocks);
-        initMBlock(MBLOCK_ROUND_DOWN(bd));
+        free_group_linked(best);
+        initMBlock(MBLOCK_ROUND_DOWN(bd), node);
     }
     else
     {
-        void *mblock = getMBlocks(mblocks);
-        initMBlock(mblock);		// only need to init the 1st one
+        void *mblock;
+        nat n_get;
+
+        // With huge pages, we only get whole huge pages from the OS;
+        // any megablocks left over go on the free list.
+        n_get = mblocks;
+        if (RtsFlags.GcFlags.hugePages != HUGE_PAGES_OFF) {
+            n_get = ((mblocks + MBLOCKS_PER_HUGE_PAGE - 1)
+                     / MBLOCKS_PER_HUGE_PAGE) * MBLOCKS_PER_HUGE_PAGE;
+        }
+        if (RtsFlags.GcFlags.numa) {
+            mblock = getMBlocksOnNode(numa_map[node], n_get);
+        } else {
+            mblock = getMBlocks(n_get);
+        }
+        if (n_get > mblocks) {
+            bdescr *spare;
+            void *spare_mblock = (StgWord8*)mblock + mblocks * MBLOCK_SIZE;
+            initMBlock(spare_mblock, node);
+            spare = FIRST_BDESCR(spare_mblock);
+            spare->blocks = MBLOCK_GROUP_BLOCKS(n_get - mblocks);
+            spare->free   = (P_)-1;
+            spare->gen    = NULL;
+            spare->gen_no = 0;
+            spare->flags  = 0;
+            free_mega_group(spare);
+        }
+        initMBlock(mblock, node);	// only need to init the 1st one
         bd = FIRST_BDESCR(mblock);
     }
     bd->blocks = MBLOCK_GROUP_BLOCKS(mblocks);
@@ -311,12 +439,13 @@ alloc_mega_group (nat mblocks)
 }
 
 bdescr *
-allocGroup (W_ n)
+allocGroupOnNode (nat node, W_ n)
 {
     bdescr *bd, *rem;
     nat ln;
 
     if (n == 0) barf("allocGroup: requested zero blocks");
+    ASSERT(node < n_numa_nodes);
     
     if (n >= BLOCKS_PER_MBLOCK)
     {
@@ -326,21 +455,19 @@ allocGroup (W_ n)
 
         // n_alloc_blocks doesn't count the extra blocks we get in a
         // megablock group.
-        n_alloc_blocks += mblocks * BLOCKS_PER_MBLOCK;
-        if (n_alloc_blocks > hw_alloc_blocks) hw_alloc_blocks = n_alloc_blocks;
+        recordAllocatedBlocks(node, mblocks * BLOCKS_PER_MBLOCK);
 
-        bd = alloc_mega_group(mblocks);
+        bd = alloc_mega_group(node, mblocks);
         // only the bdescrs of the first MB are required to be initialised
         initGroup(bd);
         goto finish;
     }
     
-    n_alloc_blocks += n;
-    if (n_alloc_blocks > hw_alloc_blocks) hw_alloc_blocks = n_alloc_blocks;
+    recordAllocatedBlocks(node, n);
 
     ln = log_2_ceil(n);
 
-    while (ln < MAX_FREE_LIST && free_list[ln] == NULL) {
+    while (ln < MAX_FREE_LIST && free_list[node][ln] == NULL) {
         ln++;
     }
 
@@ -354,27 +481,28 @@ allocGroup (W_ n)
         }
 #endif
 
-        bd = alloc_mega_group(1);
+        bd = alloc_mega_group(node, 1);
         bd->blocks = n;
         initGroup(bd);		         // we know the group will fit
         rem = bd + n;
         rem->blocks = BLOCKS_PER_MBLOCK-n;
         initGroup(rem); // init the slop
-        n_alloc_blocks += rem->blocks;
+        recordAllocatedBlocks(node, rem->blocks);
         freeGroup(rem);      	         // add the slop on to the free list
         goto finish;
     }
 
-    bd = free_list[ln];
+    bd = free_list[node][ln];
 
     if (bd->blocks == n)	        // exactly the right size!
     {
-        dbl_link_remove(bd, &free_list[ln]);
+        free_group_unlinked(bd);
+        dbl_link_remove(bd, &free_list[node][ln]);
         initGroup(bd);
     }
     else if (bd->blocks >  n)            // block too big...
     {                              
-        bd = split_free_block(bd, n, ln);
+        bd = split_free_block(bd, node, n, ln);
         ASSERT(bd->blocks == n);
         initGroup(bd);
     }
@@ -389,6 +517,29 @@ finish:
     return bd;
 }
 
+// Allocate memory on the node with the fewest blocks allocated, so
+// that memory that isn't tied to a particular Capability is spread
+// evenly across the NUMA nodes.
+STATIC_INLINE nat
+nodeWithLeastBlocks (void)
+{
+    nat node = 0, i;
+    W_ min_blocks = n_alloc_blocks_by_node[0];
+    for (i = 1; i < n_numa_nodes; i++) {
+        if (n_alloc_blocks_by_node[i] < min_blocks) {
+            min_blocks = n_alloc_blocks_by_node[i];
+            node = i;
+        }
+    }
+    return node;
+}
+
+bdescr *
+allocGroup (W_ n)
+{
+    return allocGroupOnNode(nodeWithLeastBlocks(), n);
+}
+
 //
 // Allocate a chunk of blocks that is at least min and at most max
 // blocks in size. This API is used by the nursery allocator that
@@ -406,46 +557,52 @@ finish:
 // preferably if there are any.
 //
 bdescr *
-allocLargeChunk (W_ min, W_ max)
+allocLargeChunkOnNode (nat node, W_ min, W_ max)
 {
     bdescr *bd;
     nat ln, lnmax;
 
     if (min >= BLOCKS_PER_MBLOCK) {
-        return allocGroup(max);
+        return allocGroupOnNode(node,max);
     }
 
     ln = log_2_ceil(min);
     lnmax = log_2_ceil(max); // tops out at MAX_FREE_LIST
 
-    while (ln < lnmax && free_list[ln] == NULL) {
+    while (ln < lnmax && free_list[node][ln] == NULL) {
         ln++;
     }
     if (ln == lnmax) {
-        return allocGroup(max);
+        return allocGroupOnNode(node,max);
     }
-    bd = free_list[ln];
+    bd = free_list[node][ln];
 
     if (bd->blocks <= max)              // exactly the right size!
     {
-        dbl_link_remove(bd, &free_list[ln]);
+        free_group_unlinked(bd);
+        dbl_link_remove(bd, &free_list[node][ln]);
         initGroup(bd);
     }
     else   // block too big...
     {                              
-        bd = split_free_block(bd, max, ln);
+        bd = split_free_block(bd, node, max, ln);
         ASSERT(bd->blocks == max);
         initGroup(bd);
     }
 
-    n_alloc_blocks += bd->blocks;
-    if (n_alloc_blocks > hw_alloc_blocks) hw_alloc_blocks = n_alloc_blocks;
+    recordAllocatedBlocks(node, bd->blocks);
 
     IF_DEBUG(sanity, memset(bd->start, 0xaa, bd->blocks * BLOCK_SIZE));
     IF_DEBUG(sanity, checkFreeListSanity());
     return bd;
 }
 
+bdescr *
+allocLargeChunk (W_ min, W_ max)
+{
+    return allocLargeChunkOnNode(nodeWithLeastBlocks(), min, max);
+}
+
 bdescr *
 allocGroup_lock(W_ n)
 {
@@ -472,6 +629,32 @@ allocBlock_lock(void)
     return bd;
 }
 
+bdescr *
+allocBlockOnNode(nat node)
+{
+    return allocGroupOnNode(node,1);
+}
+
+bdescr *
+allocGroupOnNode_lock(nat node, W_ n)
+{
+    bdescr *bd;
+    ACQUIRE_SM_LOCK;
+    bd = allocGroupOnNode(node,n);
+    RELEASE_SM_LOCK;
+    return bd;
+}
+
+bdescr *
+allocBlockOnNode_lock(nat node)
+{
+    bdescr *bd;
+    ACQUIRE_SM_LOCK;
+    bd = allocBlockOnNode(node);
+    RELEASE_SM_LOCK;
+    return bd;
+}
+
 /* -----------------------------------------------------------------------------
    De-Allocation
    -------------------------------------------------------------------------- */
@@ -487,9 +670,13 @@ coalesce_mblocks (bdescr *p)
         (StgWord8*)MBLOCK_ROUND_DOWN(p) + 
         BLOCKS_TO_MBLOCKS(p->blocks) * MBLOCK_SIZE) {
         // can coalesce
+        free_group_unlinked(p);
+        free_group_unlinked(q);
         p->blocks  = MBLOCK_GROUP_BLOCKS(BLOCKS_TO_MBLOCKS(p->blocks) +
                                          BLOCKS_TO_MBLOCKS(q->blocks));
         p->link = q->link;
+        p->flags = 0; // no longer entirely decommitted
+        free_group_linked(p);
         return p;
     }
     return q;
@@ -499,11 +686,13 @@ static void
 free_mega_group (bdescr *mg)
 {
     bdescr *bd, *prev;
+    nat node;
 
     // Find the right place in the free list.  free_mblock_list is
     // sorted by *address*, not by size as the free_list is.
+    node = mg->node;
     prev = NULL;
-    bd = free_mblock_list;
+    bd = free_mblock_list[node];
     while (bd && bd->start < mg->start) {
         prev = bd;
         bd = bd->link;
@@ -514,12 +703,14 @@ free_mega_group (bdescr *mg)
     {
         mg->link = prev->link;
         prev->link = mg;
+        free_group_linked(mg);
         mg = coalesce_mblocks(prev);
     }
     else
     {
-        mg->link = free_mblock_list;
-        free_mblock_list = mg;
+        mg->link = free_mblock_list[node];
+        free_mblock_list[node] = mg;
+        free_group_linked(mg);
     }
     // coalesce forwards
     coalesce_mblocks(mg);
@@ -531,16 +722,20 @@ free_mega_group (bdescr *mg)
 void
 freeGroup(bdescr *p)
 {
-  nat ln;
+  nat ln, node;
 
   // Todo: not true in multithreaded GC
   // ASSERT_SM_LOCK();
 
   ASSERT(p->free != (P_)-1);
 
+  node = p->node;
+  ASSERT(node < n_numa_nodes);
+
   p->free = (void *)-1;  /* indicates that this block is free */
   p->gen = NULL;
   p->gen_no = 0;
+  p->flags = 0;
   /* fill the block group with garbage if sanity checking is on */
   IF_DEBUG(sanity,memset(p->start, 0xaa, (W_)p->blocks * BLOCK_SIZE));
 
@@ -554,14 +749,13 @@ freeGroup(bdescr *p)
       // If this is an mgroup, make sure it has the right number of blocks
       ASSERT(p->blocks == MBLOCK_GROUP_BLOCKS(mblocks));
 
-      n_alloc_blocks -= mblocks * BLOCKS_PER_MBLOCK;
+      recordFreedBlocks(node, mblocks * BLOCKS_PER_MBLOCK);
 
       free_mega_group(p);
       return;
   }
 
-  ASSERT(n_alloc_blocks >= p->blocks);
-  n_alloc_blocks -= p->blocks;
+  recordFreedBlocks(node, p->blocks);
 
   // coalesce forwards
   {
@@ -571,7 +765,8 @@ freeGroup(bdescr *p)
       {
           p->blocks += next->blocks;
           ln = log_2(next->blocks);
-          dbl_link_remove(next, &free_list[ln]);
+          free_group_unlinked(next);
+          dbl_link_remove(next, &free_list[node][ln]);
           if (p->blocks == BLOCKS_PER_MBLOCK)
           {
               free_mega_group(p);
@@ -591,8 +786,10 @@ freeGroup(bdescr *p)
       if (prev->free == (P_)-1)
       {
           ln = log_2(prev->blocks);
-          dbl_link_remove(prev, &free_list[ln]);
+          free_group_unlinked(prev);
+          dbl_link_remove(prev, &free_list[node][ln]);
           prev->blocks += p->blocks;
+          prev->flags = 0;
           if (prev->blocks >= BLOCKS_PER_MBLOCK)
           {
               free_mega_group(prev);
@@ -603,7 +800,7 @@ freeGroup(bdescr *p)
   }
       
   setup_tail(p);
-  free_list_insert(p);
+  free_list_insert(node,p);
 
   IF_DEBUG(sanity, checkFreeListSanity());
 }
@@ -635,8 +832,398 @@ freeChain_lock(bdescr *bd)
     RELEASE_SM_LOCK;
 }
 
+/* -----------------------------------------------------------------------------
+   Per-Capability block caches
+
+   Almost all of the block allocation done by the mutator (nursery
+   extension, pinned blocks, mutable lists, small large objects such as
+   stack chunks) and by the GC (to-space blocks, todo blocks) is for
+   single blocks or small groups.  Taking sm_mutex or
+   gc_alloc_block_sync for each of these is a bottleneck with many
+   Capabilities, so each Capability keeps a small cache of free groups
+   of up to BLOCK_CACHE_MAX_BLOCKS blocks in cap->block_cache.
+
+   Only the Task that owns a Capability (or the GC thread running on
+   its behalf during GC) touches the cache, so no lock is needed to
+   allocate from it or free into it.  When the list for a given size is
+   empty we refill it with BLOCK_CACHE_BATCH blocks' worth of groups,
+   and when it holds more than two batches we give one batch back; in
+   both cases the global lock is taken once for the whole batch.
+
+   As far as the global allocator is concerned, groups in a cache are
+   allocated: they are counted in n_alloc_blocks and their free field
+   is never (P_)-1, so freeGroup() will not coalesce with them.  After
+   a major GC all the caches are flushed (flushBlockCaches()), so that
+   they don't prevent memory from being coalesced and returned to the
+   OS.
+
+   Large objects of a few blocks (ByteArrays of 4-256k, say) are
+   allocated and die at a high rate in some programs, so the cache
+   also keeps larger groups, by size class, in cache->large.  These
+   are not refilled from the global free lists, but the GC frees the
+   dead large objects into them (freeChainOnCaps()).  A group taken
+   from a class may be bigger than we need; the rest goes back into
+   the cache.
+   -------------------------------------------------------------------------- */
+
+void
+initBlockCache (BlockCache *cache)
+{
+    nat i;
+    for (i = 0; i < BLOCK_CACHE_MAX_BLOCKS; i++) {
+        cache->groups[i] = NULL;
+        cache->n_groups[i] = 0;
+    }
+    for (i = 0; i < LARGE_CACHE_CLASSES; i++) {
+        cache->large[i] = NULL;
+        cache->large_blocks[i] = 0;
+    }
+}
+
+// number of groups of n blocks that we move in one batch
+STATIC_INLINE nat
+cache_batch (W_ n)
+{
+    return n >= BLOCK_CACHE_BATCH ? 1 : BLOCK_CACHE_BATCH / n;
+}
+
+STATIC_INLINE void
+cache_push (BlockCache *cache, bdescr *bd)
+{
+    W_ n = bd->blocks;
+    bd->link = cache->groups[n-1];
+    cache->groups[n-1] = bd;
+    cache->n_groups[n-1]++;
+}
+
+STATIC_INLINE bdescr *
+cache_pop (BlockCache *cache, W_ n)
+{
+    bdescr *bd;
+
+    bd = cache->groups[n-1];
+    if (bd != NULL) {
+        cache->groups[n-1] = bd->link;
+        cache->n_groups[n-1]--;
+        bd->link = NULL;
+    }
+    return bd;
+}
+
+// size class of a group of n blocks, BLOCK_CACHE_MAX_BLOCKS < n <=
+// LARGE_CACHE_MAX_BLOCKS
+STATIC_INLINE nat
+large_class (W_ n)
+{
+    nat c = 0;
+    W_ max = BLOCK_CACHE_MAX_BLOCKS * 2;
+
+    while (n > max) {
+        max <<= 1;
+        c++;
+    }
+    return c;
+}
+
+// Put a group in the large part of the cache, unless its class is
+// full.
+STATIC_INLINE rtsBool
+large_push (BlockCache *cache, bdescr *bd)
+{
+    nat c = large_class(bd->blocks);
+
+    if (cache->large_blocks[c] + bd->blocks > LARGE_CACHE_CLASS_BLOCKS) {
+        return rtsFalse;
+    }
+    bd->link = cache->large[c];
+    cache->large[c] = bd;
+    cache->large_blocks[c] += bd->blocks;
+    return rtsTrue;
+}
+
+// Refill the cache with groups of n blocks.  We ask for a single
+// contiguous chunk and carve it up; allocLargeChunkOnNode() may give
+// us fewer blocks than we asked for, and anything left over after
+// carving is freed again.  The caller must hold the block allocator
+// lock.
+static void
+cache_refill (BlockCache *cache, nat node, W_ n)
+{
+    bdescr *chunk, *bd;
+    W_ i, k, rest;
+
+    chunk = allocLargeChunkOnNode(node, n, cache_batch(n) * n);
+    k    = chunk->blocks / n;
+    rest = chunk->blocks - k * n;
+
+    for (i = 0, bd = chunk; i < k; i++, bd += n) {
+        bd->blocks = n;
+        initGroup(bd);
+        cache_push(cache, bd);
+    }
+    if (rest > 0) {
+        bd->blocks = rest;
+        initGroup(bd);
+        freeGroup(bd);
+    }
+}
+
+// Give back the least recently freed batch of groups of n blocks.  The
+// caller must hold the block allocator lock.
+static void
+cache_drain (BlockCache *cache, W_ n)
+{
+    bdescr *bd, *rest;
+    nat i, keep;
+
+    keep = cache->n_groups[n-1] - cache_batch(n);
+    ASSERT(keep > 0);
+
+    for (i = 1, bd = cache->groups[n-1]; i < keep; i++) {
+        bd = bd->link;
+    }
+    rest = bd->link;
+    bd->link = NULL;
+    cache->n_groups[n-1] = keep;
+
+    freeChain(rest);
+}
+
+STATIC_INLINE void
+lock_block_allocator (rtsBool sync)
+{
+    if (sync) {
+        ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
+    } else {
+        ACQUIRE_SM_LOCK;
+    }
+}
+
+STATIC_INLINE void
+unlock_block_allocator (rtsBool sync)
+{
+    if (sync) {
+        RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
+    } else {
+        RELEASE_SM_LOCK;
+    }
+}
+
+// Take a group of at least n blocks from the large part of the cache:
+// first fit in n's own class, or any group of a bigger class.  What we
+// don't need goes back into the cache, or to the global free lists if
+// its class is full.
+static bdescr *
+large_pop (BlockCache *cache, W_ n, rtsBool sync)
+{
+    bdescr *bd, **prev, *rest;
+    nat c;
+
+    c = large_class(n);
+    for (prev = &cache->large[c]; *prev != NULL; prev = &(*prev)->link) {
+        if ((*prev)->blocks >= n) break;
+    }
+    while (*prev == NULL) {
+        if (++c == LARGE_CACHE_CLASSES) return NULL;
+        prev = &cache->large[c];
+    }
+
+    bd = *prev;
+    *prev = bd->link;
+    cache->large_blocks[c] -= bd->blocks;
+
+    if (bd->blocks > n) {
+        rest = bd + n;
+        rest->blocks = bd->blocks - n;
+        initGroup(rest);
+        bd->blocks = n;
+        initGroup(bd);
+        if (rest->blocks <= BLOCK_CACHE_MAX_BLOCKS) {
+            cache_push(cache, rest);
+        } else if (!large_push(cache, rest)) {
+            lock_block_allocator(sync);
+            freeGroup(rest);
+            unlock_block_allocator(sync);
+        }
+    }
+
+    bd->link = NULL;
+    return bd;
+}
+
+static bdescr *
+alloc_group_on_cap (Capability *cap, W_ n, rtsBool sync)
+{
+    bdescr *bd;
+
+    if (n > BLOCK_CACHE_MAX_BLOCKS) {
+        if (n <= LARGE_CACHE_MAX_BLOCKS) {
+            bd = large_pop(&cap->block_cache, n, sync);
+            if (bd != NULL) return bd;
+        }
+        lock_block_allocator(sync);
+        bd = allocGroupOnNode(cap->node, n);
+        unlock_block_allocator(sync);
+        return bd;
+    }
+
+    bd = cache_pop(&cap->block_cache, n);
+    if (bd == NULL) {
+        lock_block_allocator(sync);
+        cache_refill(&cap->block_cache, cap->node, n);
+        unlock_block_allocator(sync);
+        bd = cache_pop(&cap->block_cache, n);
+    }
+    return bd;
+}
+
+// Put a group that we have finished with in the cache, or return
+// rtsFalse if the cache won't take it.  The caller then has to free
+// it, and otherwise has to check whether the cache needs draining
+// (cache_too_full()).
+static rtsBool
+cache_free (BlockCache *cache, bdescr *bd)
+{
+    W_ n = bd->blocks;
+
+    if (n > LARGE_CACHE_MAX_BLOCKS) return rtsFalse;
+
+    // make the group look like a freshly allocated one
+    initGroup(bd);
+    bd->gen    = NULL;
+    bd->gen_no = 0;
+    bd->flags  = 0;
+    IF_DEBUG(sanity, memset(bd->start, 0xaa, n * BLOCK_SIZE));
+
+    if (n > BLOCK_CACHE_MAX_BLOCKS) {
+        return large_push(cache, bd);
+    }
+    cache_push(cache, bd);
+    return rtsTrue;
+}
+
+STATIC_INLINE rtsBool
+cache_too_full (BlockCache *cache, W_ n)
+{
+    return n <= BLOCK_CACHE_MAX_BLOCKS
+        && cache->n_groups[n-1] > 2 * cache_batch(n);
+}
+
 static void
-initMBlock(void *mblock)
+free_group_on_cap (Capability *cap, bdescr *bd, rtsBool sync)
+{
+    W_ n = bd->blocks;
+
+    ASSERT(bd->free != (P_)-1);
+
+    if (!cache_free(&cap->block_cache, bd)) {
+        lock_block_allocator(sync);
+        freeGroup(bd);
+        unlock_block_allocator(sync);
+        return;
+    }
+
+    if (cache_too_full(&cap->block_cache, n)) {
+        lock_block_allocator(sync);
+        cache_drain(&cap->block_cache, n);
+        unlock_block_allocator(sync);
+    }
+}
+
+bdescr *
+allocGroupOnCap_lock (Capability *cap, W_ n)
+{
+    return alloc_group_on_cap(cap, n, rtsFalse);
+}
+
+bdescr *
+allocBlockOnCap_lock (Capability *cap)
+{
+    return alloc_group_on_cap(cap, 1, rtsFalse);
+}
+
+bdescr *
+allocGroupOnCap_sync (Capability *cap, W_ n)
+{
+    return alloc_group_on_cap(cap, n, rtsTrue);
+}
+
+void
+freeGroupOnCap_lock (Capability *cap, bdescr *bd)
+{
+    free_group_on_cap(cap, bd, rtsFalse);
+}
+
+void
+freeGroupOnCap_sync (Capability *cap, bdescr *bd)
+{
+    free_group_on_cap(cap, bd, rtsTrue);
+}
+
+void
+flushBlockCaches (void)
+{
+    BlockCache *cache;
+    nat i, n;
+
+    for (i = 0; i < n_capabilities; i++) {
+        cache = &capabilities[i].block_cache;
+        for (n = 0; n < BLOCK_CACHE_MAX_BLOCKS; n++) {
+            freeChain(cache->groups[n]);
+            cache->groups[n] = NULL;
+            cache->n_groups[n] = 0;
+        }
+        for (n = 0; n < LARGE_CACHE_CLASSES; n++) {
+            freeChain(cache->large[n]);
+            cache->large[n] = NULL;
+            cache->large_blocks[n] = 0;
+        }
+    }
+}
+
+void
+freeChainOnCaps (bdescr *bd)
+{
+    static nat next_cap = 0;
+    Capability *cap;
+    bdescr *next;
+    W_ n;
+
+    for (; bd != NULL; bd = next) {
+        next = bd->link;
+        n = bd->blocks;
+        cap = &capabilities[next_cap % n_capabilities];
+
+        // keep the memory on its NUMA node
+        if (cap->node != bd->node || !cache_free(&cap->block_cache, bd)) {
+            freeGroup(bd);
+            continue;
+        }
+        if (cache_too_full(&cap->block_cache, n)) {
+            cache_drain(&cap->block_cache, n);
+        }
+        next_cap++;
+    }
+}
+
+W_
+countBlockCache (Capability *cap)
+{
+    W_ total;
+    nat n;
+
+    total = 0;
+    for (n = 0; n < BLOCK_CACHE_MAX_BLOCKS; n++) {
+        total += countBlocks(cap->block_cache.groups[n]);
+    }
+    for (n = 0; n < LARGE_CACHE_CLASSES; n++) {
+        total += cap->block_cache.large_blocks[n];
+    }
+    return total;
+}
+
+static void
+initMBlock(void *mblock, nat node)
 {
     bdescr *bd;
     StgWord8 *block;
@@ -652,6 +1239,7 @@ initMBlock(void *mblock)
     for (; block <= (StgWord8*)LAST_BLOCK(mblock); bd += 1, 
              block += BLOCK_SIZE) {
         bd->start = (void*)block;
+        bd->node = node;
     }
 }
 
@@ -689,30 +1277,103 @@ countAllocdBlocks(bdescr *bd)
     return n;
 }
 
+// With huge pages, we must give memory back to the OS in whole,
+// aligned huge pages; giving back part of a huge page would make the
+// kernel split it.  So from each free mgroup we release the largest
+// huge-page-aligned range that we can (up to n mblocks), splitting the
+// mgroup into the parts below and above that range.  Returns the number
+// of mblocks that we still want to free.
+static nat
+return_huge_pages_to_os (nat node, nat n)
+{
+    bdescr *bd, *next, *upper, **prev;
+    StgWord8 *base, *end, *lo, *hi;
+    W_ len;
+
+    prev = &free_mblock_list[node];
+    bd = *prev;
+    while (n > 0 && bd != NULL) {
+        base = MBLOCK_ROUND_DOWN(bd->start);
+        end  = base + BLOCKS_TO_MBLOCKS(bd->blocks) * MBLOCK_SIZE;
+        lo   = HUGE_PAGE_ROUND_UP(base);
+        hi   = HUGE_PAGE_ROUND_DOWN(end);
+        len  = (W_)HUGE_PAGE_ROUND_DOWN((W_)n * MBLOCK_SIZE);
+
+        if (len == 0) break;
+        if (hi <= lo) {
+            // no whole huge page in this mgroup
+            prev = &bd->link;
+            bd = bd->link;
+            continue;
+        }
+        if ((W_)(hi - lo) > len) {
+            lo = hi - len;
+        } else {
+            len = hi - lo;
+        }
+
+        free_group_unlinked(bd);
+        next = bd->link;
+        if (end > hi) {
+            upper = FIRST_BDESCR(hi);
+            initMBlock(hi, node);
+            upper->blocks = MBLOCK_GROUP_BLOCKS((end - hi) / MBLOCK_SIZE);
+            upper->free   = (P_)-1;
+            upper->flags  = bd->flags;
+            upper->link   = next;
+            free_group_linked(upper);
+            next = upper;
+        }
+        if (lo > base) {
+            bd->blocks = MBLOCK_GROUP_BLOCKS((lo - base) / MBLOCK_SIZE);
+            bd->link = next;
+            free_group_linked(bd);
+            prev = &bd->link;
+        } else {
+            *prev = next;
+        }
+        bd = next;
+
+        freeMBlocks(lo, len / MBLOCK_SIZE);
+        n -= len / MBLOCK_SIZE;
+    }
+    return n;
+}
+
 void returnMemoryToOS(nat n /* megablocks */)
 {
-    static bdescr *bd;
-    nat size;
-
-    bd = free_mblock_list;
-    while ((n > 0) && (bd != NULL)) {
-        size = BLOCKS_TO_MBLOCKS(bd->blocks);
-        if (size > n) {
-            nat newSize = size - n;
-            char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
-            freeAddr += newSize * MBLOCK_SIZE;
-            bd->blocks = MBLOCK_GROUP_BLOCKS(newSize);
-            freeMBlocks(freeAddr, n);
-            n = 0;
+    bdescr *bd;
+    nat node, size;
+
+    // ToDo: not fair, we free all the memory starting with node 0.
+    for (node = 0; n > 0 && node < n_numa_nodes; node++) {
+        if (RtsFlags.GcFlags.hugePages != HUGE_PAGES_OFF) {
+            n = return_huge_pages_to_os(node, n);
+            continue;
         }
-        else {
-            char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
-            n -= size;
-            bd = bd->link;
-            freeMBlocks(freeAddr, size);
+        bd = free_mblock_list[node];
+        while ((n > 0) && (bd != NULL)) {
+            size = BLOCKS_TO_MBLOCKS(bd->blocks);
+            if (size > n) {
+                nat newSize = size - n;
+                char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
+                freeAddr += newSize * MBLOCK_SIZE;
+                free_group_unlinked(bd);
+                bd->blocks = MBLOCK_GROUP_BLOCKS(newSize);
+                free_group_linked(bd);
+                freeMBlocks(freeAddr, n);
+                n = 0;
+            }
+            else {
+                char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
+                n -= size;
+                free_group_unlinked(bd);
+                bd = bd->link;
+                freeMBlocks(freeAddr, size);
+            }
         }
+        free_mblock_list[node] = bd;
     }
-    free_mblock_list = bd;
 
     osReleaseFreeMemory();
 
@@ -724,11 +1385,178 @@ void returnMemoryToOS(nat n /* megablocks */)
     );
 }
 
+/* -----------------------------------------------------------------------------
+   Decommitting free memory
+
+   returnMemoryToOS() can only give back whole free megablocks, so a
+   heap whose megablocks are all partly in use keeps its peak RSS
+   forever.  decommitFreeBlocks() instead tells the OS that it can have
+   the pages of free block groups (osDiscardMemory()), while the groups
+   stay on the free lists.  Such groups are marked BF_DECOMMITTED, which
+   is cleared whenever they are coalesced with other free memory or
+   allocated (see initGroup()); the OS gives us zeroed pages back as
+   soon as the memory is touched again.
+
+   It is driven by the background decommitter in Decommit.c.
+
+   n_committed_free counts the free blocks that are still committed,
+   so we know when to stop without walking the free lists.  Each batch
+   carries on from decommit_cursor, which free_group_unlinked() moves
+   on whenever the group it points to leaves its list, so we don't
+   look at the same decommitted groups again and again.  We go round
+   all the free lists at most once per batch.
+
+   The system calls are made without the lock: a batch marks its
+   groups BF_DECOMMITTED and collects their pages under the lock, then
+   releases it and discards the pages.  Anything that takes one of
+   those groups off a free list while that is going on waits for the
+   batch to finish (free_group_unlinked()), so memory is never
+   discarded once it is in use again.
+   -------------------------------------------------------------------------- */
+
+// Up to this many ranges are discarded in each batch.
+#define DISCARD_RANGES 64
+
+typedef struct {
+    StgWord8 *start;
+    W_        size;
+} DiscardRange;
+
+// Mark the free group bd decommitted, and return the range of memory to
+// discard in *range.  Returns the number of blocks in the range.
+static W_
+decommit_group (bdescr *bd, DiscardRange *range)
+{
+    StgWord8 *start, *end, *lo, *hi;
+    W_ granule;
+
+    start = (StgWord8*)bd->start;
+    if (bd->blocks >= BLOCKS_PER_MBLOCK) {
+        end = (StgWord8*)MBLOCK_ROUND_DOWN(bd) +
+              BLOCKS_TO_MBLOCKS(bd->blocks) * MBLOCK_SIZE;
+    } else {
+        end = start + (W_)bd->blocks * BLOCK_SIZE;
+    }
+
+    // With huge pages we must not split a huge page, so we only
+    // discard whole, aligned ones.
+    if (RtsFlags.GcFlags.hugePages != HUGE_PAGES_OFF) {
+        granule = HUGE_PAGE_SIZE;
+    } else {
+        granule = getPageSize();
+    }
+    lo = (StgWord8*)(((W_)start + granule - 1) & ~(granule - 1));
+    hi = (StgWord8*)((W_)end & ~(granule - 1));
+
+    ASSERT(n_committed_free >= bd->blocks);
+    n_committed_free -= bd->blocks;
+    bd->flags |= BF_DECOMMITTED;
+
+    if (hi <= lo) return 0;
+    range->start = lo;
+    range->size  = hi - lo;
+    return (hi - lo) / BLOCK_SIZE;
+}
+
+// Move decommit_cursor to the head of the next free list.  We do the
+// largest groups first: they are the least likely to be needed again
+// soon, and we get the most memory per system call.  With huge pages,
+// only free megablocks can contain whole huge pages, so we don't look
+// at the other free lists at all.
+static void
+next_decommit_list (void)
+{
+    if (decommit_list == 0 || RtsFlags.GcFlags.hugePages != HUGE_PAGES_OFF) {
+        decommit_node = (decommit_node + 1) % n_numa_nodes;
+        decommit_list = MAX_FREE_LIST;
+    } else {
+        decommit_list--;
+    }
+    if (decommit_list == MAX_FREE_LIST) {
+        decommit_cursor = free_mblock_list[decommit_node];
+    } else {
+        decommit_cursor = free_list[decommit_node][decommit_list];
+    }
+}
+
+// Decommit up to max_blocks blocks of free memory, leaving at least
+// slack blocks of free memory committed.  Returns rtsTrue if no more
+// than slack blocks of free memory remain committed, or if there is
+// nothing left to decommit.  Takes the block allocator lock, but
+// doesn't hold it while the memory is discarded.
+rtsBool
+decommitFreeBlocks (W_ max_blocks, W_ slack)
+{
+    DiscardRange ranges[DISCARD_RANGES];
+    bdescr *bd;
+    W_ done, n;
+    nat n_ranges, visits, i;
+    rtsBool finished;
+
+    ACQUIRE_SM_LOCK;
+
+    done = 0;
+    n_ranges = 0;
+    visits = 0;
+    finished = rtsFalse;
+    while (n_committed_free > slack && done < max_blocks
+           && n_ranges < DISCARD_RANGES) {
+        if (decommit_cursor == NULL) {
+            // one more than the number of lists, as we may have
+            // started part-way down one
+            if (visits++ > n_numa_nodes * (MAX_FREE_LIST + 1)) {
+                finished = rtsTrue;
+                break;
+            }
+            next_decommit_list();
+            continue;
+        }
+        bd = decommit_cursor;
+        decommit_cursor = bd->link;
+        if (!(bd->flags & BF_DECOMMITTED)) {
+            n = decommit_group(bd, &ranges[n_ranges]);
+            if (n > 0) {
+                done += n;
+                n_ranges++;
+            }
+        }
+    }
+    if (n_committed_free <= slack) finished = rtsTrue;
+
+    if (n_ranges > 0) discard_in_flight = 1;
+
+    IF_DEBUG(sanity, checkFreeListSanity());
+    RELEASE_SM_LOCK;
+
+    for (i = 0; i < n_ranges; i++) {
+        osDiscardMemory(ranges[i].start, ranges[i].size);
+    }
+
+    if (n_ranges > 0) {
+        write_barrier();
+        discard_in_flight = 0;
+        debugTrace(DEBUG_gc, "decommitted %" FMT_Word " free blocks", done);
+    }
+
+    return finished;
+}
+
+// In the child of forkProcess() no thread is discarding memory any
+// more, even if one was when we forked, so wait_for_discard() mustn't
+// wait for it.
+void
+resetDiscardAfterFork (void)
+{
+    discard_in_flight = 0;
+}
+
 /* -----------------------------------------------------------------------------
    Debugging
    -------------------------------------------------------------------------- */
 
 #ifdef DEBUG
+static W_ countCommittedFree (void);
+
 static void
 check_tail (bdescr *bd)
 {
@@ -746,70 +1574,96 @@ void
 checkFreeListSanity(void)
 {
     bdescr *bd, *prev;
-    nat ln, min;
+    nat ln, min, node;
 
+    for (node = 0; node < n_numa_nodes; node++) {
+        min = 1;
+        for (ln = 0; ln < MAX_FREE_LIST; ln++) {
+            IF_DEBUG(block_alloc,
+                     debugBelch("free block list [%d][%d]:\n", node, ln));
 
-    min = 1;
-    for (ln = 0; ln < MAX_FREE_LIST; ln++) {
-        IF_DEBUG(block_alloc, debugBelch("free block list [%d]:\n", ln));
+            prev = NULL;
+            for (bd = free_list[node][ln]; bd != NULL; prev = bd, bd = bd->link)
+            {
+                IF_DEBUG(block_alloc,
+                         debugBelch("group at %p, length %ld blocks\n", 
+                                    bd->start, (long)bd->blocks));
+                ASSERT(bd->free == (P_)-1);
+                ASSERT(bd->node == node);
+                ASSERT(bd->blocks > 0 && bd->blocks < BLOCKS_PER_MBLOCK);
+                ASSERT(bd->blocks >= min && bd->blocks <= (min*2 - 1));
+                ASSERT(bd->link != bd); // catch easy loops
+
+                check_tail(bd);
+
+                if (prev)
+                    ASSERT(bd->u.back == prev);
+                else 
+                    ASSERT(bd->u.back == NULL);
+
+                {
+                    bdescr *next;
+                    next = bd + bd->blocks;
+                    if (next <= LAST_BDESCR(MBLOCK_ROUND_DOWN(bd)))
+                    {
+                        ASSERT(next->free != (P_)-1);
+                    }
+                }
+            }
+            min = min << 1;
+        }
 
         prev = NULL;
-        for (bd = free_list[ln]; bd != NULL; prev = bd, bd = bd->link)
+        for (bd = free_mblock_list[node]; bd != NULL; prev = bd, bd = bd->link)
         {
             IF_DEBUG(block_alloc,
-                     debugBelch("group at %p, length %ld blocks\n", 
+                     debugBelch("mega group at %p, length %ld blocks\n", 
                                 bd->start, (long)bd->blocks));
-            ASSERT(bd->free == (P_)-1);
-            ASSERT(bd->blocks > 0 && bd->blocks < BLOCKS_PER_MBLOCK);
-            ASSERT(bd->blocks >= min && bd->blocks <= (min*2 - 1));
+
             ASSERT(bd->link != bd); // catch easy loops
+            ASSERT(bd->node == node);
 
-            check_tail(bd);
+            if (bd->link != NULL)
+            {
+                // make sure the list is sorted
+                ASSERT(bd->start < bd->link->start);
+            }
 
-            if (prev)
-                ASSERT(bd->u.back == prev);
-            else 
-                ASSERT(bd->u.back == NULL);
+            ASSERT(bd->blocks >= BLOCKS_PER_MBLOCK);
+            ASSERT(MBLOCK_GROUP_BLOCKS(BLOCKS_TO_MBLOCKS(bd->blocks))
+                   == bd->blocks);
 
+            // make sure we're fully coalesced
+            if (bd->link != NULL)
             {
-                bdescr *next;
-                next = bd + bd->blocks;
-                if (next <= LAST_BDESCR(MBLOCK_ROUND_DOWN(bd)))
-                {
-                    ASSERT(next->free != (P_)-1);
-                }
+                ASSERT (MBLOCK_ROUND_DOWN(bd->link) != 
+                        (StgWord8*)MBLOCK_ROUND_DOWN(bd) + 
+                        BLOCKS_TO_MBLOCKS(bd->blocks) * MBLOCK_SIZE);
             }
         }
-        min = min << 1;
     }
 
-    prev = NULL;
-    for (bd = free_mblock_list; bd != NULL; prev = bd, bd = bd->link)
-    {
-        IF_DEBUG(block_alloc,
-                 debugBelch("mega group at %p, length %ld blocks\n", 
-                            bd->start, (long)bd->blocks));
+    ASSERT(countCommittedFree() == n_committed_free);
+}
 
-        ASSERT(bd->link != bd); // catch easy loops
+static W_
+countCommittedFree (void)
+{
+    bdescr *bd;
+    W_ total_blocks = 0;
+    nat ln, node;
 
-        if (bd->link != NULL)
-        {
-            // make sure the list is sorted
-            ASSERT(bd->start < bd->link->start);
+    for (node = 0; node < n_numa_nodes; node++) {
+        for (ln = 0; ln < MAX_FREE_LIST; ln++) {
+            for (bd = free_list[node][ln]; bd != NULL; bd = bd->link) {
+                if (!(bd->flags & BF_DECOMMITTED)) total_blocks += bd->blocks;
+            }
         }
-
-        ASSERT(bd->blocks >= BLOCKS_PER_MBLOCK);
-        ASSERT(MBLOCK_GROUP_BLOCKS(BLOCKS_TO_MBLOCKS(bd->blocks))
-               == bd->blocks);
-
-        // make sure we're fully coalesced
-        if (bd->link != NULL)
-        {
-            ASSERT (MBLOCK_ROUND_DOWN(bd->link) != 
-                    (StgWord8*)MBLOCK_ROUND_DOWN(bd) + 
-                    BLOCKS_TO_MBLOCKS(bd->blocks) * MBLOCK_SIZE);
+        for (bd = free_mblock_list[node]; bd != NULL; bd = bd->link) {
+            if (!(bd->flags & BF_DECOMMITTED)) total_blocks += bd->blocks;
         }
     }
+    return total_blocks;
 }
 
 W_ /* BLOCKS */
@@ -817,19 +1671,21 @@ countFreeList(void)
 {
   bdescr *bd;
   W_ total_blocks = 0;
-  nat ln;
+  nat ln, node;
 
-  for (ln=0; ln < MAX_FREE_LIST; ln++) {
-      for (bd = free_list[ln]; bd != NULL; bd = bd->link) {
-          total_blocks += bd->blocks;
+  for (node = 0; node < n_numa_nodes; node++) {
+      for (ln=0; ln < MAX_FREE_LIST; ln++) {
+          for (bd = free_list[node][ln]; bd != NULL; bd = bd->link) {
+              total_blocks += bd->blocks;
+          }
+      }
+      for (bd = free_mblock_list[node]; bd != NULL; bd = bd->link) {
+          total_blocks += BLOCKS_PER_MBLOCK * BLOCKS_TO_MBLOCKS(bd->blocks);
+          // The caller of this function, memInventory(), expects to match
+          // the total number of blocks in the system against mblocks *
+          // BLOCKS_PER_MBLOCK, so we must subtract the space for the
+          // block descriptors from *every* mblock.
       }
-  }
-  for (bd = free_mblock_list; bd != NULL; bd = bd->link) {
-      total_blocks += BLOCKS_PER_MBLOCK * BLOCKS_TO_MBLOCKS(bd->blocks);
-      // The caller of this function, memInventory(), expects to match
-      // the total number of blocks in the system against mblocks *
-      // BLOCKS_PER_MBLOCK, so we must subtract the space for the
-      // block descriptors from *every* mblock.
   }
   return total_blocks;
 }
@@ -842,6 +1698,18 @@ markBlocks (bdescr *bd)
     }
 }
 
+void
+markBlockCache (Capability *cap)
+{
+    nat n;
+    for (n = 0; n < BLOCK_CACHE_MAX_BLOCKS; n++) {
+        markBlocks(cap->block_cache.groups[n]);
+    }
+    for (n = 0; n < LARGE_CACHE_CLASSES; n++) {
+        markBlocks(cap->block_cache.large[n]);
+    }
+}
+
 void
 reportUnmarkedBlocks (void)
 {
@@ -12,23 +12,78 @@
 #include "BeginPrivate.h"
 
 bdescr *allocLargeChunk (W_ min, W_ max);
+bdescr *allocLargeChunkOnNode (nat node, W_ min, W_ max);
+
+/* Per-Capability block caches ---------------------------------------------- */
+
+// Groups of up to BLOCK_CACHE_MAX_BLOCKS blocks are cached per
+// Capability.  BLOCK_CACHE_BATCH is the number of blocks moved between
+// a cache and the global free lists each time we take the lock.
+#define BLOCK_CACHE_MAX_BLOCKS 8
+#define BLOCK_CACHE_BATCH      8
+
+// Larger groups, up to LARGE_CACHE_MAX_BLOCKS blocks, are cached by
+// size class, mostly for large objects.  Each class holds at most
+// LARGE_CACHE_CLASS_BLOCKS blocks.
+#define LARGE_CACHE_CLASSES      3
+#define LARGE_CACHE_MAX_BLOCKS   (BLOCK_CACHE_MAX_BLOCKS << LARGE_CACHE_CLASSES)
+#define LARGE_CACHE_CLASS_BLOCKS 128
+
+typedef struct BlockCache_ {
+    // groups[n-1] is a list of free groups of exactly n blocks,
+    // linked through bd->link, and n_groups[n-1] is its length.
+    bdescr *groups[BLOCK_CACHE_MAX_BLOCKS];
+    nat     n_groups[BLOCK_CACHE_MAX_BLOCKS];
+    // large[c] is a list of free groups of more than
+    // BLOCK_CACHE_MAX_BLOCKS << c blocks, and no more than twice that;
+    // large_blocks[c] is the number of blocks in them.
+    bdescr *large[LARGE_CACHE_CLASSES];
+    W_      large_blocks[LARGE_CACHE_CLASSES];
+} BlockCache;
+
+void    initBlockCache        (BlockCache *cache);
+
+// Allocate/free using the given Capability's cache; the _lock variants
+// take sm_mutex when the global free lists must be consulted, the
+// _sync variants (for use by GC threads) take gc_alloc_block_sync.
+bdescr *allocGroupOnCap_lock  (Capability *cap, W_ n);
+bdescr *allocBlockOnCap_lock  (Capability *cap);
+bdescr *allocGroupOnCap_sync  (Capability *cap, W_ n);
+void    freeGroupOnCap_lock   (Capability *cap, bdescr *bd);
+void    freeGroupOnCap_sync   (Capability *cap, bdescr *bd);
+
+// Return all cached blocks to the global free lists.  The caller must
+// hold the block allocator lock and all Capabilities.
+void    flushBlockCaches      (void);
+
+// Free the groups of a chain of dead large objects into the caches of
+// the Capabilities in turn, so that allocate() can reuse them without
+// taking the lock.  For use by the GC, which holds the lock.
+void    freeChainOnCaps       (bdescr *bd);
+
+W_      countBlockCache       (Capability *cap);
 
 /* Debugging  -------------------------------------------------------------- */
 
 extern W_ countBlocks       (bdescr *bd);
 extern W_ countAllocdBlocks (bdescr *bd);
 extern void returnMemoryToOS(nat n);
+extern rtsBool decommitFreeBlocks(W_ max_blocks, W_ slack);
+extern void resetDiscardAfterFork(void);
 
 #ifdef DEBUG
 void checkFreeListSanity(void);
 W_   countFreeList(void);
 void markBlocks (bdescr *bd);
+void markBlockCache (Capability *cap);
 void reportUnmarkedBlocks (void);
 #endif
 
 extern W_ n_alloc_blocks;   // currently allocated blocks
 extern W_ hw_alloc_blocks;  // high-water allocated blocks
 
+extern W_ n_alloc_blocks_by_node[MAX_NUMA_NODES];
+
 #include "EndPrivate.h"
 
 #endif /* BLOCK_ALLOC_H */
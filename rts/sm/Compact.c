@@ -67,8 +67,37 @@
    closure is normally the same (if they are not the same, then
    presumably the tag is not essential and it therefore doesn't matter
    if we throw away some of the tags).
+
+   When several GC threads are compacting (see compact_par() below),
+   two of them may add to the same chain at once, so the new chain
+   root is installed with cas().  Nothing else changes a chain while
+   it is being added to, and the old root has been saved in the field
+   before the cas() makes it visible, so get_threaded_info() can
+   safely walk a chain that another thread is extending.
    ------------------------------------------------------------------------- */
 
+// rtsTrue while several GC threads may be threading pointers at once
+static rtsBool par_threading = rtsFalse;
+
+#if defined(THREADED_RTS)
+static void
+thread_par (StgClosure **p, StgClosure *q0, StgPtr q)
+{
+    StgWord iptr, new;
+
+    do {
+        iptr = *(StgVolatilePtr)q;
+        if (GET_CLOSURE_TAG((StgClosure *)iptr) == 0) {
+            *p = (StgClosure *)(iptr + GET_CLOSURE_TAG(q0));
+            new = (StgWord)p + 1;
+        } else {
+            *p = (StgClosure *)iptr;
+            new = (StgWord)p + 2;
+        }
+    } while (cas((StgVolatilePtr)q, iptr, new) != iptr);
+}
+#endif
+
 STATIC_INLINE void
 thread (StgClosure **p)
 {
@@ -89,6 +118,12 @@ thread (StgClosure **p)
 
 	if (bd->flags & BF_MARKED)
         {
+#if defined(THREADED_RTS)
+            if (par_threading) {
+                thread_par(p, q0, q);
+                return;
+            }
+#endif
             iptr = *q;
             switch (GET_CLOSURE_TAG((StgClosure *)iptr))
             {
@@ -459,16 +494,14 @@ thread_TSO (StgTSO *tso)
 
 
 static void
-update_fwd_large( bdescr *bd )
+thread_large( bdescr *bd )
 {
-  StgPtr p;
-  const StgInfoTable* info;
-
-  for (; bd != NULL; bd = bd->link) {
+    StgPtr p;
+    const StgInfoTable* info;
 
     // nothing to do in a pinned block; it might not even have an object
     // at the beginning.
-    if (bd->flags & BF_PINNED) continue;
+    if (bd->flags & BF_PINNED) return;
 
     p = bd->start;
     info  = get_itbl((StgClosure *)p);
@@ -477,7 +510,7 @@ update_fwd_large( bdescr *bd )
 
     case ARR_WORDS:
       // nothing to follow 
-      continue;
+      return;
 
     case MUT_ARR_PTRS_CLEAN:
     case MUT_ARR_PTRS_DIRTY:
@@ -491,23 +524,23 @@ update_fwd_large( bdescr *bd )
           for (p = (P_)a->payload; p < (P_)&a->payload[a->ptrs]; p++) {
               thread((StgClosure **)p);
           }
-          continue;
+          return;
       }
 
     case STACK:
     {
         StgStack *stack = (StgStack*)p;
         thread_stack(stack->sp, stack->stack + stack->stack_size);
-        continue;
+        return;
     }
 
     case AP_STACK:
 	thread_AP_STACK((StgAP_STACK *)p);
-	continue;
+	return;
 
     case PAP:
 	thread_PAP((StgPAP *)p);
-	continue;
+	return;
 
     case TREC_CHUNK:
     {
@@ -520,13 +553,20 @@ update_fwd_large( bdescr *bd )
 	  thread(&e->expected_value);
 	  thread(&e->new_value);
 	}
-	continue;
+	return;
     }
 
     default:
       barf("update_fwd_large: unknown/strange object  %d", (int)(info->type));
     }
-  }
+}
+
+static void
+update_fwd_large( bdescr *bd )
+{
+    for (; bd != NULL; bd = bd->link) {
+        thread_large(bd);
+    }
 }
 
 // ToDo: too big to inline
@@ -905,10 +945,342 @@ update_bkwd_compact( generation *gen )
     return free_blocks;
 }
 
+/* ----------------------------------------------------------------------------
+   Parallel compaction
+
+   With more than one GC thread, the oldest generation is compacted by
+   all of them (see gcParallelPhase()).  Its blocks are divided into
+   regions, each of which is compacted into itself, so that the new
+   address of every object can be worked out without looking at the
+   other regions.  The sequential algorithm above does the threading
+   and the forwarding of forward pointers in one pass; here we have
+   three, each split up between the GC threads:
+
+     1. thread every pointer field in the heap (update_fwd and
+        update_fwd_large, plus the fields of the live objects in the
+        compacted generation),
+
+     2. for each region, walk its live objects in order and unthread
+        them, giving every pointer to them its new value,
+
+     3. for each region, slide its live objects down to their new
+        addresses.
+
+   Each pass has to be finished before the next starts: all of an
+   object's pointers must be on its chain before it is unthreaded, and
+   unthreading writes to fields of objects in other regions, which must
+   not have moved yet.  Each chain is only unthreaded by the thread
+   compacting the region that its object lives in.
+
+   The cost is one partly-filled block at the end of each region.
+   ------------------------------------------------------------------------- */
+
+// A region should be at least this many blocks long
+#define MIN_REGION_BLOCKS 16
+
+// Regions per GC thread, so that an uneven spread of live data does
+// not leave threads idle.
+#define REGIONS_PER_THREAD 4
+
+typedef struct {
+    bdescr *bd;          // first block (the region is a NULL-terminated list)
+    bdescr *free_bd;     // last block in use after compaction
+    W_      n_blocks;    // blocks in use after compaction
+} CompactRegion;
+
+typedef struct {
+    bdescr *bd;
+    StgWord kind;
+} ThreadWork;
+
+#define THREAD_BLOCK   0   // a block of some other generation
+#define THREAD_LARGE   1   // a large object
+#define THREAD_MARKED  2   // a block of the compacted generation
+
+static ThreadWork    *thread_work;
+static W_             n_thread_work;
+static volatile StgWord next_thread_work;
+
+static CompactRegion *regions;
+static W_             n_regions;
+static volatile StgWord next_region;
+
+static void
+thread_marked_block (bdescr *bd)
+{
+    StgPtr p;
+    StgInfoTable *info;
+    StgWord iptr;
+
+    p = bd->start;
+    while (p < bd->free) {
+        while (p < bd->free && !is_marked(p,bd)) {
+            p++;
+        }
+        if (p >= bd->free) {
+            break;
+        }
+        iptr = get_threaded_info(p);
+        info = INFO_PTR_TO_STRUCT((StgInfoTable *)UNTAG_CLOSURE((StgClosure *)iptr));
+        p = thread_obj(info, p);
+    }
+}
+
+// pass 1
+static void
+thread_heap_par (void)
+{
+    StgWord i;
+    StgPtr p;
+    bdescr *bd;
+
+    while ((i = atomic_inc(&next_thread_work) - 1) < n_thread_work) {
+        bd = thread_work[i].bd;
+        switch (thread_work[i].kind) {
+        case THREAD_BLOCK:
+            for (p = bd->start; p < bd->free; ) {
+                ASSERT(LOOKS_LIKE_CLOSURE_PTR(p));
+                p = thread_obj(get_itbl((StgClosure *)p), p);
+            }
+            break;
+        case THREAD_LARGE:
+            thread_large(bd);
+            break;
+        case THREAD_MARKED:
+            thread_marked_block(bd);
+            break;
+        }
+    }
+}
+
+// pass 2
+static void
+forward_regions_par (void)
+{
+    StgWord i;
+    StgPtr p, free;
+    bdescr *bd, *free_bd;
+    StgInfoTable *info;
+    StgWord iptr;
+    W_ size;
+
+    while ((i = atomic_inc(&next_region) - 1) < n_regions) {
+        free_bd = regions[i].bd;
+        free = free_bd->start;
+
+        for (bd = regions[i].bd; bd != NULL; bd = bd->link) {
+            p = bd->start;
+
+            while (p < bd->free) {
+                while (p < bd->free && !is_marked(p,bd)) {
+                    p++;
+                }
+                if (p >= bd->free) {
+                    break;
+                }
+
+                // every field of the object has been threaded, so we
+                // can find out its size without unthreading it.
+                iptr = get_threaded_info(p);
+                info = INFO_PTR_TO_STRUCT((StgInfoTable *)UNTAG_CLOSURE((StgClosure *)iptr));
+                size = closure_sizeW_((StgClosure *)p, info);
+
+                if (free + size > free_bd->start + BLOCK_SIZE_W) {
+                    free_bd = free_bd->link;
+                    free = free_bd->start;
+                }
+
+                unthread(p, (StgWord)free + GET_CLOSURE_TAG((StgClosure *)iptr));
+                free += size;
+                p += size;
+            }
+        }
+    }
+}
+
+// pass 3: exactly the same walk as forward_regions_par(), now that the
+// info pointers are back in place.
+static void
+move_regions_par (void)
+{
+    StgWord i;
+    StgPtr p, free;
+    bdescr *bd, *free_bd;
+    StgInfoTable *info;
+    W_ size, free_blocks;
+
+    while ((i = atomic_inc(&next_region) - 1) < n_regions) {
+        free_bd = regions[i].bd;
+        free = free_bd->start;
+        free_blocks = 1;
+
+        for (bd = regions[i].bd; bd != NULL; bd = bd->link) {
+            p = bd->start;
+
+            while (p < bd->free) {
+                while (p < bd->free && !is_marked(p,bd)) {
+                    p++;
+                }
+                if (p >= bd->free) {
+                    break;
+                }
+
+                ASSERT(LOOKS_LIKE_INFO_PTR((StgWord)((StgClosure *)p)->header.info));
+                info = get_itbl((StgClosure *)p);
+                size = closure_sizeW_((StgClosure *)p, info);
+
+                if (free + size > free_bd->start + BLOCK_SIZE_W) {
+                    free_bd->free = free;
+                    free_bd = free_bd->link;
+                    free = free_bd->start;
+                    free_blocks++;
+                }
+
+                if (free != p) {
+                    move(free,p,size);
+                }
+
+                // relocate TSOs
+                if (info->type == STACK) {
+                    move_STACK((StgStack *)p, (StgStack *)free);
+                }
+
+                free += size;
+                p += size;
+            }
+        }
+
+        free_bd->free = free;
+        regions[i].free_bd  = free_bd;
+        regions[i].n_blocks = free_blocks;
+    }
+}
+
+static void
+add_thread_work (bdescr *bd, StgWord kind)
+{
+    for (; bd != NULL; bd = bd->link) {
+        if (thread_work != NULL) {
+            thread_work[n_thread_work].bd   = bd;
+            thread_work[n_thread_work].kind = kind;
+        }
+        n_thread_work++;
+    }
+}
+
+// Collect the blocks to be threaded in pass 1; called once with
+// thread_work == NULL to count them, and again to fill in the array.
+static void
+collect_thread_work (void)
+{
+    W_ g, n, w;
+    generation *gen;
+
+    n_thread_work = 0;
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        gen = &generations[g];
+        add_thread_work(gen->blocks, THREAD_BLOCK);
+        for (n = 0; n < n_capabilities; n++) {
+            for (w = g; w < n_gc_workspaces; w = nextGenWorkspace(g,w)) {
+                add_thread_work(gc_threads[n]->gens[w].todo_bd, THREAD_BLOCK);
+                add_thread_work(gc_threads[n]->gens[w].part_list, THREAD_BLOCK);
+            }
+        }
+        add_thread_work(gen->scavenged_large_objects, THREAD_LARGE);
+    }
+    add_thread_work(oldest_gen->old_blocks, THREAD_MARKED);
+}
+
+static void
+compact_par (generation *gen)
+{
+    W_ region_blocks, i, n, blocks;
+    bdescr *bd, *next, *last;
+
+    // Share out the threading.
+    thread_work = NULL;
+    collect_thread_work();
+    thread_work = stgMallocBytes(n_thread_work * sizeof(ThreadWork),
+                                 "compact_par");
+    collect_thread_work();
+
+    // Cut the compacted generation into regions.
+    region_blocks = gen->n_old_blocks / (n_gc_threads * REGIONS_PER_THREAD);
+    if (region_blocks < MIN_REGION_BLOCKS) {
+        region_blocks = MIN_REGION_BLOCKS;
+    }
+    n_regions = (gen->n_old_blocks + region_blocks - 1) / region_blocks;
+    regions = stgMallocBytes(n_regions * sizeof(CompactRegion), "compact_par");
+
+    n = 0;
+    for (bd = gen->old_blocks; bd != NULL; bd = next) {
+        regions[n].bd = bd;
+        last = bd;
+        for (i = 0; i < region_blocks && bd != NULL; i++) {
+            last = bd;
+            bd = bd->link;
+        }
+        next = bd;
+        last->link = NULL;
+        n++;
+    }
+    ASSERT(n <= n_regions);
+    n_regions = n;
+
+    debugTrace(DEBUG_gc, "compact_par: %ld blocks to thread, %ld regions",
+               (long)n_thread_work, (long)n_regions);
+
+    par_threading = rtsTrue;
+    next_thread_work = 0;
+    gcParallelPhase(thread_heap_par);
+    par_threading = rtsFalse;
+
+    next_region = 0;
+    gcParallelPhase(forward_regions_par);
+
+    next_region = 0;
+    gcParallelPhase(move_regions_par);
+
+    // Put the regions back together, dropping the blocks that are no
+    // longer needed.
+    gen->old_blocks = NULL;
+    last = NULL;
+    blocks = 0;
+    for (n = 0; n < n_regions; n++) {
+        bd = regions[n].free_bd;
+        if (bd->link != NULL) {
+            freeChain(bd->link);
+            bd->link = NULL;
+        }
+        if (regions[n].n_blocks == 1 && bd->free == bd->start) {
+            // nothing survived in this region
+            freeGroup(bd);
+            continue;
+        }
+        if (last == NULL) {
+            gen->old_blocks = regions[n].bd;
+        } else {
+            last->link = regions[n].bd;
+        }
+        last = bd;
+        blocks += regions[n].n_blocks;
+    }
+
+    debugTrace(DEBUG_gc,
+               "compact_par: %d (old: %d blocks, now %d blocks)",
+               gen->no, gen->n_old_blocks, blocks);
+    gen->n_old_blocks = blocks;
+
+    stgFree(thread_work);
+    thread_work = NULL;
+    stgFree(regions);
+    regions = NULL;
+}
+
 void
 compact(StgClosure *static_objects)
 {
-    W_ n, g, blocks;
+    W_ n, g, w, blocks;
     generation *gen;
 
     // 1. thread the roots
@@ -917,11 +1289,13 @@ compact(StgClosure *static_objects)
     markScheduler((evac_fn)thread_root, NULL);
 
     // the weak pointer lists...
-    if (weak_ptr_list != NULL) {
-	thread((void *)&weak_ptr_list);
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        if (generations[g].weak_ptr_list != NULL) {
+            thread((void *)&generations[g].weak_ptr_list);
+        }
     }
-    if (old_weak_ptr_list != NULL) {
-	thread((void *)&old_weak_ptr_list); // tmp
+    if (dead_weak_ptr_list != NULL) {
+	thread((void *)&dead_weak_ptr_list); // tmp
     }
 
     // mutable lists
@@ -969,6 +1343,12 @@ compact(StgClosure *static_objects)
     // the CAF list (used by GHCi)
     markCAFs((evac_fn)thread_root, NULL);
 
+    // with several GC threads, the rest is done by compact_par()
+    if (n_gc_threads > 1 && oldest_gen->old_blocks != NULL) {
+        compact_par(oldest_gen);
+        return;
+    }
+
     // 2. update forward ptrs
     for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
         gen = &generations[g];
@@ -976,8 +1356,10 @@ compact(StgClosure *static_objects)
 
         update_fwd(gen->blocks);
         for (n = 0; n < n_capabilities; n++) {
-            update_fwd(gc_threads[n]->gens[g].todo_bd);
-            update_fwd(gc_threads[n]->gens[g].part_list);
+            for (w = g; w < n_gc_workspaces; w = nextGenWorkspace(g,w)) {
+                update_fwd(gc_threads[n]->gens[w].todo_bd);
+                update_fwd(gc_threads[n]->gens[w].part_list);
+            }
         }
         update_fwd_large(gen->scavenged_large_objects);
         if (g == RtsFlags.GcFlags.generations-1 && gen->old_blocks != NULL) {
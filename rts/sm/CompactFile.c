@@ -0,0 +1,667 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Saving compact regions to a file, and mapping them back in.
+ *
+ * A compact region (see CompactRegion.c) has no pointers in it except
+ * to itself and to static constructors, so it can be written out as it
+ * is and loaded again by a later run of the same program.  A table
+ * that takes a long time to build can be built once, compacted and
+ * saved, and then loaded at startup instead of being rebuilt.
+ *
+ * The file starts with a header and the table of the region's groups,
+ * giving the address each group was at, and then has the contents of
+ * each group, starting on a block boundary.  loadCompactRegion() takes
+ * a new block group from the block allocator for each group of the
+ * file, just big enough for its objects (the region won't grow), so
+ * as far as HEAP_ALLOCED() and the rest of the storage manager are
+ * concerned the region is an ordinary part of the heap.  The sizes in
+ * the file must fit in the file itself, so that a damaged file can't
+ * ask for more memory than it takes up.
+ * It then maps the file over the group, copy-on-write, with
+ * osMapFile().  The pages that are never written (the payloads of
+ * large byte arrays, typically) stay shared with the OS's file cache.
+ * If the file can't be mapped, it is read in instead.
+ *
+ * The groups end up at new addresses, so the pointers in the region
+ * are relocated after it is loaded.  A pointer into the region moves
+ * with the group it points into.  Info pointers and pointers to static
+ * constructors move by however far the program's code and data have
+ * moved (we compare the addresses of an RTS info table and closure
+ * with those recorded in the header), which means that the file must
+ * be loaded by the same executable that saved it, statically linked.
+ * The header records a fingerprint of the executable (see
+ * osProgramImage()), and a file saved by any other is refused.  Where
+ * the OS can't give us one, regions can't be saved or loaded.
+ *
+ * The file may still have been damaged since, so every object is
+ * checked as it is relocated: its info pointer must point into the
+ * executable, at an info table of a type that can be in a region, its
+ * size must fit in its group, it must be the only object in a group
+ * bigger than a megablock, and each of its pointers must point to the
+ * start of an object in the region or to a static constructor.
+ * Checking reads every page of the region, but only the pages that
+ * relocation writes to are copied; if nothing has moved, which can
+ * happen with a fixed heap base (+RTS -xb), nothing is written and
+ * the whole region stays shared with the file cache.
+ *
+ * With profiling, closures point to cost-centre stacks that are
+ * malloc'd, so regions can't be saved or loaded.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Storage.h"
+#include "Capability.h"
+#include "CompactRegion.h"
+#include "CompactFile.h"
+#include "OSMem.h"
+#include "RtsUtils.h"
+#include "Trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#define COMPACT_FILE_MAGIC   0x47484352 /* "GHCR" */
+#define COMPACT_FILE_VERSION 2
+
+typedef struct {
+    StgWord32 magic;
+    StgWord32 version;
+    StgWord32 word_size;        // sizeof(W_)
+    StgWord32 block_size;       // BLOCK_SIZE
+    W_        n_groups;
+    W_        root;             // the root closure (tagged), where it was
+    W_        info_base;        // &stg_ARR_WORDS_info when saved
+    W_        data_base;        // &stg_END_TSO_QUEUE_closure when saved
+    StgWord64 fingerprint;      // of the executable (osProgramImage())
+} CompactFileHeader;
+
+typedef struct {
+    W_ start;                   // where the group was
+    W_ blocks;                  // its size
+    W_ words;                   // words in use
+} CompactFileGroup;
+
+// Where the groups of a loaded region have moved to, sorted by
+// old_start
+typedef struct {
+    W_  old_start, old_end;
+    W_  new_start;
+    W_  first;                  // offset (in words) of the first object
+    W_  words;                  // offset of the end of the objects
+    W_ *starts;                 // bitmap of the words that start objects
+    rtsBool big;                // bigger than a megablock: one object only
+} Reloc;
+
+typedef struct {
+    Reloc       *relocs;
+    W_           n_relocs;
+    W_           code_delta;    // for info pointers and static closures
+    ProgramImage image;
+} RelocState;
+
+#ifndef PROFILING
+
+// The size of the header and group table in the file
+STATIC_INLINE W_
+headerBytes (W_ n_groups)
+{
+    return BLOCK_ROUND_UP(sizeof(CompactFileHeader) +
+                          n_groups * sizeof(CompactFileGroup));
+}
+
+// Write n bytes of zeros, up to a block boundary
+static rtsBool
+writePadding (FILE *f, W_ n)
+{
+    static const char zeros[256] = { 0 };
+    W_ k;
+
+    while (n > 0) {
+        k = stg_min(n, sizeof(zeros));
+        if (fwrite(zeros, 1, k, f) != k) return rtsFalse;
+        n -= k;
+    }
+    return rtsTrue;
+}
+
+/* -----------------------------------------------------------------------------
+   Saving
+   -------------------------------------------------------------------------- */
+
+rtsBool
+saveCompactRegion (StgClosure *root, const char *path)
+{
+    StgClosure *q;
+    CompactRegion *region;
+    CompactGroup *group;
+    CompactFileHeader hdr;
+    CompactFileGroup *groups;
+    ProgramImage image;
+    bdescr *bd;
+    W_ n, i, bytes;
+    FILE *f;
+    rtsBool ok;
+
+    q = UNTAG_CLOSURE(root);
+    if (!HEAP_ALLOCED(q) || !(Bdescr((P_)q)->flags & BF_COMPACT_REGION)) {
+        return rtsFalse;
+    }
+    // without this, the file couldn't be checked when it is loaded
+    if (!osProgramImage(&image)) {
+        return rtsFalse;
+    }
+    region = (CompactRegion *)compactRegionHead((P_)q)->start;
+
+    n = 0;
+    for (group = &region->group; group != NULL; group = group->next) {
+        n++;
+    }
+
+    hdr.magic      = COMPACT_FILE_MAGIC;
+    hdr.version    = COMPACT_FILE_VERSION;
+    hdr.word_size  = sizeof(W_);
+    hdr.block_size = BLOCK_SIZE;
+    hdr.n_groups   = n;
+    hdr.root       = (W_)root;
+    hdr.info_base  = (W_)&stg_ARR_WORDS_info;
+    hdr.data_base  = (W_)&stg_END_TSO_QUEUE_closure;
+    hdr.fingerprint = image.fingerprint;
+
+    groups = stgMallocBytes(n * sizeof(CompactFileGroup), "saveCompactRegion");
+    for (i = 0, group = &region->group; group != NULL;
+         i++, group = group->next) {
+        bd = Bdescr((StgPtr)group);
+        groups[i].start  = (W_)bd->start;
+        groups[i].blocks = bd->blocks;
+        groups[i].words  = bd->free - bd->start;
+    }
+
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        stgFree(groups);
+        return rtsFalse;
+    }
+
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+        && fwrite(groups, sizeof(CompactFileGroup), n, f) == n
+        && writePadding(f, headerBytes(n) - sizeof(hdr)
+                           - n * sizeof(CompactFileGroup));
+
+    for (i = 0; ok && i < n; i++) {
+        bytes = groups[i].words * sizeof(W_);
+        ok = fwrite((void *)groups[i].start, 1, bytes, f) == bytes
+            && writePadding(f, BLOCK_ROUND_UP(bytes) - bytes);
+    }
+
+    if (fclose(f) != 0) ok = rtsFalse;
+    stgFree(groups);
+
+    debugTrace(DEBUG_gc, "compact: saved a region of %" FMT_Word
+               " groups to %s%s", n, path, ok ? "" : " (failed)");
+    return ok;
+}
+
+/* -----------------------------------------------------------------------------
+   Loading
+   -------------------------------------------------------------------------- */
+
+static int
+cmpReloc (const void *a, const void *b)
+{
+    W_ x = ((const Reloc *)a)->old_start;
+    W_ y = ((const Reloc *)b)->old_start;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// The group that the old address q was in, or NULL if it wasn't in
+// the region
+static Reloc *
+findReloc (RelocState *r, W_ q)
+{
+    W_ lo, hi, mid;
+
+    lo = 0;
+    hi = r->n_relocs;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (q < r->relocs[mid].old_start) {
+            hi = mid;
+        } else if (q >= r->relocs[mid].old_end) {
+            lo = mid + 1;
+        } else {
+            return &r->relocs[mid];
+        }
+    }
+    return NULL;
+}
+
+// Is [p, p+size) in the memory that the executable is loaded into?
+static rtsBool
+inImage (RelocState *r, W_ p, W_ size)
+{
+    nat i;
+
+    for (i = 0; i < r->image.n_segments; i++) {
+        if (p >= r->image.segments[i].start
+            && size <= r->image.segments[i].end - p) {
+            return rtsTrue;
+        }
+    }
+    return rtsFalse;
+}
+
+// Could info be an info pointer of the program's?  We can't tell for
+// sure, but at least the info table must be there to be read.
+static rtsBool
+validInfo (RelocState *r, const StgInfoTable *info)
+{
+    return (W_)info % sizeof(W_) == 0
+        && inImage(r, (W_)INFO_PTR_TO_STRUCT(info), sizeof(StgInfoTable));
+}
+
+STATIC_INLINE void
+markStart (Reloc *rel, W_ off)
+{
+    rel->starts[off / BITS_IN(W_)] |= (W_)1 << (off % BITS_IN(W_));
+}
+
+STATIC_INLINE rtsBool
+isStart (Reloc *rel, W_ off)
+{
+    return (rel->starts[off / BITS_IN(W_)] >> (off % BITS_IN(W_))) & 1;
+}
+
+// Relocate the pointer *p, checking that it points to an object in
+// the region, or to a static constructor of the program (the only
+// static closures that compactRegion() lets a region point to).
+static rtsBool
+relocatePtr (RelocState *r, StgClosure **p)
+{
+    StgWord tag;
+    StgClosure *c;
+    const StgInfoTable *info;
+    W_ q, off;
+    Reloc *rel;
+
+    tag = GET_CLOSURE_TAG(*p);
+    q = (W_)UNTAG_CLOSURE(*p);
+    if (q % sizeof(W_) != 0) return rtsFalse;
+
+    rel = findReloc(r, q);
+    if (rel != NULL) {
+        off = (q - rel->old_start) / sizeof(W_);
+        if (off >= rel->words || !isStart(rel, off)) {
+            return rtsFalse;
+        }
+        q = q - rel->old_start + rel->new_start;
+    } else {
+        q = q + r->code_delta;
+        if (!inImage(r, q, sizeof(StgHeader))) return rtsFalse;
+        info = ((StgClosure *)q)->header.info;
+        if (!validInfo(r, info)
+            || INFO_PTR_TO_STRUCT(info)->type != CONSTR_NOCAF_STATIC
+            || !inImage(r, q, (sizeofW(StgHeader) +
+                               INFO_PTR_TO_STRUCT(info)->layout.payload.ptrs +
+                               INFO_PTR_TO_STRUCT(info)->layout.payload.nptrs)
+                              * sizeof(W_))) {
+            return rtsFalse;
+        }
+    }
+
+    // Don't write if nothing has moved: the page would be copied.
+    c = TAG_CLOSURE(tag, (StgClosure *)q);
+    if (c != *p) *p = c;
+    return rtsTrue;
+}
+
+// Check the objects of a group, relocating their info pointers and
+// marking where each one starts.  Returns rtsFalse if it finds
+// something that can't be in a region.
+static rtsBool
+checkGroup (RelocState *r, Reloc *rel)
+{
+    StgPtr p, start, end;
+    StgClosure *q;
+    const StgInfoTable *info;
+    StgMutArrPtrs *arr;
+    W_ size;
+
+    start = (StgPtr)rel->new_start;
+    end = Bdescr(start)->free;
+
+    for (p = start + rel->first; p < end; p += size) {
+        q = (StgClosure *)p;
+        if ((W_)(end - p) < sizeofW(StgHeader) + 1) return rtsFalse;
+        // Bdescr() doesn't work past the first megablock of a group,
+        // so (as in regionAlloc()) a big group has just one object.
+        if (rel->big && p != start + rel->first) return rtsFalse;
+
+        info = (StgInfoTable *)((W_)q->header.info + r->code_delta);
+        if (!validInfo(r, info)) return rtsFalse;
+        if (info != q->header.info) SET_INFO(q, info);
+
+        // The size of each object must be checked before we use it.
+        switch (get_itbl(q)->type) {
+        case CONSTR:
+        case CONSTR_1_0:
+        case CONSTR_0_1:
+        case CONSTR_2_0:
+        case CONSTR_1_1:
+        case CONSTR_0_2:
+            break;
+
+        case ARR_WORDS:
+            if (info != &stg_ARR_WORDS_info
+                || (W_)(end - p) < sizeofW(StgArrWords)
+                || ((StgArrWords *)q)->bytes / sizeof(W_) > (W_)(end - p)) {
+                return rtsFalse;
+            }
+            break;
+
+        case MUT_ARR_PTRS_FROZEN:
+            arr = (StgMutArrPtrs *)q;
+            if (info != &stg_MUT_ARR_PTRS_FROZEN_info
+                || (W_)(end - p) < sizeofW(StgMutArrPtrs)
+                || arr->ptrs > (W_)(end - p)
+                || arr->size != arr->ptrs + mutArrPtrsCardTableSize(arr->ptrs)) {
+                return rtsFalse;
+            }
+            break;
+
+        default:
+            return rtsFalse;
+        }
+
+        size = closure_sizeW(q);
+        if (size > (W_)(end - p)) return rtsFalse;
+        markStart(rel, p - start);
+    }
+    return rtsTrue;
+}
+
+// Relocate the pointers in the objects of a group, which checkGroup()
+// has looked at already.
+static rtsBool
+relocateGroup (RelocState *r, Reloc *rel)
+{
+    StgPtr p, start, end;
+    StgClosure *q;
+    const StgInfoTable *info;
+    StgMutArrPtrs *arr;
+    W_ i;
+
+    start = (StgPtr)rel->new_start;
+    end = Bdescr(start)->free;
+
+    for (p = start + rel->first; p < end; p += closure_sizeW(q)) {
+        q = (StgClosure *)p;
+        info = get_itbl(q);
+
+        switch (info->type) {
+        case CONSTR:
+        case CONSTR_1_0:
+        case CONSTR_0_1:
+        case CONSTR_2_0:
+        case CONSTR_1_1:
+        case CONSTR_0_2:
+            for (i = 0; i < info->layout.payload.ptrs; i++) {
+                if (!relocatePtr(r, &q->payload[i])) return rtsFalse;
+            }
+            break;
+
+        case MUT_ARR_PTRS_FROZEN:
+            arr = (StgMutArrPtrs *)q;
+            for (i = 0; i < arr->ptrs; i++) {
+                if (!relocatePtr(r, &arr->payload[i])) return rtsFalse;
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+    return rtsTrue;
+}
+
+// Find the size of the file, if we can.
+static rtsBool
+fileSize (FILE *f STG_UNUSED, StgWord64 *bytes STG_UNUSED)
+{
+#ifdef HAVE_SYS_STAT_H
+    struct stat st;
+    if (fstat(fileno(f), &st) == 0) {
+        *bytes = (StgWord64)st.st_size;
+        return rtsTrue;
+    }
+#endif
+    return rtsFalse;
+}
+
+// The blocks that the objects of a group need.  A loaded region never
+// grows, so this is all we allocate, whatever the file says.
+STATIC_INLINE W_
+groupBlocks (CompactFileGroup *g)
+{
+    return BLOCK_ROUND_UP(g->words * sizeof(W_)) / BLOCK_SIZE;
+}
+
+static rtsBool
+validHeader (CompactFileHeader *hdr)
+{
+    return hdr->magic == COMPACT_FILE_MAGIC
+        && hdr->version == COMPACT_FILE_VERSION
+        && hdr->word_size == sizeof(W_)
+        && hdr->block_size == BLOCK_SIZE
+        && hdr->n_groups > 0
+        && hdr->n_groups <= HS_INT32_MAX / sizeof(CompactFileGroup);
+}
+
+static rtsBool
+validGroup (CompactFileGroup *g, rtsBool first)
+{
+    return g->start % BLOCK_SIZE == 0
+        && g->blocks > 0
+        && g->blocks <= (HS_WORD_MAX - g->start) / BLOCK_SIZE
+        && g->words <= g->blocks * BLOCK_SIZE_W
+        && g->words / BITS_IN(W_) < HS_INT32_MAX / sizeof(W_) - 1
+        && g->words >= (first ? sizeofW(CompactRegion)
+                              : sizeofW(CompactGroup))
+        // regionAlloc() only leaves the end of a group unused if the
+        // group fits in a megablock
+        && (g->blocks == groupBlocks(g) || g->blocks <= BLOCKS_PER_MBLOCK);
+}
+
+StgClosure *
+loadCompactRegion (Capability *cap, const char *path)
+{
+    CompactFileHeader hdr;
+    CompactFileGroup *groups = NULL;
+    CompactRegion *region = NULL;
+    CompactGroup *group, *last = NULL;
+    RelocState r;
+    StgClosure *root = NULL;
+    bdescr *bd;
+    StgWord64 off, file_size;
+    StgClosure *p;
+    W_ i, bytes, size, mapped, blocks;
+    rtsBool map, ok;
+    FILE *f;
+
+    r.relocs = NULL;
+    r.n_relocs = 0;
+
+    f = fopen(path, "rb");
+    if (f == NULL) return NULL;
+
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || !validHeader(&hdr)) {
+        goto done;
+    }
+
+    // The file must have been saved by this executable, as nothing
+    // else would know what its info pointers and static closures are.
+    if (!osProgramImage(&r.image) || r.image.fingerprint != hdr.fingerprint) {
+        goto done;
+    }
+
+    // The RTS's code and data should have moved together; if they
+    // haven't, we can't relocate the info pointers and static closures.
+    r.code_delta = (W_)&stg_ARR_WORDS_info - hdr.info_base;
+    if ((W_)&stg_END_TSO_QUEUE_closure - hdr.data_base != r.code_delta) {
+        goto done;
+    }
+
+    groups = stgMallocBytes(hdr.n_groups * sizeof(CompactFileGroup),
+                            "loadCompactRegion");
+    if (fread(groups, sizeof(CompactFileGroup), hdr.n_groups, f)
+        != hdr.n_groups) {
+        goto done;
+    }
+    off = headerBytes(hdr.n_groups);
+    blocks = 0;
+    for (i = 0; i < hdr.n_groups; i++) {
+        if (!validGroup(&groups[i], i == 0)) goto done;
+        bytes = BLOCK_ROUND_UP(groups[i].words * sizeof(W_));
+        off += bytes;
+        blocks += groupBlocks(&groups[i]);
+        // don't let a bad file ask for more than the heap can have
+        if (off < bytes || blocks < groupBlocks(&groups[i]) ||
+            (RtsFlags.GcFlags.maxHeapSize != 0 &&
+             blocks > RtsFlags.GcFlags.maxHeapSize)) {
+            goto done;
+        }
+    }
+
+    // Nor for more memory than the file has data for.  This also
+    // means that all of the file is there to be mapped (touching a page
+    // past the end of the file would be fatal).
+    if (!fileSize(f, &file_size) || file_size < off) goto done;
+
+    // Map the file if we can, which needs pages no bigger than a block.
+    map = getPageSize() <= BLOCK_SIZE;
+
+    r.relocs = stgMallocBytes(hdr.n_groups * sizeof(Reloc),
+                              "loadCompactRegion");
+
+    off = headerBytes(hdr.n_groups);
+    if (fseek(f, off - sizeof(hdr) - hdr.n_groups * sizeof(CompactFileGroup),
+              SEEK_CUR) != 0) {
+        goto done;
+    }
+
+    ok = rtsTrue;
+    for (i = 0; i < hdr.n_groups; i++) {
+        bytes = groups[i].words * sizeof(W_);
+        size  = BLOCK_ROUND_UP(bytes);
+        bd = allocCompactGroup(groupBlocks(&groups[i]));
+
+        mapped = 0;
+        if (map && osMapFile(bd->start, size, fileno(f), off)) {
+            mapped = size;
+            ok = fseek(f, size, SEEK_CUR) == 0;
+        } else {
+            ok = fread(bd->start, 1, bytes, f) == bytes
+                && fseek(f, size - bytes, SEEK_CUR) == 0;
+        }
+        off += size;
+
+        // (over the header that came from the file)
+        group = (CompactGroup *)bd->start;
+        if (i == 0) {
+            region = (CompactRegion *)group;
+            region->blocks = 0;
+        } else {
+            last->next = group;
+        }
+        group->region = region;
+        group->next   = NULL;
+        group->mapped = mapped;
+        last = group;
+        region->blocks += bd->blocks;
+        bd->free = bd->start + groups[i].words;
+
+        if (!ok) goto done;
+
+        r.relocs[i].old_start = groups[i].start;
+        r.relocs[i].old_end   = groups[i].start + groups[i].blocks * BLOCK_SIZE;
+        r.relocs[i].new_start = (W_)bd->start;
+        r.relocs[i].first     = i == 0 ? sizeofW(CompactRegion)
+                                       : sizeofW(CompactGroup);
+        r.relocs[i].words     = groups[i].words;
+        r.relocs[i].big       = bd->blocks > BLOCKS_PER_MBLOCK;
+        r.relocs[i].starts    = stgCallocBytes(groups[i].words / BITS_IN(W_) + 1,
+                                               sizeof(W_), "loadCompactRegion");
+        r.n_relocs++;
+    }
+    region->last = last;
+
+    qsort(r.relocs, r.n_relocs, sizeof(Reloc), cmpReloc);
+    for (i = 1; i < r.n_relocs; i++) {
+        if (r.relocs[i].old_start < r.relocs[i-1].old_end) goto done;
+    }
+
+    // Every object is checked, even if nothing has moved, so that a
+    // damaged file can't give us a pointer to anything but the
+    // region's own objects and the program's static constructors.
+    // This reads every page of the file, but only the pages that we
+    // write to are copied.
+    for (i = 0; i < r.n_relocs; i++) {
+        if (!checkGroup(&r, &r.relocs[i])) goto done;
+    }
+    for (i = 0; i < r.n_relocs; i++) {
+        if (!relocateGroup(&r, &r.relocs[i])) goto done;
+    }
+
+    // The root must be one of the region's objects.
+    p = (StgClosure *)hdr.root;
+    if (findReloc(&r, (W_)UNTAG_CLOSURE(p)) == NULL || !relocatePtr(&r, &p)) {
+        goto done;
+    }
+    root = p;
+
+    debugTrace(DEBUG_gc, "compact: loaded a region of %" FMT_Word
+               " blocks from %s (%s)", region->blocks, path,
+               map ? "mapped" : "read");
+
+    addCompactRegion(cap, region);
+
+done:
+    if (root == NULL && region != NULL) {
+        ACQUIRE_SM_LOCK;
+        freeCompactRegion(Bdescr((StgPtr)region));
+        RELEASE_SM_LOCK;
+    }
+    for (i = 0; i < r.n_relocs; i++) {
+        stgFree(r.relocs[i].starts);
+    }
+    if (r.relocs != NULL) stgFree(r.relocs);
+    if (groups != NULL) stgFree(groups);
+    fclose(f);
+    return root;
+}
+
+#else /* PROFILING */
+
+rtsBool
+saveCompactRegion (StgClosure *root STG_UNUSED, const char *path STG_UNUSED)
+{
+    return rtsFalse;
+}
+
+StgClosure *
+loadCompactRegion (Capability *cap STG_UNUSED, const char *path STG_UNUSED)
+{
+    return NULL;
+}
+
+#endif /* PROFILING */
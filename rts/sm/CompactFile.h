@@ -0,0 +1,23 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Saving compact regions to a file, and mapping them back in.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SM_COMPACTFILE_H
+#define SM_COMPACTFILE_H
+
+#include "BeginPrivate.h"
+
+// Write the compact region that root points into to the file path.
+rtsBool     saveCompactRegion (StgClosure *root, const char *path);
+
+// Load a region saved by saveCompactRegion() into g0, and return its
+// root, or NULL if the file can't be loaded.
+StgClosure *loadCompactRegion (Capability *cap, const char *path);
+
+#include "EndPrivate.h"
+
+#endif /* SM_COMPACTFILE_H */
@@ -0,0 +1,453 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Compact regions: immutable data that the GC doesn't trace.
+ *
+ * A program that keeps a large, fully-evaluated structure around for
+ * a long time (a lookup table, a parsed configuration, an index) pays
+ * for copying or marking all of it in every major GC, although none of
+ * it can ever change or point to anything new.  compact# copies such a
+ * structure into a region of its own, and returns the copy.  Nothing
+ * in the region points outside it (except to static constructors), so
+ * the GC treats the region as a single object, much like a large
+ * object that doesn't need scavenging: a pointer to anything in the
+ * region keeps the whole region alive, and evacuating it just moves
+ * its first block descriptor from one list to another (see
+ * evacuate_compact() in Evac.c).  The objects in it are never looked
+ * at again, and the region is freed in one go when nothing points
+ * into it any more.
+ *
+ * Only constructors, byte arrays and frozen arrays of pointers can go
+ * in a region.  Indirections and evaluated thunks are followed.  If
+ * the structure contains anything else (an unevaluated thunk, a
+ * function, a mutable array of pointers), the copy is abandoned and
+ * compact# says so.  So are pinned byte arrays: something may hold an
+ * Addr# into the original, which would be left pointing at memory
+ * that is freed or reused once the original dies.  Sharing within the
+ * structure is preserved, cycles included.
+ *
+ * A MutableByteArray# is an ARR_WORDS just like a ByteArray#, and
+ * there's no telling them apart, so we copy both.  Writes to the
+ * original of a MutableByteArray# aren't seen through the copy, though,
+ * so compact# tells its caller when it has copied any byte arrays, and
+ * it is up to the caller to know that none of them were mutable.
+ *
+ * The copy is made Cheney-style, by scanning the region's groups in
+ * the order they were allocated; a hash table maps the objects copied
+ * so far to their copies.  The Capability is held throughout, so a
+ * very large structure holds up the next GC until it is done.
+ *
+ * A region can also be saved to a file, and mapped back into the heap
+ * by a later run of the program (see CompactFile.c).
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Storage.h"
+#include "Capability.h"
+#include "CompactRegion.h"
+#include "BlockAlloc.h"
+#include "OSMem.h"
+#include "RtsUtils.h"
+#include "Hash.h"
+#include "Trace.h"
+
+#include <string.h>
+
+// The groups of a region start at this many blocks, and double in
+// size up to half a megablock.  A group bigger than a megablock holds
+// just the one object it was made for, because Bdescr() doesn't work
+// past its first megablock.
+#define REGION_MIN_GROUP_BLOCKS 16
+#define REGION_MAX_GROUP_BLOCKS (BLOCKS_PER_MBLOCK / 2)
+
+typedef struct {
+    CompactRegion *region;
+    HashTable     *copies;      // original -> copy
+    rtsBool        byte_arrays; // copied an ARR_WORDS
+} CopyState;
+
+bdescr *
+allocCompactGroup (W_ blocks)
+{
+    bdescr *bd, *x;
+    W_ i, n;
+
+    bd = allocGroup_lock(blocks);
+    // The descriptors past the first megablock of a megablock group
+    // don't exist.
+    n = stg_min(bd->blocks, BLOCKS_PER_MBLOCK);
+    for (i = 0, x = bd; i < n; i++, x++) {
+        x->flags = BF_COMPACT_REGION;
+        initBdescr(x, g0, g0->to);
+    }
+    return bd;
+}
+
+static CompactRegion *
+newRegion (void)
+{
+    bdescr *bd;
+    CompactRegion *region;
+
+    bd = allocCompactGroup(REGION_MIN_GROUP_BLOCKS);
+    region = (CompactRegion *)bd->start;
+    region->group.region = region;
+    region->group.next   = NULL;
+    region->group.mapped = 0;
+    region->last         = &region->group;
+    region->blocks       = bd->blocks;
+    region->group_blocks = stg_min(REGION_MIN_GROUP_BLOCKS * 2,
+                                   REGION_MAX_GROUP_BLOCKS);
+    bd->free = bd->start + sizeofW(CompactRegion);
+    return region;
+}
+
+static StgPtr
+regionAlloc (CompactRegion *region, W_ size)
+{
+    bdescr *bd;
+    CompactGroup *group;
+    W_ blocks;
+    StgPtr p;
+
+    bd = Bdescr((StgPtr)region->last);
+
+    if (bd->blocks > BLOCKS_PER_MBLOCK ||
+        bd->free + size > bd->start + bd->blocks * BLOCK_SIZE_W) {
+        blocks = BLOCK_ROUND_UP((sizeofW(CompactGroup) + size) * sizeof(W_))
+            / BLOCK_SIZE;
+        blocks = stg_max(blocks, region->group_blocks);
+        region->group_blocks = stg_min(region->group_blocks * 2,
+                                       REGION_MAX_GROUP_BLOCKS);
+
+        bd = allocCompactGroup(blocks);
+        group = (CompactGroup *)bd->start;
+        group->region = region;
+        group->next   = NULL;
+        group->mapped = 0;
+        region->last->next = group;
+        region->last  = group;
+        region->blocks += bd->blocks;
+        bd->free = bd->start + sizeofW(CompactGroup);
+    }
+
+    p = bd->free;
+    bd->free += size;
+    return p;
+}
+
+/* -----------------------------------------------------------------------------
+   Copying: point *p at the copy of the closure it points to, copying
+   the closure into the region if it isn't there already.  The fields
+   of the copy still point to the originals until the copy is scanned.
+   Returns rtsFalse if the closure can't go in a region.
+   -------------------------------------------------------------------------- */
+
+static rtsBool
+copyClosure (CopyState *s, StgClosure **p)
+{
+    StgClosure *q, *r, *copy;
+    const StgInfoTable *info;
+    StgWord tag;
+    W_ size;
+
+    q = *p;
+
+loop:
+    tag = GET_CLOSURE_TAG(q);
+    q = UNTAG_CLOSURE(q);
+
+    if (!HEAP_ALLOCED(q)) {
+        info = get_itbl(q);
+        switch (info->type) {
+        case CONSTR_NOCAF_STATIC:
+            // has no free variables, so we can point to it
+            *p = TAG_CLOSURE(tag, q);
+            return rtsTrue;
+        case IND_STATIC:
+            q = ((StgIndStatic *)q)->indirectee;
+            goto loop;
+        default:
+            // CONSTR_STATIC may refer to a CAF, which we can't keep
+            // alive from here
+            return rtsFalse;
+        }
+    }
+
+    // Already in this region?  A closure in another region is copied
+    // like any other: the GC wouldn't see the pointer between them.
+    if ((Bdescr((P_)q)->flags & BF_COMPACT_REGION) &&
+        compactRegionHead((P_)q) == Bdescr((P_)s->region)) {
+        *p = TAG_CLOSURE(tag, q);
+        return rtsTrue;
+    }
+
+    copy = lookupHashTable(s->copies, (StgWord)q);
+    if (copy != NULL) {
+        *p = TAG_CLOSURE(tag, copy);
+        return rtsTrue;
+    }
+
+    info = get_itbl(q);
+    switch (info->type) {
+
+    case IND:
+    case IND_PERM:
+        q = ((StgInd *)q)->indirectee;
+        goto loop;
+
+    case BLACKHOLE:
+        // an evaluated thunk, unless a thread is still evaluating it
+        r = ((StgInd *)q)->indirectee;
+        if (GET_CLOSURE_TAG(r) == 0) {
+            info = get_itbl(r);
+            if (info->type == TSO || info->type == BLOCKING_QUEUE) {
+                return rtsFalse;
+            }
+        }
+        q = r;
+        goto loop;
+
+    case ARR_WORDS:
+        // A pinned array may be pointed to by an Addr# (the unpacked
+        // pointer in a ByteString, say), which we couldn't update.
+        if (Bdescr((P_)q)->flags & BF_PINNED) return rtsFalse;
+        s->byte_arrays = rtsTrue;
+        // fall through
+    case CONSTR:
+    case CONSTR_1_0:
+    case CONSTR_0_1:
+    case CONSTR_2_0:
+    case CONSTR_1_1:
+    case CONSTR_0_2:
+    case MUT_ARR_PTRS_FROZEN:
+    case MUT_ARR_PTRS_FROZEN0:
+        size = closure_sizeW(q);
+        copy = (StgClosure *)regionAlloc(s->region, size);
+        memcpy(copy, q, size * sizeof(W_));
+        if (info->type == MUT_ARR_PTRS_FROZEN0) {
+            // The copy is not on any mutable list, and never will be
+            StgMutArrPtrs *arr = (StgMutArrPtrs *)copy;
+            SET_INFO(copy, &stg_MUT_ARR_PTRS_FROZEN_info);
+            memset(mutArrPtrsCard(arr, 0), 0,
+                   mutArrPtrsCardTableSize(arr->ptrs) * sizeof(W_));
+        }
+        insertHashTable(s->copies, (StgWord)q, copy);
+        *p = TAG_CLOSURE(tag, copy);
+        return rtsTrue;
+
+    default:
+        return rtsFalse;
+    }
+}
+
+static rtsBool
+scanClosure (CopyState *s, StgClosure *q)
+{
+    const StgInfoTable *info;
+    StgMutArrPtrs *arr;
+    W_ i;
+
+    info = get_itbl(q);
+    switch (info->type) {
+
+    case CONSTR:
+    case CONSTR_1_0:
+    case CONSTR_0_1:
+    case CONSTR_2_0:
+    case CONSTR_1_1:
+    case CONSTR_0_2:
+        for (i = 0; i < info->layout.payload.ptrs; i++) {
+            if (!copyClosure(s, &q->payload[i])) return rtsFalse;
+        }
+        return rtsTrue;
+
+    case MUT_ARR_PTRS_FROZEN:
+        arr = (StgMutArrPtrs *)q;
+        for (i = 0; i < arr->ptrs; i++) {
+            if (!copyClosure(s, &arr->payload[i])) return rtsFalse;
+        }
+        return rtsTrue;
+
+    case ARR_WORDS:
+        return rtsTrue;
+
+    default:
+        barf("scanClosure: strange closure type %d", (int)info->type);
+    }
+}
+
+static rtsBool
+copyRegion (CopyState *s, StgClosure **root)
+{
+    CompactGroup *group;
+    bdescr *bd;
+    StgPtr p;
+
+    if (!copyClosure(s, root)) return rtsFalse;
+
+    // The last group grows as we go, and more groups are added after
+    // it, so this picks up everything copied along the way.
+    for (group = &s->region->group; group != NULL; group = group->next) {
+        bd = Bdescr((StgPtr)group);
+        if (group == &s->region->group) {
+            p = (StgPtr)s->region + sizeofW(CompactRegion);
+        } else {
+            p = (StgPtr)group + sizeofW(CompactGroup);
+        }
+        while (p < bd->free) {
+            if (!scanClosure(s, (StgClosure *)p)) return rtsFalse;
+            p += closure_sizeW((StgClosure *)p);
+        }
+    }
+    return rtsTrue;
+}
+
+StgClosure *
+compactRegion (Capability *cap, StgClosure *p, StgWord *byte_arrays)
+{
+    CopyState s;
+    bdescr *head;
+    rtsBool ok;
+
+    s.region = newRegion();
+    s.copies = allocHashTable();
+    s.byte_arrays = rtsFalse;
+    ok = copyRegion(&s, &p);
+    freeHashTable(s.copies, NULL);
+    *byte_arrays = s.byte_arrays;
+
+    head = Bdescr((StgPtr)s.region);
+
+    // Nothing was copied if p was a static constructor
+    if (!ok || (s.region->last == &s.region->group &&
+                head->free == head->start + sizeofW(CompactRegion))) {
+        debugTrace(DEBUG_gc, "compact: %s", ok ? "nothing to copy"
+                                               : "can't compact");
+        ACQUIRE_SM_LOCK;
+        freeCompactRegion(head);
+        RELEASE_SM_LOCK;
+        return ok ? p : NULL;
+    }
+
+    debugTrace(DEBUG_gc, "compact: new region of %" FMT_Word " blocks",
+               s.region->blocks);
+
+    addCompactRegion(cap, s.region);
+    return p;
+}
+
+void
+addCompactRegion (Capability *cap, CompactRegion *region)
+{
+    ACQUIRE_SM_LOCK;
+    dbl_link_onto(Bdescr((StgPtr)region), &g0->compact_regions);
+    g0->n_compact_blocks += region->blocks;
+    RELEASE_SM_LOCK;
+
+    // The region counts as allocation, and towards the next GC, in
+    // the same way as a large object.
+#if defined(THREADED_RTS)
+    {
+        W_ old;
+        do {
+            old = g0->n_new_large_words;
+        } while (cas((StgVolatilePtr)&g0->n_new_large_words,
+                     old, old + region->blocks * BLOCK_SIZE_W) != old);
+    }
+#else
+    g0->n_new_large_words += region->blocks * BLOCK_SIZE_W;
+#endif
+    cap->total_allocated += region->blocks * BLOCK_SIZE_W;
+}
+
+void
+setCompactRegionGen (CompactRegion *region, generation *gen)
+{
+    CompactGroup *group;
+    bdescr *bd;
+    W_ i, n;
+
+    for (group = &region->group; group != NULL; group = group->next) {
+        bd = Bdescr((StgPtr)group);
+        n = stg_min(bd->blocks, BLOCKS_PER_MBLOCK);
+        for (i = 0; i < n; i++) {
+            initBdescr(&bd[i], gen, gen->to);
+        }
+    }
+}
+
+void
+freeCompactRegion (bdescr *head)
+{
+    CompactGroup *group, *next;
+    bdescr *bd;
+    W_ i, n;
+
+    for (group = &((CompactRegion *)head->start)->group; group != NULL;
+         group = next) {
+        next = group->next;
+        bd = Bdescr((StgPtr)group);
+        if (group->mapped != 0) {
+            // (the group's header goes with the mapping)
+            osUnmapFile(bd->start, group->mapped);
+        }
+        n = stg_min(bd->blocks, BLOCKS_PER_MBLOCK);
+        for (i = 0; i < n; i++) {
+            bd[i].flags = 0;
+        }
+        freeGroup(bd);
+    }
+}
+
+void
+freeCompactRegions (bdescr *head)
+{
+    bdescr *next;
+
+    for (; head != NULL; head = next) {
+        next = head->link;
+        freeCompactRegion(head);
+    }
+}
+
+#ifdef DEBUG
+void
+markCompactRegions (bdescr *head)
+{
+    CompactGroup *group;
+
+    for (; head != NULL; head = head->link) {
+        for (group = &((CompactRegion *)head->start)->group; group != NULL;
+             group = group->next) {
+            Bdescr((StgPtr)group)->flags |= BF_KNOWN;
+        }
+    }
+}
+
+// like countAllocdBlocks(), for memInventory()
+W_
+countCompactRegionBlocks (bdescr *head)
+{
+    CompactGroup *group;
+    bdescr *bd;
+    W_ n = 0;
+
+    for (; head != NULL; head = head->link) {
+        for (group = &((CompactRegion *)head->start)->group; group != NULL;
+             group = group->next) {
+            bd = Bdescr((StgPtr)group);
+            n += bd->blocks;
+            if (bd->blocks > BLOCKS_PER_MBLOCK) {
+                n -= (MBLOCK_SIZE / BLOCK_SIZE - BLOCKS_PER_MBLOCK)
+                    * (bd->blocks/(MBLOCK_SIZE/BLOCK_SIZE));
+            }
+        }
+    }
+    return n;
+}
+#endif
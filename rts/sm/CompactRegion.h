@@ -0,0 +1,72 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Compact regions: immutable data that the GC doesn't trace.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SM_COMPACTREGION_H
+#define SM_COMPACTREGION_H
+
+#include "BeginPrivate.h"
+
+// A compact region is a list of block groups, every block of which is
+// flagged BF_COMPACT_REGION.  Each group starts with a CompactGroup,
+// and the first group with the CompactRegion itself.  The region is
+// linked onto its generation's compact_regions list by the block
+// descriptor of its first group, which also carries its BF_EVACUATED
+// flag.
+typedef struct CompactGroup_ {
+    struct CompactRegion_ *region;
+    struct CompactGroup_  *next;
+    W_                     mapped; // bytes at the start of the group
+                                   // mapped from a file (CompactFile.c)
+} CompactGroup;
+
+typedef struct CompactRegion_ {
+    CompactGroup  group;        // the first group
+    CompactGroup *last;         // the group being allocated into
+    W_            blocks;       // blocks in all the groups
+    W_            group_blocks; // size of the next group
+} CompactRegion;
+
+// Copy the data reachable from p into a new region of g0, and return
+// the copy of p, or NULL if it can't be compacted.  *byte_arrays is
+// set if any byte arrays were copied (they may have been mutable).
+StgClosure *compactRegion (Capability *cap, StgClosure *p,
+                           StgWord *byte_arrays);
+
+// Allocate a block group for a region, and add a complete region to
+// g0 (for CompactFile.c).
+bdescr *allocCompactGroup (W_ blocks);
+void    addCompactRegion  (Capability *cap, CompactRegion *region);
+
+// Move a region to a new generation (during GC).
+void setCompactRegionGen (CompactRegion *region, generation *gen);
+
+// Free a list of regions, linked by the descriptors of their first
+// blocks.  The caller holds the storage manager lock.
+void freeCompactRegion  (bdescr *head);
+void freeCompactRegions (bdescr *head);
+
+#ifdef DEBUG
+void markCompactRegions       (bdescr *head);
+W_   countCompactRegionBlocks (bdescr *head);
+#endif
+
+// The descriptor of the first block of the region that p points into
+INLINE_HEADER bdescr *
+compactRegionHead (StgPtr p)
+{
+    bdescr *bd = Bdescr(p);
+
+    if (bd->blocks == 0) {
+        bd = bd->link;          // not the first block of its group
+    }
+    return Bdescr((StgPtr)((CompactGroup *)bd->start)->region);
+}
+
+#include "EndPrivate.h"
+
+#endif /* SM_COMPACTREGION_H */
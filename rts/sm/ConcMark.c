@@ -0,0 +1,1564 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Concurrent marking of the old generation (+RTS --concurrent-mark).
+ *
+ * Instead of a stop-the-world major GC, the oldest generation is
+ * marked by a separate OS thread while the program runs, and then
+ * swept in whole blocks using the code in Sweep.c.  A cycle goes like
+ * this:
+ *
+ *   - When the oldest generation is due to be collected,
+ *     concMarkPlanGC() turns the GC into a collection of all the
+ *     younger generations, at the end of which concMarkPostGC() starts
+ *     a cycle: every block of the oldest generation is flagged
+ *     BF_SNAPSHOT, a mark bitmap is attached to them, and the roots
+ *     are pushed on the mark queue.  Everything that is not in the
+ *     snapshot (the younger generations, and whatever is promoted into
+ *     the oldest generation later) is considered live.
+ *
+ *   - The marking thread marks the snapshot while the mutator runs.
+ *     It never writes to the heap, except for the mark bits.
+ *
+ *   - The mutator preserves the snapshot with a "snapshot at the
+ *     beginning" write barrier: while conc_mark_active is set, a
+ *     pointer that is about to be overwritten in a heap object is
+ *     remembered in the Capability's mark buffer first
+ *     (concMarkPushClosure() and friends, called from dirty_MUT_VAR(),
+ *     dirty_TVAR(), dirty_MVAR(), the array primops, thunk updates
+ *     and so on).  Full buffers are handed over to the marking thread.
+ *
+ *   - Once the marking thread has run out of work, the next GC
+ *     finishes the cycle: it marks whatever is left in the
+ *     Capabilities' buffers, and then frees the blocks and large
+ *     objects of the snapshot in which nothing was marked.
+ *
+ * Objects whose fields are overwritten without a write barrier are
+ * scanned eagerly when the cycle starts, instead: thread stacks, TSOs,
+ * and the objects in the younger generations (which the marker could
+ * not scan anyway, as minor GCs move them).  The threads that the last
+ * GC found to be unreachable are treated as roots, so deadlocks are
+ * only detected by a stop-the-world major GC; a forced major GC
+ * abandons the cycle in progress.
+ *
+ * Weak pointers and stable names in the oldest generation are weak
+ * here too.  When the cycle finishes, the weak pointers whose keys
+ * were marked have their values and finalizers marked, until no more
+ * keys are found (mark_weak_ptr_list()), and the rest are finalized;
+ * then the stable names of objects that weren't marked are dropped
+ * (sweepOldStableNames()).  The mutator can get hold of the fields of
+ * a weak pointer, and of a StableName object, without writing to the
+ * heap, so deRefWeak#, finalizeWeak# and makeStableName# remember
+ * what they return (concMarkPushWeak()).
+ *
+ * As with the -c and -w collectors, each block of the oldest
+ * generation is assumed to be a single block (large objects and
+ * compact regions are marked with the BF_SNAPSHOT_MARKED flag
+ * instead).
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Storage.h"
+#include "GC.h"
+#include "GCThread.h"
+#include "Compact.h"
+#include "Pinned.h"
+#include "CompactRegion.h"
+#include "Sweep.h"
+#include "ConcMark.h"
+#include "MarkWeak.h"
+#include "Weak.h"
+#include "Capability.h"
+#include "Schedule.h"
+#include "Stable.h"
+#include "RtsSignals.h"
+#include "RtsUtils.h"
+#include "Apply.h"
+#include "Hash.h"
+#include "Trace.h"
+
+#include <string.h>
+
+StgWord conc_mark_active = 0;
+
+// The number of closures the marking thread marks before checking
+// whether a GC wants it to stop.
+#define MARK_SLICE 4096
+
+// What concMarkPostGC() should do at the end of the current GC
+#define CONC_NONE   0
+#define CONC_START  1
+#define CONC_FINISH 2
+
+static nat conc_plan = CONC_NONE;
+
+// The size of the oldest generation when the cycle started
+static W_ snapshot_blocks;
+
+// +RTS --idle-slices: the size of the oldest generation after it was
+// last collected, and whether the next GC should start a cycle even
+// though the oldest generation is not due for collection.
+static W_      collected_blocks = 0;
+static rtsBool idle_start = rtsFalse;
+static rtsBool conc_major = rtsFalse;
+
+// Don't start a cycle while idle unless the oldest generation has
+// grown by this percentage since it was last collected.
+#define IDLE_START_PERCENT 10
+
+// The static closures we have already scanned during this cycle.
+// (We can't use the static_link field, as the GC does, because we run
+// concurrently with minor GCs.)
+static HashTable *static_marked = NULL;
+
+// A stack of pointers to mark.  A queue with a Capability pushes to
+// the Capability's mark buffer instead.
+typedef struct MarkQueue_ {
+    MarkChunk  *top;
+    Capability *cap;
+} MarkQueue;
+
+// The marking thread's queue.  Only the marking thread touches it,
+// except during a GC, when the marking thread is stopped.
+static MarkQueue marker_queue;
+
+#if defined(THREADED_RTS)
+static Mutex      conc_mutex;
+static Condition  conc_cond;
+static MarkChunk *full_bufs;       // full buffers handed over by the mutator
+static rtsBool    conc_pause;      // a GC is in progress
+static rtsBool    conc_stop;       // asked to exit by exitConcMark()
+static rtsBool    marker_running;  // the marking thread is alive
+static rtsBool    marker_busy;     // ... and is marking right now
+static rtsBool    marker_idle;     // ... and has run out of work
+#endif
+
+/* -----------------------------------------------------------------------------
+   Mark queues
+   -------------------------------------------------------------------------- */
+
+static MarkChunk *
+newMarkChunk (void)
+{
+    MarkChunk *c;
+
+    c = stgMallocBytes(sizeof(MarkChunk), "newMarkChunk");
+    c->link = NULL;
+    c->n = 0;
+    return c;
+}
+
+static void
+freeMarkChunks (MarkChunk *c)
+{
+    MarkChunk *next;
+
+    for (; c != NULL; c = next) {
+        next = c->link;
+        stgFree(c);
+    }
+}
+
+STATIC_INLINE void
+push (MarkQueue *q, StgClosure *p)
+{
+    MarkChunk *c;
+
+    if (q->cap != NULL) {
+        concMarkPushClosure(q->cap, p);
+        return;
+    }
+    if (p == NULL) return;
+
+    c = q->top;
+    if (c == NULL || c->n == MARK_CHUNK_SIZE) {
+        c = newMarkChunk();
+        c->link = q->top;
+        q->top = c;
+    }
+    c->entries[c->n++] = p;
+}
+
+STATIC_INLINE StgClosure *
+pop (MarkQueue *q)
+{
+    MarkChunk *c;
+
+    while ((c = q->top) != NULL) {
+        if (c->n > 0) {
+            return c->entries[--c->n];
+        }
+        q->top = c->link;
+        stgFree(c);
+    }
+    return NULL;
+}
+
+// Add a list of chunks to the marking thread's queue
+static void
+addMarkChunks (MarkChunk *chunks)
+{
+    MarkChunk *c, *next;
+
+    for (c = chunks; c != NULL; c = next) {
+        next = c->link;
+        c->link = marker_queue.top;
+        marker_queue.top = c;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   The write barrier
+   -------------------------------------------------------------------------- */
+
+void
+concMarkPushClosure (Capability *cap, StgClosure *p)
+{
+    MarkChunk *c;
+
+    if (p == NULL) return;
+
+    c = cap->conc_mark_buf;
+    if (c == NULL) {
+        c = newMarkChunk();
+        cap->conc_mark_buf = c;
+    }
+    c->entries[c->n++] = p;
+
+    if (c->n == MARK_CHUNK_SIZE) {
+        cap->conc_mark_buf = NULL;
+#if defined(THREADED_RTS)
+        ACQUIRE_LOCK(&conc_mutex);
+        c->link = full_bufs;
+        full_bufs = c;
+        signalCondition(&conc_cond);
+        RELEASE_LOCK(&conc_mutex);
+#else
+        addMarkChunks(c);
+#endif
+    }
+}
+
+static void scan_closure (MarkQueue *q, StgClosure *p);
+
+void
+concMarkPushFields (Capability *cap, StgClosure *p)
+{
+    MarkQueue q;
+
+    p = UNTAG_CLOSURE(p);
+
+    // Only the fields of objects in the snapshot need remembering;
+    // everything else is either scanned when the cycle starts, or
+    // was allocated since.
+    if (HEAP_ALLOCED_GC(p) && !(Bdescr((P_)p)->flags & BF_SNAPSHOT)) {
+        return;
+    }
+
+    q.top = NULL;
+    q.cap = cap;
+    scan_closure(&q, p);
+}
+
+void
+concMarkPushArray (Capability *cap, StgMutArrPtrs *arr, W_ off, W_ n)
+{
+    W_ i;
+
+    if (!(Bdescr((P_)arr)->flags & BF_SNAPSHOT)) return;
+
+    for (i = off; i < off + n; i++) {
+        concMarkPushClosure(cap, arr->payload[i]);
+    }
+}
+
+// deRefWeak# and finalizeWeak# hand the value or the finalizer of a
+// weak pointer to the mutator.  If the weak pointer is in the
+// snapshot, the marker only follows those fields if it finds the key
+// alive, so we have to remember them here.
+void
+concMarkPushWeak (Capability *cap, StgWeak *w)
+{
+    if (!(Bdescr((P_)w)->flags & BF_SNAPSHOT)) return;
+
+    concMarkPushClosure(cap, w->value);
+    concMarkPushClosure(cap, w->finalizer);
+    concMarkPushClosure(cap, w->cfinalizer);
+}
+
+/* -----------------------------------------------------------------------------
+   Scanning closures: push every pointer field of a closure.  This
+   mirrors scavenge_mark_stack() and friends in Scav.c, except that
+   SRTs are always followed.
+   -------------------------------------------------------------------------- */
+
+static void
+scan_large_bitmap (MarkQueue *q, StgPtr p, StgLargeBitmap *large_bitmap,
+                   nat size)
+{
+    nat i, j, b;
+    StgWord bitmap;
+
+    b = 0;
+
+    for (i = 0; i < size; b++) {
+        bitmap = large_bitmap->bitmap[b];
+        j = stg_min(size-i, BITS_IN(W_));
+        i += j;
+        for (; j > 0; j--, p++) {
+            if ((bitmap & 1) == 0) {
+                push(q, (StgClosure *)*p);
+            }
+            bitmap = bitmap >> 1;
+        }
+    }
+}
+
+STATIC_INLINE StgPtr
+scan_small_bitmap (MarkQueue *q, StgPtr p, nat size, StgWord bitmap)
+{
+    while (size > 0) {
+        if ((bitmap & 1) == 0) {
+            push(q, (StgClosure *)*p);
+        }
+        p++;
+        bitmap = bitmap >> 1;
+        size--;
+    }
+    return p;
+}
+
+static void
+scan_large_srt_bitmap (MarkQueue *q, StgLargeSRT *large_srt)
+{
+    nat i, b, size;
+    StgWord bitmap;
+    StgClosure **p;
+
+    b = 0;
+    bitmap = large_srt->l.bitmap[b];
+    size   = (nat)large_srt->l.size;
+    p      = (StgClosure **)large_srt->srt;
+    for (i = 0; i < size; ) {
+        if ((bitmap & 1) != 0) {
+            push(q, *p);
+        }
+        i++;
+        p++;
+        if (i % BITS_IN(W_) == 0) {
+            b++;
+            bitmap = large_srt->l.bitmap[b];
+        } else {
+            bitmap = bitmap >> 1;
+        }
+    }
+}
+
+static void
+scan_srt (MarkQueue *q, StgClosure **srt, nat srt_bitmap)
+{
+    nat bitmap;
+    StgClosure **p;
+
+    bitmap = srt_bitmap;
+    p = srt;
+
+    if (bitmap == (StgHalfWord)(-1)) {
+        scan_large_srt_bitmap(q, (StgLargeSRT *)srt);
+        return;
+    }
+
+    while (bitmap != 0) {
+        if ((bitmap & 1) != 0) {
+#if defined(COMPILING_WINDOWS_DLL)
+            // See scavenge_srt() in Scav.c
+            if ( (W_)(*p) & 0x1 ) {
+                push(q, *(StgClosure **)((W_)(*p) & ~0x1));
+            } else {
+                push(q, *p);
+            }
+#else
+            push(q, *p);
+#endif
+        }
+        p++;
+        bitmap = bitmap >> 1;
+    }
+}
+
+STATIC_INLINE void
+scan_thunk_srt (MarkQueue *q, const StgInfoTable *info)
+{
+    StgThunkInfoTable *thunk_info;
+
+    thunk_info = itbl_to_thunk_itbl(info);
+    scan_srt(q, (StgClosure **)GET_SRT(thunk_info), thunk_info->i.srt_bitmap);
+}
+
+STATIC_INLINE void
+scan_fun_srt (MarkQueue *q, const StgInfoTable *info)
+{
+    StgFunInfoTable *fun_info;
+
+    fun_info = itbl_to_fun_itbl(info);
+    scan_srt(q, (StgClosure **)GET_FUN_SRT(fun_info), fun_info->i.srt_bitmap);
+}
+
+static StgPtr
+scan_arg_block (MarkQueue *q, StgFunInfoTable *fun_info, StgClosure **args)
+{
+    StgPtr p;
+    StgWord bitmap;
+    nat size;
+
+    p = (StgPtr)args;
+    switch (fun_info->f.fun_type) {
+    case ARG_GEN:
+        bitmap = BITMAP_BITS(fun_info->f.b.bitmap);
+        size = BITMAP_SIZE(fun_info->f.b.bitmap);
+        p = scan_small_bitmap(q, p, size, bitmap);
+        break;
+    case ARG_GEN_BIG:
+        size = GET_FUN_LARGE_BITMAP(fun_info)->size;
+        scan_large_bitmap(q, p, GET_FUN_LARGE_BITMAP(fun_info), size);
+        p += size;
+        break;
+    default:
+        bitmap = BITMAP_BITS(stg_arg_bitmaps[fun_info->f.fun_type]);
+        size = BITMAP_SIZE(stg_arg_bitmaps[fun_info->f.fun_type]);
+        p = scan_small_bitmap(q, p, size, bitmap);
+        break;
+    }
+    return p;
+}
+
+static void
+scan_PAP_payload (MarkQueue *q, StgClosure *fun, StgClosure **payload,
+                  StgWord size)
+{
+    StgFunInfoTable *fun_info;
+
+    push(q, fun);
+
+    fun_info = get_fun_itbl(UNTAG_CLOSURE(fun));
+    ASSERT(fun_info->i.type != PAP);
+
+    switch (fun_info->f.fun_type) {
+    case ARG_GEN:
+        scan_small_bitmap(q, (StgPtr)payload, size,
+                          BITMAP_BITS(fun_info->f.b.bitmap));
+        break;
+    case ARG_GEN_BIG:
+        scan_large_bitmap(q, (StgPtr)payload,
+                          GET_FUN_LARGE_BITMAP(fun_info), size);
+        break;
+    case ARG_BCO:
+        scan_large_bitmap(q, (StgPtr)payload, BCO_BITMAP(fun), size);
+        break;
+    default:
+        scan_small_bitmap(q, (StgPtr)payload, size,
+                          BITMAP_BITS(stg_arg_bitmaps[fun_info->f.fun_type]));
+        break;
+    }
+}
+
+// Push everything a chunk of stack points to, as scavenge_stack().
+static void
+scan_stack (MarkQueue *q, StgPtr p, StgPtr stack_end)
+{
+    const StgRetInfoTable* info;
+    StgWord bitmap;
+    nat size;
+
+    while (p < stack_end) {
+        info = get_ret_itbl((StgClosure *)p);
+
+        switch (info->i.type) {
+
+        case UPDATE_FRAME:
+            push(q, ((StgUpdateFrame *)p)->updatee);
+            p += sizeofW(StgUpdateFrame);
+            continue;
+
+        case CATCH_STM_FRAME:
+        case CATCH_RETRY_FRAME:
+        case ATOMICALLY_FRAME:
+        case UNDERFLOW_FRAME:
+        case STOP_FRAME:
+        case CATCH_FRAME:
+        case RET_SMALL:
+            bitmap = BITMAP_BITS(info->i.layout.bitmap);
+            size   = BITMAP_SIZE(info->i.layout.bitmap);
+            p++;
+            p = scan_small_bitmap(q, p, size, bitmap);
+
+        follow_srt:
+            scan_srt(q, (StgClosure **)GET_SRT(info), info->i.srt_bitmap);
+            continue;
+
+        case RET_BCO: {
+            StgBCO *bco;
+
+            p++;
+            push(q, (StgClosure *)*p);
+            bco = (StgBCO *)*p;
+            p++;
+            size = BCO_BITMAP_SIZE(bco);
+            scan_large_bitmap(q, p, BCO_BITMAP(bco), size);
+            p += size;
+            continue;
+        }
+
+        case RET_BIG:
+            size = GET_LARGE_BITMAP(&info->i)->size;
+            p++;
+            scan_large_bitmap(q, p, GET_LARGE_BITMAP(&info->i), size);
+            p += size;
+            goto follow_srt;
+
+        case RET_FUN:
+        {
+            StgRetFun *ret_fun = (StgRetFun *)p;
+            StgFunInfoTable *fun_info;
+
+            push(q, ret_fun->fun);
+            fun_info = get_fun_itbl(UNTAG_CLOSURE(ret_fun->fun));
+            p = scan_arg_block(q, fun_info, ret_fun->payload);
+            goto follow_srt;
+        }
+
+        default:
+            barf("scan_stack: weird activation record found on stack: %d",
+                 (int)(info->i.type));
+        }
+    }
+}
+
+static void
+scan_TSO (MarkQueue *q, StgTSO *tso)
+{
+    push(q, (StgClosure *)tso->blocked_exceptions);
+    push(q, (StgClosure *)tso->bq);
+    push(q, (StgClosure *)tso->trec);
+    push(q, (StgClosure *)tso->stackobj);
+    push(q, (StgClosure *)tso->_link);
+    if (   tso->why_blocked == BlockedOnMVar
+        || tso->why_blocked == BlockedOnBlackHole
+        || tso->why_blocked == BlockedOnMsgThrowTo
+        || tso->why_blocked == NotBlocked
+        ) {
+        push(q, tso->block_info.closure);
+    }
+}
+
+// Push every pointer field of p.
+static void
+scan_closure (MarkQueue *q, StgClosure *p)
+{
+    const StgInfoTable *info;
+    StgPtr s, end;
+
+    info = get_itbl(p);
+
+    switch (info->type) {
+
+    case MVAR_CLEAN:
+    case MVAR_DIRTY:
+    {
+        StgMVar *mvar = (StgMVar *)p;
+        push(q, (StgClosure *)mvar->head);
+        push(q, (StgClosure *)mvar->tail);
+        push(q, mvar->value);
+        break;
+    }
+
+    case TVAR:
+    {
+        StgTVar *tvar = (StgTVar *)p;
+        push(q, tvar->current_value);
+        push(q, (StgClosure *)tvar->first_watch_queue_entry);
+        break;
+    }
+
+    case FUN_2_0:
+        scan_fun_srt(q, info);
+        push(q, p->payload[1]);
+        push(q, p->payload[0]);
+        break;
+
+    case THUNK_2_0:
+        scan_thunk_srt(q, info);
+        push(q, ((StgThunk *)p)->payload[1]);
+        push(q, ((StgThunk *)p)->payload[0]);
+        break;
+
+    case CONSTR_2_0:
+        push(q, p->payload[1]);
+        push(q, p->payload[0]);
+        break;
+
+    case FUN_1_0:
+    case FUN_1_1:
+        scan_fun_srt(q, info);
+        push(q, p->payload[0]);
+        break;
+
+    case THUNK_1_0:
+    case THUNK_1_1:
+        scan_thunk_srt(q, info);
+        push(q, ((StgThunk *)p)->payload[0]);
+        break;
+
+    case CONSTR_1_0:
+    case CONSTR_1_1:
+        push(q, p->payload[0]);
+        break;
+
+    case FUN_0_1:
+    case FUN_0_2:
+        scan_fun_srt(q, info);
+        break;
+
+    case THUNK_0_1:
+    case THUNK_0_2:
+        scan_thunk_srt(q, info);
+        break;
+
+    case CONSTR_0_1:
+    case CONSTR_0_2:
+    case CONSTR_NOCAF_STATIC:
+    case ARR_WORDS:
+    case WHITEHOLE:
+        break;
+
+    case FUN:
+        scan_fun_srt(q, info);
+        goto gen_obj;
+
+    case THUNK:
+        scan_thunk_srt(q, info);
+        end = (P_)((StgThunk *)p)->payload + info->layout.payload.ptrs;
+        for (s = (P_)((StgThunk *)p)->payload; s < end; s++) {
+            push(q, (StgClosure *)*s);
+        }
+        break;
+
+    gen_obj:
+    case CONSTR:
+    case WEAK:
+    case PRIM:
+    case MUT_PRIM:
+    case CONSTR_STATIC:
+        end = (P_)p->payload + info->layout.payload.ptrs;
+        for (s = (P_)p->payload; s < end; s++) {
+            push(q, (StgClosure *)*s);
+        }
+        break;
+
+    case FUN_STATIC:
+        scan_fun_srt(q, info);
+        break;
+
+    case THUNK_STATIC:
+        scan_thunk_srt(q, info);
+        break;
+
+    case BCO:
+    {
+        StgBCO *bco = (StgBCO *)p;
+        push(q, (StgClosure *)bco->instrs);
+        push(q, (StgClosure *)bco->literals);
+        push(q, (StgClosure *)bco->ptrs);
+        break;
+    }
+
+    case IND:
+    case IND_PERM:
+    case IND_STATIC:
+    case BLACKHOLE:
+        push(q, ((StgInd *)p)->indirectee);
+        break;
+
+    case MUT_VAR_CLEAN:
+    case MUT_VAR_DIRTY:
+        push(q, ((StgMutVar *)p)->var);
+        break;
+
+    case BLOCKING_QUEUE:
+    {
+        StgBlockingQueue *bq = (StgBlockingQueue *)p;
+        push(q, bq->bh);
+        push(q, (StgClosure *)bq->owner);
+        push(q, (StgClosure *)bq->queue);
+        push(q, (StgClosure *)bq->link);
+        break;
+    }
+
+    case THUNK_SELECTOR:
+        push(q, ((StgSelector *)p)->selectee);
+        break;
+
+    case AP_STACK:
+    {
+        StgAP_STACK *ap = (StgAP_STACK *)p;
+        push(q, ap->fun);
+        scan_stack(q, (StgPtr)ap->payload, (StgPtr)ap->payload + ap->size);
+        break;
+    }
+
+    case PAP:
+    {
+        StgPAP *pap = (StgPAP *)p;
+        scan_PAP_payload(q, pap->fun, pap->payload, pap->n_args);
+        break;
+    }
+
+    case AP:
+    {
+        StgAP *ap = (StgAP *)p;
+        scan_PAP_payload(q, ap->fun, ap->payload, ap->n_args);
+        break;
+    }
+
+    case MUT_ARR_PTRS_CLEAN:
+    case MUT_ARR_PTRS_DIRTY:
+    case MUT_ARR_PTRS_FROZEN:
+    case MUT_ARR_PTRS_FROZEN0:
+    {
+        StgMutArrPtrs *a = (StgMutArrPtrs *)p;
+        end = (P_)&a->payload[a->ptrs];
+        for (s = (P_)&a->payload[0]; s < end; s++) {
+            push(q, (StgClosure *)*s);
+        }
+        break;
+    }
+
+    case TSO:
+        scan_TSO(q, (StgTSO *)p);
+        break;
+
+    case STACK:
+    {
+        StgStack *stack = (StgStack *)p;
+        scan_stack(q, stack->sp, stack->stack + stack->stack_size);
+        break;
+    }
+
+    case TREC_CHUNK:
+    {
+        StgWord i;
+        StgTRecChunk *tc = (StgTRecChunk *)p;
+        TRecEntry *e = &(tc->entries[0]);
+        push(q, (StgClosure *)tc->prev_chunk);
+        for (i = 0; i < tc->next_entry_idx; i++, e++) {
+            push(q, (StgClosure *)e->tvar);
+            push(q, e->expected_value);
+            push(q, e->new_value);
+        }
+        break;
+    }
+
+    default:
+        barf("scan_closure: unimplemented/strange closure type %d @ %p",
+             info->type, p);
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Marking
+   -------------------------------------------------------------------------- */
+
+// Mark p, and push its fields if it wasn't marked already.  Returns
+// rtsFalse if p is locked and has to be looked at again later.
+STATIC_INLINE rtsBool
+mark_closure (MarkQueue *q, StgClosure *p)
+{
+    bdescr *bd;
+    const StgInfoTable *info;
+
+    p = UNTAG_CLOSURE(p);
+
+    if (!HEAP_ALLOCED_GC(p)) {
+        info = get_itbl(p);
+        switch (info->type) {
+        case THUNK_STATIC:
+        case FUN_STATIC:
+        case IND_STATIC:
+        case CONSTR_STATIC:
+            if (lookupHashTable(static_marked, (StgWord)p) != NULL) {
+                return rtsTrue;
+            }
+            insertHashTable(static_marked, (StgWord)p, p);
+            scan_closure(q, p);
+            return rtsTrue;
+        case WHITEHOLE:
+            // a CAF being claimed by lockCAF()
+            return rtsFalse;
+        default:
+            return rtsTrue;
+        }
+    }
+
+    // Anything outside the snapshot is live; in particular, pointers
+    // to objects in the younger generations may be out of date, and
+    // must not be followed.
+    bd = Bdescr((P_)p);
+
+    // A compact region is marked as a whole, on its first block, and
+    // has nothing in it to scan.
+    if (bd->flags & BF_COMPACT_REGION) {
+        bd = compactRegionHead((P_)p);
+        if (bd->flags & BF_SNAPSHOT) {
+            bd->flags |= BF_SNAPSHOT_MARKED;
+        }
+        return rtsTrue;
+    }
+
+    if (!(bd->flags & BF_SNAPSHOT)) return rtsTrue;
+
+    if (p->header.info == &stg_WHITEHOLE_info) return rtsFalse;
+
+    if (bd->flags & BF_LARGE) {
+        if (bd->flags & BF_SNAPSHOT_MARKED) return rtsTrue;
+        bd->flags |= BF_SNAPSHOT_MARKED;
+        // pinned blocks only contain ARR_WORDS objects
+        if (bd->flags & BF_PINNED) return rtsTrue;
+    } else {
+        if (is_marked((P_)p, bd)) return rtsTrue;
+        mark((P_)p, bd);
+    }
+
+    // TSOs and stacks were scanned when the cycle started; they are
+    // modified without a write barrier, so scanning them now would
+    // not tell us anything more.
+    info = get_itbl(p);
+    if (info->type == TSO || info->type == STACK) return rtsTrue;
+
+    scan_closure(q, p);
+    return rtsTrue;
+}
+
+// Mark at most max closures from q (all of them if max is 0).
+// Returns the number of closures marked.
+static W_
+mark_loop (MarkQueue *q, W_ max)
+{
+    StgClosure *p;
+    W_ n;
+
+    for (n = 0; max == 0 || n < max; n++) {
+        p = pop(q);
+        if (p == NULL) break;
+        if (!mark_closure(q, p)) {
+            // try again later
+            push(q, p);
+#if defined(THREADED_RTS)
+            if (max == 0) yieldThread();
+#endif
+        }
+    }
+    return n;
+}
+
+/* -----------------------------------------------------------------------------
+   The marking thread
+   -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+static void startMarkerThread (void);
+
+static void OSThreadProcAttr
+markerThread (void *arg STG_UNUSED)
+{
+    ACQUIRE_LOCK(&conc_mutex);
+    while (1) {
+        while (!conc_stop &&
+               (conc_pause || !conc_mark_active ||
+                (marker_queue.top == NULL && full_bufs == NULL))) {
+            if (!conc_pause && conc_mark_active) {
+                marker_idle = rtsTrue;
+            }
+            waitCondition(&conc_cond, &conc_mutex);
+        }
+        if (conc_stop) break;
+
+        addMarkChunks(full_bufs);
+        full_bufs = NULL;
+        marker_idle = rtsFalse;
+        marker_busy = rtsTrue;
+
+        RELEASE_LOCK(&conc_mutex);
+        mark_loop(&marker_queue, MARK_SLICE);
+        ACQUIRE_LOCK(&conc_mutex);
+
+        marker_busy = rtsFalse;
+        if (conc_pause) {
+            broadcastCondition(&conc_cond);
+        }
+    }
+    marker_running = rtsFalse;
+    broadcastCondition(&conc_cond);
+    RELEASE_LOCK(&conc_mutex);
+}
+#endif
+
+void
+initConcMark (void)
+{
+    if (!RtsFlags.GcFlags.concurrentMark) return;
+
+    marker_queue.top = NULL;
+    marker_queue.cap = NULL;
+
+#if defined(THREADED_RTS)
+    full_bufs = NULL;
+    startMarkerThread();
+#endif
+}
+
+#if defined(THREADED_RTS)
+static void
+startMarkerThread (void)
+{
+    OSThreadId tid;
+
+    initMutex(&conc_mutex);
+    initCondition(&conc_cond);
+    conc_pause     = rtsFalse;
+    conc_stop      = rtsFalse;
+    marker_running = rtsTrue;
+    marker_busy    = rtsFalse;
+    marker_idle    = rtsFalse;
+
+    if (createOSThread(&tid, (OSThreadProc*)markerThread, NULL) != 0) {
+        sysErrorBelch("failed to create the concurrent mark thread");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+#endif
+
+void
+exitConcMark (void)
+{
+    if (!RtsFlags.GcFlags.concurrentMark) return;
+
+#if defined(THREADED_RTS)
+    ACQUIRE_LOCK(&conc_mutex);
+    conc_stop = rtsTrue;
+    broadcastCondition(&conc_cond);
+    while (marker_running) {
+        waitCondition(&conc_cond, &conc_mutex);
+    }
+    RELEASE_LOCK(&conc_mutex);
+    closeCondition(&conc_cond);
+    closeMutex(&conc_mutex);
+
+    freeMarkChunks(full_bufs);
+    full_bufs = NULL;
+#endif
+    freeMarkChunks(marker_queue.top);
+    marker_queue.top = NULL;
+}
+
+/* -----------------------------------------------------------------------------
+   Starting a cycle
+   -------------------------------------------------------------------------- */
+
+static void
+mark_root (void *user, StgClosure **root)
+{
+    push((MarkQueue *)user, *root);
+}
+
+// Push the fields of every object in a block (or the part of it up
+// to end).  The younger generations have just been collected, so
+// their blocks contain nothing but live objects.
+static void
+scan_block (MarkQueue *q, bdescr *bd, StgPtr end)
+{
+    StgPtr p;
+
+    for (p = bd->start; p < end; p += closure_sizeW((StgClosure *)p)) {
+        scan_closure(q, (StgClosure *)p);
+    }
+}
+
+static void
+scan_young_gen (MarkQueue *q, generation *gen)
+{
+    bdescr *bd;
+    gen_workspace *ws;
+    nat n;
+
+    for (bd = gen->blocks; bd != NULL; bd = bd->link) {
+        scan_block(q, bd, bd->free);
+    }
+    for (bd = gen->large_objects; bd != NULL; bd = bd->link) {
+        if (!(bd->flags & BF_PINNED)) {
+            scan_closure(q, (StgClosure *)bd->start);
+        }
+    }
+    for (n = 0; n < n_capabilities; n++) {
+        ws = &gc_threads[n]->gens[gen->no];
+        for (bd = ws->part_list; bd != NULL; bd = bd->link) {
+            scan_block(q, bd, bd->free);
+        }
+        scan_block(q, ws->todo_bd, ws->todo_free);
+    }
+}
+
+// Threads and their stacks are mutated without a write barrier, so we
+// scan them now, and the marker only marks them.
+static void
+scan_thread (MarkQueue *q, StgTSO *tso)
+{
+    StgStack *stack;
+    StgUnderflowFrame *frame;
+
+    push(q, (StgClosure *)tso);
+    scan_TSO(q, tso);
+
+    for (stack = tso->stackobj; ; stack = (StgStack *)frame->next_chunk) {
+        push(q, (StgClosure *)stack);
+        scan_stack(q, stack->sp, stack->stack + stack->stack_size);
+
+        frame = (StgUnderflowFrame *)(stack->stack + stack->stack_size
+                                      - sizeofW(StgUnderflowFrame));
+        if (frame->info != &stg_stack_underflow_frame_info) break;
+    }
+}
+
+// The next weak pointer on a weak pointer list, which may have
+// DEAD_WEAKs on it if finalizeWeak# was called (see tidyWeakList()).
+STATIC_INLINE StgWeak *
+weak_link (StgWeak *w)
+{
+    if (w->header.info == &stg_DEAD_WEAK_info) {
+        return ((StgDeadWeak *)w)->link;
+    }
+    return w->link;
+}
+
+// Mark a weak pointer whose key is alive, and everything its fields
+// keep alive.  Only cfinalizer is a pointer field as far as
+// scan_closure() is concerned, as for the GC.
+STATIC_INLINE void
+push_weak (MarkQueue *q, StgWeak *w)
+{
+    push(q, (StgClosure *)w);
+    push(q, w->key);
+    push(q, w->value);
+    push(q, w->finalizer);
+}
+
+static void
+start_cycle (void)
+{
+    generation *gen = oldest_gen;
+    gen_workspace *ws;
+    bdescr *bd, *next;
+    StgWord bitmap_size; // in bytes
+    StgWord *bitmap;
+    StgWeak *w;
+    StgTSO *t;
+    nat g, n;
+    MarkQueue *q = &marker_queue;
+
+    // The snapshot must not include blocks that have yet to be swept
+    // after the last major GC (+RTS --lazy-sweep).
+    finishLazySweep();
+
+    // Grab the partial blocks stashed in the workspaces of the oldest
+    // generation, so that nothing more is promoted into them, as in
+    // prepare_collected_gen().
+    for (n = 0; n < n_capabilities; n++) {
+        ws = &gc_threads[n]->gens[gen->no];
+
+        for (bd = ws->part_list; bd != NULL; bd = next) {
+            next = bd->link;
+            bd->link = gen->blocks;
+            gen->blocks = bd;
+            gen->n_blocks += bd->blocks;
+            gen->n_words += bd->free - bd->start;
+        }
+        ws->part_list = NULL;
+        ws->n_part_blocks = 0;
+
+        if (ws->todo_free != ws->todo_bd->start) {
+            ws->todo_bd->free = ws->todo_free;
+            ws->todo_bd->link = gen->blocks;
+            gen->blocks = ws->todo_bd;
+            gen->n_blocks += ws->todo_bd->blocks;
+            gen->n_words += ws->todo_free - ws->todo_bd->start;
+
+            // We can't call alloc_todo_block() here, because it uses
+            // gct.  As in init_gc_thread(), allocate the block manually.
+            bd = allocBlockOnNode(capNoToNumaNode(n));
+            initBdescr(bd, ws->gen, ws->gen->to);
+            bd->dest_no = ws->dest_no;
+            bd->flags = BF_EVACUATED;
+            bd->u.scan = bd->free = bd->start;
+
+            ws->todo_bd = bd;
+            ws->todo_free = bd->free;
+            ws->todo_lim = bd->start + BLOCK_SIZE_W;
+        }
+    }
+
+    // Allocate the mark bitmap, as for a compacting collection.
+    bitmap_size = gen->n_blocks * BLOCK_SIZE / (sizeof(W_)*BITS_PER_BYTE);
+
+    if (bitmap_size > 0) {
+        gen->bitmap = allocGroup((StgWord)BLOCK_ROUND_UP(bitmap_size)
+                                 / BLOCK_SIZE);
+        gen->bitmap->link = NULL; // counted by memInventory()
+        bitmap = gen->bitmap->start;
+        memset(bitmap, 0, bitmap_size);
+
+        for (bd = gen->blocks; bd != NULL; bd = bd->link) {
+            bd->u.bitmap = bitmap;
+            bitmap += BLOCK_SIZE_W / (sizeof(W_)*BITS_PER_BYTE);
+            bd->flags |= BF_SNAPSHOT;
+        }
+    }
+    for (bd = gen->large_objects; bd != NULL; bd = bd->link) {
+        bd->flags |= BF_SNAPSHOT;
+    }
+    for (bd = gen->compact_regions; bd != NULL; bd = bd->link) {
+        bd->flags |= BF_SNAPSHOT;
+    }
+
+    static_marked = allocHashTable();
+
+    // The roots
+    for (n = 0; n < n_capabilities; n++) {
+        markCapability(mark_root, q, &capabilities[n], rtsFalse);
+    }
+    markScheduler(mark_root, q);
+    markCAFs(mark_root, q);
+    markSignalHandlers(mark_root, q);
+    markStableTablesExceptOldest(mark_root, q);
+
+    // The weak pointers in the younger generations aren't collected
+    // by this cycle, so their fields are roots, as in a GC that
+    // doesn't collect the oldest generation.  Those in the oldest
+    // generation are looked at by mark_weak_ptr_list() when the cycle
+    // finishes.  The weak pointers that this GC found to be dead are
+    // about to have their finalizers run.
+    for (g = 0; g < gen->no; g++) {
+        for (w = generations[g].weak_ptr_list; w != NULL; w = weak_link(w)) {
+            if (w->header.info != &stg_DEAD_WEAK_info) {
+                push_weak(q, w);
+            }
+        }
+    }
+    for (w = dead_weak_ptr_list; w != NULL; w = w->link) {
+        push(q, w->cfinalizer);
+        push(q, w->finalizer);
+    }
+
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        for (t = generations[g].threads; t != END_TSO_QUEUE;
+             t = t->global_link) {
+            scan_thread(q, t);
+        }
+    }
+    for (t = resurrected_threads; t != END_TSO_QUEUE; t = t->global_link) {
+        scan_thread(q, t);
+    }
+
+    for (g = 0; g < gen->no; g++) {
+        scan_young_gen(q, &generations[g]);
+    }
+
+    snapshot_blocks = gen->n_blocks + gen->n_large_blocks;
+    conc_mark_active = 1;
+
+    debugTrace(DEBUG_gc, "concurrent mark: started, %ld blocks in the snapshot",
+               (long)snapshot_blocks);
+}
+
+/* -----------------------------------------------------------------------------
+   Finishing or abandoning a cycle
+   -------------------------------------------------------------------------- */
+
+// Collect the mark buffers of the Capabilities (and in the threaded
+// RTS the ones handed over to the marking thread) into marker_queue.
+static void
+collect_mark_bufs (void)
+{
+    nat n;
+
+    for (n = 0; n < n_capabilities; n++) {
+        addMarkChunks(capabilities[n].conc_mark_buf);
+        capabilities[n].conc_mark_buf = NULL;
+    }
+#if defined(THREADED_RTS)
+    addMarkChunks(full_bufs);
+    full_bufs = NULL;
+#endif
+}
+
+STATIC_INLINE rtsBool
+is_live (StgClosure *p)
+{
+    bdescr *bd;
+
+    if (!HEAP_ALLOCED_GC(p)) return rtsTrue;
+    bd = Bdescr((P_)p);
+    if (bd->flags & BF_COMPACT_REGION) bd = compactRegionHead((P_)p);
+    if (!(bd->flags & BF_SNAPSHOT)) return rtsTrue;
+    if (bd->flags & (BF_LARGE | BF_COMPACT_REGION)) {
+        return (bd->flags & BF_SNAPSHOT_MARKED) != 0;
+    }
+    return is_marked((P_)p, bd) != 0;
+}
+
+// Remove the dead objects from the mutable lists of the oldest
+// generation, before their blocks are freed.
+static void
+prune_mut_lists (void)
+{
+    bdescr *bd;
+    StgPtr p, q;
+    nat n;
+
+    for (n = 0; n < n_capabilities; n++) {
+        for (bd = capabilities[n].mut_lists[oldest_gen->no]; bd != NULL;
+             bd = bd->link) {
+            for (p = q = bd->start; p < bd->free; p++) {
+                if (is_live((StgClosure *)*p)) {
+                    *q++ = *p;
+                }
+            }
+            bd->free = q;
+        }
+    }
+}
+
+// The weak pointers in the oldest generation are dealt with as in
+// traverseWeakPtrList(): those whose keys have been marked keep their
+// values and finalizers alive, which may mark more keys, and so on.
+// The rest are dead: their finalizers are marked, and they go on
+// dead_weak_ptr_list for the GC to schedule.  Both lists keep their
+// order (#7160).
+static void
+mark_weak_ptr_list (void)
+{
+    generation *gen = oldest_gen;
+    StgWeak *w, *next, **last, *live, *live_last, **live_tail, **dead;
+    rtsBool flag;
+
+    live = NULL;
+    live_last = NULL;
+    live_tail = &live;
+
+    do {
+        flag = rtsFalse;
+        last = &gen->weak_ptr_list;
+        for (w = gen->weak_ptr_list; w != NULL; w = next) {
+            next = weak_link(w);
+            if (w->header.info == &stg_DEAD_WEAK_info) {
+                *last = next;
+            } else if (is_live(UNTAG_CLOSURE(w->key))) {
+                *last = next;
+                *live_tail = w;
+                live_tail = &w->link;
+                live_last = w;
+                push_weak(&marker_queue, w);
+                flag = rtsTrue;
+            } else {
+                last = &w->link;
+            }
+        }
+        mark_loop(&marker_queue, 0);
+    } while (flag);
+
+    for (w = gen->weak_ptr_list; w != NULL; w = w->link) {
+        debugTrace(DEBUG_weak, "concurrent mark: weak pointer %p is dead", w);
+        push(&marker_queue, (StgClosure *)w);
+        push(&marker_queue, w->finalizer);
+    }
+    mark_loop(&marker_queue, 0);
+
+    for (dead = &dead_weak_ptr_list; *dead != NULL; dead = &(*dead)->link) {
+        ;
+    }
+    *dead = gen->weak_ptr_list;
+
+    *live_tail = NULL;
+    gen->weak_ptr_list = live;
+    gen->weak_ptr_list_tail = live_last;
+}
+
+static void
+finish_cycle (void)
+{
+    generation *gen = oldest_gen;
+    bdescr *bd, *next;
+    W_ live, snapshot_live;
+
+    collect_mark_bufs();
+    mark_loop(&marker_queue, 0);
+
+    // Everything that will survive the cycle has been marked once the
+    // weak pointers are done, so then we can drop the stable names of
+    // the objects that won't.
+    mark_weak_ptr_list();
+    sweepOldStableNames(is_live);
+
+    prune_mut_lists();
+
+    // Sweep: free the blocks in which nothing was marked...
+    snapshot_live = sweepSnapshot(gen);
+
+    // ...and the dead large objects
+    for (bd = gen->large_objects; bd != NULL; bd = next) {
+        next = bd->link;
+        if ((bd->flags & (BF_SNAPSHOT | BF_SNAPSHOT_MARKED)) == BF_SNAPSHOT) {
+            if (bd->flags & BF_PINNED_SMALL) {
+                pinnedFreeBlock(bd);
+            }
+            dbl_link_remove(bd, &gen->large_objects);
+            gen->n_large_blocks -= bd->blocks;
+            gen->n_large_words  -= bd->free - bd->start;
+            freeGroup(bd);
+        } else {
+            bd->flags &= ~(BF_SNAPSHOT | BF_SNAPSHOT_MARKED);
+        }
+    }
+
+    // ...and the dead compact regions
+    for (bd = gen->compact_regions; bd != NULL; bd = next) {
+        next = bd->link;
+        if ((bd->flags & (BF_SNAPSHOT | BF_SNAPSHOT_MARKED)) == BF_SNAPSHOT) {
+            dbl_link_remove(bd, &gen->compact_regions);
+            gen->n_compact_blocks -= ((CompactRegion *)bd->start)->blocks;
+            freeCompactRegion(bd);
+        } else {
+            bd->flags &= ~(BF_SNAPSHOT | BF_SNAPSHOT_MARKED);
+        }
+    }
+
+    // the live data is what we marked, plus everything that was not
+    // in the snapshot
+    live = 0;
+    for (bd = gen->blocks; bd != NULL; bd = bd->link) {
+        if (bd->flags & BF_SNAPSHOT) {
+            bd->flags &= ~BF_SNAPSHOT;
+        } else {
+            live += bd->free - bd->start;
+        }
+    }
+    gen->live_estimate = live + snapshot_live;
+
+    debugTrace(DEBUG_gc, "concurrent mark: finished, %ld blocks left of %ld",
+               (long)(gen->n_blocks + gen->n_large_blocks),
+               (long)snapshot_blocks);
+
+    if (gen->bitmap != NULL) {
+        freeGroup(gen->bitmap);
+        gen->bitmap = NULL;
+    }
+    freeHashTable(static_marked, NULL);
+    static_marked = NULL;
+    conc_mark_active = 0;
+}
+
+static void
+abandon_cycle (void)
+{
+    generation *gen = oldest_gen;
+    bdescr *bd;
+    nat n;
+
+    for (bd = gen->blocks; bd != NULL; bd = bd->link) {
+        bd->flags &= ~BF_SNAPSHOT;
+    }
+    for (bd = gen->large_objects; bd != NULL; bd = bd->link) {
+        bd->flags &= ~(BF_SNAPSHOT | BF_SNAPSHOT_MARKED);
+    }
+    for (bd = gen->compact_regions; bd != NULL; bd = bd->link) {
+        bd->flags &= ~(BF_SNAPSHOT | BF_SNAPSHOT_MARKED);
+    }
+
+    for (n = 0; n < n_capabilities; n++) {
+        freeMarkChunks(capabilities[n].conc_mark_buf);
+        capabilities[n].conc_mark_buf = NULL;
+    }
+#if defined(THREADED_RTS)
+    freeMarkChunks(full_bufs);
+    full_bufs = NULL;
+#endif
+    freeMarkChunks(marker_queue.top);
+    marker_queue.top = NULL;
+
+    if (gen->bitmap != NULL) {
+        freeGroup(gen->bitmap);
+        gen->bitmap = NULL;
+    }
+    freeHashTable(static_marked, NULL);
+    static_marked = NULL;
+    conc_mark_active = 0;
+
+    debugTrace(DEBUG_gc, "concurrent mark: abandoned");
+}
+
+// Called in the child of forkProcess().  The marking thread wasn't
+// copied, and may have been holding conc_mutex or been part-way
+// through a slice of marking, so we drop the cycle in progress, as a
+// major GC would, and start a new marking thread.  The next time the
+// oldest generation is due to be collected starts a new cycle.
+void
+resetConcMarkAfterFork (void)
+{
+    if (!RtsFlags.GcFlags.concurrentMark) return;
+
+    conc_plan  = CONC_NONE;
+    idle_start = rtsFalse;
+    if (conc_mark_active) {
+        abandon_cycle();
+    }
+
+#if defined(THREADED_RTS)
+    startMarkerThread();
+#endif
+}
+
+/* -----------------------------------------------------------------------------
+   Interface to the GC
+   -------------------------------------------------------------------------- */
+
+nat
+concMarkPlanGC (nat collect_gen)
+{
+    const nat old = RtsFlags.GcFlags.generations - 1;
+    rtsBool idle;
+
+    conc_plan = CONC_NONE;
+
+    if (!conc_mark_active) {
+        // Instead of collecting the oldest generation, collect all
+        // the others and start marking it.
+        if (collect_gen == old || idle_start) {
+            idle_start = rtsFalse;
+            conc_plan = CONC_START;
+            return old - 1;
+        }
+        return collect_gen;
+    }
+
+#if defined(THREADED_RTS)
+    ACQUIRE_LOCK(&conc_mutex);
+    idle = marker_idle && full_bufs == NULL;
+    RELEASE_LOCK(&conc_mutex);
+#else
+    idle = rtsTrue;
+#endif
+
+    // Finish the cycle when the marking thread has run out of work,
+    // or if the program is allocating faster than we can mark: then
+    // we finish the mark in this GC, which is no worse than a major
+    // GC would have been.
+    if (idle ||
+        oldest_gen->n_blocks + oldest_gen->n_large_blocks >
+          (W_)(snapshot_blocks * RtsFlags.GcFlags.oldGenFactor)) {
+        conc_plan = CONC_FINISH;
+    }
+
+    return stg_min(collect_gen, old - 1);
+}
+
+void
+concMarkPreGC (rtsBool major_gc)
+{
+    if (!RtsFlags.GcFlags.concurrentMark) return;
+
+#if defined(THREADED_RTS)
+    // Stop the marking thread for the duration of the GC.
+    ACQUIRE_LOCK(&conc_mutex);
+    conc_pause = rtsTrue;
+    while (marker_busy) {
+        waitCondition(&conc_cond, &conc_mutex);
+    }
+    RELEASE_LOCK(&conc_mutex);
+#endif
+
+    conc_major = major_gc;
+    if (major_gc) {
+        conc_plan = CONC_NONE;
+        idle_start = rtsFalse;
+        if (conc_mark_active) {
+            abandon_cycle();
+        }
+    }
+}
+
+rtsBool
+concMarkPostGC (void)
+{
+    nat plan;
+
+    if (!RtsFlags.GcFlags.concurrentMark) return rtsFalse;
+
+    plan = conc_plan;
+    conc_plan = CONC_NONE;
+
+    if (conc_major) {
+        collected_blocks = oldest_gen->n_blocks + oldest_gen->n_large_blocks;
+    }
+
+    if (plan == CONC_START && !conc_mark_active) {
+        start_cycle();
+    } else if (plan == CONC_FINISH && conc_mark_active) {
+        finish_cycle();
+        collected_blocks = oldest_gen->n_blocks + oldest_gen->n_large_blocks;
+        return rtsTrue;
+    }
+    return rtsFalse;
+}
+
+rtsBool
+concMarkIdle (void)
+{
+    W_ blocks;
+    rtsBool idle;
+
+    if (!RtsFlags.GcFlags.concurrentMark) return rtsFalse;
+
+    if (!conc_mark_active) {
+        blocks = oldest_gen->n_blocks + oldest_gen->n_large_blocks;
+        if (blocks * 100 <= collected_blocks * (100 + IDLE_START_PERCENT)) {
+            return rtsFalse;
+        }
+        idle_start = rtsTrue;
+        return rtsTrue;
+    }
+
+#if defined(THREADED_RTS)
+    ACQUIRE_LOCK(&conc_mutex);
+    idle = marker_idle && full_bufs == NULL;
+    RELEASE_LOCK(&conc_mutex);
+#else
+    idle = rtsTrue;
+#endif
+    return idle;
+}
+
+void
+concMarkResume (void)
+{
+    if (!RtsFlags.GcFlags.concurrentMark) return;
+
+#if defined(THREADED_RTS)
+    ACQUIRE_LOCK(&conc_mutex);
+    conc_pause = rtsFalse;
+    marker_idle = rtsFalse;
+    signalCondition(&conc_cond);
+    RELEASE_LOCK(&conc_mutex);
+#endif
+}
@@ -0,0 +1,77 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Concurrent marking of the old generation (+RTS --concurrent-mark).
+ *
+ * Documentation on the architecture of the Garbage Collector can be
+ * found in the online commentary:
+ *
+ *   http://hackage.haskell.org/trac/ghc/wiki/Commentary/Rts/Storage/GC
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SM_CONCMARK_H
+#define SM_CONCMARK_H
+
+#include "BeginPrivate.h"
+
+// The mark queue is a list of chunks of pointers to closures that
+// still have to be marked.  Each Capability has a chunk of its own
+// (cap->conc_mark_buf) in which the write barrier remembers the
+// pointers that the mutator overwrites; full chunks are handed over to
+// the marking thread.
+#define MARK_CHUNK_SIZE 1022
+
+typedef struct MarkChunk_ {
+    struct MarkChunk_ *link;
+    StgWord            n;        // entries in use
+    StgClosure        *entries[MARK_CHUNK_SIZE];
+} MarkChunk;
+
+void     initConcMark    (void);
+void     exitConcMark    (void);
+
+// Called in the child after forkProcess().
+void     resetConcMarkAfterFork (void);
+
+// Decide what the next GC should do; returns the generation to
+// collect.  Called by scheduleDoGC() when a major GC was not forced.
+nat      concMarkPlanGC  (nat collect_gen);
+
+// Called by GarbageCollect(): concMarkPreGC() stops the marking
+// thread (and abandons the current cycle before a major GC),
+// concMarkPostGC() starts or finishes a cycle once the heap is tidy,
+// and returns rtsTrue if a cycle finished, concMarkResume() lets the
+// marking thread carry on.
+void     concMarkPreGC   (rtsBool major_gc);
+rtsBool  concMarkPostGC  (void);
+void     concMarkResume  (void);
+
+// Called by the scheduler when the program is idle (+RTS
+// --idle-slices).  Returns rtsTrue if the next GC should be a
+// collection of the younger generations that starts a cycle, or
+// finishes one whose marking is done.
+rtsBool  concMarkIdle    (void);
+
+// Called by deRefWeak# and finalizeWeak# before they hand a field of
+// w to the mutator, if a concurrent mark is in progress.
+void     concMarkPushWeak (Capability *cap, StgWeak *w);
+
+// The write barrier, for use in the RTS: remember p (or the pointer
+// fields of p) if a concurrent mark is in progress.
+INLINE_HEADER void
+concMarkBarrier (Capability *cap, StgClosure *p)
+{
+    if (conc_mark_active) concMarkPushClosure(cap, p);
+}
+
+INLINE_HEADER void
+concMarkBarrierFields (Capability *cap, StgClosure *p)
+{
+    if (conc_mark_active) concMarkPushFields(cap, p);
+}
+
+#include "EndPrivate.h"
+
+#endif /* SM_CONCMARK_H */
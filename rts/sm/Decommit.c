@@ -0,0 +1,175 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Giving free memory back to the OS in the background (+RTS --decommit).
+ *
+ * Free memory is only returned to the OS synchronously at the end of a
+ * major GC, and only in whole megablocks (returnMemoryToOS()).  With
+ * --decommit we also discard the pages of free block groups inside
+ * partly-used megablocks (decommitFreeBlocks()), keeping
+ * RtsFlags.GcFlags.decommitSlack blocks of free memory committed so
+ * that the next GC doesn't have to fault all of its to-space back in.
+ *
+ * The work is rate-limited to RtsFlags.GcFlags.decommitRate blocks per
+ * second of elapsed time, and done in batches of DECOMMIT_BATCH blocks.
+ * The block allocator lock is only held while a batch is chosen, not
+ * while its memory is being discarded (see BlockAlloc.c).  In the
+ * threaded RTS it is done by a separate OS thread, which is woken up
+ * at the end of each GC, so it adds nothing to GC pause times.  In the
+ * non-threaded RTS there is nowhere else to do it, so it is done at
+ * the end of the GC instead.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Storage.h"
+#include "BlockAlloc.h"
+#include "Decommit.h"
+#include "GetTime.h"
+#include "Trace.h"
+
+#define DECOMMIT_BATCH 256
+
+// the time up to which we have used our decommit allowance
+static Time decommit_time;
+
+#if defined(THREADED_RTS)
+static Mutex      decommit_mutex;
+static Condition  decommit_cond;
+static rtsBool    decommit_wanted;   // woken up by scheduleDecommit()
+static rtsBool    decommit_stop;     // asked to exit by exitDecommit()
+static rtsBool    decommit_running;  // the decommit thread is alive
+#endif
+
+static void
+decommitPass (void)
+{
+    Time now;
+    W_ budget, n;
+    rtsBool done;
+
+    now = getProcessElapsedTime();
+    budget = (W_)((double)RtsFlags.GcFlags.decommitRate *
+                  (double)(now - decommit_time) / TIME_RESOLUTION);
+
+    // Let the allowance build up to at least a batch before doing
+    // anything, so that we don't scan the free lists after every
+    // minor GC.
+    if (budget < DECOMMIT_BATCH) return;
+    decommit_time = now;
+
+    do {
+        n = stg_min(budget, DECOMMIT_BATCH);
+        done = decommitFreeBlocks(n, RtsFlags.GcFlags.decommitSlack);
+        budget -= n;
+    } while (!done && budget > 0);
+}
+
+#if defined(THREADED_RTS)
+static void startDecommitThread (void);
+
+static void OSThreadProcAttr
+decommitThread (void *arg STG_UNUSED)
+{
+    ACQUIRE_LOCK(&decommit_mutex);
+    while (1) {
+        while (!decommit_wanted && !decommit_stop) {
+            waitCondition(&decommit_cond, &decommit_mutex);
+        }
+        if (decommit_stop) break;
+        decommit_wanted = rtsFalse;
+
+        RELEASE_LOCK(&decommit_mutex);
+        decommitPass();
+        ACQUIRE_LOCK(&decommit_mutex);
+    }
+    decommit_running = rtsFalse;
+    broadcastCondition(&decommit_cond);
+    RELEASE_LOCK(&decommit_mutex);
+}
+#endif
+
+void
+initDecommit (void)
+{
+    if (!RtsFlags.GcFlags.decommit) return;
+
+    decommit_time = getProcessElapsedTime();
+
+#if defined(THREADED_RTS)
+    startDecommitThread();
+#endif
+}
+
+#if defined(THREADED_RTS)
+static void
+startDecommitThread (void)
+{
+    OSThreadId tid;
+
+    initMutex(&decommit_mutex);
+    initCondition(&decommit_cond);
+    decommit_wanted  = rtsFalse;
+    decommit_stop    = rtsFalse;
+    decommit_running = rtsTrue;
+
+    if (createOSThread(&tid, (OSThreadProc*)decommitThread, NULL) != 0) {
+        sysErrorBelch("failed to create the decommit thread");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+#endif
+
+void
+exitDecommit (void)
+{
+    if (!RtsFlags.GcFlags.decommit) return;
+
+#if defined(THREADED_RTS)
+    // Wait for the thread to finish: it must not touch the block
+    // allocator after we have freed the heap.
+    ACQUIRE_LOCK(&decommit_mutex);
+    decommit_stop = rtsTrue;
+    broadcastCondition(&decommit_cond);
+    while (decommit_running) {
+        waitCondition(&decommit_cond, &decommit_mutex);
+    }
+    RELEASE_LOCK(&decommit_mutex);
+    closeCondition(&decommit_cond);
+    closeMutex(&decommit_mutex);
+#endif
+}
+
+// Called in the child of forkProcess().  The decommit thread wasn't
+// copied, and may have been holding decommit_mutex or been part-way
+// through a batch when we forked.  The batch's groups are already
+// marked BF_DECOMMITTED, and whether their pages were discarded
+// doesn't matter, so we just forget about it and start a new thread.
+void
+resetDecommitAfterFork (void)
+{
+    if (!RtsFlags.GcFlags.decommit) return;
+
+#if defined(THREADED_RTS)
+    resetDiscardAfterFork();
+    startDecommitThread();
+#endif
+}
+
+void
+scheduleDecommit (void)
+{
+    if (!RtsFlags.GcFlags.decommit) return;
+
+#if defined(THREADED_RTS)
+    ACQUIRE_LOCK(&decommit_mutex);
+    decommit_wanted = rtsTrue;
+    signalCondition(&decommit_cond);
+    RELEASE_LOCK(&decommit_mutex);
+#else
+    decommitPass();
+#endif
+}
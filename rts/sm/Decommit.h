@@ -0,0 +1,25 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Giving free memory back to the OS in the background.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SM_DECOMMIT_H
+#define SM_DECOMMIT_H
+
+#include "BeginPrivate.h"
+
+void initDecommit     (void);
+void exitDecommit     (void);
+
+// Called in the child after forkProcess().
+void resetDecommitAfterFork (void);
+
+// Called at the end of each GC.
+void scheduleDecommit (void);
+
+#include "EndPrivate.h"
+
+#endif /* SM_DECOMMIT_H */
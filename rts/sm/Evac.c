@@ -23,6 +23,9 @@
 #include "Compact.h"
 #include "MarkStack.h"
 #include "Prelude.h"
+#include "Pretenure.h"
+#include "Pinned.h"
+#include "CompactRegion.h"
 #include "Trace.h"
 #include "LdvProfile.h"
 
@@ -60,9 +63,10 @@ alloc_for_copy (nat size, nat gen_no)
     /* Find out where we're going, using the handy "to" pointer in 
      * the gen of the source object.  If it turns out we need to
      * evacuate to an older generation, adjust it here (see comment
-     * by evacuate()).
+     * by evacuate()).  An aging workspace belongs to gen 0.
      */
-    if (gen_no < gct->evac_gen_no) {
+    if (gen_no < gct->evac_gen_no ||
+        (isAgingWorkspace(gen_no) && gct->evac_gen_no > 0)) {
 	if (gct->eager_promotion) {
             gen_no = gct->evac_gen_no;
 	} else {
@@ -240,6 +244,36 @@ copy(StgClosure **p, const StgInfoTable *info,
     copy_tag(p,info,src,size,gen_no,0);
 }
 
+/* -----------------------------------------------------------------------------
+   Mark an object in a block of small pinned objects (BF_PINNED_MARK)
+   as live, so that the space around it can be reused after the GC
+   (see Pinned.c).  Several GC threads may be marking objects in the
+   same block.
+   -------------------------------------------------------------------------- */
+
+STATIC_INLINE void
+mark_pinned(StgPtr p, bdescr *bd)
+{
+    StgWord off, bit;
+    StgPtr w;
+
+    off = p - bd->start;
+    w   = bd->start + off / BITS_IN(W_);
+    bit = (StgWord)1 << (off % BITS_IN(W_));
+
+    if (*w & bit) return;
+#ifndef THREADED_RTS
+    *w |= bit;
+#else
+    {
+        StgWord old;
+        do {
+            old = *w;
+        } while (cas((StgVolatilePtr)w, old, old | bit) != old);
+    }
+#endif
+}
+
 /* -----------------------------------------------------------------------------
    Evacuate a large object
 
@@ -262,6 +296,11 @@ evacuate_large(StgPtr p)
   bd = Bdescr(p);
   gen = bd->gen;
   gen_no = bd->gen_no;
+
+  if (bd->flags & BF_PINNED_MARK) {
+      mark_pinned(p, bd);
+  }
+
   ACQUIRE_SPIN_LOCK(&gen->sync);
 
   // already evacuated? 
@@ -323,6 +362,75 @@ evacuate_large(StgPtr p)
   RELEASE_SPIN_LOCK(&gen->sync);
 }
 
+/* -----------------------------------------------------------------------------
+   Evacuate a compact region
+
+   p points somewhere into a compact region (see CompactRegion.c).  The
+   region is kept alive as a whole: it is relinked onto the
+   live_compact_regions list of its destination generation, with
+   BF_EVACUATED set on the descriptor of its first block, in the same
+   way as a large object.  Nothing in it points outside it, so it is
+   not scavenged.
+   -------------------------------------------------------------------------- */
+
+STATIC_INLINE void
+evacuate_compact(StgPtr p)
+{
+  bdescr *bd;
+  generation *gen, *new_gen;
+  nat gen_no, new_gen_no;
+  CompactRegion *region;
+
+  bd = compactRegionHead(p);
+  gen = bd->gen;
+  gen_no = bd->gen_no;
+
+  ACQUIRE_SPIN_LOCK(&gen->sync);
+
+  // already evacuated, or in a generation we aren't collecting?
+  if (bd->flags & BF_EVACUATED) {
+    if (gen_no < gct->evac_gen_no) {
+	gct->failed_to_evac = rtsTrue;
+	TICK_GC_FAILED_PROMOTION();
+    }
+    RELEASE_SPIN_LOCK(&gen->sync);
+    return;
+  }
+
+  dbl_link_remove(bd, &gen->compact_regions);
+
+  new_gen_no = bd->dest_no;
+
+  if (new_gen_no < gct->evac_gen_no) {
+      if (gct->eager_promotion) {
+          new_gen_no = gct->evac_gen_no;
+      } else {
+	  gct->failed_to_evac = rtsTrue;
+      }
+  }
+
+  new_gen = &generations[new_gen_no];
+  region = (CompactRegion *)bd->start;
+
+  bd->flags |= BF_EVACUATED;
+
+  if (new_gen != gen) { ACQUIRE_SPIN_LOCK(&new_gen->sync); }
+  dbl_link_onto(bd, &new_gen->live_compact_regions);
+  new_gen->n_live_compact_blocks += region->blocks;
+  if (new_gen != gen) { RELEASE_SPIN_LOCK(&new_gen->sync); }
+
+  RELEASE_SPIN_LOCK(&gen->sync);
+
+  // Only a promoted region costs more than the constant time above:
+  // all of its block descriptors have to be updated.  This is done
+  // outside the lock, as other threads only read them now that
+  // BF_EVACUATED is set; one that still sees the old (younger)
+  // generation just puts an object on a mutable list needlessly.
+  if (new_gen != gen) {
+      setCompactRegionGen(region, new_gen);
+  }
+}
+
 /* ----------------------------------------------------------------------------
    Evacuate
 
@@ -480,7 +588,15 @@ loop:
 
   bd = Bdescr((P_)q);
 
-  if ((bd->flags & (BF_LARGE | BF_MARKED | BF_EVACUATED)) != 0) {
+  if ((bd->flags & (BF_LARGE | BF_MARKED | BF_EVACUATED
+                    | BF_COMPACT_REGION)) != 0) {
+
+      // only the first block of a compact region says whether it has
+      // been evacuated
+      if (bd->flags & BF_COMPACT_REGION) {
+          evacuate_compact((P_)q);
+          return;
+      }
 
       // pointer into to-space: just return it.  It might be a pointer
       // into a generation that we aren't collecting (> N), or it
@@ -489,6 +605,12 @@ loop:
       // easier; e.g. scavenging an object is idempotent, so it's OK to
       // have an object on the mutable list multiple times.
       if (bd->flags & BF_EVACUATED) {
+          // the rest of a block of pinned objects is evacuated with
+          // its first live object, but we still need to know which
+          // objects are live.
+          if (bd->flags & BF_PINNED_MARK) {
+              mark_pinned((P_)q, bd);
+          }
           // We aren't copying this object, so we have to check
           // whether it is already in the target generation.  (this is
           // the write barrier).
@@ -539,7 +661,7 @@ loop:
      */
       StgClosure *e = (StgClosure*)UN_FORWARDING_PTR(info);
       *p = TAG_CLOSURE(tag,e);
-      if (gen_no < gct->evac_gen_no) {  // optimisation
+      if (gen_no < gct->evac_gen_no || isAgingWorkspace(gen_no)) {  // optimisation
           if (Bdescr((P_)e)->gen_no < gct->evac_gen_no) {
 	      gct->failed_to_evac = rtsTrue;
 	      TICK_GC_FAILED_PROMOTION();
@@ -548,6 +670,12 @@ loop:
       return;
   }
 
+  // +RTS --pretenure: types that survive aging skip gen 0
+  if (RtsFlags.GcFlags.pretenure && bd->gen_no == 0
+      && info != &stg_WHITEHOLE_info) {
+      gen_no = pretenureDest(info, bd);
+  }
+
   switch (INFO_PTR_TO_STRUCT(info)->type) {
 
   case WHITEHOLE:
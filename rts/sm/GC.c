@@ -27,6 +27,12 @@
 #include "MarkWeak.h"
 #include "Sparks.h"
 #include "Sweep.h"
+#include "Pretenure.h"
+#include "PauseTarget.h"
+#include "Pinned.h"
+#include "CompactRegion.h"
+#include "Decommit.h"
+#include "ConcMark.h"
 
 #include "Storage.h"
 #include "RtsUtils.h"
@@ -116,7 +122,8 @@ nat mutlist_MUTVARS,
     mutlist_TREC_HEADER,
     mutlist_ATOMIC_INVARIANT,
     mutlist_INVARIANT_CHECK_QUEUE,
-    mutlist_OTHERS;
+    mutlist_OTHERS,
+    mutlist_DUPS;
 #endif
 
 /* Thread-local data for each GC thread
@@ -131,6 +138,10 @@ StgWord8 the_gc_thread[sizeof(gc_thread) + 64 * sizeof(gen_workspace)];
 // step->todos[] lists we have to look in to find work.
 nat n_gc_threads;
 
+// Number of workspaces in each gc_thread: one per generation, plus the
+// aging workspaces of gen 0 (see GCThread.h).
+nat n_gc_workspaces;
+
 // For stats:
 long copied;        // *words* copied & scavenged during this GC
 
@@ -147,16 +158,20 @@ static void zero_static_object_list (StgClosure* first_static);
 static void prepare_collected_gen   (generation *gen);
 static void prepare_uncollected_gen (generation *gen);
 static void init_gc_thread          (gc_thread *t);
-static void resize_generations      (void);
+static void resize_generations      (rtsBool resize);
 static void resize_nursery          (void);
 static void start_gc_threads        (void);
 static void scavenge_until_all_done (void);
-static StgWord inc_running          (void);
-static StgWord dec_running          (void);
+static void set_busy                (gc_thread *t);
 static void wakeup_gc_threads       (nat me);
 static void shutdown_gc_threads     (nat me);
+static void end_gc_phases           (void);
+#if defined(THREADED_RTS)
+static void help_gc_phases          (StgWord phase_no);
+#endif
 static void collect_gct_blocks      (void);
 static void collect_pinned_object_blocks (void);
+static void collect_large_objects        (void);
 
 #if 0 && defined(DEBUG)
 static void gcCAFs                  (void);
@@ -191,6 +206,7 @@ GarbageCollect (nat collect_gen,
   gc_thread *saved_gct;
 #endif
   nat g, n;
+  rtsBool conc_done;
 
   // necessary if we stole a callee-saves register for gct:
 #if defined(THREADED_RTS)
@@ -233,6 +249,7 @@ GarbageCollect (nat collect_gen,
   mutlist_ATOMIC_INVARIANT = 0;
   mutlist_INVARIANT_CHECK_QUEUE = 0;
   mutlist_OTHERS = 0;
+  mutlist_DUPS = 0;
 #endif
 
   // attribute any costs to CCS_GC 
@@ -248,6 +265,18 @@ GarbageCollect (nat collect_gen,
   N = collect_gen;
   major_gc = (N == RtsFlags.GcFlags.generations-1);
 
+  // note how much we are collecting (+RTS --pause-target)
+  pauseStartGC(N);
+
+  // stop the concurrent mark, if there is one
+  concMarkPreGC(major_gc);
+
+  // a major GC marks the oldest generation afresh, so finish sweeping
+  // it first (+RTS --lazy-sweep)
+  if (major_gc) {
+      finishLazySweep();
+  }
+
 #if defined(THREADED_RTS)
   work_stealing = RtsFlags.ParFlags.parGcLoadBalancingEnabled &&
                   N >= RtsFlags.ParFlags.parGcLoadBalancingGen;
@@ -300,6 +329,11 @@ GarbageCollect (nat collect_gen,
   // gather blocks allocated using allocatePinned() from each capability
   // and put them on the g0->large_object list.
   collect_pinned_object_blocks();
+  collect_large_objects();
+
+  // the free space in the pinned blocks we're collecting will be
+  // found again after the GC
+  pinnedStartGC(N);
 
   // Initialise all the generations/steps that we're collecting.
   for (g = 0; g <= N; g++) {
@@ -335,7 +369,7 @@ GarbageCollect (nat collect_gen,
   // exiting prematurely, so we can start them now.
   // NB. do this after the mutable lists have been saved above, otherwise
   // the other GC threads will be writing into the old mutable lists.
-  inc_running();
+  set_busy(gct);
   wakeup_gc_threads(gct->thread_index);
 
   traceEventGcWork(gct->cap);
@@ -344,21 +378,22 @@ GarbageCollect (nat collect_gen,
   // of markSomeCapabilities() because markSomeCapabilities() can only
   // call back into the GC via mark_root() (due to the gct register
   // variable).
+  // scavenge_capability_mut_lists() shares out the mutable lists of
+  // all the Capabilities between the GC threads, including those of
+  // idle Capabilities.
   if (n_gc_threads == 1) {
-      for (n = 0; n < n_capabilities; n++) {
 #if defined(THREADED_RTS)
-          scavenge_capability_mut_Lists1(&capabilities[n]);
+      scavenge_capability_mut_Lists1(gct->cap);
 #else
-          scavenge_capability_mut_lists(&capabilities[n]);
+      scavenge_capability_mut_lists(gct->cap);
 #endif
-      }
   } else {
       scavenge_capability_mut_lists(gct->cap);
       for (n = 0; n < n_capabilities; n++) {
           if (gc_threads[n]->idle) {
               markCapability(mark_root, gct, &capabilities[n],
                              rtsTrue/*don't mark sparks*/);
-              scavenge_capability_mut_lists(&capabilities[n]);
+              markCapabilityWeakPtrList(&capabilities[n]);
           }
       }
   }
@@ -373,9 +408,11 @@ GarbageCollect (nat collect_gen,
       for (n = 0; n < n_capabilities; n++) {
           markCapability(mark_root, gct, &capabilities[n],
                          rtsTrue/*don't mark sparks*/);
+          markCapabilityWeakPtrList(&capabilities[n]);
       }
   } else {
       markCapability(mark_root, gct, cap, rtsTrue/*don't mark sparks*/);
+      markCapabilityWeakPtrList(cap);
   }
 
   markScheduler(mark_root, gct);
@@ -405,7 +442,7 @@ GarbageCollect (nat collect_gen,
       // must be last...  invariant is that everything is fully
       // scavenged at this point.
       if (traverseWeakPtrList()) { // returns rtsTrue if evaced something 
-	  inc_running();
+	  set_busy(gct);
 	  continue;
       }
 
@@ -419,6 +456,17 @@ GarbageCollect (nat collect_gen,
 
   shutdown_gc_threads(gct->thread_index);
 
+#if defined(THREADED_RTS)
+  // Free the pieces of large arrays that we shared out
+  // (see split_mut_arr_ptrs()); all of them have been scavenged.
+  for (n = 0; n < n_gc_threads; n++) {
+      if (gc_threads[n]->arr_chunks != NULL) {
+          freeChain(gc_threads[n]->arr_chunks);
+          gc_threads[n]->arr_chunks = NULL;
+      }
+  }
+#endif
+
   // Now see which stable names are still alive.
   gcStableTables();
 
@@ -449,14 +497,23 @@ GarbageCollect (nat collect_gen,
 
   // NO MORE EVACUATION AFTER THIS POINT!
 
+  // Find the free space between the live objects in the surviving
+  // pinned blocks, before they go back on the large_objects lists.
+  pinnedEndGC(N);
+
   // Finally: compact or sweep the oldest generation.
   if (major_gc && oldest_gen->mark) {
       if (oldest_gen->compact) 
           compact(gct->scavenged_static_objects);
       else
-          sweep(oldest_gen);
+          // don't leave blocks unswept if we're about to census the heap
+          sweep(oldest_gen,
+                RtsFlags.GcFlags.lazySweep && !do_heap_census);
   }
 
+  // The other GC threads have nothing more to help with.
+  end_gc_phases();
+
   copied = 0;
   par_max_copied = 0;
   par_tot_copied = 0;
@@ -508,14 +565,14 @@ GarbageCollect (nat collect_gen,
 	copied +=  mut_list_size;
 
 	debugTrace(DEBUG_gc,
-		   "mut_list_size: %lu (%d vars, %d arrays, %d MVARs, %d TVARs, %d TVAR_WATCH_QUEUEs, %d TREC_CHUNKs, %d TREC_HEADERs, %d ATOMIC_INVARIANTs, %d INVARIANT_CHECK_QUEUEs, %d others)",
+		   "mut_list_size: %lu (%d vars, %d arrays, %d MVARs, %d TVARs, %d TVAR_WATCH_QUEUEs, %d TREC_CHUNKs, %d TREC_HEADERs, %d ATOMIC_INVARIANTs, %d INVARIANT_CHECK_QUEUEs, %d others, %d duplicates)",
 		   (unsigned long)(mut_list_size * sizeof(W_)),
                    mutlist_MUTVARS, mutlist_MUTARRS, mutlist_MVARS,
                    mutlist_TVAR, mutlist_TVAR_WATCH_QUEUE,
                    mutlist_TREC_CHUNK, mutlist_TREC_HEADER,
                    mutlist_ATOMIC_INVARIANT,
                    mutlist_INVARIANT_CHECK_QUEUE,
-                   mutlist_OTHERS);
+                   mutlist_OTHERS, mutlist_DUPS);
     }
 
     bdescr *next, *prev;
@@ -573,8 +630,10 @@ GarbageCollect (nat collect_gen,
             }
             // add the new blocks to the block tally
             gen->n_blocks += gen->n_old_blocks;
-            ASSERT(countBlocks(gen->blocks) == gen->n_blocks);
-            ASSERT(countOccupied(gen->blocks) == gen->n_words);
+            ASSERT(countBlocks(gen->blocks) + gen->n_unswept_blocks
+                   == gen->n_blocks);
+            ASSERT(countOccupied(gen->blocks)
+                   + countOccupied(gen->unswept_blocks) == gen->n_words);
         }
         else // not copacted
         {
@@ -589,11 +648,17 @@ GarbageCollect (nat collect_gen,
          * collection from large_objects.  Any objects left on the
          * large_objects list are therefore dead, so we free them here.
          */
-        freeChain(gen->large_objects);
+        freeChainOnCaps(gen->large_objects);
         gen->large_objects  = gen->scavenged_large_objects;
         gen->n_large_blocks = gen->n_scavenged_large_blocks;
         gen->n_large_words  = countOccupied(gen->large_objects);
         gen->n_new_large_words = 0;
+
+        // COMPACT REGIONS.  Likewise, the regions left on
+        // compact_regions are dead.
+        freeCompactRegions(gen->compact_regions);
+        gen->compact_regions  = gen->live_compact_regions;
+        gen->n_compact_blocks = gen->n_live_compact_blocks;
     }
     else // for generations > N
     {
@@ -609,6 +674,13 @@ GarbageCollect (nat collect_gen,
         
 	// add the new blocks we promoted during this GC 
 	gen->n_large_blocks += gen->n_scavenged_large_blocks;
+
+        // and the compact regions
+	for (bd = gen->live_compact_regions; bd; bd = next) {
+            next = bd->link;
+            dbl_link_onto(bd, &gen->compact_regions);
+        }
+        gen->n_compact_blocks += gen->n_live_compact_blocks;
     }
 
     ASSERT(countBlocks(gen->large_objects) == gen->n_large_blocks);
@@ -616,6 +688,8 @@ GarbageCollect (nat collect_gen,
 
     gen->scavenged_large_objects = NULL;
     gen->n_scavenged_large_blocks = 0;
+    gen->live_compact_regions = NULL;
+    gen->n_live_compact_blocks = 0;
 
     // Count "live" data
     live_words  += genLiveWords(gen);
@@ -632,8 +706,12 @@ GarbageCollect (nat collect_gen,
     }
   } // for all generations
 
-  // update the max size of older generations after a major GC
-  resize_generations();
+  // start or finish a concurrent mark of the old generation
+  conc_done = concMarkPostGC();
+
+  // update the max size of older generations after a major GC, or
+  // when a concurrent mark has finished
+  resize_generations(major_gc || conc_done);
   
   // Free the mark stack.
   if (mark_stack_top_bd != NULL) {
@@ -642,10 +720,10 @@ GarbageCollect (nat collect_gen,
       freeChain(mark_stack_top_bd);
   }
 
-  // Free any bitmaps.
+  // Free any bitmaps, except one that a lazy sweep still needs.
   for (g = 0; g <= N; g++) {
       gen = &generations[g];
-      if (gen->bitmap != NULL) {
+      if (gen->bitmap != NULL && gen->unswept_blocks == NULL) {
           freeGroup(gen->bitmap);
           gen->bitmap = NULL;
       }
@@ -698,7 +776,7 @@ GarbageCollect (nat collect_gen,
   }
 
   // Update the stable pointer hash table.
-  updateStableTables(major_gc);
+  updateStableTables();
 
   // unlock the StablePtr table.  Must be before scheduleFinalizers(),
   // because a finalizer may call hs_free_fun_ptr() or
@@ -708,7 +786,7 @@ GarbageCollect (nat collect_gen,
   // Start any pending finalizers.  Must be after
   // updateStableTables() and stableUnlock() (see #4221).
   RELEASE_SM_LOCK;
-  scheduleFinalizers(cap, old_weak_ptr_list);
+  scheduleFinalizers(cap, dead_weak_ptr_list);
   ACQUIRE_SM_LOCK;
 
   // check sanity after GC
@@ -735,6 +813,10 @@ GarbageCollect (nat collect_gen,
 
   if (major_gc) {
       W_ need, got;
+      // Give the blocks held in the per-Capability caches back to the
+      // global free lists, so that they can be coalesced and possibly
+      // returned to the OS below.
+      flushBlockCaches();
       need = BLOCKS_TO_MBLOCKS(n_alloc_blocks);
       got = mblocks_allocated;
       /* If the amount of data remains constant, next major GC we'll
@@ -746,6 +828,11 @@ GarbageCollect (nat collect_gen,
       }
   }
 
+  // decide what to pretenure during the next GC, if +RTS --pretenure
+  if (RtsFlags.GcFlags.pretenure) {
+      pretenureEndGC();
+  }
+
   // extra GC trace info
   IF_DEBUG(gc, statDescribeGens());
 
@@ -786,6 +873,12 @@ GarbageCollect (nat collect_gen,
 
   RELEASE_SM_LOCK;
 
+  // give some free memory back to the OS, if +RTS --decommit
+  scheduleDecommit();
+
+  // let the concurrent mark carry on, if +RTS --concurrent-mark
+  concMarkResume();
+
   SET_GCT(saved_gct);
 }
 
@@ -816,6 +909,12 @@ new_gc_thread (nat n, gc_thread *t)
 #endif
 
     t->thread_index = n;
+#ifdef THREADED_RTS
+    t->steal_seed = n + 1;
+    t->scavenging = rtsFalse;
+    t->arr_q = newWSDeque(128);
+    t->arr_chunks = NULL;
+#endif
     t->idle = rtsFalse;
     t->free_blocks = NULL;
     t->gc_count = 0;
@@ -826,20 +925,39 @@ new_gc_thread (nat n, gc_thread *t)
     t->papi_events = -1;
 #endif
 
-    for (g = 0; g < RtsFlags.GcFlags.generations; g++)
+    for (g = 0; g < n_gc_workspaces; g++)
     {
         ws = &t->gens[g];
-        ws->gen = &generations[g];
-        ASSERT(g == ws->gen->no);
         ws->my_gct = t;
+
+        // Which workspace do objects leaving this one go to?  See
+        // "Aging" in GCThread.h.
+        if (isAgingWorkspace(g)) {
+            ws->gen = g0;
+            if (g + 1 < n_gc_workspaces) {
+                ws->dest_no = g + 1;
+            } else {
+                ws->dest_no = g0->to->no;
+            }
+        } else {
+            ws->gen = &generations[g];
+            ASSERT(g == ws->gen->no);
+            if (g == 0 && n_gc_workspaces > RtsFlags.GcFlags.generations) {
+                ws->dest_no = RtsFlags.GcFlags.generations;
+            } else {
+                ws->dest_no = ws->gen->to->no;
+            }
+        }
         
         // We want to call
         //   alloc_todo_block(ws,0);
         // but can't, because it uses gct which isn't set up at this point.
         // Hence, allocate a block for todo_bd manually:
         {
-            bdescr *bd = allocBlock(); // no lock, locks aren't initialised yet
+            // no lock, locks aren't initialised yet
+            bdescr *bd = allocBlockOnNode(capNoToNumaNode(n));
             initBdescr(bd, ws->gen, ws->gen->to);
+            bd->dest_no = ws->dest_no;
             bd->flags = BF_EVACUATED;
             bd->u.scan = bd->free = bd->start;
 
@@ -867,6 +985,14 @@ initGcThreads (nat from USED_IF_THREADS, nat to USED_IF_THREADS)
 {
 #if defined(THREADED_RTS)
     nat i;
+#endif
+
+    n_gc_workspaces = RtsFlags.GcFlags.generations;
+    if (RtsFlags.GcFlags.tenureAge > 2) {
+        n_gc_workspaces += RtsFlags.GcFlags.tenureAge - 2;
+    }
+
+#if defined(THREADED_RTS)
 
     if (from > 0) {
         gc_threads = stgReallocBytes (gc_threads, to * sizeof(gc_thread*),
@@ -885,7 +1011,7 @@ initGcThreads (nat from USED_IF_THREADS, nat to USED_IF_THREADS)
     for (i = from; i < to; i++) {
         gc_threads[i] =
             stgMallocBytes(sizeof(gc_thread) +
-                           RtsFlags.GcFlags.generations * sizeof(gen_workspace),
+                           n_gc_workspaces * sizeof(gen_workspace),
                            "alloc_gc_threads");
 
         new_gc_thread(i, gc_threads[i]);
@@ -906,15 +1032,16 @@ freeGcThreads (void)
 #if defined(THREADED_RTS)
         nat i;
 	for (i = 0; i < n_capabilities; i++) {
-            for (g = 0; g < RtsFlags.GcFlags.generations; g++)
+            for (g = 0; g < n_gc_workspaces; g++)
             {
                 freeWSDeque(gc_threads[i]->gens[g].todo_q);
             }
+            freeWSDeque(gc_threads[i]->arr_q);
             stgFree (gc_threads[i]);
 	}
         stgFree (gc_threads);
 #else
-        for (g = 0; g < RtsFlags.GcFlags.generations; g++)
+        for (g = 0; g < n_gc_workspaces; g++)
         {
             freeWSDeque(gc_threads[0]->gens[g].todo_q);
         }
@@ -928,24 +1055,67 @@ freeGcThreads (void)
    Start GC threads
    ------------------------------------------------------------------------- */
 
-static volatile StgWord gc_running_threads;
+#if defined(THREADED_RTS)
+// Termination: see scavenge_until_all_done()
+static volatile StgWord gc_busy_seq;  // incremented by set_busy()
+static volatile StgWord gc_scav_done; // gc_busy_seq when all were idle
+
+// Parallel phases: see gcParallelPhase()
+static void (* volatile gc_phase_fn)(void);
+static volatile StgWord gc_phase_no;       // incremented for each phase
+static volatile StgWord gc_phase_running;  // helpers still in the phase
+static volatile rtsBool gc_phases_done;
+#endif
 
-static StgWord
-inc_running (void)
+// Mark t as having work to do.  Called for every GC thread before it
+// starts, and by a thread that has gone idle before it takes any work
+// again.
+static void
+set_busy (gc_thread *t USED_IF_THREADS)
 {
-    StgWord new;
-    new = atomic_inc(&gc_running_threads);
-    ASSERT(new <= n_gc_threads);
-    return new;
+#if defined(THREADED_RTS)
+    t->scavenging = rtsTrue;
+    atomic_inc(&gc_busy_seq);  // also a full memory barrier
+#endif
 }
 
+#if defined(THREADED_RTS)
+// Were all the GC threads idle at once?  Looks at every thread's flag
+// between two reads of gc_busy_seq: if any thread went back to work
+// in the meantime, it may have stolen work from a thread we had
+// already seen, so the answer is no.  Returns the value of
+// gc_busy_seq that was seen, or 0.
 static StgWord
-dec_running (void)
+all_idle (void)
 {
-    ASSERT(gc_running_threads != 0);
-    return atomic_dec(&gc_running_threads);
+    StgWord seq;
+    nat i;
+
+    seq = gc_busy_seq;
+    load_load_barrier();
+    for (i = 0; i < n_gc_threads; i++) {
+        if (gc_threads[i]->idle) continue;
+        if (gc_threads[i]->scavenging) return 0;
+    }
+    load_load_barrier();
+    if (gc_busy_seq != seq) return 0;
+    return seq;
 }
 
+// gc_scav_done only ever goes up, so that a thread that finished its
+// check late can't hide the result of a later one.
+static void
+set_scav_done (StgWord seq)
+{
+    StgWord old;
+
+    do {
+        old = gc_scav_done;
+        if (old >= seq) return;
+    } while (cas(&gc_scav_done, old, seq) != old);
+}
+#endif
+
 static rtsBool
 any_work (void)
 {
@@ -964,7 +1134,7 @@ any_work (void)
     // Check for global work in any step.  We don't need to check for
     // local work, because we have already exited scavenge_loop(),
     // which means there is no local work for this thread.
-    for (g = 0; g < (int)RtsFlags.GcFlags.generations; g++) {
+    for (g = 0; g < (int)n_gc_workspaces; g++) {
         ws = &gct->gens[g];
         if (ws->todo_large_objects) return rtsTrue;
         if (!looksEmptyWSDeque(ws->todo_q)) return rtsTrue;
@@ -974,33 +1144,63 @@ any_work (void)
 #if defined(THREADED_RTS)
     if (work_stealing) {
         nat n;
-        // look for work to steal
-        for (n = 0; n < n_gc_threads; n++) {
-            if (n == gct->thread_index) continue;
-            for (g = RtsFlags.GcFlags.generations-1; g >= 0; g--) {
+        // look at one thread, chosen at random, for work to steal.
+        // This is called over and over again by every idle thread, so
+        // it doesn't look at them all.
+        n = steal_victim();
+        if (n != gct->thread_index && !gc_threads[n]->idle) {
+            for (g = n_gc_workspaces-1; g >= 0; g--) {
                 ws = &gc_threads[n]->gens[g];
                 if (!looksEmptyWSDeque(ws->todo_q)) return rtsTrue;
             }
+            if (!looksEmptyWSDeque(gc_threads[n]->arr_q)) return rtsTrue;
         }
     }
 #endif
 
     gct->no_work++;
-#if defined(THREADED_RTS)
-    yieldThread();
-#endif
 
     return rtsFalse;
 }    
 
+/* ----------------------------------------------------------------------------
+   Termination
+
+   Every GC thread is busy (t->scavenging) from when it starts until
+   scavenge_loop() runs out of work, and a thread that has gone idle
+   marks itself busy again (set_busy()) before it takes any more.  An
+   idle thread's own queues are empty, so whatever work is left is on
+   the queues of busy threads, and the scavenging is done once all
+   the threads are idle at the same time.
+
+   Each thread looks for that once, whenever it goes idle
+   (all_idle()), and records what it saw in gc_scav_done.  A check
+   only fails because some thread was busy or went back to work
+   during it, and that thread will go idle again and check for itself,
+   so the last thread to go idle always sees the end.  In the meantime
+   an idle thread only reads gc_scav_done and gc_busy_seq, which
+   change when a thread goes back to work, and looks for work in its
+   own workspaces and on one other thread's deques (any_work()).  It
+   never writes to anything shared until it finds some.
+   ------------------------------------------------------------------------- */
+
+// An idle GC thread waits a while before looking for work again, so
+// that the threads that are still working are not slowed down by the
+// idle ones reading their deques.  The wait doubles each time no work
+// is found, up to a limit, after which we yield.
+#define IDLE_SPIN_MIN 16
+#define IDLE_SPIN_MAX 4096
+
 static void
 scavenge_until_all_done (void)
 {
-    DEBUG_ONLY( nat r );
-	
+#if defined(THREADED_RTS)
+    nat spin, i;
+    StgWord seq;
+#endif
 
-loop:
 #if defined(THREADED_RTS)
+loop:
     if (n_gc_threads > 1) {
         scavenge_loop();
     } else {
@@ -1014,29 +1214,41 @@ loop:
 
     // scavenge_loop() only exits when there's no work to do
 
-#ifdef DEBUG
-    r = dec_running();
-#else
-    dec_running();
-#endif
-
     traceEventGcIdle(gct->cap);
 
-    debugTrace(DEBUG_gc, "%d GC threads still running", r);
-    
-    while (gc_running_threads != 0) {
-        // usleep(1);
+#if defined(THREADED_RTS)
+    gct->scavenging = rtsFalse;
+    store_load_barrier();
+
+    seq = all_idle();
+    if (seq != 0) {
+        set_scav_done(seq);
+    }
+
+    spin = IDLE_SPIN_MIN;
+    while (gc_scav_done != gc_busy_seq) {
         if (any_work()) {
-            inc_running();
+            set_busy(gct);
             traceEventGcWork(gct->cap);
             goto loop;
         }
         // any_work() does not remove the work from the queue, it
         // just checks for the presence of work.  If we find any,
-        // then we increment gc_running_threads and go back to 
-        // scavenge_loop() to perform any pending work.
+        // then we mark ourselves busy and go back to scavenge_loop()
+        // to perform any pending work.
+
+        if (spin < IDLE_SPIN_MAX) {
+            for (i = 0; i < spin && gc_scav_done != gc_busy_seq; i++) {
+                busy_wait_nop();
+            }
+            spin *= 2;
+        } else {
+            yieldThread();
+        }
     }
-    
+#endif
+
+    debugTrace(DEBUG_gc, "GC thread %d: no more work", gct->thread_index);
     traceEventGcDone(gct->cap);
 }
 
@@ -1046,10 +1258,14 @@ void
 gcWorkerThread (Capability *cap)
 {
     gc_thread *saved_gct;
+    StgWord phase_no;
 
     // necessary if we stole a callee-saves register for gct:
     saved_gct = gct;
 
+    // no parallel phase can start before we have finished scavenging
+    phase_no = gc_phase_no;
+
     SET_GCT(gc_threads[cap->no]);
     gct->id = osThreadId();
 
@@ -1081,6 +1297,7 @@ gcWorkerThread (Capability *cap)
     // Every thread evacuates some roots.
     gct->evac_gen_no = 0;
     markCapability(mark_root, gct, cap, rtsTrue/*prune sparks*/);
+    markCapabilityWeakPtrList(cap);
     scavenge_capability_mut_lists(cap);
 
     scavenge_until_all_done();
@@ -1109,6 +1326,7 @@ gcWorkerThread (Capability *cap)
     gct->wakeup = GC_THREAD_WAITING_TO_CONTINUE;
     debugTrace(DEBUG_gc, "GC thread %d waiting to continue...", 
                gct->thread_index);
+    help_gc_phases(phase_no);
     ACQUIRE_SPIN_LOCK(&gct->mut_spin);
     debugTrace(DEBUG_gc, "GC thread %d on my way...", gct->thread_index);
 
@@ -1159,7 +1377,9 @@ static void
 start_gc_threads (void)
 {
 #if defined(THREADED_RTS)
-    gc_running_threads = 0;
+    gc_busy_seq = 0;
+    gc_scav_done = 0;
+    gc_phases_done = rtsFalse;
 #endif
 }
 
@@ -1173,7 +1393,7 @@ wakeup_gc_threads (nat me USED_IF_THREADS)
 
     for (i=0; i < n_gc_threads; i++) {
         if (i == me || gc_threads[i]->idle) continue;
-        inc_running();
+        set_busy(gc_threads[i]);
         debugTrace(DEBUG_gc, "waking up gc thread %d", i);
         if (gc_threads[i]->wakeup != GC_THREAD_STANDING_BY) barf("wakeup_gc_threads");
 
@@ -1202,6 +1422,86 @@ shutdown_gc_threads (nat me USED_IF_THREADS)
 #endif
 }
 
+/* ----------------------------------------------------------------------------
+   Parallel phases
+
+   Once the heap has been marked, the GC threads other than the main
+   one would normally just wait for the collection to finish.  Work
+   that can be split up after that point (e.g. compacting the oldest
+   generation) is done by calling gcParallelPhase(fn): fn is run on
+   every GC thread, and gcParallelPhase() returns when they have all
+   finished.  fn must share out the work itself, typically by claiming
+   pieces of it with atomic_inc().  With a single GC thread, fn is just
+   called directly.
+   ------------------------------------------------------------------------- */
+
+void
+gcParallelPhase (void (*fn)(void))
+{
+#if defined(THREADED_RTS)
+    nat i, n;
+
+    n = 0;
+    if (n_gc_threads > 1) {
+        for (i=0; i < n_gc_threads; i++) {
+            if (i == gct->thread_index || gc_threads[i]->idle) continue;
+            n++;
+        }
+    }
+
+    if (n > 0) {
+        gc_phase_fn = fn;
+        gc_phase_running = n;
+        write_barrier();
+        gc_phase_no++;
+    }
+#endif
+
+    fn();
+
+#if defined(THREADED_RTS)
+    while (gc_phase_running != 0) {
+        busy_wait_nop();
+    }
+#endif
+}
+
+// Called by the GC worker threads once they have finished scavenging:
+// help with any parallel phases until the main GC thread calls
+// end_gc_phases().
+#if defined(THREADED_RTS)
+static void
+help_gc_phases (StgWord phase_no)
+{
+    nat spin = 0;
+
+    while (!gc_phases_done) {
+        if (gc_phase_no != phase_no) {
+            phase_no = gc_phase_no;
+            gc_phase_fn();
+            atomic_dec(&gc_phase_running);
+            spin = 0;
+        } else if (spin < SPIN_COUNT) {
+            busy_wait_nop();
+            spin++;
+        } else {
+            // the main thread may be in a long sequential stretch;
+            // don't hog a core on an oversubscribed machine.
+            yieldThread();
+            spin = 0;
+        }
+    }
+}
+#endif
+
+static void
+end_gc_phases (void)
+{
+#if defined(THREADED_RTS)
+    gc_phases_done = rtsTrue;
+#endif
+}
+
 #if defined(THREADED_RTS)
 void
 releaseGCThreads (Capability *cap USED_IF_THREADS)
@@ -1228,7 +1528,7 @@ releaseGCThreads (Capability *cap USED_IF_THREADS)
 static void
 prepare_collected_gen (generation *gen)
 {
-    nat i, g, n;
+    nat i, g, n, w;
     gen_workspace *ws;
     bdescr *bd, *next;
 
@@ -1239,7 +1539,8 @@ prepare_collected_gen (generation *gen)
     if (g != 0) {
         for (i = 0; i < n_capabilities; i++) {
 	    freeChain(capabilities[i].mut_lists[g]);
-	    capabilities[i].mut_lists[g] = allocBlock();
+	    capabilities[i].mut_lists[g] =
+                allocBlockOnNode(capNoToNumaNode(i));
 	}
     }
 
@@ -1262,30 +1563,34 @@ prepare_collected_gen (generation *gen)
     // initialise the large object queues.
     ASSERT(gen->scavenged_large_objects == NULL);
     ASSERT(gen->n_scavenged_large_blocks == 0);
+    ASSERT(gen->live_compact_regions == NULL);
+    ASSERT(gen->n_live_compact_blocks == 0);
 
     // grab all the partial blocks stashed in the gc_thread workspaces and
     // move them to the old_blocks list of this gen.
     for (n = 0; n < n_capabilities; n++) {
-        ws = &gc_threads[n]->gens[gen->no];
-
-        for (bd = ws->part_list; bd != NULL; bd = next) {
-            next = bd->link;
-            bd->link = gen->old_blocks;
-            gen->old_blocks = bd;
-            gen->n_old_blocks += bd->blocks;
-        }
-        ws->part_list = NULL;
-        ws->n_part_blocks = 0;
-
-        ASSERT(ws->scavd_list == NULL);
-        ASSERT(ws->n_scavd_blocks == 0);
-
-        if (ws->todo_free != ws->todo_bd->start) {
-            ws->todo_bd->free = ws->todo_free;
-            ws->todo_bd->link = gen->old_blocks;
-            gen->old_blocks = ws->todo_bd;
-            gen->n_old_blocks += ws->todo_bd->blocks;
-            alloc_todo_block(ws,0); // always has one block.
+        for (w = gen->no; w < n_gc_workspaces; w = nextGenWorkspace(gen->no,w)) {
+            ws = &gc_threads[n]->gens[w];
+
+            for (bd = ws->part_list; bd != NULL; bd = next) {
+                next = bd->link;
+                bd->link = gen->old_blocks;
+                gen->old_blocks = bd;
+                gen->n_old_blocks += bd->blocks;
+            }
+            ws->part_list = NULL;
+            ws->n_part_blocks = 0;
+
+            ASSERT(ws->scavd_list == NULL);
+            ASSERT(ws->n_scavd_blocks == 0);
+
+            if (ws->todo_free != ws->todo_bd->start) {
+                ws->todo_bd->free = ws->todo_free;
+                ws->todo_bd->link = gen->old_blocks;
+                gen->old_blocks = ws->todo_bd;
+                gen->n_old_blocks += ws->todo_bd->blocks;
+                alloc_todo_block(ws,0); // always has one block.
+            }
         }
     }
 
@@ -1297,6 +1602,14 @@ prepare_collected_gen (generation *gen)
     // mark the large objects as from-space
     for (bd = gen->large_objects; bd; bd = bd->link) {
         bd->flags &= ~BF_EVACUATED;
+        if (bd->flags & BF_PINNED_SMALL) {
+            startPinnedMarking(bd);
+        }
+    }
+
+    // and the compact regions
+    for (bd = gen->compact_regions; bd; bd = bd->link) {
+        bd->flags &= ~BF_EVACUATED;
     }
 
     // for a compacted generation, we need to allocate the bitmap
@@ -1351,7 +1664,7 @@ static void
 stash_mut_list (Capability *cap, nat gen_no)
 {
     cap->saved_mut_lists[gen_no] = cap->mut_lists[gen_no];
-    cap->mut_lists[gen_no] = allocBlock_sync();
+    cap->mut_lists[gen_no] = allocBlockOnNode_sync(cap->node);
 }
 
 /* ----------------------------------------------------------------------------
@@ -1389,7 +1702,7 @@ collect_gct_blocks (void)
     gen_workspace *ws;
     bdescr *bd, *prev;
     
-    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+    for (g = 0; g < n_gc_workspaces; g++) {
         ws = &gct->gens[g];
         
         // there may still be a block attached to ws->todo_bd;
@@ -1453,6 +1766,36 @@ collect_pinned_object_blocks (void)
     }
 }
 
+/* -----------------------------------------------------------------------------
+   Likewise, allocate() puts new large objects on cap->large_objects
+   rather than taking a lock to put them on g0->large_objects; here we
+   move them over.
+   -------------------------------------------------------------------------- */
+
+static void
+collect_large_objects (void)
+{
+    nat n;
+    bdescr *bd, *prev;
+
+    for (n = 0; n < n_capabilities; n++) {
+        prev = NULL;
+        for (bd = capabilities[n].large_objects; bd != NULL; bd = bd->link) {
+            prev = bd;
+        }
+        if (prev != NULL) {
+            prev->link = g0->large_objects;
+            if (g0->large_objects != NULL) {
+                g0->large_objects->u.back = prev;
+            }
+            g0->large_objects = capabilities[n].large_objects;
+            g0->n_large_blocks += capabilities[n].n_large_blocks;
+            capabilities[n].large_objects = NULL;
+            capabilities[n].n_large_blocks = 0;
+        }
+    }
+}
+
 /* -----------------------------------------------------------------------------
    Initialise a gc_thread before GC
    -------------------------------------------------------------------------- */
@@ -1464,6 +1807,7 @@ init_gc_thread (gc_thread *t)
     t->scavenged_static_objects = END_OF_STATIC_LIST;
     t->scan_bd = NULL;
     t->mut_lists = t->cap->mut_lists;
+    memset(t->mut_filter, 0, sizeof(t->mut_filter));
     t->evac_gen_no = 0;
     t->failed_to_evac = rtsFalse;
     t->eager_promotion = rtsTrue;
@@ -1526,11 +1870,11 @@ zero_static_object_list(StgClosure* first_static)
    ------------------------------------------------------------------------- */
 
 static void
-resize_generations (void)
+resize_generations (rtsBool resize)
 {
     nat g;
 
-    if (major_gc && RtsFlags.GcFlags.generations > 1) {
+    if (resize && RtsFlags.GcFlags.generations > 1) {
         W_ live, size, min_alloc, words;
         const W_ max  = RtsFlags.GcFlags.maxHeapSize;
         const W_ gens = RtsFlags.GcFlags.generations;
@@ -1542,7 +1886,7 @@ resize_generations (void)
             words = oldest_gen->n_words;
         }
         live = (words + BLOCK_SIZE_W - 1) / BLOCK_SIZE_W +
-            oldest_gen->n_large_blocks;
+            oldest_gen->n_large_blocks + oldest_gen->n_compact_blocks;
 	
 	// default max size for all generations except zero
 	size = stg_max(live * RtsFlags.GcFlags.oldGenFactor,
@@ -1616,6 +1960,17 @@ resize_generations (void)
 	    generations[g].max_blocks = size;
 	}
     }
+
+    // +RTS --pause-target: collect the intermediate generations
+    // before they get too big to collect within the target.  The
+    // oldest generation keeps its size, because a major GC takes as
+    // long as the live data takes to copy or mark.
+    if (RtsFlags.GcFlags.pauseTarget != 0) {
+        for (g = 1; g + 1 < RtsFlags.GcFlags.generations; g++) {
+            generations[g].max_blocks =
+                pauseMaxBlocks(g, oldest_gen->max_blocks);
+        }
+    }
 }
 
 /* -----------------------------------------------------------------------------
@@ -1678,11 +2033,20 @@ resize_nursery (void)
     }
     else  // Generational collector
     {
+	/*
+	 * If the user has given us a pause target, size the allocation
+	 * area so that a minor GC takes about that long.
+	 */
+	if (RtsFlags.GcFlags.pauseTarget != 0)
+	{
+	    resizeNurseries(pauseNurseryBlocks(countNurseryBlocks(),
+	                                       min_nursery));
+	}
 	/* 
 	 * If the user has given us a suggested heap size, adjust our
 	 * allocation area to make best use of the memory available.
 	 */
-	if (RtsFlags.GcFlags.heapSizeSuggestion)
+	else if (RtsFlags.GcFlags.heapSizeSuggestion)
 	{
 	    long blocks;
             StgWord needed;
@@ -1730,7 +2094,7 @@ resize_nursery (void)
 	{
 	    // we might have added extra large blocks to the nursery, so
 	    // resize back to minAllocAreaSize again.
-	    resizeNurseriesFixed(RtsFlags.GcFlags.minAllocAreaSize);
+	    resizeNurseriesFixed();
 	}
     }
 }
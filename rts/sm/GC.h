@@ -43,7 +43,8 @@ extern nat mutlist_MUTVARS, mutlist_MUTARRS, mutlist_MVARS, mutlist_OTHERS,
     mutlist_TREC_CHUNK,
     mutlist_TREC_HEADER,
     mutlist_ATOMIC_INVARIANT,
-    mutlist_INVARIANT_CHECK_QUEUE;
+    mutlist_INVARIANT_CHECK_QUEUE,
+    mutlist_DUPS;
 #endif
 
 #if defined(PROF_SPIN) && defined(THREADED_RTS)
@@ -51,6 +52,7 @@ extern StgWord64 whitehole_spin;
 #endif
 
 void gcWorkerThread (Capability *cap);
+void gcParallelPhase (void (*fn)(void));
 void initGcThreads (nat from, nat to);
 void freeGcThreads (void);
 
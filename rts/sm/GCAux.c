@@ -13,6 +13,8 @@
 #include "GC.h"
 #include "Storage.h"
 #include "Compact.h"
+#include "Pinned.h"
+#include "CompactRegion.h"
 #include "Task.h"
 #include "Capability.h"
 #include "Trace.h"
@@ -60,8 +62,18 @@ isAlive(StgClosure *p)
     // ignore closures in generations that we're not collecting. 
     bd = Bdescr((P_)q);
 
+    // a compact region is alive if its first block was evacuated
+    if (bd->flags & BF_COMPACT_REGION) {
+        return (compactRegionHead((P_)q)->flags & BF_EVACUATED) ? p : NULL;
+    }
+
     // if it's a pointer into to-space, then we're done
     if (bd->flags & BF_EVACUATED) {
+        // ... unless it's in a block of small pinned objects, which is
+        // evacuated along with the first of its objects that is.
+        if ((bd->flags & BF_PINNED_MARK) && !isPinnedMarked((P_)q,bd)) {
+            return NULL;
+        }
 	return p;
     }
 
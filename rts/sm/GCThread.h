@@ -65,6 +65,13 @@
    ------------------------------------------------------------------------- */
 
 
+// The length of the prefetch queue in a gc_thread: how many closures
+// are prefetched before we get round to prefetching their info tables.
+#define PREFETCH_QUEUE_SIZE 8
+
+// The number of entries in a gc_thread's mut_filter (a power of 2).
+#define MUT_FILTER_SIZE 512
+
 /* -----------------------------------------------------------------------------
    Generation Workspace
   
@@ -100,7 +107,13 @@ typedef struct gen_workspace_ {
     bdescr *     part_list;
     unsigned int n_part_blocks;      // count of above
 
+    nat          dest_no;            // the dest_no of our to-space blocks
+
+#if SIZEOF_VOID_P == 8
     StgWord pad[3];
+#else
+    StgWord pad[2];
+#endif
 
 } gen_workspace ATTRIBUTE_ALIGNED(64);
 // align so that computing gct->gens[n] is a shift, not a multiply
@@ -123,6 +136,13 @@ typedef struct gc_thread_ {
     SpinLock   gc_spin;
     SpinLock   mut_spin;
     volatile rtsBool wakeup;
+    volatile rtsBool scavenging;   // has work to do; see
+                                   // scavenge_until_all_done()
+    StgWord    steal_seed;         // state of the generator that picks
+                                   // the threads to steal from
+    WSDeque *  arr_q;              // pieces of large arrays to scavenge,
+                                   // see split_mut_arr_ptrs()
+    bdescr *   arr_chunks;         // blocks holding those pieces
 #endif
     nat thread_index;              // a zero based index identifying the thread
     rtsBool idle;                  // sitting out of this GC cycle
@@ -139,6 +159,11 @@ typedef struct gc_thread_ {
     // block that is currently being scanned
     bdescr *     scan_bd;
 
+    // closures prefetched by scavenge_block(), whose info tables are
+    // still to be prefetched (see prefetch_closure() in Scav.c)
+    StgClosure * pf_queue[PREFETCH_QUEUE_SIZE];
+    nat          pf_next;
+
     // Remembered sets on this CPU.  Each GC thread has its own
     // private per-generation remembered sets, so it can add an item
     // to the remembered set without taking a lock.  The mut_lists
@@ -147,6 +172,12 @@ typedef struct gc_thread_ {
     // during GC; see recordMutableGen_GC().
     bdescr **    mut_lists;
 
+    // The mutable list entries this thread has scavenged recently in
+    // this GC, indexed by a hash of the address, so that
+    // scavenge_mutable_list() can skip an object that was recorded
+    // more than once (and drop the duplicate from the remembered set).
+    StgClosure * mut_filter[MUT_FILTER_SIZE];
+
     // --------------------
     // evacuate flags
 
@@ -190,7 +221,8 @@ typedef struct gc_thread_ {
     // -------------------
     // workspaces
 
-    // array of workspaces, indexed by gen->abs_no.  This is placed
+    // array of workspaces, indexed by gen->abs_no, followed by the
+    // aging workspaces of gen 0 (see below).  This is placed
     // directly at the end of the gc_thread structure so that we can get from
     // the gc_thread pointer to a workspace using only pointer
     // arithmetic, no memory access.  This happens in the inner loop
@@ -201,6 +233,55 @@ typedef struct gc_thread_ {
 
 extern nat n_gc_threads;
 
+/* -----------------------------------------------------------------------------
+   Aging
+
+   An object that survives a GC in the nursery is copied into gen 0,
+   and promoted once it has survived RtsFlags.GcFlags.tenureAge GCs in
+   all.  Objects of different ages have to be kept in different blocks,
+   so gen 0 has a workspace for each age: gens[0] for the objects that
+   have survived one GC, and the aging workspaces gens[G] ..
+   gens[n_gc_workspaces-1] (where G is the number of generations) for
+   the older ones.  All of them belong to gen 0.
+
+   The dest_no of a block, which is normally the generation to copy its
+   objects into, is really the index of a workspace: gens[0] copies
+   into gens[G], gens[G] into gens[G+1], and so on, and the last one
+   into gen 1.  With the default tenure age of 2 there are no aging
+   workspaces, and gens[0] copies into gen 1.
+   -------------------------------------------------------------------------- */
+
+extern nat n_gc_workspaces;
+
+INLINE_HEADER rtsBool
+isAgingWorkspace (nat w)
+{
+    return w >= RtsFlags.GcFlags.generations;
+}
+
+// Iterate over the workspaces of generation g:
+//   for (w = g; w < n_gc_workspaces; w = nextGenWorkspace(g,w)) ...
+INLINE_HEADER nat
+nextGenWorkspace (nat g, nat w)
+{
+    if (g != 0) return n_gc_workspaces;
+    if (w == 0) return RtsFlags.GcFlags.generations;
+    return w + 1;
+}
+
+// The workspace of t that the to-space block bd was allocated by.
+INLINE_HEADER gen_workspace *
+blockWorkspace (gc_thread *t, bdescr *bd)
+{
+    if (bd->gen_no != 0 || bd->dest_no == t->gens[0].dest_no) {
+        return &t->gens[bd->gen_no];
+    }
+    if (isAgingWorkspace(bd->dest_no)) {
+        return &t->gens[bd->dest_no - 1];
+    }
+    return &t->gens[n_gc_workspaces - 1];  // the oldest age
+}
+
 extern gc_thread **gc_threads;
 
 #if defined(THREADED_RTS) && defined(llvm_CC_FLAVOR)
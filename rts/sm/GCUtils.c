@@ -20,8 +20,10 @@
 #include "GCThread.h"
 #include "GCTDecl.h"
 #include "GCUtils.h"
+#include "Sweep.h"
 #include "Printer.h"
 #include "Trace.h"
+#include "Capability.h"
 #ifdef THREADED_RTS
 #include "WSDeque.h"
 #endif
@@ -30,24 +32,34 @@
 SpinLock gc_alloc_block_sync;
 #endif
 
+// During GC, each GC thread allocates memory on the NUMA node of its
+// Capability, so that the data it copies ends up in memory local to
+// the Capability that is most likely to use it next.
+
 bdescr *
-allocBlock_sync(void)
+allocBlockOnNode_sync(nat node)
 {
     bdescr *bd;
     ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
-    bd = allocBlock();
+    bd = allocBlockOnNode(node);
     RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
     return bd;
 }
 
+// Most blocks are allocated from, and freed into, the block cache of
+// the Capability that this GC thread is working for; see
+// "Per-Capability block caches" in BlockAlloc.c.
+
+bdescr *
+allocBlock_sync(void)
+{
+    return allocGroupOnCap_sync(gct->cap, 1);
+}
+
 static bdescr *
 allocGroup_sync(nat n)
 {
-    bdescr *bd;
-    ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
-    bd = allocGroup(n);
-    RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
-    return bd;
+    return allocGroupOnCap_sync(gct->cap, n);
 }
 
 
@@ -78,9 +90,12 @@ allocBlocks_sync(nat n, bdescr **hd, bdescr **tl,
 void
 freeChain_sync(bdescr *bd)
 {
-    ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
-    freeChain(bd);
-    RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
+    bdescr *next_bd;
+    while (bd != NULL) {
+        next_bd = bd->link;
+        freeGroupOnCap_sync(gct->cap, bd);
+        bd = next_bd;
+    }
 }
 
 /* -----------------------------------------------------------------------------
@@ -115,12 +130,13 @@ grab_local_todo_block (gen_workspace *ws)
 bdescr *
 steal_todo_block (nat g)
 {
-    nat n;
+    nat i, n;
     bdescr *bd;
 
-    // look for work to steal
-    for (n = 0; n < n_gc_threads; n++) {
-        if (n == gct->thread_index) continue;
+    // look for work to steal, starting from a random thread
+    n = steal_victim();
+    for (i = 0; i < n_gc_threads; i++, n = n + 1 == n_gc_threads ? 0 : n + 1) {
+        if (n == gct->thread_index || gc_threads[n]->idle) continue;
         bd = stealWSDeque(gc_threads[n]->gens[g].todo_q);
         if (bd) {
             return bd;
@@ -262,6 +278,10 @@ alloc_todo_block (gen_workspace *ws, nat size)
 //
 //        bd = hd;
 
+        // pay for the new block by sweeping some of the oldest
+        // generation (+RTS --lazy-sweep)
+        lazySweep_sync(LAZY_SWEEP_BLOCKS);
+
         if (size > BLOCK_SIZE_W) {
             bd = allocGroup_sync((W_)BLOCK_ROUND_UP(size*sizeof(W_))
                                  / BLOCK_SIZE);
@@ -269,6 +289,7 @@ alloc_todo_block (gen_workspace *ws, nat size)
             bd = allocBlock_sync();
         }
         initBdescr(bd, ws->gen, ws->gen->to);
+        bd->dest_no = ws->dest_no;
         bd->flags = BF_EVACUATED;
         bd->u.scan = bd->free = bd->start;
     }
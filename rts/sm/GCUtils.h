@@ -19,6 +19,7 @@
 #include "GCTDecl.h"
 
 bdescr *allocBlock_sync(void);
+bdescr *allocBlockOnNode_sync(nat node);
 void    freeChain_sync(bdescr *bd);
 
 void    push_scanned_block   (bdescr *bd, gen_workspace *ws);
@@ -28,6 +29,22 @@ StgPtr  alloc_todo_block     (gen_workspace *ws, nat size);
 bdescr *grab_local_todo_block  (gen_workspace *ws);
 #if defined(THREADED_RTS)
 bdescr *steal_todo_block       (nat s);
+
+// Pick the first GC thread to look for work to steal from.  If every
+// thread looked at the others in the same order, thread 0 would be
+// robbed by everybody and the threads it pushed work to would be
+// hammered too, so each thread starts at a random place instead
+// (xorshift; the seed is never 0).
+INLINE_HEADER nat
+steal_victim (void)
+{
+    StgWord x = gct->steal_seed;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    gct->steal_seed = x;
+    return (nat)(x % n_gc_threads);
+}
 #endif
 
 // Returns true if a block is partially full.  This predicate is used to try
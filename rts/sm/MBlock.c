@@ -26,7 +26,36 @@ W_ mpc_misses = 0;
    The MBlock Map: provides our implementation of HEAP_ALLOCED()
    -------------------------------------------------------------------------- */
 
-#if SIZEOF_VOID_P == 4
+#ifdef USE_LARGE_ADDRESS_SPACE
+
+/* With a large address space, the heap is a single range of address
+   space reserved by initMBlocks().  Megablocks are handed out from the
+   bottom of the range upwards: everything below mblock_high_watermark
+   is committed, except for the ranges on free_list_head, which have
+   been freed (and decommitted) and are reused before we move the
+   watermark up again.  The free list is kept sorted by address, and
+   adjacent ranges are coalesced.
+ */
+
+struct mblock_address_range mblock_address_space = { 0, 0, {0} };
+
+static W_ mblock_high_watermark;
+
+typedef struct free_range_ {
+    struct free_range_ *prev, *next;
+    W_ address;
+    W_ size;
+} free_range;
+
+static free_range *free_list_head = NULL;
+
+static void
+setHeapAlloced(void *p STG_UNUSED, StgWord8 i STG_UNUSED)
+{
+    // nothing to do: HEAP_ALLOCED is a range check
+}
+
+#elif SIZEOF_VOID_P == 4
 StgWord8 mblock_map[MBLOCK_MAP_SIZE]; // initially all zeros
 
 static void
@@ -122,7 +151,35 @@ markHeapUnalloced(void *p)
     setHeapAlloced(p, 0);
 }
 
-#if SIZEOF_VOID_P == 4
+#ifdef USE_LARGE_ADDRESS_SPACE
+
+// Find the first committed mblock at or above p.
+static void *
+getCommittedMBlock (W_ p)
+{
+    free_range *iter;
+
+    for (iter = free_list_head; iter != NULL; iter = iter->next) {
+        if (iter->address + iter->size <= p) continue;
+        if (iter->address > p) break;
+        // p is in a free range; skip to the end of it
+        p = iter->address + iter->size;
+    }
+    if (p >= mblock_high_watermark) return NULL;
+    return (void *)p;
+}
+
+void * getFirstMBlock(void)
+{
+    return getCommittedMBlock(mblock_address_space.begin);
+}
+
+void * getNextMBlock(void *mblock)
+{
+    return getCommittedMBlock((W_)mblock + MBLOCK_SIZE);
+}
+
+#elif SIZEOF_VOID_P == 4
 
 STATIC_INLINE
 void * mapEntryToMBlock(nat i)
@@ -212,6 +269,139 @@ void * getFirstMBlock(void)
 
 #endif // SIZEOF_VOID_P
 
+/* -----------------------------------------------------------------------------
+   Committing and decommitting parts of the large address space
+   -------------------------------------------------------------------------- */
+
+#ifdef USE_LARGE_ADDRESS_SPACE
+
+static void
+unlinkFreeRange (free_range *r)
+{
+    if (r->prev != NULL) {
+        r->prev->next = r->next;
+    } else {
+        free_list_head = r->next;
+    }
+    if (r->next != NULL) {
+        r->next->prev = r->prev;
+    }
+    stgFree(r);
+}
+
+// First fit from the free list, or NULL if nothing fits.
+static void *
+getReusableMBlocks (nat n)
+{
+    free_range *iter;
+    W_ size = MBLOCK_SIZE * (W_)n;
+    void *addr;
+
+    for (iter = free_list_head; iter != NULL; iter = iter->next) {
+        if (iter->size < size) continue;
+
+        addr = (void *)iter->address;
+        iter->address += size;
+        iter->size -= size;
+        if (iter->size == 0) {
+            unlinkFreeRange(iter);
+        }
+        return addr;
+    }
+    return NULL;
+}
+
+static void *
+getFreshMBlocks (nat n)
+{
+    W_ size = MBLOCK_SIZE * (W_)n;
+    void *addr;
+
+    if (mblock_high_watermark + size > mblock_address_space.end) {
+        errorBelch("out of memory (the heap has used all %" FMT_Word
+                   " bytes of its reserved address space; see +RTS -xr)",
+                   mblock_address_space.end - mblock_address_space.begin);
+        stg_exit(EXIT_HEAPOVERFLOW);
+    }
+    addr = (void *)mblock_high_watermark;
+    mblock_high_watermark += size;
+    return addr;
+}
+
+static void *
+getCommittedMBlocks (nat n)
+{
+    void *addr;
+
+    addr = getReusableMBlocks(n);
+    if (addr == NULL) {
+        addr = getFreshMBlocks(n);
+    }
+    osCommitMemory(addr, (W_)n * MBLOCK_SIZE);
+    return addr;
+}
+
+static void
+decommitMBlocks (char *addr, nat n)
+{
+    free_range *iter, *prev, *r;
+    W_ address = (W_)addr;
+    W_ size = MBLOCK_SIZE * (W_)n;
+
+    osDecommitMemory(addr, size);
+
+    prev = NULL;
+    for (iter = free_list_head; iter != NULL; prev = iter, iter = iter->next) {
+        if (iter->address + iter->size < address) continue;
+
+        if (iter->address + iter->size == address) {
+            // extend iter upwards, and merge with the next range if
+            // the two now touch
+            iter->size += size;
+            if (iter->next != NULL &&
+                iter->next->address == iter->address + iter->size) {
+                iter->size += iter->next->size;
+                unlinkFreeRange(iter->next);
+            }
+            goto done;
+        }
+        if (address + size == iter->address) {
+            // extend iter downwards
+            iter->address = address;
+            iter->size += size;
+            goto done;
+        }
+        // iter is entirely above the new range
+        break;
+    }
+
+    r = stgMallocBytes(sizeof(free_range), "decommitMBlocks");
+    r->address = address;
+    r->size = size;
+    r->prev = prev;
+    r->next = iter;
+    if (prev != NULL) {
+        prev->next = r;
+    } else {
+        free_list_head = r;
+    }
+    if (iter != NULL) {
+        iter->prev = r;
+    }
+
+done:
+    // If the last free range ends at the high watermark, lower the
+    // watermark instead, so that getFirstMBlock()/getNextMBlock()
+    // have less to skip.
+    for (r = free_list_head; r != NULL && r->next != NULL; r = r->next) {}
+    if (r != NULL && r->address + r->size == mblock_high_watermark) {
+        mblock_high_watermark = r->address;
+        unlinkFreeRange(r);
+    }
+}
+
+#endif /* USE_LARGE_ADDRESS_SPACE */
+
 /* -----------------------------------------------------------------------------
    Allocate new mblock(s)
    -------------------------------------------------------------------------- */
@@ -231,7 +421,11 @@ getMBlocks(nat n)
     nat i;
     void *ret;
 
+#ifdef USE_LARGE_ADDRESS_SPACE
+    ret = getCommittedMBlocks(n);
+#else
     ret = osGetMBlocks(n);
+#endif
 
     debugTrace(DEBUG_gc, "allocated %d megablock(s) at %p",n,ret);
     
@@ -246,6 +440,18 @@ getMBlocks(nat n)
     return ret;
 }
 
+// Allocate 'n' mblocks and bind them to the given (OS) NUMA node.
+// The binding only affects pages that have not been touched yet,
+// which is the case for memory that we have just mapped.
+
+void *
+getMBlocksOnNode(nat node, nat n)
+{
+    void *addr = getMBlocks(n);
+    osBindMBlocksToNode(addr, (W_)n * MBLOCK_SIZE, node);
+    return addr;
+}
+
 void
 freeMBlocks(void *addr, nat n)
 {
@@ -259,7 +465,11 @@ freeMBlocks(void *addr, nat n)
         markHeapUnalloced( (StgWord8*)addr + i * MBLOCK_SIZE );
     }
 
+#ifdef USE_LARGE_ADDRESS_SPACE
+    decommitMBlocks(addr, n);
+#else
     osFreeMBlocks(addr, n);
+#endif
 }
 
 void
@@ -267,9 +477,19 @@ freeAllMBlocks(void)
 {
     debugTrace(DEBUG_gc, "freeing all megablocks");
 
+#ifdef USE_LARGE_ADDRESS_SPACE
+    osReleaseHeapMemory();
+    while (free_list_head != NULL) {
+        unlinkFreeRange(free_list_head);
+    }
+    mblock_address_space.begin = 0;
+    mblock_address_space.end = 0;
+    mblock_high_watermark = 0;
+#else
     osFreeAllMBlocks();
+#endif
 
-#if SIZEOF_VOID_P == 8
+#if SIZEOF_VOID_P == 8 && !defined(USE_LARGE_ADDRESS_SPACE)
     nat n;
     for (n = 0; n < mblock_map_count; n++) {
         stgFree(mblock_maps[n]);
@@ -282,7 +502,18 @@ void
 initMBlocks(void)
 {
     osMemInit();
-#if SIZEOF_VOID_P == 8
+#ifdef USE_LARGE_ADDRESS_SPACE
+    {
+        W_ size = RtsFlags.GcFlags.addressSpaceSize;
+        void *addr = osReserveHeapMemory(&size);
+
+        mblock_address_space.begin = (W_)addr;
+        mblock_address_space.end   = (W_)addr + size;
+        mblock_high_watermark      = (W_)addr;
+        debugTrace(DEBUG_gc, "reserved %" FMT_Word " bytes of heap address space at %p",
+                   size, addr);
+    }
+#elif SIZEOF_VOID_P == 8
     memset(mblock_cache,0xff,sizeof(mblock_cache));
 #endif
 }
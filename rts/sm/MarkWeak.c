@@ -18,7 +18,9 @@
 #include "GC.h"
 #include "GCThread.h"
 #include "GCTDecl.h"
+#include "GCUtils.h"
 #include "Evac.h"
+#include "Scav.h"
 #include "Trace.h"
 #include "Schedule.h"
 #include "Weak.h"
@@ -39,10 +41,23 @@
    new live weak pointers, then all the currently unreachable ones are
    dead.
 
-   For generational GC: we just don't try to finalize weak pointers in
-   older generations than the one we're collecting.  This could
-   probably be optimised by keeping per-generation lists of weak
-   pointers, but for a few weak pointers this scheme will work.
+   For generational GC: each generation has its own list of weak
+   pointers (gen->weak_ptr_list), and we only look at the lists of the
+   generations we're collecting.  A weak pointer in an older
+   generation is treated as if its key were alive: its key, value and
+   finalizer are kept alive through the mutable list (see
+   scavengeLiveWeak()), and it can only be found dead when its own
+   generation is collected.  New weak pointers are put on a list in the
+   Capability that created them (cap->weak_ptr_list_hd), so that mkWeak#
+   doesn't need a lock; each GC thread marks the list for its own
+   Capability, and we move them onto generation 0's list before
+   looking at it.
+
+   ForeignPtrs with C finalizers rely on the weak pointers on each of
+   these lists staying in the same order (#7160): newest first.  The
+   Capability lists would lose that order between Capabilities, so
+   mkWeakForeignEnv# puts weak pointers with C finalizers straight onto
+   generation 0's list instead, taking sm_mutex.
 
    There are three distinct stages to processing weak pointers:
 
@@ -75,23 +90,40 @@
 typedef enum { WeakPtrs, WeakThreads, WeakDone } WeakStage;
 static WeakStage weak_stage;
 
-/* Weak pointers
+/* Weak pointers found to be dead: the pending finaliser list
  */
-StgWeak *old_weak_ptr_list; // also pending finaliser list
-StgWeak *weak_ptr_list_tail;
+StgWeak *dead_weak_ptr_list;
 
 // List of threads found to be unreachable
 StgTSO *resurrected_threads;
 
 static void resurrectUnreachableThreads (generation *gen);
 static rtsBool tidyThreadList (generation *gen);
+static void collectCapabilityWeakPtrLists (void);
+static rtsBool tidyWeakList (generation *gen);
+static void collectDeadWeakPtrs (void);
+static void finishWeakPtrLists (void);
 
 void
 initWeakForGC(void)
 {
-    old_weak_ptr_list = weak_ptr_list;
-    weak_ptr_list = NULL;
-    weak_ptr_list_tail = NULL;
+    nat g;
+
+    // Live weak pointers may also be promoted into a generation we
+    // aren't collecting.  They are younger than the ones already
+    // there, so they have to go at the front of its list: for those
+    // generations we keep the old contents of the list aside on
+    // old_weak_ptr_list (which tidyWeakList() only looks at for the
+    // generations we're collecting), and put them back at the end in
+    // finishWeakPtrLists().
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        generation *gen = &generations[g];
+        gen->old_weak_ptr_list = gen->weak_ptr_list;
+        gen->weak_ptr_list = NULL;
+        gen->weak_ptr_list_tail = NULL;
+    }
+
+    dead_weak_ptr_list = NULL;
     weak_stage = WeakPtrs;
     resurrected_threads = END_TSO_QUEUE;
 }
@@ -99,10 +131,7 @@ initWeakForGC(void)
 rtsBool 
 traverseWeakPtrList(void)
 {
-  StgWeak *w, **last_w, *next_w;
-  StgClosure *new;
   rtsBool flag = rtsFalse;
-  const StgInfoTable *info;
 
   switch (weak_stage) {
 
@@ -110,74 +139,26 @@ traverseWeakPtrList(void)
       return rtsFalse;
 
   case WeakPtrs:
-      /* doesn't matter where we evacuate values/finalizers to, since
-       * these pointers are treated as roots (iff the keys are alive).
-       */
-      gct->evac_gen_no = 0;
-      
-      last_w = &old_weak_ptr_list;
-      for (w = old_weak_ptr_list; w != NULL; w = next_w) {
-	  
-	  /* There might be a DEAD_WEAK on the list if finalizeWeak# was
-	   * called on a live weak pointer object.  Just remove it.
-	   */
-	  if (w->header.info == &stg_DEAD_WEAK_info) {
-	      next_w = ((StgDeadWeak *)w)->link;
-	      *last_w = next_w;
-	      continue;
-	  }
-	  
-          info = get_itbl((StgClosure *)w);
-	  switch (info->type) {
-
-	  case WEAK:
-	      /* Now, check whether the key is reachable.
-	       */
-	      new = isAlive(w->key);
-	      if (new != NULL) {
-		  w->key = new;
-		  // evacuate the value and finalizer 
-		  evacuate(&w->value);
-		  evacuate(&w->finalizer);
-		  // remove this weak ptr from the old_weak_ptr list 
-		  *last_w = w->link;
-                  next_w  = w->link;
-
-                  // and put it on the new weak ptr list.
-                  // NB. we must retain the order of the weak_ptr_list (#7160)
-                  if (weak_ptr_list == NULL) {
-                      weak_ptr_list = w;
-                  } else {
-                      weak_ptr_list_tail->link = w;
-                  }
-                  weak_ptr_list_tail = w;
-                  w->link = NULL;
-                  flag = rtsTrue;
-
-		  debugTrace(DEBUG_weak, 
-			     "weak pointer still alive at %p -> %p",
-			     w, w->key);
-		  continue;
-	      }
-	      else {
-		  last_w = &(w->link);
-		  next_w = w->link;
-		  continue;
-	      }
-
-	  default:
-	      barf("traverseWeakPtrList: not WEAK");
-	  }
+  {
+      nat g;
+
+      // The GC threads have marked the new weak pointers on their
+      // Capabilities by now.
+      collectCapabilityWeakPtrLists();
+
+      for (g = 0; g <= N; g++) {
+          if (tidyWeakList(&generations[g])) {
+              flag = rtsTrue;
+          }
       }
-      
+
       /* If we didn't make any changes, then we can go round and kill all
-       * the dead weak pointers.  The old_weak_ptr list is used as a list
+       * the dead weak pointers.  The dead_weak_ptr_list is used as a list
        * of pending finalizers later on.
        */
       if (flag == rtsFalse) {
-	  for (w = old_weak_ptr_list; w; w = w->link) {
-	      evacuate(&w->finalizer);
-	  }
+          collectDeadWeakPtrs();
+          finishWeakPtrLists();
 
 	  // Next, move to the WeakThreads stage after fully
 	  // scavenging the finalizers we've just evacuated.
@@ -185,6 +166,7 @@ traverseWeakPtrList(void)
       }
 
       return rtsTrue;
+  }
 
   case WeakThreads:
       /* Now deal with the step->threads lists, which behave somewhat like
@@ -230,7 +212,173 @@ traverseWeakPtrList(void)
   }
 }
   
-  static void resurrectUnreachableThreads (generation *gen)
+/* -----------------------------------------------------------------------------
+   Move the new weak pointers from each Capability onto the front of
+   generation 0's list.  They are all younger than the ones already
+   there.
+   -------------------------------------------------------------------------- */
+
+static void
+collectCapabilityWeakPtrLists (void)
+{
+    Capability *cap;
+    nat n;
+
+    for (n = 0; n < n_capabilities; n++) {
+        cap = &capabilities[n];
+        if (cap->weak_ptr_list_hd != NULL) {
+            if (cap->weak_ptr_list_tl->header.info == &stg_DEAD_WEAK_info) {
+                ((StgDeadWeak *)cap->weak_ptr_list_tl)->link =
+                    g0->old_weak_ptr_list;
+            } else {
+                cap->weak_ptr_list_tl->link = g0->old_weak_ptr_list;
+            }
+            g0->old_weak_ptr_list = cap->weak_ptr_list_hd;
+            cap->weak_ptr_list_hd = NULL;
+            cap->weak_ptr_list_tl = NULL;
+        }
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Look for weak pointers in gen->old_weak_ptr_list whose keys have
+   been found to be alive, evacuate their fields and move them onto the
+   weak pointer list of the generation they now live in.  Returns
+   rtsTrue if it found any.
+   -------------------------------------------------------------------------- */
+
+static rtsBool
+tidyWeakList (generation *gen)
+{
+    StgWeak *w, **last_w, *next_w;
+    StgClosure *new;
+    generation *new_gen;
+    const StgInfoTable *info;
+    rtsBool flag = rtsFalse;
+
+    last_w = &gen->old_weak_ptr_list;
+    for (w = gen->old_weak_ptr_list; w != NULL; w = next_w) {
+
+        /* There might be a DEAD_WEAK on the list if finalizeWeak# was
+         * called on a live weak pointer object.  Just remove it.
+         */
+        if (w->header.info == &stg_DEAD_WEAK_info) {
+            next_w = ((StgDeadWeak *)w)->link;
+            *last_w = next_w;
+            continue;
+        }
+
+        info = get_itbl((StgClosure *)w);
+        switch (info->type) {
+
+        case WEAK:
+            /* Now, check whether the key is reachable.
+             */
+            new = isAlive(w->key);
+            if (new != NULL) {
+                w->key = new;
+
+                // Evacuate the fields of the weak pointer to its own
+                // generation; if any of them are left in a younger
+                // generation, the weak pointer must go on the mutable
+                // list, because we won't look at it again until its
+                // generation is collected.
+                new_gen = Bdescr((P_)w)->gen;
+                gct->evac_gen_no = new_gen->no;
+                gct->failed_to_evac = rtsFalse;
+
+                scavengeLiveWeak(w);
+
+                if (gct->failed_to_evac) {
+                    gct->failed_to_evac = rtsFalse;
+                    recordMutableGen_GC((StgClosure *)w, new_gen->no);
+                }
+
+                // remove this weak ptr from the old_weak_ptr list
+                *last_w = w->link;
+                next_w  = w->link;
+
+                // and put it on the weak ptr list of its generation.
+                // NB. we must retain the order of the weak_ptr_list (#7160)
+                if (new_gen->weak_ptr_list == NULL) {
+                    new_gen->weak_ptr_list = w;
+                } else {
+                    new_gen->weak_ptr_list_tail->link = w;
+                }
+                new_gen->weak_ptr_list_tail = w;
+                w->link = NULL;
+                flag = rtsTrue;
+
+                debugTrace(DEBUG_weak,
+                           "weak pointer still alive at %p -> %p",
+                           w, w->key);
+                continue;
+            }
+            else {
+                last_w = &(w->link);
+                next_w = w->link;
+                continue;
+            }
+
+        default:
+            barf("tidyWeakList: not WEAK");
+        }
+    }
+
+    gct->evac_gen_no = 0;
+    return flag;
+}
+
+/* -----------------------------------------------------------------------------
+   The weak pointers left on the old_weak_ptr_lists are dead.  Evacuate
+   their finalizers and collect them on dead_weak_ptr_list, youngest
+   generation first, so that the list is newest first like the
+   others.
+   -------------------------------------------------------------------------- */
+
+static void
+collectDeadWeakPtrs (void)
+{
+    StgWeak *w, **last_w;
+    nat g;
+
+    gct->evac_gen_no = 0;
+
+    last_w = &dead_weak_ptr_list;
+    for (g = 0; g <= N; g++) {
+        generation *gen = &generations[g];
+        *last_w = gen->old_weak_ptr_list;
+        for (w = gen->old_weak_ptr_list; w != NULL; w = w->link) {
+            evacuate(&w->finalizer);
+            last_w = &(w->link);
+        }
+        gen->old_weak_ptr_list = NULL;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Put back the weak pointers that were already in the generations we
+   aren't collecting, behind the ones that have just been promoted
+   there (see initWeakForGC()).
+   -------------------------------------------------------------------------- */
+
+static void
+finishWeakPtrLists (void)
+{
+    nat g;
+
+    for (g = N+1; g < RtsFlags.GcFlags.generations; g++) {
+        generation *gen = &generations[g];
+        if (gen->weak_ptr_list == NULL) {
+            gen->weak_ptr_list = gen->old_weak_ptr_list;
+        } else {
+            gen->weak_ptr_list_tail->link = gen->old_weak_ptr_list;
+        }
+        gen->old_weak_ptr_list = NULL;
+    }
+}
+
+static void resurrectUnreachableThreads (generation *gen)
 {
     StgTSO *t, *tmp, *next;
 
@@ -302,27 +450,29 @@ static rtsBool tidyThreadList (generation *gen)
 }
 
 /* -----------------------------------------------------------------------------
-   Evacuate every weak pointer object on the weak_ptr_list, and update
-   the link fields.
-
-   ToDo: with a lot of weak pointers, this will be expensive.  We
-   should have a per-GC weak pointer list, just like threads.
+   Evacuate every weak pointer object on the weak pointer lists of the
+   generations we are collecting, and update the link fields.
+   markCapabilityWeakPtrList() does the same for the new weak pointers
+   on a Capability; each GC thread does this for its own Capability.
    -------------------------------------------------------------------------- */
 
-void
-markWeakPtrList ( void )
+// Returns the last weak pointer on the list, or NULL if it is empty
+static StgWeak *
+evacuateWeakPtrList (StgWeak **list)
 {
   StgWeak *w, **last_w;
 
-  last_w = &weak_ptr_list;
-  for (w = weak_ptr_list; w; w = w->link) {
-      // w might be WEAK, EVACUATED, or DEAD_WEAK (actually CON_STATIC) here
+  w = NULL;
+  last_w = list;
+  while (*last_w != NULL) {
+      // *last_w might be WEAK, EVACUATED, or DEAD_WEAK (actually
+      // CON_STATIC) here
 
 #ifdef DEBUG
       {   // careful to do this assertion only reading the info ptr
           // once, because during parallel GC it might change under our feet.
           const StgInfoTable *info;
-          info = w->header.info;
+          info = (*last_w)->header.info;
           ASSERT(IS_FORWARDING_PTR(info)
                  || info == &stg_DEAD_WEAK_info 
                  || INFO_PTR_TO_STRUCT(info)->type == WEAK);
@@ -337,5 +487,22 @@ markWeakPtrList ( void )
           last_w = &(w->link);
       }
   }
+
+  return w;
+}
+
+void
+markWeakPtrList ( void )
+{
+  nat g;
+
+  for (g = 0; g <= N; g++) {
+      evacuateWeakPtrList(&generations[g].weak_ptr_list);
+  }
 }
 
+void
+markCapabilityWeakPtrList (Capability *cap)
+{
+  cap->weak_ptr_list_tl = evacuateWeakPtrList(&cap->weak_ptr_list_hd);
+}
@@ -16,13 +16,14 @@
 
 #include "BeginPrivate.h"
 
-extern StgWeak *old_weak_ptr_list;
+extern StgWeak *dead_weak_ptr_list;
 extern StgTSO *resurrected_threads;
 extern StgTSO *exception_threads;
 
 void    initWeakForGC          ( void );
 rtsBool traverseWeakPtrList    ( void );
 void    markWeakPtrList        ( void );
+void    markCapabilityWeakPtrList ( Capability *cap );
 
 #include "EndPrivate.h"
 
@@ -19,6 +19,73 @@ void osFreeAllMBlocks(void);
 W_ getPageSize (void);
 void setExecutable (void *p, W_ len, rtsBool exec);
 
+// NUMA support
+rtsBool osNumaAvailable(void);
+nat osNumaNodes(void);
+StgWord osNumaMask(void);
+void osBindMBlocksToNode(void *addr, W_ size, nat node);
+
+// Huge page support (+RTS --huge-pages).  With huge pages on, the
+// memory we get from the OS is aligned to HUGE_PAGE_SIZE, and the
+// block allocator only ever asks for, and gives back, whole huge pages.
+#define HUGE_PAGE_SIZE          ((W_)2*1024*1024)
+#define HUGE_PAGE_MASK          (HUGE_PAGE_SIZE-1)
+#define HUGE_PAGE_ROUND_UP(p)   ((void *)(((W_)(p)+HUGE_PAGE_MASK) & ~HUGE_PAGE_MASK))
+#define HUGE_PAGE_ROUND_DOWN(p) ((void *)((W_)(p) & ~HUGE_PAGE_MASK))
+#define MBLOCKS_PER_HUGE_PAGE   (HUGE_PAGE_SIZE > MBLOCK_SIZE ? \
+                                 HUGE_PAGE_SIZE / MBLOCK_SIZE : 1)
+
+// Tell the OS that the contents of [at, at+size) are no longer needed,
+// so that it can reclaim the physical pages.  The memory stays mapped,
+// and reads as zero (or its old contents) when next touched.
+void osDiscardMemory(void *at, W_ size);
+
+// Bytes of the process's memory currently backed by huge pages, or 0
+// if the OS can't tell us.
+W_ osHugePageBytes(void);
+
+// Map size bytes of the file fd, from offset, copy-on-write over the
+// heap memory at [at, at+size).  at, size and offset must be multiples
+// of the page size.  Returns rtsFalse if the OS can't do it, in which
+// case the memory is left mapped, but its contents are undefined.
+rtsBool osMapFile(void *at, W_ size, int fd, StgWord64 offset);
+
+// Put ordinary memory back in place of a mapping made by osMapFile().
+void osUnmapFile(void *at, W_ size);
+
+// The memory that the program's executable is loaded into, and a
+// fingerprint that identifies the executable (its build ID, if it has
+// one, otherwise the layout of its segments).  Used to check the
+// pointers to info tables and static closures in a file loaded by
+// CompactFile.c.  Returns rtsFalse if the OS can't tell us.
+#define MAX_IMAGE_SEGMENTS 16
+
+typedef struct {
+    nat       n_segments;
+    struct { W_ start, end; } segments[MAX_IMAGE_SEGMENTS];
+    StgWord64 fingerprint;
+} ProgramImage;
+
+rtsBool osProgramImage(ProgramImage *img);
+
+#ifdef USE_LARGE_ADDRESS_SPACE
+
+// Reserve (but do not commit) a range of address space for the heap,
+// aligned to MBLOCK_SIZE.  *len is the size requested, and is updated
+// to the size actually reserved, which may be smaller.
+void *osReserveHeapMemory(W_ *len);
+
+// Commit/decommit memory within the range reserved by
+// osReserveHeapMemory().  Decommitted memory is returned to the OS but
+// stays reserved.
+void osCommitMemory(void *at, W_ size);
+void osDecommitMemory(void *at, W_ size);
+
+// Release the whole reservation.
+void osReleaseHeapMemory(void);
+
+#endif
+
 #include "EndPrivate.h"
 
 #endif /* SM_OSMEM_H */
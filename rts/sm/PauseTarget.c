@@ -0,0 +1,180 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Sizing the heap to meet a pause time target (+RTS --pause-target).
+ *
+ * Normally the size of the nursery comes from -A (or -H), and a
+ * generation is collected when it grows to -F times the live data in
+ * the oldest generation.  Neither has anything to do with how long the
+ * GC pauses the program for.  With a pause target, we instead measure
+ * how long each collection of each generation takes (stat_endGC()
+ * tells us), per block of heap collected, and size things so that the
+ * next collection should fit within the target:
+ *
+ *   - the nursery is resized after every GC, so that a minor GC
+ *     collects about as many blocks as it can in the target time,
+ *
+ *   - the intermediate generations (not the oldest) get a max_blocks
+ *     small enough that collecting them fits in the target,
+ *
+ *   - a collection is a parallel GC only if doing it sequentially
+ *     would use up more than half of the target.
+ *
+ * The time taken by a major GC depends on the amount of live data,
+ * which we can't change, so the oldest generation is sized as usual.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Storage.h"
+#include "PauseTarget.h"
+#include "RtsUtils.h"
+#include "Trace.h"
+
+// Aim for this percentage of the target, to leave room for noise
+#define PAUSE_TARGET_PERCENT 80
+
+// The nursery never gets smaller than this many blocks per capability,
+// nor bigger than this many times the size -A asks for.
+#define PAUSE_MIN_NURSERY_BLOCKS 16
+#define PAUSE_MAX_NURSERY_FACTOR 16
+
+// The intermediate generations never get smaller than this
+#define PAUSE_MIN_GEN_BLOCKS 64
+
+typedef struct {
+    W_     blocks;  // blocks collected by the last GC of this generation
+    W_     young;   // ... of which in younger generations and the nursery
+    double cost;    // average pause per block collected, or 0 if unknown
+    double work;    // average pause * GC threads per block collected
+} PauseGen;
+
+static PauseGen *pause_gens = NULL;
+
+void
+initPauseTarget (void)
+{
+    nat g;
+
+    pause_gens = stgMallocBytes(RtsFlags.GcFlags.generations * sizeof(PauseGen),
+                                "initPauseTarget");
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        pause_gens[g].blocks = 0;
+        pause_gens[g].young  = 0;
+        pause_gens[g].cost   = 0;
+        pause_gens[g].work   = 0;
+    }
+}
+
+void
+freePauseTarget (void)
+{
+    stgFree(pause_gens);
+    pause_gens = NULL;
+}
+
+void
+pauseStartGC (nat gen)
+{
+    nat g;
+    W_ blocks;
+
+    if (RtsFlags.GcFlags.pauseTarget == 0) return;
+
+    blocks = countNurseryBlocks();
+    for (g = 0; g < gen; g++) {
+        blocks += generations[g].n_blocks + generations[g].n_large_blocks;
+    }
+    pause_gens[gen].young  = blocks;
+    pause_gens[gen].blocks = blocks + generations[gen].n_blocks
+                                    + generations[gen].n_large_blocks;
+}
+
+void
+pauseEndGC (nat gen, Time pause, nat n_threads)
+{
+    PauseGen *p;
+    double cost;
+
+    if (RtsFlags.GcFlags.pauseTarget == 0) return;
+
+    p = &pause_gens[gen];
+    if (p->blocks == 0) return;
+
+    debugTrace(DEBUG_gc, "pause target: gen %d took %" FMT_Word64 "us for %"
+               FMT_Word " blocks with %d threads",
+               gen, (StgWord64)TimeToUS(pause), p->blocks, n_threads);
+
+    // a running average, so that one odd GC doesn't upset things
+    cost = (double)pause / p->blocks;
+    if (p->cost == 0) {
+        p->cost = cost;
+        p->work = cost * n_threads;
+    } else {
+        p->cost = (p->cost * 3 + cost) / 4;
+        p->work = (p->work * 3 + cost * n_threads) / 4;
+    }
+}
+
+// How many blocks a collection of gen can get through in the target time
+static double
+targetBlocks (nat gen)
+{
+    return ((double)RtsFlags.GcFlags.pauseTarget * PAUSE_TARGET_PERCENT / 100)
+        / pause_gens[gen].cost;
+}
+
+W_
+pauseNurseryBlocks (W_ current, W_ default_blocks)
+{
+    PauseGen *p = &pause_gens[0];
+    double want;
+    W_ blocks;
+
+    if (p->cost == 0) return default_blocks;
+
+    // leave room for the live data already in gen 0
+    want = targetBlocks(0) - (double)(p->blocks - p->young);
+
+    // don't change the size too quickly
+    want = stg_max(want, (double)current / 2);
+    want = stg_min(want, (double)current * 2);
+
+    blocks = (W_)want;
+    blocks = stg_max(blocks, (W_)PAUSE_MIN_NURSERY_BLOCKS * n_capabilities);
+    blocks = stg_min(blocks, default_blocks * PAUSE_MAX_NURSERY_FACTOR);
+    return blocks;
+}
+
+W_
+pauseMaxBlocks (nat gen, W_ size)
+{
+    PauseGen *p = &pause_gens[gen];
+    double want;
+
+    if (p->cost == 0) return size;
+
+    want = targetBlocks(gen) - (double)p->young;
+    if (want < PAUSE_MIN_GEN_BLOCKS) {
+        return stg_min(size, PAUSE_MIN_GEN_BLOCKS);
+    }
+    return stg_min(size, (W_)want);
+}
+
+#if defined(THREADED_RTS)
+rtsBool
+pauseParallelGC (nat gen)
+{
+    PauseGen *p = &pause_gens[gen];
+
+    if (p->work == 0) {
+        return gen >= RtsFlags.ParFlags.parGcGen;
+    }
+
+    // p->work is roughly what a sequential GC would take per block.
+    return p->work * p->blocks > (double)RtsFlags.GcFlags.pauseTarget / 2;
+}
+#endif
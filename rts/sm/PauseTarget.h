@@ -0,0 +1,39 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Sizing the heap to meet a pause time target (+RTS --pause-target).
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SM_PAUSETARGET_H
+#define SM_PAUSETARGET_H
+
+#include "BeginPrivate.h"
+
+void    initPauseTarget    (void);
+void    freePauseTarget    (void);
+
+// Called by GarbageCollect() once it knows which generation it is
+// collecting, and by stat_endGC() with the elapsed time of the GC and
+// the number of GC threads that took part.
+void    pauseStartGC       (nat gen);
+void    pauseEndGC         (nat gen, Time pause, nat n_threads);
+
+// The size of the nursery, in blocks, to use until the next GC.
+// current is its size now, and default_blocks the size that -A asks
+// for.
+W_      pauseNurseryBlocks (W_ current, W_ default_blocks);
+
+// The max_blocks of an intermediate generation, given the size that
+// resize_generations() would make it.
+W_      pauseMaxBlocks     (nat gen, W_ size);
+
+#if defined(THREADED_RTS)
+// Whether a collection of generation gen should be a parallel GC.
+rtsBool pauseParallelGC    (nat gen);
+#endif
+
+#include "EndPrivate.h"
+
+#endif /* SM_PAUSETARGET_H */
@@ -0,0 +1,319 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Reusing the free space in blocks of small pinned objects.
+ *
+ * allocatePinned() bump-allocates small pinned objects into a block of
+ * its own (see Storage.c), and the GC treats the block as a single
+ * large object: it is kept alive, as a whole, for as long as any of
+ * the objects in it are live.  A program that keeps a few small
+ * ByteStrings out of every block it allocates ends up with a heap of
+ * mostly-empty pinned blocks.
+ *
+ * So the blocks of small pinned objects are flagged BF_PINNED_SMALL,
+ * and start with a bitmap in which evacuate() marks each live object.
+ * After the GC, pinnedEndGC() walks the live objects of each block that
+ * survived, and the gaps between them become free chunks, which
+ * allocatePinned() uses before taking a new block.  The objects can't
+ * move, so this is the best we can do.
+ *
+ * The chunks are kept on per-Capability lists, so allocating from them
+ * doesn't take a lock, by generation (the chunks of a generation are
+ * dropped and found again when it is collected) and by size class.  A
+ * block's chunks all go to one Capability, and the blocks are shared
+ * out among the Capabilities in turn.
+ *
+ * Nothing else looks inside pinned blocks: they can already contain
+ * slop left by newAlignedPinnedByteArray#, so the heap profiler,
+ * sanity checker and friends skip them.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Storage.h"
+#include "Capability.h"
+#include "Pinned.h"
+#include "RtsUtils.h"
+#include "Trace.h"
+
+#include <string.h>
+
+// Blocks of small pinned objects in each generation, as of the last
+// time it was collected (plus those promoted into it since).
+static W_ *pinned_gen_blocks = NULL;
+
+// The Capability to give the chunks of the next block to.
+static nat pinned_next_cap;
+
+void
+initPinned (void)
+{
+    nat g;
+
+    pinned_gen_blocks = stgMallocBytes(RtsFlags.GcFlags.generations * sizeof(W_),
+                                       "initPinned");
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        pinned_gen_blocks[g] = 0;
+    }
+    pinned_next_cap = 0;
+}
+
+void
+freePinned (void)
+{
+    stgFree(pinned_gen_blocks);
+    pinned_gen_blocks = NULL;
+}
+
+void
+initCapabilityPinned (Capability *cap)
+{
+    nat i;
+
+    cap->pinned_chunks = stgMallocBytes(sizeof(PinnedChunk *) *
+                                        RtsFlags.GcFlags.generations *
+                                        PINNED_SIZE_CLASSES,
+                                        "initCapabilityPinned");
+    for (i = 0; i < RtsFlags.GcFlags.generations * PINNED_SIZE_CLASSES; i++) {
+        cap->pinned_chunks[i] = NULL;
+    }
+    cap->pinned_free_words   = 0;
+    cap->pinned_free_chunks  = 0;
+    cap->pinned_reused_words = 0;
+}
+
+void
+freeCapabilityPinned (Capability *cap)
+{
+    stgFree(cap->pinned_chunks);
+    cap->pinned_chunks = NULL;
+}
+
+STATIC_INLINE nat
+sizeClass (W_ size)
+{
+    nat c = 0;
+
+    size >>= PINNED_MIN_CHUNK_SHIFT;
+    while (size > 1) {
+        size >>= 1;
+        c++;
+    }
+    return c;
+}
+
+static void
+addChunk (Capability *cap, nat g, StgPtr p, W_ size)
+{
+    PinnedChunk *chunk, **list;
+
+    ASSERT(size >= PINNED_MIN_CHUNK_W);
+
+    chunk = (PinnedChunk *)p;
+    list  = &cap->pinned_chunks[g * PINNED_SIZE_CLASSES + sizeClass(size)];
+    chunk->size = size;
+    chunk->link = *list;
+    *list = chunk;
+    cap->pinned_free_words += size;
+    cap->pinned_free_chunks++;
+}
+
+StgPtr
+allocPinnedChunk (Capability *cap, W_ n)
+{
+    PinnedChunk **lists, **prev, *chunk;
+    nat c, g;
+
+    if (cap->pinned_free_words < n) return NULL;
+
+    // Only the first usable chunk of each list is tried: any chunk in a
+    // class above n's own is big enough.  The younger generations come
+    // first, because their blocks are collected sooner.
+    for (c = sizeClass(n); c < PINNED_SIZE_CLASSES; c++) {
+        for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+            lists = &cap->pinned_chunks[g * PINNED_SIZE_CLASSES];
+            // Skip the chunks in blocks that a concurrent mark is
+            // looking at: it would free the block if the new object
+            // were the only live one (see ConcMark.c).
+            prev = &lists[c];
+            for (chunk = *prev; chunk != NULL; chunk = *prev) {
+                if (!(Bdescr((P_)chunk)->flags & BF_SNAPSHOT)) break;
+                prev = &chunk->link;
+            }
+            if (chunk != NULL && chunk->size >= n) {
+                *prev = chunk->link;
+                cap->pinned_free_words -= chunk->size;
+                cap->pinned_free_chunks--;
+                if (chunk->size - n >= PINNED_MIN_CHUNK_W) {
+                    addChunk(cap, g, (StgPtr)chunk + n, chunk->size - n);
+                }
+                cap->pinned_reused_words += n;
+                return (StgPtr)chunk;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void
+dropChunks (nat from, nat to)
+{
+    nat n, g, i;
+    PinnedChunk **lists, *chunk;
+    Capability *cap;
+
+    for (n = 0; n < n_capabilities; n++) {
+        cap = &capabilities[n];
+        for (g = from; g <= to; g++) {
+            lists = &cap->pinned_chunks[g * PINNED_SIZE_CLASSES];
+            for (i = 0; i < PINNED_SIZE_CLASSES; i++) {
+                for (chunk = lists[i]; chunk != NULL; chunk = chunk->link) {
+                    cap->pinned_free_words -= chunk->size;
+                    cap->pinned_free_chunks--;
+                }
+                lists[i] = NULL;
+            }
+        }
+    }
+}
+
+void
+pinnedStartGC (nat N)
+{
+    nat g;
+
+    dropChunks(0, N);
+    for (g = 0; g <= N; g++) {
+        pinned_gen_blocks[g] = 0;
+    }
+}
+
+void
+startPinnedMarking (bdescr *bd)
+{
+    memset(bd->start, 0, PINNED_BITMAP_W * sizeof(W_));
+    bd->flags |= BF_PINNED_MARK;
+}
+
+/* -----------------------------------------------------------------------------
+   Find the gaps between the live objects of a pinned block, which are
+   marked in the bitmap at the start of the block.  The unused space at
+   the end of the block, that allocatePinned() gave up on when it took
+   a new block, is a gap too.
+   -------------------------------------------------------------------------- */
+
+static void
+findPinnedChunks (Capability *cap, bdescr *bd)
+{
+    StgPtr bitmap, p, gap, end;
+    W_ off;
+
+    bitmap = bd->start;
+    end = bd->start + BLOCK_SIZE_W;
+    gap = bd->start + PINNED_BITMAP_W;
+
+    p = gap;
+    while (p < bd->free) {
+        off = p - bd->start;
+        if (off % BITS_IN(W_) == 0 && bitmap[off / BITS_IN(W_)] == 0) {
+            p += BITS_IN(W_);
+            continue;
+        }
+        if (isPinnedMarked(p, bd)) {
+            if ((W_)(p - gap) >= PINNED_MIN_CHUNK_W) {
+                addChunk(cap, bd->gen_no, gap, p - gap);
+            }
+            p += closure_sizeW((StgClosure *)p);
+            gap = p;
+        } else {
+            p++;
+        }
+    }
+
+    if ((W_)(end - gap) >= PINNED_MIN_CHUNK_W) {
+        addChunk(cap, bd->gen_no, gap, end - gap);
+        // the chunks can now be anywhere in the block
+        bd->free = end;
+    }
+
+    bd->flags &= ~BF_PINNED_MARK;
+}
+
+void
+pinnedEndGC (nat N)
+{
+    nat g, top;
+    bdescr *bd;
+
+    // The surviving blocks of generations 0..N are on the
+    // scavenged_large_objects lists of their new generations.
+    top = stg_min(N + 1, RtsFlags.GcFlags.generations - 1);
+
+    for (g = 0; g <= top; g++) {
+        for (bd = generations[g].scavenged_large_objects; bd != NULL;
+             bd = bd->link) {
+            if (bd->flags & BF_PINNED_SMALL) {
+                findPinnedChunks(&capabilities[pinned_next_cap], bd);
+                pinned_next_cap = (pinned_next_cap + 1) % n_capabilities;
+                pinned_gen_blocks[g] += bd->blocks;
+            }
+        }
+    }
+
+    debugTrace(DEBUG_gc, "pinned: %" FMT_Word " blocks, %" FMT_Word
+               " free words", pinnedBlockWords() / BLOCK_SIZE_W,
+               pinnedFreeWords());
+}
+
+// The concurrent mark found nothing live in a pinned block of an older
+// generation, and is about to free it.  We don't know which chunks are
+// in the block, so we forget all the chunks of its generation; they
+// are found again when the generation is next collected.
+void
+pinnedFreeBlock (bdescr *bd)
+{
+    dropChunks(bd->gen_no, bd->gen_no);
+    pinned_gen_blocks[bd->gen_no] -= bd->blocks;
+}
+
+W_
+pinnedBlockWords (void)
+{
+    nat g;
+    W_ blocks = 0;
+
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        blocks += pinned_gen_blocks[g];
+    }
+    return blocks * BLOCK_SIZE_W;
+}
+
+W_
+pinnedFreeWords (void)
+{
+    nat n;
+    W_ words = 0;
+
+    for (n = 0; n < n_capabilities; n++) {
+        words += capabilities[n].pinned_free_words;
+    }
+    return words;
+}
+
+// The figures are only updated by the Capability itself and the GC, so
+// they may be slightly out of date if the Capability is running.
+void
+getPinnedStats (nat n, PinnedStats *s)
+{
+    Capability *cap;
+
+    ASSERT(n < n_capabilities);
+    cap = &capabilities[n];
+
+    s->free_bytes   = cap->pinned_free_words * (StgWord64)sizeof(W_);
+    s->free_chunks  = cap->pinned_free_chunks;
+    s->reused_bytes = cap->pinned_reused_words * (StgWord64)sizeof(W_);
+}
@@ -0,0 +1,70 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Reusing the free space in blocks of small pinned objects.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SM_PINNED_H
+#define SM_PINNED_H
+
+#include "BeginPrivate.h"
+
+// Each block of small pinned objects (BF_PINNED_SMALL) starts with a
+// bitmap, one bit per word of the block, in which the GC marks the
+// live objects.  The objects are allocated after it.  The bitmap is
+// only valid while the block has BF_PINNED_MARK set, i.e. during a GC
+// of its generation.
+#define PINNED_BITMAP_W (BLOCK_SIZE_W / BITS_IN(W_))
+
+// A free gap between the live objects of a pinned block, written
+// into the gap itself.
+typedef struct PinnedChunk_ {
+    struct PinnedChunk_ *link;
+    W_ size;                    // in words, including this header
+} PinnedChunk;
+
+// Gaps smaller than this many words aren't worth keeping.
+#define PINNED_MIN_CHUNK_SHIFT 3
+#define PINNED_MIN_CHUNK_W     (1 << PINNED_MIN_CHUNK_SHIFT)
+
+// Size class c holds chunks of [2^(c+PINNED_MIN_CHUNK_SHIFT),
+// 2^(c+PINNED_MIN_CHUNK_SHIFT+1)) words.  A gap is always smaller
+// than a block.
+#define PINNED_SIZE_CLASSES (BLOCK_SHIFT - PINNED_MIN_CHUNK_SHIFT)
+
+void   initPinned      (void);
+void   freePinned      (void);
+
+void   initCapabilityPinned (Capability *cap);
+void   freeCapabilityPinned (Capability *cap);
+
+// Allocate n words from the free chunks of cap, or return NULL.
+StgPtr allocPinnedChunk (Capability *cap, W_ n);
+
+// Drop the free chunks of the generations being collected (0..N).
+void   pinnedStartGC   (nat N);
+
+// Clear the bitmap of a pinned block in a generation being collected.
+void   startPinnedMarking (bdescr *bd);
+
+// Find the free chunks in the pinned blocks that survived the GC.
+void   pinnedEndGC     (nat N);
+
+// Called before the concurrent mark frees a BF_PINNED_SMALL block.
+void   pinnedFreeBlock (bdescr *bd);
+
+W_     pinnedBlockWords (void);
+W_     pinnedFreeWords  (void);
+
+INLINE_HEADER rtsBool
+isPinnedMarked (StgPtr p, bdescr *bd)
+{
+    W_ off = p - bd->start;
+    return (bd->start[off / BITS_IN(W_)] >> (off % BITS_IN(W_))) & 1;
+}
+
+#include "EndPrivate.h"
+
+#endif /* SM_PINNED_H */
@@ -0,0 +1,95 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Pretenuring objects by their info table (+RTS --pretenure).
+ *
+ * An object that survives its first GC is copied out of the nursery
+ * into gen 0, where it ages, and only if it survives a second GC is it
+ * copied into gen 1.  Data that lives for a long time, such as a large
+ * Data.Map, is therefore copied twice before it settles down.
+ *
+ * We can't tell where in the program an object was allocated, but we
+ * can tell what it is.  So for each info table, evacuate() counts how
+ * many objects were copied out of the nursery into gen 0, and how many
+ * were later copied out of gen 0.  When most of the objects of a type
+ * survive aging, we stop aging them: they are copied straight out of
+ * the nursery into gen 1.  A few of them still go through gen 0, so
+ * that the decision is revised if the type stops surviving.  The
+ * counts are halved at the end of every GC, so that old behaviour is
+ * forgotten.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Storage.h"
+#include "Pretenure.h"
+#include "Trace.h"
+
+#include <string.h>
+
+// Don't decide anything on fewer objects than this
+#define PRETENURE_MIN_AGED 64
+
+// Pretenure a type when this percentage of its aged objects survive
+#define PRETENURE_PERCENT  80
+
+PretenureEntry pretenure_table[PRETENURE_TABLE_SIZE];
+
+void
+initPretenure (void)
+{
+    memset(pretenure_table, 0, sizeof(pretenure_table));
+}
+
+// Called by pretenureLookup() when it finds a free entry.  Another GC
+// thread may be claiming the same entry, hence the cas().
+PretenureEntry *
+pretenureInsert (const StgInfoTable *info)
+{
+    StgWord i, n;
+    PretenureEntry *e;
+    StgWord old;
+
+    i = ((StgWord)info >> 3) * 2654435761UL;
+    for (n = 0; n < PRETENURE_MAX_PROBES; n++, i++) {
+        e = &pretenure_table[i & (PRETENURE_TABLE_SIZE - 1)];
+        if (e->info == NULL) {
+#if defined(THREADED_RTS)
+            old = cas((StgVolatilePtr)&e->info, 0, (StgWord)info);
+#else
+            old = (StgWord)e->info;
+            e->info = info;
+#endif
+            if (old == 0 || old == (StgWord)info) return e;
+        } else if (e->info == info) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+void
+pretenureEndGC (void)
+{
+    PretenureEntry *e;
+    nat i, n;
+
+    n = 0;
+    for (i = 0; i < PRETENURE_TABLE_SIZE; i++) {
+        e = &pretenure_table[i];
+        if (e->info == NULL) continue;
+
+        if (e->aged >= PRETENURE_MIN_AGED) {
+            e->pretenure = e->promoted * 100 >= e->aged * PRETENURE_PERCENT;
+        }
+        e->aged     /= 2;
+        e->promoted /= 2;
+
+        if (e->pretenure) n++;
+    }
+
+    debugTrace(DEBUG_gc, "pretenuring %d types", n);
+}
@@ -0,0 +1,80 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2013
+ *
+ * Pretenuring objects by their info table (+RTS --pretenure).
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SM_PRETENURE_H
+#define SM_PRETENURE_H
+
+#include "BeginPrivate.h"
+
+// The survival record of one info table.  The counts are only
+// statistics, so the GC threads update them without synchronisation.
+typedef struct {
+    const StgInfoTable *info;  // NULL if the entry is free
+    StgWord aged;              // copied out of the nursery into gen 0
+    StgWord promoted;          // copied out of gen 0 into gen 1
+    StgWord sampled;           // copies of a pretenured type, see below
+    rtsBool pretenure;         // copy straight out of the nursery into gen 1
+} PretenureEntry;
+
+#define PRETENURE_TABLE_SIZE 4096  // must be a power of 2
+#define PRETENURE_MAX_PROBES 16
+
+// One in PRETENURE_SAMPLE objects of a pretenured type still goes
+// through gen 0, so that we notice if the type stops surviving.
+#define PRETENURE_SAMPLE 8
+
+extern PretenureEntry pretenure_table[PRETENURE_TABLE_SIZE];
+
+void            initPretenure    (void);
+PretenureEntry *pretenureInsert  (const StgInfoTable *info);
+
+// Called at the end of each GC: decide which types to pretenure
+// during the next one.
+void            pretenureEndGC   (void);
+
+INLINE_HEADER PretenureEntry *
+pretenureLookup (const StgInfoTable *info)
+{
+    StgWord i, n;
+    PretenureEntry *e;
+
+    i = ((StgWord)info >> 3) * 2654435761UL;
+    for (n = 0; n < PRETENURE_MAX_PROBES; n++, i++) {
+        e = &pretenure_table[i & (PRETENURE_TABLE_SIZE - 1)];
+        if (e->info == info) return e;
+        if (e->info == NULL) return pretenureInsert(info);
+    }
+    return NULL; // the table is full around here: don't bother
+}
+
+// The generation to copy an object with the given info pointer into,
+// when it lives in gen 0 block bd.  Objects leaving the nursery have
+// dest_no 0; those leaving gen 0 for gen 1 have survived the whole
+// tenure age (see "Aging" in GCThread.h).
+INLINE_HEADER nat
+pretenureDest (const StgInfoTable *info, bdescr *bd)
+{
+    PretenureEntry *e;
+
+    e = pretenureLookup(info);
+    if (e == NULL) return bd->dest_no;
+
+    if (bd->dest_no == 0) {
+        if (e->pretenure && ++e->sampled % PRETENURE_SAMPLE != 0) {
+            return g0->to->no;
+        }
+        e->aged++;
+    } else if (bd->dest_no == g0->to->no) {
+        e->promoted++;
+    }
+    return bd->dest_no;
+}
+
+#include "EndPrivate.h"
+
+#endif /* SM_PRETENURE_H */
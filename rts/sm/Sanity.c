@@ -21,6 +21,7 @@
 #include "RtsUtils.h"
 #include "sm/Storage.h"
 #include "sm/BlockAlloc.h"
+#include "sm/CompactRegion.h"
 #include "GCThread.h"
 #include "Sanity.h"
 #include "Schedule.h"
@@ -690,10 +691,10 @@ checkNurserySanity (nursery *nursery)
 static void checkGeneration (generation *gen, 
                              rtsBool after_major_gc USED_IF_THREADS)
 {
-    nat n;
+    nat n, w;
     gen_workspace *ws;
 
-    ASSERT(countBlocks(gen->blocks) == gen->n_blocks);
+    ASSERT(countBlocks(gen->blocks) + gen->n_unswept_blocks == gen->n_blocks);
     ASSERT(countBlocks(gen->large_objects) == gen->n_large_blocks);
 
 #if defined(THREADED_RTS)
@@ -706,10 +707,13 @@ static void checkGeneration (generation *gen,
     checkHeapChain(gen->blocks);
 
     for (n = 0; n < n_capabilities; n++) {
-        ws = &gc_threads[n]->gens[gen->no];
-        checkHeapChain(ws->todo_bd);
-        checkHeapChain(ws->part_list);
-        checkHeapChain(ws->scavd_list);
+        for (w = gen->no; w < n_gc_workspaces;
+             w = nextGenWorkspace(gen->no,w)) {
+            ws = &gc_threads[n]->gens[w];
+            checkHeapChain(ws->todo_bd);
+            checkHeapChain(ws->part_list);
+            checkHeapChain(ws->scavd_list);
+        }
     }
 
     checkLargeObjects(gen->large_objects);
@@ -723,7 +727,7 @@ static void checkFullHeap (rtsBool after_major_gc)
     for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
         checkGeneration(&generations[g], after_major_gc);
     }
-    for (n = 0; n < n_capabilities; n++) {
+    for (n = 0; n < n_nurseries; n++) {
         checkNurserySanity(&nurseries[n]);
     }
 }
@@ -752,21 +756,31 @@ void checkSanity (rtsBool after_gc, rtsBool major_gc)
 static void
 findMemoryLeak (void)
 {
-    nat g, i;
+    nat g, i, w;
     for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
         for (i = 0; i < n_capabilities; i++) {
             markBlocks(capabilities[i].mut_lists[g]);
-            markBlocks(gc_threads[i]->gens[g].part_list);
-            markBlocks(gc_threads[i]->gens[g].scavd_list);
-            markBlocks(gc_threads[i]->gens[g].todo_bd);
+            for (w = g; w < n_gc_workspaces; w = nextGenWorkspace(g,w)) {
+                markBlocks(gc_threads[i]->gens[w].part_list);
+                markBlocks(gc_threads[i]->gens[w].scavd_list);
+                markBlocks(gc_threads[i]->gens[w].todo_bd);
+            }
         }
         markBlocks(generations[g].blocks);
+        markBlocks(generations[g].unswept_blocks);
         markBlocks(generations[g].large_objects);
+        markCompactRegions(generations[g].compact_regions);
+        markBlocks(generations[g].bitmap);
     }
 
-    for (i = 0; i < n_capabilities; i++) {
+    for (i = 0; i < n_nurseries; i++) {
         markBlocks(nurseries[i].blocks);
+    }
+
+    for (i = 0; i < n_capabilities; i++) {
         markBlocks(capabilities[i].pinned_object_block);
+        markBlocks(capabilities[i].large_objects);
+        markBlockCache(&capabilities[i]);
     }
 
 #ifdef PROFILING
@@ -825,19 +839,22 @@ void findSlop(bdescr *bd)
 static W_
 genBlocks (generation *gen)
 {
-    ASSERT(countBlocks(gen->blocks) == gen->n_blocks);
+    ASSERT(countBlocks(gen->blocks) + gen->n_unswept_blocks == gen->n_blocks);
     ASSERT(countBlocks(gen->large_objects) == gen->n_large_blocks);
     return gen->n_blocks + gen->n_old_blocks + 
-	    countAllocdBlocks(gen->large_objects);
+	    countAllocdBlocks(gen->large_objects) +
+            countCompactRegionBlocks(gen->compact_regions) +
+            countBlocks(gen->bitmap); // a concurrent mark or lazy sweep
+                                      // is in progress
 }
 
 void
 memInventory (rtsBool show)
 {
-  nat g, i;
+  nat g, i, w;
   W_ gen_blocks[RtsFlags.GcFlags.generations];
   W_ nursery_blocks, retainer_blocks,
-       arena_blocks, exec_blocks;
+       arena_blocks, exec_blocks, cached_blocks;
   W_ live_blocks = 0, free_blocks = 0;
   rtsBool leak;
 
@@ -847,21 +864,28 @@ memInventory (rtsBool show)
       gen_blocks[g] = 0;
       for (i = 0; i < n_capabilities; i++) {
 	  gen_blocks[g] += countBlocks(capabilities[i].mut_lists[g]);
-          gen_blocks[g] += countBlocks(gc_threads[i]->gens[g].part_list);
-          gen_blocks[g] += countBlocks(gc_threads[i]->gens[g].scavd_list);
-          gen_blocks[g] += countBlocks(gc_threads[i]->gens[g].todo_bd);
+          for (w = g; w < n_gc_workspaces; w = nextGenWorkspace(g,w)) {
+              gen_blocks[g] += countBlocks(gc_threads[i]->gens[w].part_list);
+              gen_blocks[g] += countBlocks(gc_threads[i]->gens[w].scavd_list);
+              gen_blocks[g] += countBlocks(gc_threads[i]->gens[w].todo_bd);
+          }
       }
       gen_blocks[g] += genBlocks(&generations[g]);
   }
 
   nursery_blocks = 0;
-  for (i = 0; i < n_capabilities; i++) {
+  for (i = 0; i < n_nurseries; i++) {
       ASSERT(countBlocks(nurseries[i].blocks) == nurseries[i].n_blocks);
       nursery_blocks += nurseries[i].n_blocks;
+  }
+  for (i = 0; i < n_capabilities; i++) {
       if (capabilities[i].pinned_object_block != NULL) {
           nursery_blocks += capabilities[i].pinned_object_block->blocks;
       }
       nursery_blocks += countBlocks(capabilities[i].pinned_object_blocks);
+      ASSERT(countBlocks(capabilities[i].large_objects)
+             == capabilities[i].n_large_blocks);
+      nursery_blocks += capabilities[i].n_large_blocks;
   }
 
   retainer_blocks = 0;
@@ -877,6 +901,12 @@ memInventory (rtsBool show)
   // count the blocks containing executable memory
   exec_blocks = countAllocdBlocks(exec_block);
 
+  // count the blocks held in the per-Capability block caches
+  cached_blocks = 0;
+  for (i = 0; i < n_capabilities; i++) {
+      cached_blocks += countBlockCache(&capabilities[i]);
+  }
+
   /* count the blocks on the free list */
   free_blocks = countFreeList();
 
@@ -885,7 +915,7 @@ memInventory (rtsBool show)
       live_blocks += gen_blocks[g];
   }
   live_blocks += nursery_blocks + 
-               + retainer_blocks + arena_blocks + exec_blocks;
+               + retainer_blocks + arena_blocks + exec_blocks + cached_blocks;
 
 #define MB(n) (((double)(n) * BLOCK_SIZE_W) / ((1024*1024)/sizeof(W_)))
 
@@ -910,6 +940,8 @@ memInventory (rtsBool show)
                  arena_blocks, MB(arena_blocks));
       debugBelch("  exec         : %5" FMT_Word " blocks (%6.1lf MB)\n",
                  exec_blocks, MB(exec_blocks));
+      debugBelch("  cached       : %5" FMT_Word " blocks (%6.1lf MB)\n",
+                 cached_blocks, MB(cached_blocks));
       debugBelch("  free         : %5" FMT_Word " blocks (%6.1lf MB)\n",
                  free_blocks, MB(free_blocks));
       debugBelch("  total        : %5" FMT_Word " blocks (%6.1lf MB)\n",
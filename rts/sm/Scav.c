@@ -40,8 +40,23 @@ static void scavenge_large_bitmap (StgPtr p,
 # define scavenge_block(a) scavenge_block1(a)
 # define scavenge_mutable_list(bd,g) scavenge_mutable_list1(bd,g)
 # define scavenge_capability_mut_lists(cap) scavenge_capability_mut_Lists1(cap)
+# define scavengeLiveWeak(w) scavengeLiveWeak1(w)
 #endif
 
+/* -----------------------------------------------------------------------------
+   Scavenge a weak pointer whose key is alive: evacuate everything it
+   points to, which the GC normally treats as weak (see MarkWeak.c).
+   -------------------------------------------------------------------------- */
+
+void
+scavengeLiveWeak (StgWeak *w)
+{
+    evacuate(&w->key);
+    evacuate(&w->value);
+    evacuate(&w->finalizer);
+    evacuate(&w->cfinalizer);
+}
+
 /* -----------------------------------------------------------------------------
    Scavenge a TSO.
    -------------------------------------------------------------------------- */
@@ -167,6 +182,153 @@ static StgPtr scavenge_mut_arr_ptrs_marked (StgMutArrPtrs *a)
     return (StgPtr)a + mut_arr_ptrs_sizeW(a);
 }
 
+/* -----------------------------------------------------------------------------
+   Splitting large arrays
+
+   In a parallel GC, a large MUT_ARR_PTRS is not scavenged in one go
+   by the thread that finds it.  Instead, a work unit (ArrChunk)
+   covering its cards is pushed on the thread's arr_q, a deque that the
+   other GC threads can steal from.  Whoever takes a unit that is
+   bigger than ARR_CHUNK_CARDS cards halves it first, pushing the upper
+   half back, so a huge array gets split up among as many threads as
+   are looking for work.  The same goes for the dirty cards of an array
+   on a mutable list.
+
+   The threads scavenging the pieces of an array don't know whether
+   the array as a whole still points into a younger generation, so it
+   is marked dirty (or FROZEN0) and kept on the mutable list.  The card
+   table says which parts of it need looking at, and the next GC will
+   find that it is clean if it is.
+   -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+
+typedef struct {
+    StgMutArrPtrs *arr;
+    W_             card;        // first card
+    W_             n_cards;
+    nat            gen_no;      // gct->evac_gen_no for this array
+    rtsBool        eager;       // gct->eager_promotion for this array
+    rtsBool        marked;      // only scavenge the marked cards
+} ArrChunk;
+
+#define ARR_CHUNK_CARDS 32
+#define ARR_SPLIT_CARDS (ARR_CHUNK_CARDS * 2)
+
+static ArrChunk *
+new_arr_chunk (void)
+{
+    bdescr *bd;
+    ArrChunk *c;
+
+    bd = gct->arr_chunks;
+    if (bd == NULL ||
+        bd->free + sizeofW(ArrChunk) > bd->start + BLOCK_SIZE_W) {
+        bd = allocBlock_sync();
+        bd->link = gct->arr_chunks;
+        gct->arr_chunks = bd;
+    }
+    c = (ArrChunk *)bd->free;
+    bd->free += sizeofW(ArrChunk);
+    return c;
+}
+
+// Share out the cards of the array a, which the caller was about to
+// scavenge with the current evac_gen_no and eager_promotion.  Returns
+// rtsFalse if the array is not worth splitting (or the deque is full),
+// in which case the caller must scavenge it itself.
+static rtsBool
+split_mut_arr_ptrs (StgMutArrPtrs *a, rtsBool marked)
+{
+    ArrChunk *c;
+    W_ n_cards;
+
+    n_cards = mutArrPtrsCards(a->ptrs);
+    if (n_gc_threads == 1 || !work_stealing || n_cards < ARR_SPLIT_CARDS) {
+        return rtsFalse;
+    }
+
+    c = new_arr_chunk();
+    c->arr     = a;
+    c->card    = 0;
+    c->n_cards = n_cards;
+    c->gen_no  = gct->evac_gen_no;
+    c->eager   = gct->eager_promotion;
+    c->marked  = marked;
+
+    return pushWSDeque(gct->arr_q, c);
+}
+
+static void
+scavenge_arr_chunk (ArrChunk *c)
+{
+    ArrChunk *d;
+    StgMutArrPtrs *a;
+    StgPtr p, q, end;
+    W_ m, half;
+    rtsBool saved_eager_promotion;
+
+    // leave the upper halves for other threads
+    while (c->n_cards > ARR_CHUNK_CARDS) {
+        half = c->n_cards / 2;
+        d = new_arr_chunk();
+        *d = *c;
+        d->card    = c->card + half;
+        d->n_cards = c->n_cards - half;
+        if (!pushWSDeque(gct->arr_q, d)) break;
+        c->n_cards = half;
+    }
+
+    saved_eager_promotion = gct->eager_promotion;
+    gct->evac_gen_no = c->gen_no;
+    gct->eager_promotion = c->eager;
+
+    a = c->arr;
+    end = (StgPtr)&a->payload[a->ptrs];
+    for (m = c->card; m < c->card + c->n_cards; m++)
+    {
+        if (c->marked && *mutArrPtrsCard(a,m) == 0) continue;
+
+        p = (StgPtr)&a->payload[m << MUT_ARR_PTRS_CARD_BITS];
+        q = stg_min(p + (1 << MUT_ARR_PTRS_CARD_BITS), end);
+        gct->scanned += q - p;
+        for (; p < q; p++) {
+            evacuate((StgClosure**)p);
+        }
+        if (gct->failed_to_evac) {
+            *mutArrPtrsCard(a,m) = 1;
+            gct->failed_to_evac = rtsFalse;
+        } else {
+            *mutArrPtrsCard(a,m) = 0;
+        }
+    }
+
+    gct->eager_promotion = saved_eager_promotion;
+}
+
+static ArrChunk *
+steal_arr_chunk (void)
+{
+    nat i, n;
+    ArrChunk *c;
+
+    n = steal_victim();
+    for (i = 0; i < n_gc_threads; i++, n = n + 1 == n_gc_threads ? 0 : n + 1) {
+        if (n == gct->thread_index || gc_threads[n]->idle) continue;
+        c = stealWSDeque(gc_threads[n]->arr_q);
+        if (c) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+#else
+
+#define split_mut_arr_ptrs(a,marked) rtsFalse
+
+#endif
+
 /* -----------------------------------------------------------------------------
    Blocks of function args occur on the stack (at the top) and
    in PAPs.
@@ -359,6 +521,103 @@ scavenge_fun_srt(const StgInfoTable *info)
     scavenge_srt((StgClosure **)GET_FUN_SRT(fun_info), fun_info->i.srt_bitmap);
 }
 
+/* -----------------------------------------------------------------------------
+   Prefetching
+
+   The first thing evacuate() does with a pointer is to load the header
+   of the closure it points to, and then its info table; when the heap
+   is much bigger than the cache, both loads usually miss.  So
+   scavenge_block() keeps a cursor a little way ahead of the object it
+   is scavenging, and prefetches the closures that the object under the
+   cursor points to.  These closures also go on a short queue in the
+   gc_thread; by the time one comes off the other end its header should
+   have arrived, so we can prefetch its info table too.
+
+   Only the pointer fields of constructors, functions and thunks are
+   prefetched; the other objects are rare enough not to matter.
+   -------------------------------------------------------------------------- */
+
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch((p), 0, 3)
+#else
+#define PREFETCH(p) /* nothing */
+#endif
+
+#define PREFETCH_DISTANCE_W 32  // how far ahead of the scan pointer
+#define PREFETCH_MAX_PTRS   4   // pointer fields prefetched per object
+
+STATIC_INLINE void
+prefetch_init (void)
+{
+    nat i;
+
+    // the queue may refer to memory freed since the last GC
+    for (i = 0; i < PREFETCH_QUEUE_SIZE; i++) {
+        gct->pf_queue[i] = NULL;
+    }
+    gct->pf_next = 0;
+}
+
+STATIC_INLINE void
+prefetch_closure (StgClosure *q)
+{
+    StgClosure *prev;
+    const StgInfoTable *info;
+
+    PREFETCH(q);
+
+    prev = gct->pf_queue[gct->pf_next];
+    gct->pf_queue[gct->pf_next] = q;
+    gct->pf_next = (gct->pf_next + 1) % PREFETCH_QUEUE_SIZE;
+
+    if (prev != NULL) {
+        info = prev->header.info;
+        // it may have been evacuated since we prefetched it
+        if (!IS_FORWARDING_PTR(info)) {
+            PREFETCH(INFO_PTR_TO_STRUCT(info));
+        }
+    }
+}
+
+// Prefetch what the object at p points to; returns the next object.
+STATIC_INLINE StgPtr
+prefetch_object (StgPtr p)
+{
+    StgInfoTable *info;
+    StgClosure **fields;
+    nat i, n;
+
+    info = get_itbl((StgClosure *)p);
+
+    switch (info->type) {
+    case CONSTR:
+    case CONSTR_1_0:
+    case CONSTR_2_0:
+    case CONSTR_1_1:
+    case FUN:
+    case FUN_1_0:
+    case FUN_2_0:
+    case FUN_1_1:
+        fields = ((StgClosure *)p)->payload;
+        break;
+    case THUNK:
+    case THUNK_1_0:
+    case THUNK_2_0:
+    case THUNK_1_1:
+        fields = ((StgThunk *)p)->payload;
+        break;
+    default:
+        return p + closure_sizeW_((StgClosure *)p, info);
+    }
+
+    n = stg_min(info->layout.payload.ptrs, PREFETCH_MAX_PTRS);
+    for (i = 0; i < n; i++) {
+        prefetch_closure(UNTAG_CLOSURE(fields[i]));
+    }
+
+    return p + closure_sizeW_((StgClosure *)p, info);
+}
+
 /* -----------------------------------------------------------------------------
    Scavenge a block from the given scan pointer up to bd->free.
 
@@ -374,7 +633,7 @@ scavenge_fun_srt(const StgInfoTable *info)
 static GNUC_ATTR_HOT void
 scavenge_block (bdescr *bd)
 {
-  StgPtr p, q;
+  StgPtr p, q, pf, lim;
   StgInfoTable *info;
   rtsBool saved_eager_promotion;
   gen_workspace *ws;
@@ -387,9 +646,11 @@ scavenge_block (bdescr *bd)
   saved_eager_promotion = gct->eager_promotion;
   gct->failed_to_evac = rtsFalse;
 
-  ws = &gct->gens[bd->gen->no];
+  ws = blockWorkspace(gct, bd);
 
   p = bd->u.scan;
+  pf = p;
+  prefetch_init();
   
   // we might be evacuating into the very object that we're
   // scavenging, so we have to check the real bd->free pointer each
@@ -398,6 +659,15 @@ scavenge_block (bdescr *bd)
 
       ASSERT(bd->link == NULL);
     ASSERT(LOOKS_LIKE_CLOSURE_PTR(p));
+
+    // keep the prefetch cursor ahead of p, but not past the objects
+    // that have been copied so far.
+    if (pf < p) pf = p;
+    lim = bd == ws->todo_bd ? ws->todo_free : bd->free;
+    while (pf < lim && pf < p + PREFETCH_DISTANCE_W) {
+        pf = prefetch_object(pf);
+    }
+
     info = get_itbl((StgClosure *)p);
     
     ASSERT(gct->thunk_selector_depth == 0);
@@ -1165,7 +1435,6 @@ scavenge_one(StgPtr p)
     case CONSTR_1_1:
     case CONSTR_0_2:
     case CONSTR_2_0:
-    case WEAK:
     case PRIM:
     case IND_PERM:
     {
@@ -1177,6 +1446,13 @@ scavenge_one(StgPtr p)
 	}
 	break;
     }
+
+    case WEAK:
+        // A weak pointer on the mutable list is in a generation we
+        // aren't collecting, so tidyWeakList() won't look at it: keep
+        // everything it points to alive.
+        scavengeLiveWeak((StgWeak *)p);
+        break;
     
     case MUT_VAR_CLEAN:
     case MUT_VAR_DIRTY: {
@@ -1251,7 +1527,12 @@ scavenge_one(StgPtr p)
 	// avoid traversing it during minor GCs.
 	gct->eager_promotion = rtsFalse;
 
-        scavenge_mut_arr_ptrs((StgMutArrPtrs *)p);
+        if (split_mut_arr_ptrs((StgMutArrPtrs *)p, rtsFalse)) {
+            // scavenged by the GC threads in pieces
+            gct->failed_to_evac = rtsTrue;
+        } else {
+            scavenge_mut_arr_ptrs((StgMutArrPtrs *)p);
+        }
 
 	if (gct->failed_to_evac) {
 	    ((StgClosure *)p)->header.info = &stg_MUT_ARR_PTRS_DIRTY_info;
@@ -1268,7 +1549,12 @@ scavenge_one(StgPtr p)
     case MUT_ARR_PTRS_FROZEN0:
     {
 	// follow everything 
-        scavenge_mut_arr_ptrs((StgMutArrPtrs *)p);
+        if (split_mut_arr_ptrs((StgMutArrPtrs *)p, rtsFalse)) {
+            // scavenged by the GC threads in pieces
+            gct->failed_to_evac = rtsTrue;
+        } else {
+            scavenge_mut_arr_ptrs((StgMutArrPtrs *)p);
+        }
         
 	// If we're going to put this object on the mutable list, then
 	// set its info ptr to MUT_ARR_PTRS_FROZEN0 to indicate that.
@@ -1383,13 +1669,18 @@ scavenge_one(StgPtr p)
    We treat the mutable list of each generation > N (i.e. all the
    generations older than the one being collected) as roots.  We also
    remove non-mutable objects from the mutable list at this point.
+
+   An object can be on the mutable lists more than once, e.g. if two
+   Capabilities dirtied it at the same time.  We skip the objects that
+   this thread has seen recently (gct->mut_filter), which also stops
+   the duplicates being carried over to the next GC's mutable list.
    -------------------------------------------------------------------------- */
 
 void
 scavenge_mutable_list(bdescr *bd, generation *gen)
 {
     StgPtr p, q;
-    nat gen_no;
+    nat gen_no, h;
 
     gen_no = gen->no;
     gct->evac_gen_no = gen_no;
@@ -1398,6 +1689,15 @@ scavenge_mutable_list(bdescr *bd, generation *gen)
 	    p = (StgPtr)*q;
 	    ASSERT(LOOKS_LIKE_CLOSURE_PTR(p));
 
+            h = ((W_)p / sizeof(W_)) & (MUT_FILTER_SIZE - 1);
+            if (gct->mut_filter[h] == (StgClosure *)p) {
+#ifdef DEBUG
+                mutlist_DUPS++;
+#endif
+                continue;
+            }
+            gct->mut_filter[h] = (StgClosure *)p;
+
 #ifdef DEBUG	    
 	    switch (get_itbl((StgClosure *)p)->type) {
 	    case MUT_VAR_CLEAN:
@@ -1451,7 +1751,12 @@ scavenge_mutable_list(bdescr *bd, generation *gen)
                 saved_eager_promotion = gct->eager_promotion;
                 gct->eager_promotion = rtsFalse;
 
-                scavenge_mut_arr_ptrs_marked((StgMutArrPtrs *)p);
+                if (split_mut_arr_ptrs((StgMutArrPtrs *)p, rtsTrue)) {
+                    // scavenged by the GC threads in pieces
+                    gct->failed_to_evac = rtsTrue;
+                } else {
+                    scavenge_mut_arr_ptrs_marked((StgMutArrPtrs *)p);
+                }
 
                 if (gct->failed_to_evac) {
                     ((StgClosure *)p)->header.info = &stg_MUT_ARR_PTRS_DIRTY_info;
@@ -1477,22 +1782,54 @@ scavenge_mutable_list(bdescr *bd, generation *gen)
     }
 }
 
+// Take a block off one of the saved mutable lists, which all the GC
+// threads are taking blocks from.  Nothing is added to the lists
+// during the GC, so a block can't reappear at the head of a list.
+STATIC_INLINE bdescr *
+grab_mut_list_block (bdescr **list)
+{
+    bdescr *bd;
+
+    do {
+        bd = *(bdescr * volatile *)list;
+        if (bd == NULL) return NULL;
+    } while (cas((StgVolatilePtr)list, (StgWord)bd, (StgWord)bd->link)
+             != (StgWord)bd);
+
+    return bd;
+}
+
 void
 scavenge_capability_mut_lists (Capability *cap)
 {
-    nat g;
+    nat g, i, n;
+    bdescr *bd, *done;
 
     /* Mutable lists from each generation > N
      * we want to *scavenge* these roots, not evacuate them: they're not
      * going to move in this GC.
      * Also do them in reverse generation order, for the usual reason:
      * namely to reduce the likelihood of spurious old->new pointers.
+     *
+     * The GC threads share out the mutable lists of all the
+     * Capabilities a block at a time, each starting with those of its
+     * own Capability, so that one long mutable list (or those of the
+     * idle Capabilities) isn't left to a single thread.
      */
+    done = NULL;
     for (g = RtsFlags.GcFlags.generations-1; g > N; g--) {
-        scavenge_mutable_list(cap->saved_mut_lists[g], &generations[g]);
-        freeChain_sync(cap->saved_mut_lists[g]);
-        cap->saved_mut_lists[g] = NULL;
+        for (i = 0; i < n_capabilities; i++) {
+            n = (cap->no + i) % n_capabilities;
+            while ((bd = grab_mut_list_block(
+                        &capabilities[n].saved_mut_lists[g])) != NULL) {
+                bd->link = NULL;
+                scavenge_mutable_list(bd, &generations[g]);
+                bd->link = done;
+                done = bd;
+            }
+        }
     }
+    freeChain_sync(done);
 }
 
 /* -----------------------------------------------------------------------------
@@ -1844,7 +2181,7 @@ scavenge_find_work (void)
 
 loop:
     did_something = rtsFalse;
-    for (g = RtsFlags.GcFlags.generations-1; g >= 0; g--) {
+    for (g = n_gc_workspaces-1; g >= 0; g--) {
         ws = &gct->gens[g];
         
         gct->scan_bd = NULL;
@@ -1879,8 +2216,17 @@ loop:
 
 #if defined(THREADED_RTS)
     if (work_stealing) {
+        ArrChunk *c;
+
+        // pieces of large arrays that we shared out ourselves
+        if ((c = popWSDeque(gct->arr_q)) != NULL) {
+            scavenge_arr_chunk(c);
+            did_anything = rtsTrue;
+            goto loop;
+        }
+
         // look for work to steal
-        for (g = RtsFlags.GcFlags.generations-1; g >= 0; g--) {
+        for (g = n_gc_workspaces-1; g >= 0; g--) {
             if ((bd = steal_todo_block(g)) != NULL) {
                 scavenge_block(bd);
                 did_something = rtsTrue;
@@ -1888,6 +2234,11 @@ loop:
             }
         }
 
+        if (!did_something && (c = steal_arr_chunk()) != NULL) {
+            scavenge_arr_chunk(c);
+            did_something = rtsTrue;
+        }
+
         if (did_something) {
             did_anything = rtsTrue;
             goto loop;
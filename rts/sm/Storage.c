@@ -29,6 +29,12 @@
 #include "Trace.h"
 #include "GC.h"
 #include "Evac.h"
+#include "Sweep.h"
+#include "Pretenure.h"
+#include "PauseTarget.h"
+#include "Pinned.h"
+#include "Decommit.h"
+#include "ConcMark.h"
 
 #include <string.h>
 
@@ -50,7 +56,16 @@ generation *generations = NULL; /* all the generations */
 generation *g0          = NULL; /* generation 0, for convenience */
 generation *oldest_gen  = NULL; /* oldest generation, for convenience */
 
-nursery *nurseries = NULL;     /* array of nurseries, size == n_capabilities */
+nursery *nurseries = NULL;     /* array of nurseries, size == n_nurseries */
+nat n_nurseries = 0;
+
+/*
+ * With +RTS -n, the allocation area is divided into more nurseries
+ * ("chunks") than there are Capabilities.  Each Capability starts with
+ * one, and when it fills up takes the next unused one, next_nursery,
+ * so we only need to GC once every chunk has been used.
+ */
+static volatile StgWord next_nursery = 0;
 
 #ifdef THREADED_RTS
 /*
@@ -61,6 +76,7 @@ Mutex sm_mutex;
 #endif
 
 static void allocNurseries (nat from, nat to);
+static void assignNurseriesToCapabilities (nat from, nat to);
 
 static void
 initGeneration (generation *gen, int g)
@@ -73,6 +89,8 @@ initGeneration (generation *gen, int g)
     gen->blocks = NULL;
     gen->n_blocks = 0;
     gen->n_words = 0;
+    gen->unswept_blocks = NULL;
+    gen->n_unswept_blocks = 0;
     gen->live_estimate = 0;
     gen->old_blocks = NULL;
     gen->n_old_blocks = 0;
@@ -82,6 +100,10 @@ initGeneration (generation *gen, int g)
     gen->n_new_large_words = 0;
     gen->scavenged_large_objects = NULL;
     gen->n_scavenged_large_blocks = 0;
+    gen->compact_regions = NULL;
+    gen->n_compact_blocks = 0;
+    gen->live_compact_regions = NULL;
+    gen->n_live_compact_blocks = 0;
     gen->mark = 0;
     gen->compact = 0;
     gen->bitmap = NULL;
@@ -90,6 +112,9 @@ initGeneration (generation *gen, int g)
 #endif
     gen->threads = END_TSO_QUEUE;
     gen->old_threads = END_TSO_QUEUE;
+    gen->weak_ptr_list = NULL;
+    gen->old_weak_ptr_list = NULL;
+    gen->weak_ptr_list_tail = NULL;
 }
 
 void
@@ -166,7 +191,6 @@ initStorage (void)
 
   generations[0].max_blocks = 0;
 
-  weak_ptr_list = NULL;
   caf_list = END_OF_STATIC_LIST;
   revertible_caf_list = END_OF_STATIC_LIST;
    
@@ -180,6 +204,11 @@ initStorage (void)
   whitehole_spin = 0;
 #endif
 
+  initSweep();
+  initPretenure();
+  initPauseTarget();
+  initPinned();
+
   N = 0;
 
   storageAddCapabilities(0, n_capabilities);
@@ -188,6 +217,9 @@ initStorage (void)
 
   RELEASE_SM_LOCK;
 
+  initDecommit();
+  initConcMark();
+
   traceEventHeapInfo(CAPSET_HEAP_DEFAULT,
                      RtsFlags.GcFlags.generations,
                      RtsFlags.GcFlags.maxHeapSize * BLOCK_SIZE_W * sizeof(W_),
@@ -198,20 +230,34 @@ initStorage (void)
 
 void storageAddCapabilities (nat from, nat to)
 {
-    nat n, g, i;
+    nat n, g, i, new_n_nurseries;
+    nursery *old_nurseries;
 
+    // Each new Capability brings -A worth of nursery, in chunks of -n
+    // (but at least one chunk).
+    if (RtsFlags.GcFlags.nurseryChunkSize == 0) {
+        new_n_nurseries = to;
+    } else {
+        new_n_nurseries = n_nurseries +
+            stg_max(to - from, ((to - from) * RtsFlags.GcFlags.minAllocAreaSize)
+                               / RtsFlags.GcFlags.nurseryChunkSize);
+    }
+
+    old_nurseries = nurseries;
     if (from > 0) {
-        nurseries = stgReallocBytes(nurseries, to * sizeof(struct nursery_),
+        nurseries = stgReallocBytes(nurseries,
+                                    new_n_nurseries * sizeof(struct nursery_),
                                     "storageAddCapabilities");
     } else {
-        nurseries = stgMallocBytes(to * sizeof(struct nursery_),
+        nurseries = stgMallocBytes(new_n_nurseries * sizeof(struct nursery_),
                                    "storageAddCapabilities");
     }
 
     // we've moved the nurseries, so we have to update the rNursery
     // pointers from the Capabilities.
-    for (i = 0; i < to; i++) {
-        capabilities[i].r.rNursery = &nurseries[i];
+    for (i = 0; i < from; i++) {
+        capabilities[i].r.rNursery =
+            &nurseries[capabilities[i].r.rNursery - old_nurseries];
     }
 
     /* The allocation area.  Policy: keep the allocation area
@@ -220,12 +266,19 @@ void storageAddCapabilities (nat from, nat to)
      * don't want it to be a big one.  This vague idea is borne out by
      * rigorous experimental evidence.
      */
-    allocNurseries(from, to);
+    allocNurseries(n_nurseries, new_n_nurseries);
+    n_nurseries = new_n_nurseries;
+
+    // Give each of the new Capabilities a nursery, starting from
+    // next_nursery, as the Capabilities we already have may have used
+    // some of the others.
+    assignNurseriesToCapabilities(from, to);
 
     // allocate a block for each mut list
     for (n = from; n < to; n++) {
         for (g = 1; g < RtsFlags.GcFlags.generations; g++) {
-            capabilities[n].mut_lists[g] = allocBlock();
+            capabilities[n].mut_lists[g] =
+                allocBlockOnNode(capNoToNumaNode(n));
         }
     }
 
@@ -240,6 +293,8 @@ void storageAddCapabilities (nat from, nat to)
 void
 exitStorage (void)
 {
+    exitDecommit();
+    exitConcMark();
     updateNurseriesStats();
     stat_exit();
 }
@@ -253,6 +308,8 @@ freeStorage (rtsBool free_heap)
     closeMutex(&sm_mutex);
 #endif
     stgFree(nurseries);
+    freePauseTarget();
+    freePinned();
 #if defined(THREADED_RTS) && defined(llvm_CC_FLAVOR)
     freeThreadLocalKey(&gctKey);
 #endif
@@ -325,12 +382,16 @@ freeStorage (rtsBool free_heap)
 
    -------------------------------------------------------------------------- */
 
-STATIC_INLINE StgWord lockCAF (StgClosure *caf, StgClosure *bh)
+STATIC_INLINE StgWord lockCAF (Capability *cap, StgClosure *caf, StgClosure *bh)
 {
     const StgInfoTable *orig_info;
 
     orig_info = caf->header.info;
 
+    // Once the CAF is an IND_STATIC its SRT is no longer reachable
+    // from it, so remember the SRT for the concurrent mark.
+    concMarkBarrierFields(cap, caf);
+
 #ifdef THREADED_RTS
     const StgInfoTable *cur_info;
 
@@ -366,7 +427,7 @@ STATIC_INLINE StgWord lockCAF (StgClosure *caf, StgClosure *bh)
 StgWord
 newCAF(StgRegTable *reg, StgClosure *caf, StgClosure *bh)
 {
-    if (lockCAF(caf,bh) == 0) return 0;
+    if (lockCAF(regTableToCapability(reg),caf,bh) == 0) return 0;
 
     if(keepCAFs)
     {
@@ -414,9 +475,9 @@ setKeepCAFs (void)
 // The linker hackily arranges that references to newCaf from dynamic
 // code end up pointing to newDynCAF.
 StgWord
-newDynCAF (StgRegTable *reg STG_UNUSED, StgClosure *caf, StgClosure *bh)
+newDynCAF (StgRegTable *reg, StgClosure *caf, StgClosure *bh)
 {
-    if (lockCAF(caf,bh) == 0) return 0;
+    if (lockCAF(regTableToCapability(reg),caf,bh) == 0) return 0;
 
     ACQUIRE_SM_LOCK;
 
@@ -433,7 +494,7 @@ newDynCAF (StgRegTable *reg STG_UNUSED, StgClosure *caf, StgClosure *bh)
    -------------------------------------------------------------------------- */
 
 static bdescr *
-allocNursery (bdescr *tail, W_ blocks)
+allocNursery (nat node, bdescr *tail, W_ blocks)
 {
     bdescr *bd = NULL;
     W_ i, n;
@@ -449,7 +510,7 @@ allocNursery (bdescr *tail, W_ blocks)
         // allocLargeChunk will prefer large chunks, but will pick up
         // small chunks if there are any available.  We must allow
         // single blocks here to avoid fragmentation (#7257)
-        bd = allocLargeChunk(1, n);
+        bd = allocLargeChunkOnNode(node, 1, n);
         n = bd->blocks;
         blocks -= n;
 
@@ -483,14 +544,22 @@ allocNursery (bdescr *tail, W_ blocks)
     return &bd[0];
 }
 
+static void
+assignNurseryToCapability (Capability *cap, StgWord n)
+{
+    ASSERT(n < n_nurseries);
+    cap->r.rNursery        = &nurseries[n];
+    cap->r.rCurrentNursery = nurseries[n].blocks;
+    cap->r.rCurrentAlloc   = NULL;
+}
+
 static void
 assignNurseriesToCapabilities (nat from, nat to)
 {
     nat i;
 
     for (i = from; i < to; i++) {
-        capabilities[i].r.rCurrentNursery = nurseries[i].blocks;
-        capabilities[i].r.rCurrentAlloc   = NULL;
+        assignNurseryToCapability(&capabilities[i], next_nursery++);
     }
 }
 
@@ -498,22 +567,49 @@ static void
 allocNurseries (nat from, nat to)
 { 
     nat i;
+    W_ blocks;
+
+    if (RtsFlags.GcFlags.nurseryChunkSize != 0) {
+        blocks = RtsFlags.GcFlags.nurseryChunkSize;
+    } else {
+        blocks = RtsFlags.GcFlags.minAllocAreaSize;
+    }
 
     for (i = from; i < to; i++) {
         nurseries[i].blocks =
-            allocNursery(NULL, RtsFlags.GcFlags.minAllocAreaSize);
-        nurseries[i].n_blocks =
-            RtsFlags.GcFlags.minAllocAreaSize;
+            allocNursery(capNoToNumaNode(i), NULL, blocks);
+        nurseries[i].n_blocks = blocks;
     }
-    assignNurseriesToCapabilities(from, to);
 }
-      
+
+// Give cap the next unused nursery chunk (+RTS -n).  Returns rtsFalse
+// if they have all been used, in which case it is time to GC.
+rtsBool
+getNewNursery (Capability *cap)
+{
+    StgWord i;
+
+    for (;;) {
+        i = next_nursery;
+        if (i >= n_nurseries) return rtsFalse;
+        if (cas(&next_nursery, i, i+1) == i) break;
+    }
+
+    // The chunk we are leaving is full, so count what was allocated in
+    // it now: clearNursery() only looks at the chunk that the
+    // Capability has at the time of the GC.
+    cap->total_allocated += countOccupied(cap->r.rNursery->blocks);
+
+    assignNurseryToCapability(cap, i);
+    return rtsTrue;
+}
+
 void
 clearNursery (Capability *cap)
 {
     bdescr *bd;
 
-    for (bd = nurseries[cap->no].blocks; bd; bd = bd->link) {
+    for (bd = cap->r.rNursery->blocks; bd; bd = bd->link) {
         cap->total_allocated += (W_)(bd->free - bd->start);
         bd->free = bd->start;
         ASSERT(bd->gen_no == 0);
@@ -525,6 +621,24 @@ clearNursery (Capability *cap)
 void
 resetNurseries (void)
 {
+    bdescr *bd;
+    nat i;
+
+    // clearNursery() has emptied the chunks that the Capabilities
+    // had; empty the others, whose allocation getNewNursery() has
+    // already counted.
+    if (n_nurseries > n_capabilities) {
+        for (i = 0; i < n_nurseries; i++) {
+            for (bd = nurseries[i].blocks; bd; bd = bd->link) {
+                bd->free = bd->start;
+                ASSERT(bd->gen_no == 0);
+                ASSERT(bd->gen == g0);
+                IF_DEBUG(sanity,memset(bd->start, 0xaa, BLOCK_SIZE));
+            }
+        }
+    }
+
+    next_nursery = 0;
     assignNurseriesToCapabilities(0, n_capabilities);
 }
 
@@ -534,7 +648,7 @@ countNurseryBlocks (void)
     nat i;
     W_ blocks = 0;
 
-    for (i = 0; i < n_capabilities; i++) {
+    for (i = 0; i < n_nurseries; i++) {
         blocks += nurseries[i].n_blocks;
     }
     return blocks;
@@ -552,7 +666,8 @@ resizeNursery (nursery *nursery, W_ blocks)
   if (nursery_blocks < blocks) {
       debugTrace(DEBUG_gc, "increasing size of nursery to %d blocks", 
                  blocks);
-    nursery->blocks = allocNursery(nursery->blocks, blocks-nursery_blocks);
+    nursery->blocks = allocNursery(capNoToNumaNode(nursery - nurseries),
+                                   nursery->blocks, blocks-nursery_blocks);
   } 
   else {
     bdescr *next_bd;
@@ -572,7 +687,9 @@ resizeNursery (nursery *nursery, W_ blocks)
     // might have gone just under, by freeing a large block, so make
     // up the difference.
     if (nursery_blocks < blocks) {
-        nursery->blocks = allocNursery(nursery->blocks, blocks-nursery_blocks);
+        nursery->blocks =
+            allocNursery(capNoToNumaNode(nursery - nurseries),
+                         nursery->blocks, blocks-nursery_blocks);
     }
   }
   
@@ -583,15 +700,34 @@ resizeNursery (nursery *nursery, W_ blocks)
 // 
 // Resize each of the nurseries to the specified size.
 //
-void
-resizeNurseriesFixed (W_ blocks)
+static void
+resizeNurseriesEach (W_ blocks)
 {
     nat i;
-    for (i = 0; i < n_capabilities; i++) {
+
+    for (i = 0; i < n_nurseries; i++) {
         resizeNursery(&nurseries[i], blocks);
     }
 }
 
+// 
+// Reset each of the nurseries to the size given by -A, or -n if the
+// nursery is divided into chunks.
+//
+void
+resizeNurseriesFixed (void)
+{
+    W_ blocks;
+
+    if (RtsFlags.GcFlags.nurseryChunkSize != 0) {
+        blocks = RtsFlags.GcFlags.nurseryChunkSize;
+    } else {
+        blocks = RtsFlags.GcFlags.minAllocAreaSize;
+    }
+
+    resizeNurseriesEach(blocks);
+}
+
 // 
 // Resize the nurseries to the total specified size.
 //
@@ -600,7 +736,7 @@ resizeNurseries (W_ blocks)
 {
     // If there are multiple nurseries, then we just divide the number
     // of available blocks between them.
-    resizeNurseriesFixed(blocks / n_capabilities);
+    resizeNurseriesEach(blocks / n_nurseries);
 }
 
 
@@ -661,12 +797,29 @@ allocate (Capability *cap, W_ n)
             stg_exit(EXIT_HEAPOVERFLOW);
         }
 
-        ACQUIRE_SM_LOCK
-        bd = allocGroup(req_blocks);
-        dbl_link_onto(bd, &g0->large_objects);
-        g0->n_large_blocks += bd->blocks; // might be larger than req_blocks
+        lazySweep(cap, req_blocks * LAZY_SWEEP_BLOCKS);
+
+        // Recently freed groups are cached by the Capability, so this
+        // usually doesn't take sm_mutex.
+        bd = allocGroupOnCap_lock(cap, req_blocks);
+
+        // g0->large_objects is shared, so the object goes on a list of
+        // the Capability's own until the next GC (see
+        // collect_large_objects()).  g0->n_new_large_words still has
+        // to be up to date, because it tells us when to GC.
+        dbl_link_onto(bd, &cap->large_objects);
+        cap->n_large_blocks += bd->blocks; // might be larger than req_blocks
+#if defined(THREADED_RTS)
+        {
+            W_ old;
+            do {
+                old = g0->n_new_large_words;
+            } while (cas((StgVolatilePtr)&g0->n_new_large_words,
+                         old, old + n) != old);
+        }
+#else
         g0->n_new_large_words += n;
-        RELEASE_SM_LOCK;
+#endif
         initBdescr(bd, g0, g0);
         bd->flags = BF_LARGE;
         bd->free = bd->start + n;
@@ -687,10 +840,9 @@ allocate (Capability *cap, W_ n)
         if (bd == NULL || bd->free + n > bd->start + BLOCK_SIZE_W) {
             // The nursery is empty, or the next block is already
             // full: allocate a fresh block (we can't fail here).
-            ACQUIRE_SM_LOCK;
-            bd = allocBlock();
+            lazySweep(cap, LAZY_SWEEP_BLOCKS);
+            bd = allocBlockOnCap_lock(cap);
             cap->r.rNursery->n_blocks++;
-            RELEASE_SM_LOCK;
             initBdescr(bd, g0, g0);
             bd->flags = 0;
             // If we had to allocate a new block, then we'll GC
@@ -721,7 +873,9 @@ allocate (Capability *cap, W_ n)
 
    We allocate small pinned objects into a single block, allocating a
    new block when the current one overflows.  The block is chained
-   onto the large_object_list of generation 0.
+   onto the large_object_list of generation 0.  Before we do that, we
+   try the free space that the GC found between the live objects of
+   the pinned blocks that survived it (see Pinned.c).
 
    NOTE: The GC can't in general handle pinned objects.  This
    interface is only safe to use for ByteArrays, which have no
@@ -729,7 +883,7 @@ allocate (Capability *cap, W_ n)
    block's descriptor has the BF_LARGE flag set, so the block is
    treated as a large object and chained onto various lists, rather
    than the individual objects being copied.  However, when it comes
-   to scavenge the block, the GC will only scavenge the first object.
+   to scavenge the block, the GC won't scavenge any of the objects.
    The reason is that the GC can't linearly scan a block of pinned
    objects at the moment (doing so would require using the
    mostly-copying techniques).  But since we're restricting ourselves
@@ -762,13 +916,22 @@ allocatePinned (Capability *cap, W_ n)
     // one isn't large enough to hold the new object, get a new one.
     if (bd == NULL || (bd->free + n) > (bd->start + BLOCK_SIZE_W)) {
 
+        // Reuse the free space in an older pinned block, if there is
+        // a piece big enough.  We keep the current block, so that its
+        // remaining space isn't wasted.
+        p = allocPinnedChunk(cap, n);
+        if (p != NULL) {
+            cap->total_allocated += n;
+            return p;
+        }
+
         // stash the old block on cap->pinned_object_blocks.  On the
         // next GC cycle these objects will be moved to
         // g0->large_objects.
         if (bd != NULL) {
             dbl_link_onto(bd, &cap->pinned_object_blocks);
             // add it to the allocation stats when the block is full
-            cap->total_allocated += bd->free - bd->start;
+            cap->total_allocated += bd->free - (bd->start + PINNED_BITMAP_W);
         }
 
         // We need to find another block.  We could just allocate one,
@@ -793,9 +956,8 @@ allocatePinned (Capability *cap, W_ n)
             // counted towards allocation, and we're already counting
             // our pinned obects as allocation in
             // collect_pinned_object_blocks in the GC.
-            ACQUIRE_SM_LOCK;
-            bd = allocBlock();
-            RELEASE_SM_LOCK;
+            lazySweep(cap, LAZY_SWEEP_BLOCKS);
+            bd = allocBlockOnCap_lock(cap);
             initBdescr(bd, g0, g0);
         } else {
             // we have a block in the nursery: steal it
@@ -807,7 +969,11 @@ allocatePinned (Capability *cap, W_ n)
         }
 
         cap->pinned_object_block = bd;
-        bd->flags  = BF_PINNED | BF_LARGE | BF_EVACUATED;
+        bd->flags  = BF_PINNED | BF_PINNED_SMALL | BF_LARGE | BF_EVACUATED;
+
+        // The GC marks the live objects in the bitmap at the start of
+        // the block; it clears the bitmap before it does so.
+        bd->free   = bd->start + PINNED_BITMAP_W;
 
         // The pinned_object_block remains attached to the capability
         // until it is full, even if a GC occurs.  We want this
@@ -838,11 +1004,17 @@ allocatePinned (Capability *cap, W_ n)
    MUT_VAR_CLEAN object is not on the mutable list; a MUT_VAR_DIRTY
    is.  When written to, a MUT_VAR_CLEAN turns into a MUT_VAR_DIRTY
    and is put on the mutable list.
+
+   While the old generation is being marked concurrently, the value
+   being overwritten (old) is also remembered for the marker, so
+   MUT_VAR_DIRTY objects must call this too when conc_mark_active is
+   set.  See ConcMark.c.
 */
 void
-dirty_MUT_VAR(StgRegTable *reg, StgClosure *p)
+dirty_MUT_VAR(StgRegTable *reg, StgClosure *p, StgClosure *old)
 {
     Capability *cap = regTableToCapability(reg);
+    concMarkBarrier(cap, old);
     if (p->header.info == &stg_MUT_VAR_CLEAN_info) {
         p->header.info = &stg_MUT_VAR_DIRTY_info;
         recordClosureMutated(cap,p);
@@ -850,8 +1022,9 @@ dirty_MUT_VAR(StgRegTable *reg, StgClosure *p)
 }
 
 void
-dirty_TVAR(Capability *cap, StgTVar *p)
+dirty_TVAR(Capability *cap, StgTVar *p, StgClosure *old)
 {
+    concMarkBarrier(cap, old);
     if (p->header.info == &stg_TVAR_CLEAN_info) {
         p->header.info = &stg_TVAR_DIRTY_info;
         recordClosureMutated(cap,(StgClosure*)p);
@@ -909,11 +1082,26 @@ dirty_STACK (Capability *cap, StgStack *stack)
    The check for MVAR_CLEAN is inlined at the call site for speed,
    this really does make a difference on concurrency-heavy benchmarks
    such as Chaneneos and cheap-concurrency.
+
+   During a concurrent mark the call sites also call this for a
+   MVAR_DIRTY, and we remember the fields that are about to be
+   overwritten.  The MVar is locked (a WHITEHOLE) at this point, so
+   the caller passes its original info pointer.
 */
 void
-dirty_MVAR(StgRegTable *reg, StgClosure *p)
+dirty_MVAR(StgRegTable *reg, StgClosure *p, const StgInfoTable *info)
 {
-    recordClosureMutated(regTableToCapability(reg),p);
+    Capability *cap = regTableToCapability(reg);
+    StgMVar *mvar = (StgMVar *)p;
+
+    if (conc_mark_active) {
+        concMarkPushClosure(cap, (StgClosure *)mvar->head);
+        concMarkPushClosure(cap, (StgClosure *)mvar->tail);
+        concMarkPushClosure(cap, mvar->value);
+    }
+    if (info == &stg_MVAR_CLEAN_info) {
+        recordClosureMutated(cap,p);
+    }
 }
 
 /* -----------------------------------------------------------------------------
@@ -935,7 +1123,8 @@ void updateNurseriesStats (void)
     nat i;
 
     for (i = 0; i < n_capabilities; i++) {
-        capabilities[i].total_allocated += countOccupied(nurseries[i].blocks);
+        capabilities[i].total_allocated +=
+            countOccupied(capabilities[i].r.rNursery->blocks);
     }
 }
 
@@ -953,32 +1142,39 @@ W_ countOccupied (bdescr *bd)
 
 W_ genLiveWords (generation *gen)
 {
-    return gen->n_words + gen->n_large_words;
+    return gen->n_words + gen->n_large_words
+        + gen->n_compact_blocks * BLOCK_SIZE_W;
 }
 
 W_ genLiveBlocks (generation *gen)
 {
-    return gen->n_blocks + gen->n_large_blocks;
+    return gen->n_blocks + gen->n_large_blocks + gen->n_compact_blocks;
 }
 
 W_ gcThreadLiveWords (nat i, nat g)
 {
-    W_ words;
+    W_ words = 0;
+    nat w;
 
-    words   = countOccupied(gc_threads[i]->gens[g].todo_bd);
-    words  += countOccupied(gc_threads[i]->gens[g].part_list);
-    words  += countOccupied(gc_threads[i]->gens[g].scavd_list);
+    for (w = g; w < n_gc_workspaces; w = nextGenWorkspace(g,w)) {
+        words  += countOccupied(gc_threads[i]->gens[w].todo_bd);
+        words  += countOccupied(gc_threads[i]->gens[w].part_list);
+        words  += countOccupied(gc_threads[i]->gens[w].scavd_list);
+    }
 
     return words;
 }
 
 W_ gcThreadLiveBlocks (nat i, nat g)
 {
-    W_ blocks;
+    W_ blocks = 0;
+    nat w;
 
-    blocks  = countBlocks(gc_threads[i]->gens[g].todo_bd);
-    blocks += gc_threads[i]->gens[g].n_part_blocks;
-    blocks += gc_threads[i]->gens[g].n_scavd_blocks;
+    for (w = g; w < n_gc_workspaces; w = nextGenWorkspace(g,w)) {
+        blocks += countBlocks(gc_threads[i]->gens[w].todo_bd);
+        blocks += gc_threads[i]->gens[w].n_part_blocks;
+        blocks += gc_threads[i]->gens[w].n_scavd_blocks;
+    }
 
     return blocks;
 }
@@ -1036,7 +1232,8 @@ calcNeeded (rtsBool force_major, memcount *blocks_needed)
         gen = &generations[g];
 
         blocks = gen->n_blocks // or: gen->n_words / BLOCK_SIZE_W (?)
-               + gen->n_large_blocks;
+               + gen->n_large_blocks
+               + gen->n_compact_blocks;
 
         // we need at least this much space
         needed += blocks;
@@ -72,20 +72,22 @@ extern Mutex sm_mutex;
    The write barrier for MVARs and TVARs
    -------------------------------------------------------------------------- */
 
-void dirty_MVAR(StgRegTable *reg, StgClosure *p);
-void dirty_TVAR(Capability *cap, StgTVar *p);
+void dirty_MVAR(StgRegTable *reg, StgClosure *p, const StgInfoTable *info);
+void dirty_TVAR(Capability *cap, StgTVar *p, StgClosure *old);
 
 /* -----------------------------------------------------------------------------
    Nursery manipulation
    -------------------------------------------------------------------------- */
 
 extern nursery *nurseries;
+extern nat n_nurseries;
 
 void     resetNurseries       ( void );
 void     clearNursery         ( Capability *cap );
 void     resizeNurseries      ( W_ blocks );
-void     resizeNurseriesFixed ( W_ blocks );
+void     resizeNurseriesFixed ( void );
 W_       countNurseryBlocks   ( void );
+rtsBool  getNewNursery        ( Capability *cap );
 
 /* -----------------------------------------------------------------------------
    Stats 'n' DEBUG stuff
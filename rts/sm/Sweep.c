@@ -14,73 +14,430 @@
 #include "PosixSource.h"
 #include "Rts.h"
 
+#include "Storage.h"
+#include "RtsUtils.h"
 #include "BlockAlloc.h"
+#include "GC.h"
+#include "GCThread.h"
+#include "GCTDecl.h"
 #include "Sweep.h"
 #include "Trace.h"
 
-void
-sweep(generation *gen)
+typedef struct {
+    W_ swept;   // blocks swept
+    W_ freed;   // of which were freed
+    W_ fragd;   // of which are fragmented
+    W_ live;    // estimate of live words in the blocks swept
+} SweepStats;
+
+static void
+init_stats (SweepStats *stats)
+{
+    stats->swept = 0;
+    stats->freed = 0;
+    stats->fragd = 0;
+    stats->live  = 0;
+}
+
+static void
+add_stats (SweepStats *to, SweepStats *from)
+{
+    to->swept += from->swept;
+    to->freed += from->freed;
+    to->fragd += from->fragd;
+    to->live  += from->live;
+}
+
+static void
+trace_stats (SweepStats *stats STG_UNUSED, memcount n_blocks STG_UNUSED)
+{
+    debugTrace(DEBUG_gc, "sweeping: %d blocks, %d were not swept, %d freed (%d%%), %d are fragmented, live estimate: %ld%%",
+          n_blocks + stats->freed,
+          n_blocks - stats->swept + stats->freed,
+          stats->freed,
+          stats->swept == 0 ? 0 : (stats->freed * 100) / stats->swept,
+          stats->fragd, 
+          (unsigned long)((stats->swept - stats->freed) == 0 ? 0 : ((stats->live / BLOCK_SIZE_W) * 100) / (stats->swept - stats->freed)));
+}
+
+// Sweep one block.  Returns rtsTrue if nothing in it is marked, in
+// which case the caller frees it; otherwise the block is flagged
+// BF_SWEPT (and BF_FRAGMENTED if it is mostly empty).
+static rtsBool
+sweep_block (bdescr *bd, SweepStats *stats)
 {
-    bdescr *bd, *prev, *next;
     nat i;
-    W_ freed, resid, fragd, blocks, live;
-    
-    ASSERT(countBlocks(gen->old_blocks) == gen->n_old_blocks);
+    W_ resid;
 
-    live = 0; // estimate of live data in this gen
-    freed = 0;
-    fragd = 0;
-    blocks = 0;
+    stats->swept++;
+    resid = 0;
+    for (i = 0; i < BLOCK_SIZE_W / BITS_IN(W_); i++)
+    {
+        if (bd->u.bitmap[i] != 0) resid++;
+    }
+    stats->live += resid * BITS_IN(W_);
+
+    if (resid == 0)
+    {
+        stats->freed++;
+        return rtsTrue;
+    }
+
+    if (resid < (BLOCK_SIZE_W * 3) / (BITS_IN(W_) * 4)) {
+        stats->fragd++;
+        bd->flags |= BF_FRAGMENTED;
+    }
+
+    bd->flags |= BF_SWEPT;
+    return rtsFalse;
+}
+
+// Sweep the blocks on *blocks that have the given flag set, freeing
+// the ones in which nothing is marked.  *n_blocks, and *n_words if it
+// is not NULL, are kept up to date.  Called by a GC thread.
+static void
+sweep_blocks (bdescr **blocks, memcount *n_blocks, memcount *n_words,
+              StgWord16 flag, SweepStats *stats)
+{
+    bdescr *bd, *prev, *next;
+    
     prev = NULL;
-    for (bd = gen->old_blocks; bd != NULL; bd = next)
+    for (bd = *blocks; bd != NULL; bd = next)
     {
         next = bd->link;
 
-        if (!(bd->flags & BF_MARKED)) { 
+        if (!(bd->flags & flag)) { 
             prev = bd;
             continue;
         }
 
-        blocks++;
-        resid = 0;
-        for (i = 0; i < BLOCK_SIZE_W / BITS_IN(W_); i++)
-        {
-            if (bd->u.bitmap[i] != 0) resid++;
-        }
-        live += resid * BITS_IN(W_);
-
-        if (resid == 0)
+        if (sweep_block(bd, stats))
         {
-            freed++;
-            gen->n_old_blocks--;
+            (*n_blocks)--;
+            if (n_words != NULL) {
+                *n_words -= bd->free - bd->start;
+            }
             if (prev == NULL) {
-                gen->old_blocks = next;
+                *blocks = next;
             } else {
                 prev->link = next;
             }
-            freeGroup(bd);
+            freeGroupOnCap_sync(gct->cap, bd);
         }
         else
         {
             prev = bd;
-            if (resid < (BLOCK_SIZE_W * 3) / (BITS_IN(W_) * 4)) {
-                fragd++;
-                bd->flags |= BF_FRAGMENTED;
+        }
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Parallel sweeping
+
+   With more than one GC thread, the blocks are cut into chunks which
+   the GC threads sweep between them (see gcParallelPhase()).
+   -------------------------------------------------------------------------- */
+
+#define SWEEP_CHUNK_BLOCKS 256
+
+typedef struct {
+    bdescr    *blocks;
+    memcount   n_blocks;
+    SweepStats stats;
+} SweepChunk;
+
+static SweepChunk *sweep_chunks;
+static W_ n_sweep_chunks;
+static volatile StgWord next_sweep_chunk;
+
+static void
+sweep_chunks_par (void)
+{
+    StgWord i;
+
+    while ((i = atomic_inc(&next_sweep_chunk) - 1) < n_sweep_chunks) {
+        sweep_blocks(&sweep_chunks[i].blocks, &sweep_chunks[i].n_blocks,
+                     NULL, BF_MARKED, &sweep_chunks[i].stats);
+    }
+}
+
+static void
+sweep_par (generation *gen, SweepStats *stats)
+{
+    bdescr *bd, *last;
+    W_ i, n;
+
+    n_sweep_chunks = (gen->n_old_blocks + SWEEP_CHUNK_BLOCKS - 1)
+                     / SWEEP_CHUNK_BLOCKS;
+    sweep_chunks = stgMallocBytes(n_sweep_chunks * sizeof(SweepChunk),
+                                  "sweep_par");
+
+    n = 0;
+    bd = gen->old_blocks;
+    while (bd != NULL) {
+        sweep_chunks[n].blocks = bd;
+        sweep_chunks[n].n_blocks = 0;
+        init_stats(&sweep_chunks[n].stats);
+        last = bd;
+        for (i = 0; i < SWEEP_CHUNK_BLOCKS && bd != NULL; i++) {
+            sweep_chunks[n].n_blocks++;
+            last = bd;
+            bd = bd->link;
+        }
+        last->link = NULL;
+        n++;
+    }
+    ASSERT(n <= n_sweep_chunks);
+    n_sweep_chunks = n;
+
+    next_sweep_chunk = 0;
+    gcParallelPhase(sweep_chunks_par);
+
+    // put the surviving blocks back together
+    gen->old_blocks = NULL;
+    gen->n_old_blocks = 0;
+    last = NULL;
+    for (n = 0; n < n_sweep_chunks; n++) {
+        add_stats(stats, &sweep_chunks[n].stats);
+        if (sweep_chunks[n].blocks == NULL) continue;
+        if (last == NULL) {
+            gen->old_blocks = sweep_chunks[n].blocks;
+        } else {
+            last->link = sweep_chunks[n].blocks;
+        }
+        for (last = sweep_chunks[n].blocks; last->link != NULL;
+             last = last->link) {}
+        gen->n_old_blocks += sweep_chunks[n].n_blocks;
+    }
+
+    stgFree(sweep_chunks);
+    sweep_chunks = NULL;
+}
+
+/* -----------------------------------------------------------------------------
+   Lazy sweeping (+RTS --lazy-sweep)
+
+   Rather than sweeping the marked blocks of the oldest generation at
+   the end of a major GC, we leave them on gen->unswept_blocks, with
+   the mark bitmap still attached, and sweep a few of them whenever
+   more memory is needed: by the GC when it needs a new block to copy
+   into (alloc_todo_block()), and by allocate() and allocatePinned()
+   when the nursery has run out.  The blocks that turn out to be
+   empty are freed, and the rest are put back on gen->blocks.
+
+   Unswept blocks are counted in gen->n_blocks and gen->n_words, so
+   the heap looks as big as it would if nothing had been freed yet.
+   Whatever is left to sweep is swept before the next major GC, or
+   before a concurrent mark takes its snapshot.
+
+   As we don't know how much of the oldest generation is live until
+   it has been swept, the next major GC is scheduled according to its
+   occupied size, rather than an estimate of its live data.
+   -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+static SpinLock lazy_sweep_sync;  // for oldest_gen->unswept_blocks
+                                  // and bitmap, and lazy_sweepers
+#endif
+static nat lazy_sweepers;         // threads sweeping blocks taken off the list
+
+void
+initSweep (void)
+{
+#if defined(THREADED_RTS)
+    initSpinLock(&lazy_sweep_sync);
+#endif
+    lazy_sweepers = 0;
+}
+
+static void
+sweep_lazily (generation *gen)
+{
+    bdescr *bd, *next, *prev;
+    nat flags;
+
+    ASSERT(gen->unswept_blocks == NULL);
+
+    // Move the marked blocks on to gen->unswept_blocks.  They are
+    // still counted in gen->n_old_blocks, which GarbageCollect() adds
+    // to gen->n_blocks; their words are counted here.
+    prev = NULL;
+    for (bd = gen->old_blocks; bd != NULL; bd = next) {
+        next = bd->link;
+        if (!(bd->flags & BF_MARKED)) {
+            prev = bd;
+            continue;
+        }
+        if (prev == NULL) {
+            gen->old_blocks = next;
+        } else {
+            prev->link = next;
+        }
+
+        // as GarbageCollect() does for the blocks it keeps
+        flags = bd->flags;
+        flags &= ~BF_MARKED;
+        flags |= BF_EVACUATED;
+        bd->flags = (StgWord16)flags;
+
+        bd->link = gen->unswept_blocks;
+        gen->unswept_blocks = bd;
+        gen->n_unswept_blocks++;
+        gen->n_words += bd->free - bd->start;
+    }
+
+    debugTrace(DEBUG_gc, "sweeping lazily: %ld blocks",
+               (long)gen->n_unswept_blocks);
+}
+
+// Sweep up to n of the unswept blocks of the oldest generation.  cap
+// is NULL if we are a GC thread.
+static void
+lazy_sweep (Capability *cap, W_ n)
+{
+    generation *gen = oldest_gen;
+    bdescr *bd, *next, *todo, *kept, *kept_last;
+    memcount taken, freed, freed_words;
+    SweepStats stats;
+    rtsBool done;
+
+    if (gen->unswept_blocks == NULL) return;
+
+    ACQUIRE_SPIN_LOCK(&lazy_sweep_sync);
+    todo = gen->unswept_blocks;
+    taken = 0;
+    for (bd = todo; bd != NULL && taken < n; bd = bd->link) {
+        taken++;
+        if (taken == n || bd->link == NULL) {
+            gen->unswept_blocks = bd->link;
+            bd->link = NULL;
+            break;
+        }
+    }
+    gen->n_unswept_blocks -= taken;
+    if (taken > 0) lazy_sweepers++;
+    RELEASE_SPIN_LOCK(&lazy_sweep_sync);
+
+    if (taken == 0) return;
+
+    init_stats(&stats);
+    kept = kept_last = NULL;
+    freed = 0;
+    freed_words = 0;
+    for (bd = todo; bd != NULL; bd = next) {
+        next = bd->link;
+        if (sweep_block(bd, &stats)) {
+            freed++;
+            freed_words += bd->free - bd->start;
+            if (cap == NULL) {
+                freeGroupOnCap_sync(gct->cap, bd);
+            } else {
+                freeGroupOnCap_lock(cap, bd);
             }
+        } else {
+            bd->link = kept;
+            kept = bd;
+            if (kept_last == NULL) kept_last = bd;
+        }
+    }
+
+    // gen->blocks and its counts are also updated by GC threads in
+    // collect_gct_blocks(), under gen->sync.
+    ACQUIRE_SPIN_LOCK(&gen->sync);
+    if (kept != NULL) {
+        kept_last->link = gen->blocks;
+        gen->blocks = kept;
+    }
+    gen->n_blocks -= freed;
+    gen->n_words  -= freed_words;
+    RELEASE_SPIN_LOCK(&gen->sync);
+
+    ACQUIRE_SPIN_LOCK(&lazy_sweep_sync);
+    lazy_sweepers--;
+    // the last one out frees the bitmap
+    done = gen->unswept_blocks == NULL && lazy_sweepers == 0
+        && gen->bitmap != NULL;
+    if (done) {
+        bd = gen->bitmap;
+        gen->bitmap = NULL;
+    }
+    RELEASE_SPIN_LOCK(&lazy_sweep_sync);
 
-            bd->flags |= BF_SWEPT;
+    if (done) {
+        debugTrace(DEBUG_gc, "lazy sweep finished");
+        if (cap == NULL) {
+            freeGroupOnCap_sync(gct->cap, bd);
+        } else {
+            freeGroupOnCap_lock(cap, bd);
         }
     }
+}
+
+void
+lazySweep (Capability *cap, W_ n)
+{
+    lazy_sweep(cap, n);
+}
+
+void
+lazySweep_sync (W_ n)
+{
+    lazy_sweep(NULL, n);
+}
+
+// Sweep whatever is left; called by the main GC thread before the
+// heap is traversed.
+void
+finishLazySweep (void)
+{
+    if (oldest_gen->unswept_blocks == NULL) return;
+
+    lazy_sweep(NULL, oldest_gen->n_unswept_blocks);
+    ASSERT(oldest_gen->unswept_blocks == NULL);
+    ASSERT(oldest_gen->bitmap == NULL);
+}
+
+void
+sweep(generation *gen, rtsBool lazy)
+{
+    SweepStats stats;
+
+    ASSERT(countBlocks(gen->old_blocks) == gen->n_old_blocks);
 
-    gen->live_estimate = live;
+    if (lazy) {
+        sweep_lazily(gen);
+        return;
+    }
 
-    debugTrace(DEBUG_gc, "sweeping: %d blocks, %d were copied, %d freed (%d%%), %d are fragmented, live estimate: %ld%%",
-          gen->n_old_blocks + freed,
-          gen->n_old_blocks - blocks + freed,
-          freed,
-          blocks == 0 ? 0 : (freed * 100) / blocks,
-          fragd, 
-          (unsigned long)((blocks - freed) == 0 ? 0 : ((live / BLOCK_SIZE_W) * 100) / (blocks - freed)));
+    init_stats(&stats);
+    if (n_gc_threads > 1) {
+        sweep_par(gen, &stats);
+    } else {
+        sweep_blocks(&gen->old_blocks, &gen->n_old_blocks, NULL,
+                     BF_MARKED, &stats);
+    }
+    trace_stats(&stats, gen->n_old_blocks);
+    gen->live_estimate = stats.live;
 
     ASSERT(countBlocks(gen->old_blocks) == gen->n_old_blocks);
 }
+
+// Sweep the blocks of gen->blocks that were in the snapshot of a
+// concurrent mark (see ConcMark.c).  The mark bitmap must still be
+// attached to them.
+W_
+sweepSnapshot(generation *gen)
+{
+    SweepStats stats;
+
+    ASSERT(countBlocks(gen->blocks) == gen->n_blocks);
+
+    init_stats(&stats);
+    sweep_blocks(&gen->blocks, &gen->n_blocks, &gen->n_words,
+                 BF_SNAPSHOT, &stats);
+    trace_stats(&stats, gen->n_blocks);
+
+    ASSERT(countBlocks(gen->blocks) == gen->n_blocks);
+    ASSERT(countOccupied(gen->blocks) == gen->n_words);
+    return stats.live;
+}
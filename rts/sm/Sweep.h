@@ -14,6 +14,18 @@
 #ifndef SM_SWEEP_H
 #define SM_SWEEP_H
 
-RTS_PRIVATE void sweep(generation *gen);
+RTS_PRIVATE void sweep(generation *gen, rtsBool lazy);
+RTS_PRIVATE W_   sweepSnapshot(generation *gen);
+
+// Lazy sweeping (+RTS --lazy-sweep): sweep up to n blocks of the
+// oldest generation.  lazySweep_sync() is for GC threads.  The
+// allocators sweep LAZY_SWEEP_BLOCKS blocks whenever they need a
+// fresh block.
+#define LAZY_SWEEP_BLOCKS 4
+
+RTS_PRIVATE void initSweep(void);
+RTS_PRIVATE void lazySweep(Capability *cap, W_ n);
+RTS_PRIVATE void lazySweep_sync(W_ n);
+RTS_PRIVATE void finishLazySweep(void);
 
 #endif /* SM_SWEEP_H */
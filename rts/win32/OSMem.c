@@ -390,3 +390,70 @@ void setExecutable (void *p, W_ len, rtsBool exec)
         stg_exit(EXIT_FAILURE);
     }
 }
+
+/* -----------------------------------------------------------------------------
+   NUMA support: not implemented on Windows yet, so we look like a
+   machine with a single node.
+   -------------------------------------------------------------------------- */
+
+rtsBool osNumaAvailable(void)
+{
+    return rtsFalse;
+}
+
+nat osNumaNodes(void)
+{
+    return 1;
+}
+
+StgWord osNumaMask(void)
+{
+    return 1;
+}
+
+void osBindMBlocksToNode(void *addr STG_UNUSED,
+                         W_ size STG_UNUSED,
+                         nat node STG_UNUSED)
+{
+}
+
+void osDiscardMemory(void *at, W_ size)
+{
+    // MEM_RESET tells the OS that it need not preserve the contents of
+    // the pages, without decommitting them.
+    if (VirtualAlloc(at, size, MEM_RESET, PAGE_READWRITE) == NULL) {
+        sysErrorBelch("osDiscardMemory: VirtualAlloc MEM_RESET failed");
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Mapping files into the heap: not implemented on Windows, where a
+   file view can't replace part of an existing allocation.  The caller
+   reads the file instead.  Nor is osProgramImage(), so compact regions
+   can't be saved or loaded.
+   -------------------------------------------------------------------------- */
+
+rtsBool osMapFile(void *at STG_UNUSED, W_ size STG_UNUSED,
+                  int fd STG_UNUSED, StgWord64 offset STG_UNUSED)
+{
+    return rtsFalse;
+}
+
+void osUnmapFile(void *at STG_UNUSED, W_ size STG_UNUSED)
+{
+}
+
+rtsBool osProgramImage(ProgramImage *img STG_UNUSED)
+{
+    return rtsFalse;
+}
+
+/* -----------------------------------------------------------------------------
+   Huge pages: not implemented on Windows yet; +RTS --huge-pages is
+   accepted but has no effect.
+   -------------------------------------------------------------------------- */
+
+W_ osHugePageBytes(void)
+{
+    return 0;
+}